@@ -1,8 +1,11 @@
 #ifndef __SLAKEDEF_H__
 #define __SLAKEDEF_H__
 
-#include "util/list.h"
+#include "util/arena.h"
+#include "util/vector.h"
+#include "util/hashmap.h"
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef _WIN32
 
@@ -16,8 +19,6 @@
 
 #endif
 
-#define SLAKE_SYMBOL_MAX 63
-
 typedef enum _SlakeValueType
 {
 	VALUE_TYPE_STR = 0, // String
@@ -25,7 +26,8 @@ typedef enum _SlakeValueType
 	VALUE_TYPE_LONG,	// 64-bit signed interger
 	VALUE_TYPE_UINT,	// 32-bit unsigned integer
 	VALUE_TYPE_ULONG,	// 64-bit unsigned integer
-	VALUE_TYPE_NULL		// Null
+	VALUE_TYPE_NULL,	// Null
+	VALUE_TYPE_FUTURE	// Result of an asynchronous call
 } SlakeValueType;
 
 typedef enum _SlakeExprType
@@ -35,6 +37,7 @@ typedef enum _SlakeExprType
 	EXPR_AWAIT,			// Awaiting
 	EXPR_SUPER_CALL,	// Super function call
 	EXPR_EXTERNAL_CALL, // External function call
+	EXPR_RETURN,		// Return
 
 	EXPR_IF,	   // If block
 	EXPR_SWITCH, // Switch block
@@ -45,10 +48,11 @@ typedef enum _SlakeExprType
 	EXPR_WHILE,	   // While block
 
 	EXPR_UNARY,	 // Unary operations
-	EXPR_BINARY, // Unary operations
+	EXPR_BINARY, // Binary operations
 
 	EXPR_VALUE,	 // Immediate value
 	EXPR_VARREF, // Variable reference
+	EXPR_VARDEF, // Variable definition
 
 	EXPR_INVALID = 0xffff // Invalid expression type
 } SlakeExprType;
@@ -81,6 +85,27 @@ typedef enum _SlakeBinaryExprType
 	BINARY_EXPR_GTEQ, // Greater or equal (aka '>=')
 } SlakeBinaryExprType;
 
+typedef struct _SlakeFuture SlakeFuture;
+
+//
+// Immutable string shared by values. Strings owned by an arena are not
+// counted, they live as long as the arena.
+//
+typedef struct _SlakeString
+{
+	size_t refCount; // 0 if owned by an arena.
+	size_t length;
+	size_t capacity; // Room for characters, strings referred once may grow in place.
+	char data[];
+} SlakeString;
+
+#define SLAKE_SMALL_STRING_MAX 13 // Longest string stored in a value itself.
+
+//
+// Values are 16 bytes and passed by value. Small strings are stored from the
+// beginning of the value, through data and smallTail, so they do not need to
+// be allocated.
+//
 typedef struct _SlakeValue
 {
 	union
@@ -89,19 +114,34 @@ typedef struct _SlakeValue
 		unsigned int u32;		// VALUE_TYPE_UINT
 		long long i64;			// VALUE_TYPE_LONG
 		unsigned long long u64; // VALUE_TYPE_ULONG
-		char *str;				// VALUE_TYPE_STR
+		SlakeString *str;		// VALUE_TYPE_STR unless small, referred by counting
+		SlakeFuture *future;	// VALUE_TYPE_FUTURE, referred by counting
 	} data;
-	SlakeValueType type;
+	char smallTail[SLAKE_SMALL_STRING_MAX + 1 - sizeof(long long)];
+	unsigned char isSmall; // Whether a string is stored in the value itself.
+	unsigned char type;	   // SlakeValueType
 } SlakeValue;
 
-typedef char SlakeSymbol[SLAKE_SYMBOL_MAX + 1];
+//
+// Interned name, equal names always have the same symbol ID.
+//
+typedef uint32_t SlakeSymbol;
+
+#define SLAKE_SYMBOL_NONE 0
+
+//
+// Slot of variables which have not been resolved.
+//
+#define SLAKE_SLOT_UNRESOLVED 0xffffffff
 
 typedef struct _SlakeExpr SlakeExpr;
 typedef struct _SlakeFunction SlakeFunction;
 typedef struct _SlakeVariable SlakeVariable;
 typedef struct _SlakeScope SlakeScope;
+typedef struct _SlakeBytecode SlakeBytecode;
+typedef struct _SlakeModule SlakeModule;
 
-typedef UtilList* SlakeExecBody;
+typedef UtilVector* SlakeExecBody; // Vector of SlakeExpr*.
 
 typedef struct _SlakeSwitchCase
 {
@@ -116,16 +156,18 @@ typedef struct _SlakeExpr
 		struct
 		{
 			SlakeSymbol symbol;
-			SlakeValue *params;
+			SlakeExpr **params;
 			unsigned short paramCount;
 		} call;
 		SlakeExpr* await;
 		struct
 		{
 			SlakeSymbol moduleName, funcName;
-			SlakeValue *params;
+			SlakeExpr **params;
 			unsigned short paramCount;
+			int async;
 		} externalCall;
+		SlakeExpr *returnValue;
 
 		struct
 		{
@@ -169,33 +211,103 @@ typedef struct _SlakeExpr
 			SlakeExpr *r;
 		} unaryOp;
 
-		SlakeSymbol varRef;
+		struct
+		{
+			SlakeSymbol symbol;
+			unsigned int depth; // Count of scopes to go up from the current one.
+			unsigned int slot;	// Slot in the target scope.
+		} varRef;
+		struct
+		{
+			SlakeSymbol symbol;
+			SlakeValueType type;
+			SlakeExpr *initValue;
+			unsigned int slot; // Slot in local variables of the function.
+		} varDef;
 
 		SlakeValue *value;
 	} attribs;
 	SlakeExprType type;
 } SlakeExpr;
 
+typedef struct _SlakeParamDef
+{
+	SlakeSymbol name;
+	SlakeValueType type;
+} SlakeParamDef;
+
 typedef struct _SlakeFunction
 {
-	UtilList* exprs;
-	char name[SLAKE_SYMBOL_MAX + 1];
+	SlakeExecBody exprs;
+	SlakeParamDef *params;
+	unsigned short paramCount;
+	int isPublic;
+	int isResolved;			 // Whether variable references in the body have been resolved.
+	unsigned int localCount; // Count of local variable slots, including parameters.
+	SlakeBytecode *bytecode; // Compiled body, NULL if not compiled yet.
+	SlakeScope *scope;		 // Root scope of the module which defines the function.
+	SlakeSymbol name;
 } SlakeFunction;
 
 typedef struct _SlakeVariable
 {
-	SlakeValue *value;
-	char name[SLAKE_SYMBOL_MAX + 1];
+	SlakeValue value;
+	SlakeSymbol name;
+	unsigned int slot; // Slot in the owner scope.
 } SlakeVariable;
 
+typedef enum _SlakeStmtType
+{
+	STMT_IMPORT = 0, // Module import
+	STMT_GLOBALS,	 // Global variable definitions
+	STMT_FUNCTION	 // Function definition
+} SlakeStmtType;
+
+//
+// Top-level statement of a script. Statements are recorded in order by the
+// parser and executed after the script is parsed, so the script can be cached
+// and replayed without being parsed again.
+//
+typedef struct _SlakeStmt
+{
+	union
+	{
+		struct
+		{
+			SlakeSymbol name;
+			char *path;
+		} import;
+		SlakeExecBody globals;
+		struct
+		{
+			SlakeSymbol name;
+			SlakeParamDef *params;
+			unsigned short paramCount;
+			int isPublic;
+			SlakeExecBody body;
+		} function;
+	} attribs;
+	SlakeStmtType type;
+} SlakeStmt;
+
 typedef struct _SlakeScope
 {
 	SlakeScope *parent;
-	UtilList* variables;
-	UtilList* functions;
+	UtilHashMap *variables; // Variable objects (SlakeVariable*), keyed by symbols.
+	UtilHashMap *functions; // Function objects (SlakeFunction*), keyed by symbols.
+	UtilHashMap *modules;	// Imported modules (SlakeModule*), keyed by symbols.
+	UtilVector slots;		// Variable objects (SlakeVariable*) in definition order, NULL for undefined ones.
 } SlakeScope;
 
+// Value of the built-in variable __SLAKE_HOST__.
+#ifdef _WIN32
+#define SLAKE_HOST "WIN32"
+#else
+#define SLAKE_HOST "UNIXLIKE"
+#endif
+
 void slakeInit();
+void slakeInitScope(SlakeScope *scope);
 
 //
 // Create functions.
@@ -211,8 +323,6 @@ SlakeExpr *slakeCreateExpr();
 void slakeDestroyScope(SlakeScope *scope);
 void slakeDestroyFunction(SlakeFunction *func);
 void slakeDestroyVariable(SlakeVariable *var);
-void slakeDestroyExpr(SlakeExpr *expr);
-void slakeDestroyValue(SlakeValue *value);
 
 //
 // Scope functions.
@@ -223,47 +333,84 @@ SlakeScope *slakeGetParentScope(SlakeScope *scope);
 size_t slakeGetScopeDepth(SlakeScope *scope);
 void slakeEnterScope(SlakeScope *scope);
 
-SlakeFunction *slakeSetFunction(SlakeScope *scope, const char *name, SlakeFunction *func);
-SlakeVariable *slakeSetVariable(SlakeScope *scope, const char *name, SlakeValue *value);
+SlakeFunction *slakeSetFunction(SlakeScope *scope, SlakeSymbol name, SlakeFunction *func);
+SlakeVariable *slakeSetVariable(SlakeScope *scope, SlakeSymbol name, SlakeValue *value);
 
-SlakeFunction *slakeGetFunction(SlakeScope *scope, const char *name);
-SlakeVariable *slakeGetVariable(SlakeScope *scope, const char *name);
+SlakeFunction *slakeGetFunction(SlakeScope *scope, SlakeSymbol name);
+SlakeVariable *slakeGetVariable(SlakeScope *scope, SlakeSymbol name);
+SlakeFunction *slakeLookupFunction(SlakeScope *scope, SlakeSymbol name);
+SlakeVariable *slakeLookupVariable(SlakeScope *scope, SlakeSymbol name);
 
-void slakeUndefFunction(SlakeScope *scope, const char *name);
-void slakeUndefVariable(SlakeScope *scope, const char *name);
+void slakeUndefFunction(SlakeScope *scope, SlakeSymbol name);
+void slakeUndefVariable(SlakeScope *scope, SlakeSymbol name);
+
+//
+// Arena functions.
+//
+UtilArena *slakeGetCurrentArena();
+void slakeEnterArena(UtilArena *arena);
+
+//
+// Statement functions.
+//
+UtilVector *slakeCreateStatements();
+void slakeAddImport(UtilVector *statements, SlakeSymbol name, const char *path);
+void slakeAddGlobals(UtilVector *statements, SlakeExecBody execBody);
+void slakeAddFunction(UtilVector *statements, SlakeSymbol name, SlakeParamDef *params, unsigned short paramCount, SlakeExecBody body, int isPublic);
+
+void slakeDefineGlobals(SlakeScope *scope, SlakeExecBody execBody);
+SlakeFunction *slakeDefineFunction(SlakeScope *scope, SlakeSymbol name, SlakeParamDef *params, unsigned short paramCount, SlakeExecBody body, int isPublic);
+
+//
+// Symbol functions.
+//
+SlakeSymbol slakeIntern(const char *name);
+const char *slakeGetSymbolName(SlakeSymbol symbol);
 
 //
 // Functional functions.
 //
-SlakeFunction *slakeSetFunctionBody(SlakeFunction *func, SlakeExpr *exprs);
+SlakeFunction *slakeSetFunctionBody(SlakeFunction *func, SlakeExecBody body);
+SlakeFunction *slakeSetFunctionParams(SlakeFunction *func, SlakeParamDef *params, unsigned short paramCount);
+SlakeValue slakeCallFunction(SlakeFunction *func, SlakeValue *args, unsigned short argCount);
 
 //
 // Value functions.
 //
-SlakeValue *slakeCreateValue();
-SlakeValue *slakeCopyValue(SlakeValue *value);
-SlakeValue *slakeMakeInt(int value);
-SlakeValue *slakeMakeLong(long long value);
-SlakeValue *slakeMakeUInt(unsigned int value);
-SlakeValue *slakeMakeULong(unsigned long long value);
-SlakeValue *slakeMakeString(const char *value);
+SlakeValue slakeMakeInt(int value);
+SlakeValue slakeMakeLong(long long value);
+SlakeValue slakeMakeUInt(unsigned int value);
+SlakeValue slakeMakeULong(unsigned long long value);
+SlakeValue slakeMakeString(const char *value);
+SlakeValue slakeMakeArenaString(const char *value);
 SlakeValue *slakeSetInt(SlakeValue *dest, int value);
 SlakeValue *slakeSetLong(SlakeValue *dest, long long value);
 SlakeValue *slakeSetUInt(SlakeValue *dest, unsigned int value);
 SlakeValue *slakeSetULong(SlakeValue *dest, unsigned long long value);
 SlakeValue *slakeSetString(SlakeValue *dest, const char *value);
+char *slakeAllocString(SlakeValue *dest, size_t length);
+char *slakeExtendString(SlakeValue *value, size_t length);
+const char *slakeGetString(const SlakeValue *value);
+size_t slakeGetStringLength(const SlakeValue *value);
+SlakeValue *slakeAssignValue(SlakeValue *dest, const SlakeValue *src);
+SlakeValue *slakeConvertValue(SlakeValue *value, SlakeValueType type);
+void slakeClearValue(SlakeValue *value);
+int slakeIsValueTrue(const SlakeValue *value);
 
 //
 // Expression functions.
 //
-SlakeExpr *slakeExprVarRef(const char *symbol);
-SlakeExpr *slakeExprCall(const char *symbol, SlakeValue *params, unsigned short paramCount);
-SlakeExpr *slakeExprCallAsync(const char *symbol, SlakeValue *params, unsigned short paramCount);
+SlakeExpr *slakeExprVarRef(SlakeSymbol symbol);
+SlakeExpr *slakeExprVarDef(SlakeSymbol symbol, SlakeValueType type, SlakeExpr *initValue);
+SlakeExpr *slakeExprCall(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount);
+SlakeExpr *slakeExprCallAsync(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount);
 SlakeExpr *slakeExprAwait(SlakeExpr *e);
+SlakeExpr *slakeExprReturn(SlakeExpr *value);
 
-SlakeExpr *slakeExprSuperCall(const char *symbol, SlakeValue *params, unsigned short paramCount);
+SlakeExpr *slakeExprSuperCall(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount);
 
-SlakeExpr *slakeExprExternalCall(const char *moduleName, const char *funcName, SlakeValue *params, unsigned short paramCount);
+SlakeExpr *slakeExprExternalCall(SlakeSymbol moduleName, SlakeSymbol funcName, SlakeExpr **params, unsigned short paramCount);
+SlakeExpr *slakeExprExternalCallAsync(SlakeSymbol moduleName, SlakeSymbol funcName, SlakeExpr **params, unsigned short paramCount);
 
 SlakeExpr *slakeExprIfBlock(SlakeExpr *condition, SlakeExecBody trueBlock, SlakeExecBody falseBlock);
 SlakeExpr* slakeExprSwitch(SlakeExpr* condition, SlakeSwitchCase** cases, size_t caseCount, SlakeExecBody defaultBody);
@@ -280,18 +427,35 @@ SlakeExpr *slakeExprBinary(SlakeBinaryExprType t, SlakeExpr *x, SlakeExpr *y);
 SlakeExpr *slakeExprImmediateValue(SlakeValue *value);
 
 SlakeExecBody slakeCreateExecBody();
-void slakeDestroyExecBody(SlakeExecBody execBody);
 
 SlakeSwitchCase* slakeCreateSwitchCase(SlakeExpr* condition, SlakeExecBody execBody);
-void slakeDestroySwitchCase(SlakeSwitchCase* swCase);
 
 SlakeExecBody slakeExprAttach(SlakeExecBody execBody, SlakeExpr* expr);
-SlakeValue *slakeExprExec(SlakeExpr *expr);
+SlakeExecBody slakeExecBodyMerge(SlakeExecBody dest, SlakeExecBody src);
+SlakeValue slakeExprExec(SlakeScope *scope, SlakeExpr *expr);
+
+//
+// Resolver functions.
+//
+void slakeResolveExpr(SlakeScope *scope, SlakeExpr *expr);
+void slakeResolveFunction(SlakeScope *scope, SlakeFunction *func);
+void slakeResolveScope(SlakeScope *scope);
+
+//
+// Optimizer functions.
+//
+void slakeFoldStatements(UtilVector *statements);
 
 //
 // Miscellaneous functions.
 //
-void slakePanic(const char *msg);
+#ifdef _MSC_VER
+#define SLAKE_NORETURN __declspec(noreturn)
+#else
+#define SLAKE_NORETURN __attribute__((noreturn))
+#endif
+
+SLAKE_NORETURN void slakePanic(const char *msg);
 
 #if defined(DEBUG)||defined(_DEBUG)
 #define slakeDbgPrintf(s, ...) printf("[SLAKE DEBUG]"s,##__VA_ARGS__)
@@ -0,0 +1,32 @@
+#ifndef __UTIL_ARENA_H__
+#define __UTIL_ARENA_H__
+
+#include <stddef.h>
+
+typedef struct _UtilArenaChunk
+{
+	struct _UtilArenaChunk *next; // Next chunk.
+	size_t size;				  // Size in byte of the data part.
+	size_t used;				  // Size in byte of allocated data.
+} UtilArenaChunk;
+
+//
+// Bump allocator. Memory allocated from an arena is released all at once.
+//
+typedef struct _UtilArena
+{
+	UtilArenaChunk *chunks;		// Chunks in use, the first one is the current chunk.
+	UtilArenaChunk *lastChunk;	// The first allocated chunk in use.
+	UtilArenaChunk *freeChunks; // Chunks released by resetting, kept for reuse.
+	size_t chunkSize;			// Size in byte of the data part of each chunk.
+} UtilArena;
+
+UtilArena *utilArenaNew(size_t chunkSize);
+void utilArenaDelete(UtilArena *arena);
+void utilArenaReset(UtilArena *arena);
+
+void *utilArenaAlloc(UtilArena *arena, size_t size);
+void *utilArenaDup(UtilArena *arena, const void *data, size_t size);
+char *utilArenaStrdup(UtilArena *arena, const char *str);
+
+#endif
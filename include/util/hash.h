@@ -0,0 +1,9 @@
+#ifndef __UTIL_HASH_H__
+#define __UTIL_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t utilHash64(const void *data, size_t size, uint64_t seed);
+
+#endif
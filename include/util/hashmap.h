@@ -0,0 +1,32 @@
+#ifndef __UTIL_HASHMAP_H__
+#define __UTIL_HASHMAP_H__
+
+#include <stddef.h>
+
+typedef struct _UtilHashMapSlot
+{
+	size_t key;	 // Key, 0 if the slot is empty.
+	void *value; // Stored value.
+} UtilHashMapSlot;
+
+//
+// Open addressing hash map with linear probing, keyed by non-zero integers.
+//
+typedef struct _UtilHashMap
+{
+	UtilHashMapSlot *slots; // Slot array, NULL if nothing has been inserted.
+	size_t capacity;		// Count of slots, always a power of 2.
+	size_t size;			// Count of used slots.
+} UtilHashMap;
+
+size_t utilHashString(const char *str);
+
+UtilHashMap *utilHashMapNew();
+void utilHashMapDelete(UtilHashMap *map);
+
+UtilHashMapSlot *utilHashMapFind(const UtilHashMap *map, size_t key);
+void *utilHashMapGet(const UtilHashMap *map, size_t key);
+UtilHashMapSlot *utilHashMapInsert(UtilHashMap *map, size_t key);
+void *utilHashMapRemove(UtilHashMap *map, size_t key);
+
+#endif
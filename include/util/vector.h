@@ -0,0 +1,33 @@
+#ifndef __UTIL_VECTOR_H__
+#define __UTIL_VECTOR_H__
+
+#include <stddef.h>
+#include <util/arena.h>
+
+//
+// Contiguous growable array.
+//
+typedef struct _UtilVector
+{
+	void *data;		  // Element buffer, NULL if nothing has been pushed.
+	size_t dataSize;  // Size in byte of each element.
+	size_t size;	  // Count of elements.
+	size_t capacity;  // Count of elements which the buffer can hold.
+	UtilArena *arena; // Arena which the buffer is allocated from, NULL for heap.
+} UtilVector;
+
+#define utilVectorAt(vec, type, i) (((type *)(vec)->data)[(i)])
+
+void utilVectorInit(UtilVector *vec, size_t dataSize, UtilArena *arena);
+void utilVectorFree(UtilVector *vec);
+
+UtilVector *utilVectorNew(size_t dataSize);
+UtilVector *utilVectorNewInArena(UtilArena *arena, size_t dataSize);
+void utilVectorDelete(UtilVector *vec);
+
+int utilVectorReserve(UtilVector *vec, size_t capacity);
+void *utilVectorPush(UtilVector *vec, const void *data);
+void *utilVectorAppend(UtilVector *vec, const void *data, size_t count);
+void utilVectorClear(UtilVector *vec);
+
+#endif
@@ -0,0 +1,1000 @@
+#include "build.h"
+#include "cache.h"
+#include "exec.h"
+#include "source.h"
+#include "task.h"
+#include <util/hash.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define SLAKE_BUILD_STATE_HEADER "# slake build state 3\n"
+
+// Minimum count of files to hash for each hashing task.
+#define SLAKE_HASH_FILES_PER_TASK 16
+
+typedef enum _SlakeBuildStatus
+{
+	BUILD_STATUS_UNCHECKED = 0,
+	BUILD_STATUS_CHECKING, // Being checked, used to detect cycles.
+	BUILD_STATUS_CLEAN,	   // Up to date.
+	BUILD_STATUS_DIRTY	   // Needs to be rebuilt.
+} SlakeBuildStatus;
+
+typedef struct _SlakeFileStat
+{
+	int exists;
+	long long mtime; // Modification time in nanoseconds.
+	unsigned long long size;
+	unsigned long long inode;
+} SlakeFileStat;
+
+typedef struct _SlakeBuildNode
+{
+	SlakeSymbol path;
+	char *command;		   // Command line to build the file, NULL for source files.
+	UtilVector deps;	   // Prerequisites (SlakeBuildNode*).
+	UtilVector dependents; // Dirty nodes waiting for this node (SlakeBuildNode*), only used while building.
+	UtilVector envVars;	   // Names of environment variables in the action key besides the toolchain ones (SlakeSymbol).
+	size_t pendingDeps;	   // Count of dirty prerequisites which have not been built.
+	SlakeBuildStatus status;
+	SlakeFileStat stat;	   // Cached status of the file.
+	int isStatted;		   // Non-zero if the status is cached.
+	char *lastCommand;	   // Command line of the last successful build, NULL if never built.
+	long long lastMtime;   // Modification time after the last successful build or check.
+	long long inputMtime;  // Newest modification time of prerequisites the file is known to be up to date with.
+	uint64_t lastDepsHash; // Hash of the prerequisites at the last successful build, 0 if unknown.
+	int useHash;		   // Non-zero if the node is rebuilt only if contents of prerequisites change.
+	int isRebuilt;		   // Non-zero if the command has run in the current build.
+	int isChanged;		   // Non-zero if the command has run in the current build and changed the file.
+	long long oldMtime;	   // Modification time before the command ran in the current build.
+	int hasHash;		   // Non-zero if a content hash of the file is cached.
+	int isHashQueued;	   // Non-zero if the file is queued to be hashed.
+	int isVisited;		   // Non-zero if visited while collecting files to hash.
+	uint64_t hash;		   // Cached content hash, valid only if the file status still matches the keys.
+	unsigned long long hashInode, hashSize;
+	long long hashMtime;
+} SlakeBuildNode;
+
+typedef struct _SlakeHashWorker
+{
+	UtilVector *nodes;
+	size_t start, step;
+} SlakeHashWorker;
+
+typedef struct _SlakeBuildJob
+{
+	SlakeBuildNode *node;
+	SlakeJob *job;
+	uint64_t key; // Key of the action in the action cache.
+} SlakeBuildJob;
+
+static UtilHashMap *buildNodes = NULL; // Build nodes keyed by path symbols.
+static int isStateLoaded = 0, isStateDirty = 0;
+
+// Protects the build graph and the action cache. Builds run without the
+// interpreter lock, so scripts may define rules meanwhile.
+static SlakeMutex buildMutex = SLAKE_MUTEX_INIT;
+
+static char *_slakeStrdup(const char *s, size_t n)
+{
+	char *p = malloc(n + 1);
+	if (!p)
+		slakePanic("Out of memory");
+
+	memcpy(p, s, n);
+	p[n] = '\0';
+	return p;
+}
+
+static SlakeBuildNode *_slakeGetBuildNode(SlakeSymbol path)
+{
+	if (!buildNodes && !(buildNodes = utilHashMapNew()))
+		slakePanic("Out of memory");
+
+	UtilHashMapSlot *slot = utilHashMapInsert(buildNodes, path);
+	if (!slot)
+		slakePanic("Out of memory");
+	if (slot->value)
+		return slot->value;
+
+	SlakeBuildNode *node = malloc(sizeof(SlakeBuildNode));
+	if (!node)
+		slakePanic("Out of memory");
+
+	node->path = path;
+	node->command = NULL;
+	utilVectorInit(&node->deps, sizeof(SlakeBuildNode *), NULL);
+	utilVectorInit(&node->dependents, sizeof(SlakeBuildNode *), NULL);
+	utilVectorInit(&node->envVars, sizeof(SlakeSymbol), NULL);
+	node->pendingDeps = 0;
+	node->status = BUILD_STATUS_UNCHECKED;
+	node->isStatted = 0;
+	node->lastCommand = NULL;
+	node->lastMtime = 0;
+	node->inputMtime = 0;
+	node->lastDepsHash = 0;
+	node->useHash = 0;
+	node->isRebuilt = 0;
+	node->isChanged = 0;
+	node->hasHash = 0;
+	node->isHashQueued = 0;
+	node->isVisited = 0;
+
+	slot->value = node;
+	return node;
+}
+
+static void _slakeStatFile(const char *path, SlakeFileStat *out)
+{
+	memset(out, 0, sizeof(SlakeFileStat));
+
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st))
+		return;
+	out->mtime = (long long)st.st_mtime * 1000000000;
+#else
+	struct stat st;
+	if (stat(path, &st))
+		return;
+#ifdef __APPLE__
+	out->mtime = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	out->mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+	out->exists = 1;
+	out->size = (unsigned long long)st.st_size;
+	out->inode = (unsigned long long)st.st_ino;
+}
+
+//
+// Get status of the file of a node. Each file is only statted once unless
+// it is rebuilt.
+//
+static const SlakeFileStat *_slakeGetFileStat(SlakeBuildNode *node)
+{
+	if (!node->isStatted)
+	{
+		_slakeStatFile(slakeGetSymbolName(node->path), &node->stat);
+		node->isStatted = 1;
+	}
+	return &node->stat;
+}
+
+//
+// Read a space-terminated decimal field of a state record. Returns non-zero
+// if the field is malformed.
+//
+static int _slakeReadStateField(char **p, unsigned long long *value)
+{
+	// The data is followed by null characters, so strtoull stops there.
+	// Negative modification times are wrapped around and cast back later.
+	char *next;
+	*value = strtoull(*p, &next, 10);
+	if (next == *p || *next != ' ')
+		return 1;
+	*p = next + 1;
+	return 0;
+}
+
+//
+// Load records of the last builds. Each record is a line in form of
+// "T <mtime> <input mtime> <deps hash> <path length> <command length>
+// <path><command>" for built targets, or
+// "F <inode> <size> <mtime> <hash> <path length> <path>" for cached content
+// hashes.
+//
+static void _slakeLoadBuildState()
+{
+	isStateLoaded = 1;
+
+	SlakeSource *source = slakeLoadSource(SLAKE_BUILD_STATE_FILE);
+	if (!source)
+		return;
+
+	char *p = source->data, *end = source->data + source->size;
+	size_t headerLength = strlen(SLAKE_BUILD_STATE_HEADER);
+
+	if (source->size < headerLength || memcmp(p, SLAKE_BUILD_STATE_HEADER, headerLength))
+		p = NULL;
+	else
+		p += headerLength;
+
+	while (p && p < end)
+	{
+		unsigned long long fields[5];
+		char type = *p;
+		if ((type != 'T' && type != 'F') || p[1] != ' ')
+			break;
+		p += 2;
+
+		size_t fieldCount = 5, i;
+		for (i = 0; i < fieldCount; i++)
+		{
+			if (_slakeReadStateField(&p, &fields[i]))
+				break;
+		}
+		if (i < fieldCount)
+			break;
+
+		unsigned long long pathLength = fields[type == 'T' ? 3 : 4];
+		unsigned long long commandLength = type == 'T' ? fields[4] : 0;
+		if (!pathLength || (unsigned long long)(end - p) <= pathLength + commandLength || p[pathLength + commandLength] != '\n')
+			break;
+
+		char *path = p, *command = p + pathLength;
+		p = command + commandLength + 1;
+
+		if (type == 'T')
+		{
+			// Null-terminate the path in place after the command is copied.
+			command = _slakeStrdup(command, (size_t)commandLength);
+			path[pathLength] = '\0';
+
+			SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(path));
+			free(node->lastCommand);
+			node->lastCommand = command;
+			node->lastMtime = (long long)fields[0];
+			node->inputMtime = (long long)fields[1];
+			node->lastDepsHash = fields[2];
+		}
+		else
+		{
+			path[pathLength] = '\0';
+
+			SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(path));
+			node->hasHash = 1;
+			node->hashInode = fields[0];
+			node->hashSize = fields[1];
+			node->hashMtime = (long long)fields[2];
+			node->hash = fields[3];
+		}
+	}
+
+	if (p != end)
+	{
+		fprintf(stderr, "Warning: Ignoring corrupted build state file:%s\n", SLAKE_BUILD_STATE_FILE);
+		isStateDirty = 1;
+	}
+
+	slakeUnloadSource(source);
+}
+
+//
+// Save records of successful builds, the build lock must be held.
+//
+static void _slakeSaveBuildState()
+{
+	if (!isStateDirty)
+		return;
+
+	FILE *fp = fopen(SLAKE_BUILD_STATE_FILE ".tmp", "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "Warning: Error writing build state file:%s\n", SLAKE_BUILD_STATE_FILE);
+		return;
+	}
+
+	fputs(SLAKE_BUILD_STATE_HEADER, fp);
+	for (size_t i = 0; buildNodes && i < buildNodes->capacity; i++)
+	{
+		SlakeBuildNode *node = buildNodes->slots[i].value;
+		if (!buildNodes->slots[i].key)
+			continue;
+
+		const char *path = slakeGetSymbolName(node->path);
+		if (node->lastCommand)
+		{
+			fprintf(fp, "T %lld %lld %llu %zu %zu %s%s\n", node->lastMtime, node->inputMtime, (unsigned long long)node->lastDepsHash,
+					strlen(path), strlen(node->lastCommand), path, node->lastCommand);
+		}
+		if (node->hasHash)
+		{
+			fprintf(fp, "F %llu %llu %lld %llu %zu %s\n", node->hashInode, node->hashSize, node->hashMtime,
+					(unsigned long long)node->hash, strlen(path), path);
+		}
+	}
+
+	int failed = ferror(fp);
+	if (fclose(fp) || failed)
+	{
+		remove(SLAKE_BUILD_STATE_FILE ".tmp");
+		fprintf(stderr, "Warning: Error writing build state file:%s\n", SLAKE_BUILD_STATE_FILE);
+		return;
+	}
+
+#ifdef _WIN32
+	// Existing files are not replaced by rename() on Windows.
+	remove(SLAKE_BUILD_STATE_FILE);
+#endif
+	if (rename(SLAKE_BUILD_STATE_FILE ".tmp", SLAKE_BUILD_STATE_FILE))
+		fprintf(stderr, "Warning: Error writing build state file:%s\n", SLAKE_BUILD_STATE_FILE);
+	else
+		isStateDirty = 0;
+}
+
+/**
+ * @brief Save records of successful builds if they were changed.
+ */
+void slakeSaveBuildState()
+{
+	slakeLockMutex(&buildMutex);
+	_slakeSaveBuildState();
+	slakeUnlockMutex(&buildMutex);
+}
+
+/**
+ * @brief Lock the build graph and the action cache, which are shared with
+ * builds running without the interpreter lock.
+ */
+void slakeLockBuildGraph()
+{
+	slakeLockMutex(&buildMutex);
+}
+
+/**
+ * @brief Unlock the build graph and the action cache.
+ */
+void slakeUnlockBuildGraph()
+{
+	slakeUnlockMutex(&buildMutex);
+}
+
+/**
+ * @brief Release all build nodes.
+ */
+void slakeDestroyBuildGraph()
+{
+	slakeLockMutex(&buildMutex);
+	if (!buildNodes)
+	{
+		slakeUnlockMutex(&buildMutex);
+		return;
+	}
+
+	for (size_t i = 0; i < buildNodes->capacity; i++)
+	{
+		SlakeBuildNode *node = buildNodes->slots[i].value;
+		if (!buildNodes->slots[i].key)
+			continue;
+
+		free(node->command);
+		free(node->lastCommand);
+		utilVectorFree(&node->deps);
+		utilVectorFree(&node->dependents);
+		utilVectorFree(&node->envVars);
+		free(node);
+	}
+
+	utilHashMapDelete(buildNodes);
+	buildNodes = NULL;
+	slakeUnlockMutex(&buildMutex);
+}
+
+/**
+ * @brief Define a rule to build a file. An existing rule of the file will be
+ * replaced.
+ *
+ * @param target Path of the file to build.
+ * @param command Command line which builds the file.
+ * @param deps Paths of prerequisites.
+ * @param depCount Count of prerequisites.
+ */
+void slakeDefineRule(const char *target, const char *command, const char **deps, size_t depCount)
+{
+	assert(target != NULL);
+	assert(command != NULL);
+
+	slakeLockMutex(&buildMutex);
+	SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(target));
+
+	free(node->command);
+	node->command = _slakeStrdup(command, strlen(command));
+	node->status = BUILD_STATUS_UNCHECKED;
+
+	utilVectorClear(&node->deps);
+	for (size_t i = 0; i < depCount; i++)
+	{
+		SlakeBuildNode *dep = _slakeGetBuildNode(slakeIntern(deps[i]));
+		if (!utilVectorPush(&node->deps, &dep))
+			slakePanic("Out of memory");
+	}
+	slakeUnlockMutex(&buildMutex);
+}
+
+/**
+ * @brief Make a target rebuilt only if contents of its prerequisites change,
+ * instead of comparing modification times. Touching a prerequisite without
+ * changing it does not rebuild the target.
+ *
+ * @param target Path of the target.
+ */
+void slakeUseContentHash(const char *target)
+{
+	assert(target != NULL);
+
+	slakeLockMutex(&buildMutex);
+	SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(target));
+	node->useHash = 1;
+	node->status = BUILD_STATUS_UNCHECKED;
+	slakeUnlockMutex(&buildMutex);
+}
+
+/**
+ * @brief Include environment variables in the action cache key of a target,
+ * besides PATH and the variables of toolchains.
+ *
+ * @param target Path of the target.
+ * @param names Names of the variables.
+ * @param count Count of the variables.
+ */
+void slakeUseEnvironment(const char *target, const char **names, size_t count)
+{
+	assert(target != NULL);
+
+	slakeLockMutex(&buildMutex);
+	SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(target));
+	for (size_t i = 0; i < count; i++)
+	{
+		SlakeSymbol name = slakeIntern(names[i]);
+		size_t j = 0;
+		while (j < node->envVars.size && utilVectorAt(&node->envVars, SlakeSymbol, j) != name)
+			j++;
+
+		if (j == node->envVars.size && !utilVectorPush(&node->envVars, &name))
+			slakePanic("Out of memory");
+	}
+	slakeUnlockMutex(&buildMutex);
+}
+
+//
+// Check if the cached content hash of a node matches the current file.
+//
+static int _slakeIsHashValid(SlakeBuildNode *node)
+{
+	const SlakeFileStat *st = _slakeGetFileStat(node);
+	return node->hasHash && node->hashInode == st->inode && node->hashSize == st->size && node->hashMtime == st->mtime;
+}
+
+//
+// Hash contents of the file of a node, keyed by the cached file status.
+// Missing files are hashed as 0. This may run on hashing tasks, so the file
+// must have been statted.
+//
+static void _slakeHashFile(SlakeBuildNode *node)
+{
+	SlakeSource *source = node->stat.exists ? slakeLoadSource(slakeGetSymbolName(node->path)) : NULL;
+
+	node->hash = source ? utilHash64(source->data, source->size, 0) : 0;
+	node->hashInode = node->stat.inode;
+	node->hashSize = node->stat.size;
+	node->hashMtime = node->stat.mtime;
+	node->hasHash = 1;
+
+	if (source)
+		slakeUnloadSource(source);
+}
+
+static int _slakeHashWorkerProc(void *arg)
+{
+	SlakeHashWorker *worker = arg;
+	for (size_t i = worker->start; i < worker->nodes->size; i += worker->step)
+		_slakeHashFile(utilVectorAt(worker->nodes, SlakeBuildNode *, i));
+	return 0;
+}
+
+//
+// Hash files of nodes on parallel tasks.
+//
+static void _slakeHashFiles(UtilVector *nodes)
+{
+	if (!nodes->size)
+		return;
+	isStateDirty = 1;
+
+	size_t taskCount = (nodes->size + SLAKE_HASH_FILES_PER_TASK - 1) / SLAKE_HASH_FILES_PER_TASK;
+	if (taskCount > slakeGetCpuCount())
+		taskCount = slakeGetCpuCount();
+	if (taskCount < 1)
+		taskCount = 1;
+
+	SlakeHashWorker *workers = malloc(sizeof(SlakeHashWorker) * taskCount);
+	SlakeTask **tasks = malloc(sizeof(SlakeTask *) * taskCount);
+	if (!workers || !tasks)
+		slakePanic("Out of memory");
+
+	// The first partition is hashed on the current thread.
+	for (size_t i = 0; i < taskCount; i++)
+	{
+		workers[i].nodes = nodes;
+		workers[i].start = i;
+		workers[i].step = taskCount;
+		tasks[i] = i ? slakeCreateTask(_slakeHashWorkerProc, &workers[i]) : NULL;
+	}
+
+	// The build graph lock is held, so the current thread has to block.
+	_slakeHashWorkerProc(&workers[0]);
+	for (size_t i = 1; i < taskCount; i++)
+	{
+		if (tasks[i])
+			slakeAwaitBlocking(tasks[i]);
+		else
+			_slakeHashWorkerProc(&workers[i]);
+	}
+
+	free(workers);
+	free(tasks);
+}
+
+//
+// Collect prerequisites of content-hashed targets whose hashes are out of
+// date, so they can be hashed in parallel before checking.
+//
+static void _slakeCollectHashJobs(SlakeBuildNode *node, UtilVector *nodes, UtilVector *visited)
+{
+	if (node->status != BUILD_STATUS_UNCHECKED || node->isVisited)
+		return;
+
+	node->isVisited = 1;
+	if (!utilVectorPush(visited, &node))
+		slakePanic("Out of memory");
+
+	for (size_t i = 0; i < node->deps.size; i++)
+	{
+		SlakeBuildNode *dep = utilVectorAt(&node->deps, SlakeBuildNode *, i);
+		_slakeCollectHashJobs(dep, nodes, visited);
+
+		if ((node->useHash || slakeIsActionCacheEnabled()) && node->command && !dep->isHashQueued && _slakeGetFileStat(dep)->exists && !_slakeIsHashValid(dep))
+		{
+			dep->isHashQueued = 1;
+			if (!utilVectorPush(nodes, &dep))
+				slakePanic("Out of memory");
+		}
+	}
+}
+
+//
+// Cache a known content hash of the file of a node.
+//
+static void _slakeSetContentHash(SlakeBuildNode *node, uint64_t hash)
+{
+	const SlakeFileStat *st = _slakeGetFileStat(node);
+	node->hash = hash;
+	node->hashInode = st->inode;
+	node->hashSize = st->size;
+	node->hashMtime = st->mtime;
+	node->hasHash = 1;
+	isStateDirty = 1;
+}
+
+//
+// Get the content hash of the file of a node.
+//
+static uint64_t _slakeGetContentHash(SlakeBuildNode *node)
+{
+	if (!_slakeIsHashValid(node))
+	{
+		_slakeHashFile(node);
+		isStateDirty = 1;
+	}
+	return node->hash;
+}
+
+//
+// Hash paths and contents of the prerequisites of a node. Never returns 0,
+// which means the hash is unknown.
+//
+static uint64_t _slakeGetDepsHash(SlakeBuildNode *node)
+{
+	uint64_t hash = 0;
+	for (size_t i = 0; i < node->deps.size; i++)
+	{
+		SlakeBuildNode *dep = utilVectorAt(&node->deps, SlakeBuildNode *, i);
+		const char *path = slakeGetSymbolName(dep->path);
+		uint64_t contentHash = _slakeGetContentHash(dep);
+
+		hash = utilHash64(path, strlen(path) + 1, hash);
+		hash = utilHash64(&contentHash, sizeof(contentHash), hash);
+	}
+	return hash ? hash : 1;
+}
+
+//
+// Get the key of the action which builds a node, including its command,
+// prerequisites and environment variables.
+//
+static uint64_t _slakeGetActionKey(SlakeBuildNode *node)
+{
+	const char *path = slakeGetSymbolName(node->path);
+	uint64_t key = _slakeGetDepsHash(node) ^ slakeGetEnvironmentHash();
+	for (size_t i = 0; i < node->envVars.size; i++)
+		key = slakeHashEnvironmentVariable(slakeGetSymbolName(utilVectorAt(&node->envVars, SlakeSymbol, i)), key);
+
+	key = utilHash64(path, strlen(path) + 1, key);
+	return utilHash64(node->command, strlen(node->command), key);
+}
+
+//
+// Check if a node has to be rebuilt, assuming its prerequisites are up to
+// date or have been rebuilt.
+//
+static int _slakeIsOutOfDate(SlakeBuildNode *node)
+{
+	const SlakeFileStat *st = _slakeGetFileStat(node);
+	if (!st->exists || !node->lastCommand || strcmp(node->lastCommand, node->command))
+		return 1;
+
+	// A file left untouched since it was last checked is also up to date with
+	// prerequisites which were rebuilt without changes then.
+	long long mtime = st->mtime;
+	if (mtime == node->lastMtime && node->inputMtime > mtime)
+		mtime = node->inputMtime;
+
+	for (size_t i = 0; i < node->deps.size; i++)
+	{
+		SlakeBuildNode *dep = utilVectorAt(&node->deps, SlakeBuildNode *, i);
+		const SlakeFileStat *depStat = _slakeGetFileStat(dep);
+		if (!depStat->exists)
+			return 1;
+		if (!node->useHash && (dep->isChanged || (dep->isRebuilt ? dep->oldMtime : depStat->mtime) > mtime))
+			return 1;
+	}
+
+	return node->useHash && node->lastDepsHash != _slakeGetDepsHash(node);
+}
+
+//
+// Check if a node and its prerequisites are up to date, and append nodes
+// to rebuild into the plan, prerequisites first. Returns non-zero if failed.
+//
+static int _slakeCheckNode(SlakeBuildNode *node, UtilVector *plan)
+{
+	switch (node->status)
+	{
+	case BUILD_STATUS_CHECKING:
+	{
+		char msg[256];
+		snprintf(msg, sizeof(msg), "Dependency cycle detected at target: %s", slakeGetSymbolName(node->path));
+		slakePanic(msg);
+	}
+	case BUILD_STATUS_CLEAN:
+	case BUILD_STATUS_DIRTY:
+		return 0;
+	default:
+		break;
+	}
+
+	const SlakeFileStat *st = _slakeGetFileStat(node);
+
+	if (!node->command)
+	{
+		if (!st->exists)
+		{
+			fprintf(stderr, "Error: No rule to make target:%s\n", slakeGetSymbolName(node->path));
+			return 1;
+		}
+
+		node->status = BUILD_STATUS_CLEAN;
+		return 0;
+	}
+
+	node->status = BUILD_STATUS_CHECKING;
+
+	int dirty = 0;
+	for (size_t i = 0; i < node->deps.size; i++)
+	{
+		SlakeBuildNode *dep = utilVectorAt(&node->deps, SlakeBuildNode *, i);
+		if (_slakeCheckNode(dep, plan))
+		{
+			node->status = BUILD_STATUS_UNCHECKED;
+			return 1;
+		}
+
+		if (dep->status == BUILD_STATUS_DIRTY)
+			dirty = 1;
+	}
+
+	// Nodes with dirty prerequisites are checked again when they are ready.
+	if (dirty || _slakeIsOutOfDate(node))
+	{
+		node->status = BUILD_STATUS_DIRTY;
+		if (!utilVectorPush(plan, &node))
+			slakePanic("Out of memory");
+	}
+	else
+		node->status = BUILD_STATUS_CLEAN;
+
+	return 0;
+}
+
+static void _slakePushNode(UtilVector *nodes, SlakeBuildNode *node)
+{
+	if (!utilVectorPush(nodes, &node))
+		slakePanic("Out of memory");
+}
+
+//
+// Mark a node as up to date and make its dependents ready once all of their
+// prerequisites are.
+//
+static void _slakeReleaseDependents(SlakeBuildNode *node, UtilVector *ready)
+{
+	node->status = BUILD_STATUS_CLEAN;
+
+	for (size_t i = 0; i < node->dependents.size; i++)
+	{
+		SlakeBuildNode *dependent = utilVectorAt(&node->dependents, SlakeBuildNode *, i);
+		if (!--dependent->pendingDeps)
+			_slakePushNode(ready, dependent);
+	}
+}
+
+//
+// Get the newest modification time of the prerequisites of a node.
+//
+static long long _slakeGetInputMtime(SlakeBuildNode *node)
+{
+	long long mtime = 0;
+	for (size_t i = 0; i < node->deps.size; i++)
+	{
+		const SlakeFileStat *depStat = _slakeGetFileStat(utilVectorAt(&node->deps, SlakeBuildNode *, i));
+		if (depStat->mtime > mtime)
+			mtime = depStat->mtime;
+	}
+	return mtime;
+}
+
+//
+// Check if a node has dependents waiting for it which compare modification
+// times. They need the content hash from before the rebuild to tell if the
+// file has changed.
+//
+static int _slakeHasMtimeDependents(SlakeBuildNode *node)
+{
+	for (size_t i = 0; i < node->dependents.size; i++)
+		if (!utilVectorAt(&node->dependents, SlakeBuildNode *, i)->useHash)
+			return 1;
+	return 0;
+}
+
+//
+// Record a node which has been rebuilt or restored from the action cache.
+// The content hash of the new file is passed if known, otherwise NULL.
+//
+static void _slakeFinishNode(SlakeBuildNode *node, const uint64_t *hash, UtilVector *ready)
+{
+	free(node->lastCommand);
+	isStateDirty = 1;
+
+	SlakeFileStat old = *_slakeGetFileStat(node);
+	int hadHash = old.exists && _slakeIsHashValid(node);
+	uint64_t oldHash = node->hash;
+
+	node->isStatted = 0;
+	const SlakeFileStat *st = _slakeGetFileStat(node);
+	if (hash)
+		_slakeSetContentHash(node, *hash);
+
+	// Rewriting a file with the same contents does not change it, so
+	// dependents comparing modification times are not rebuilt either.
+	if (old.exists && st->exists && old.inode == st->inode && old.size == st->size && old.mtime == st->mtime)
+		node->isChanged = 0;
+	else
+		node->isChanged = !hadHash || !st->exists || _slakeGetContentHash(node) != oldHash;
+
+	node->isRebuilt = 1;
+	node->oldMtime = old.mtime;
+	node->lastCommand = _slakeStrdup(node->command, strlen(node->command));
+	node->lastMtime = st->mtime;
+	node->inputMtime = _slakeGetInputMtime(node);
+	node->lastDepsHash = node->useHash ? _slakeGetDepsHash(node) : 0;
+	_slakeReleaseDependents(node, ready);
+}
+
+//
+// Handle a finished build job. Returns the exit code of the job.
+//
+static int _slakeFinishBuildJob(SlakeBuildJob *buildJob, UtilVector *ready)
+{
+	SlakeBuildNode *node = buildJob->node;
+	int exitCode = slakeWaitJob(buildJob->job);
+
+	if (exitCode)
+	{
+		// The target may be partially written, so it is not recorded.
+		fprintf(stderr, "Error: Failed to build target:%s (exit code %d)\n", slakeGetSymbolName(node->path), exitCode);
+		free(node->lastCommand);
+		node->lastCommand = NULL;
+		isStateDirty = 1;
+		node->status = BUILD_STATUS_UNCHECKED;
+		return exitCode;
+	}
+
+	uint64_t hash;
+	int isStored = slakeIsActionCacheEnabled() && slakeStoreAction(buildJob->key, slakeGetSymbolName(node->path), &hash);
+	_slakeFinishNode(node, isStored ? &hash : NULL, ready);
+
+	return 0;
+}
+
+//
+// Execute the commands of a plan in parallel, each node starts after its
+// prerequisites. Returns the exit code of the first failed command.
+//
+static int _slakeExecutePlan(UtilVector *plan)
+{
+	UtilVector ready, running;
+	utilVectorInit(&ready, sizeof(SlakeBuildNode *), NULL);
+	utilVectorInit(&running, sizeof(SlakeBuildJob), NULL);
+
+	for (size_t i = 0; i < plan->size; i++)
+		utilVectorClear(&utilVectorAt(plan, SlakeBuildNode *, i)->dependents);
+
+	for (size_t i = 0; i < plan->size; i++)
+	{
+		SlakeBuildNode *node = utilVectorAt(plan, SlakeBuildNode *, i);
+
+		node->pendingDeps = 0;
+		for (size_t j = 0; j < node->deps.size; j++)
+		{
+			SlakeBuildNode *dep = utilVectorAt(&node->deps, SlakeBuildNode *, j);
+			if (dep->status == BUILD_STATUS_DIRTY)
+			{
+				_slakePushNode(&dep->dependents, node);
+				node->pendingDeps++;
+			}
+		}
+
+		if (!node->pendingDeps)
+			_slakePushNode(&ready, node);
+	}
+
+	int exitCode = 0;
+	size_t readyIndex = 0;
+	for (;;)
+	{
+		// Stop starting new commands after a failure.
+		while (!exitCode && readyIndex < ready.size && running.size < slakeGetMaxJobs())
+		{
+			SlakeBuildJob buildJob;
+			buildJob.node = utilVectorAt(&ready, SlakeBuildNode *, readyIndex++);
+
+			// Rebuilt prerequisites may have the same contents as before,
+			// then there is no need to rebuild the node. The check is
+			// recorded, so the node is not rebuilt next time either.
+			if (!_slakeIsOutOfDate(buildJob.node))
+			{
+				buildJob.node->lastMtime = _slakeGetFileStat(buildJob.node)->mtime;
+				buildJob.node->inputMtime = _slakeGetInputMtime(buildJob.node);
+				isStateDirty = 1;
+				_slakeReleaseDependents(buildJob.node, &ready);
+				continue;
+			}
+
+			if (_slakeGetFileStat(buildJob.node)->exists && _slakeHasMtimeDependents(buildJob.node))
+				_slakeGetContentHash(buildJob.node);
+
+			const char *path = slakeGetSymbolName(buildJob.node->path);
+			if (slakeIsActionCacheEnabled())
+			{
+				uint64_t hash;
+				buildJob.key = _slakeGetActionKey(buildJob.node);
+				if (slakeRestoreAction(buildJob.key, path, &hash))
+				{
+					printf("Restored from cache:%s\n", path);
+					_slakeFinishNode(buildJob.node, &hash, &ready);
+					continue;
+				}
+			}
+
+			// The file may be hard linked to the action cache.
+			slakeDetachActionOutput(path);
+
+			puts(buildJob.node->command);
+			fflush(stdout);
+			buildJob.job = slakeSubmitJob(buildJob.node->command);
+
+			if (!utilVectorPush(&running, &buildJob))
+				slakePanic("Out of memory");
+		}
+
+		if (!running.size)
+			break;
+
+		size_t finished = 0;
+		for (size_t i = 0; i < running.size;)
+		{
+			SlakeBuildJob *buildJob = &utilVectorAt(&running, SlakeBuildJob, i);
+			if (!slakeIsJobDone(buildJob->job))
+			{
+				i++;
+				continue;
+			}
+
+			int result = _slakeFinishBuildJob(buildJob, &ready);
+			if (result && !exitCode)
+				exitCode = result;
+
+			*buildJob = utilVectorAt(&running, SlakeBuildJob, --running.size);
+			finished++;
+		}
+
+		if (!finished)
+			slakeWaitAnyJob();
+	}
+
+	// Nodes which were not built have to be checked again next time.
+	for (size_t i = 0; i < plan->size; i++)
+	{
+		SlakeBuildNode *node = utilVectorAt(plan, SlakeBuildNode *, i);
+		if (node->status == BUILD_STATUS_DIRTY)
+			node->status = BUILD_STATUS_UNCHECKED;
+		node->isRebuilt = 0;
+		node->isChanged = 0;
+	}
+
+	utilVectorFree(&ready);
+	utilVectorFree(&running);
+
+	return exitCode;
+}
+
+/**
+ * @brief Build a target and its prerequisites which are out of date. A
+ * target is out of date if it does not exist, its command line has changed
+ * since the last build, or any of its prerequisites is newer than it. For
+ * targets using content hashes, prerequisites are compared by contents
+ * instead of modification times. Prerequisites rebuilt with the same
+ * contents do not make targets out of date. The interpreter lock is not
+ * needed.
+ *
+ * The build graph lock is held during the whole build, and a thread lock
+ * cannot be moved to another thread, so a build on a fiber blocks its
+ * worker instead of suspending the fiber. Concurrent builds wait for each
+ * other anyway.
+ *
+ * @param target Path of the target.
+ * @return 0 if succeeded, otherwise the exit code of the failed command.
+ */
+int slakeBuild(const char *target)
+{
+	assert(target != NULL);
+
+	slakeLockMutex(&buildMutex);
+	if (!isStateLoaded)
+		_slakeLoadBuildState();
+
+	UtilVector plan, visited;
+	utilVectorInit(&plan, sizeof(SlakeBuildNode *), NULL);
+	utilVectorInit(&visited, sizeof(SlakeBuildNode *), NULL);
+
+	SlakeBuildNode *node = _slakeGetBuildNode(slakeIntern(target));
+
+	// Hash changed prerequisites in parallel, the plan is used as the queue.
+	_slakeCollectHashJobs(node, &plan, &visited);
+	for (size_t i = 0; i < visited.size; i++)
+		utilVectorAt(&visited, SlakeBuildNode *, i)->isVisited = 0;
+	for (size_t i = 0; i < plan.size; i++)
+		utilVectorAt(&plan, SlakeBuildNode *, i)->isHashQueued = 0;
+	_slakeHashFiles(&plan);
+	utilVectorClear(&plan);
+	utilVectorFree(&visited);
+
+	int exitCode = 1;
+	if (!_slakeCheckNode(node, &plan))
+		exitCode = _slakeExecutePlan(&plan);
+	else
+	{
+		for (size_t i = 0; i < plan.size; i++)
+			utilVectorAt(&plan, SlakeBuildNode *, i)->status = BUILD_STATUS_UNCHECKED;
+	}
+
+	utilVectorFree(&plan);
+	slakeUnlockMutex(&buildMutex);
+	return exitCode;
+}
@@ -0,0 +1,19 @@
+#ifndef __BUILD_H__
+#define __BUILD_H__
+
+#include <slakedef.h>
+
+// Name of the build state file, in the working directory.
+#define SLAKE_BUILD_STATE_FILE ".slake_state"
+
+void slakeDefineRule(const char *target, const char *command, const char **deps, size_t depCount);
+void slakeUseContentHash(const char *target);
+void slakeUseEnvironment(const char *target, const char **names, size_t count);
+int slakeBuild(const char *target);
+
+void slakeSaveBuildState();
+void slakeLockBuildGraph();
+void slakeUnlockBuildGraph();
+void slakeDestroyBuildGraph();
+
+#endif
@@ -0,0 +1,562 @@
+#include "cache.h"
+#include "source.h"
+#include <slakedef.h>
+#include <util/hash.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+#define SLAKE_CACHE_PATH_MAX 4096
+
+typedef struct _SlakeCacheObject
+{
+	uint64_t hash;
+	unsigned long long size;
+	long long mtime; // Time of the last use in nanoseconds, from "<object>.used".
+} SlakeCacheObject;
+
+static char *cacheDir = NULL;
+static unsigned long long cacheMaxSize = 0;
+static int isCacheChanged = 0;
+
+//
+// Format a path in the cache directory. Returns non-zero if the path is too
+// long.
+//
+static int _slakeCachePath(char *buf, const char *kind, uint64_t id, const char *suffix)
+{
+	int n = snprintf(buf, SLAKE_CACHE_PATH_MAX, "%s/%s/%016llx%s", cacheDir, kind, (unsigned long long)id, suffix);
+	return n < 0 || n >= SLAKE_CACHE_PATH_MAX;
+}
+
+static int _slakeMakeDir(const char *path)
+{
+#ifdef _WIN32
+	return _mkdir(path) && errno != EEXIST;
+#else
+	return mkdir(path, 0777) && errno != EEXIST;
+#endif
+}
+
+//
+// Create a directory and its parents.
+//
+static int _slakeMakeDirs(const char *path)
+{
+	char buf[SLAKE_CACHE_PATH_MAX];
+	size_t length = strlen(path);
+	if (length >= sizeof(buf))
+		return 1;
+	memcpy(buf, path, length + 1);
+
+	for (size_t i = 1; i < length; i++)
+	{
+		if (buf[i] != '/' && buf[i] != '\\')
+			continue;
+
+		buf[i] = '\0';
+		int failed = _slakeMakeDir(buf);
+		buf[i] = path[i];
+		if (failed)
+			return 1;
+	}
+	return _slakeMakeDir(buf);
+}
+
+//
+// Copy a file to a path which does not exist, sharing its data if possible.
+// Reflinks are preferred since the copies are independent, then hard links,
+// then plain copies.
+//
+static int _slakeCloneFile(const char *src, const char *dst)
+{
+#ifdef _WIN32
+	if (CreateHardLinkA(dst, src, NULL))
+		return 0;
+	return !CopyFileA(src, dst, TRUE);
+#else
+	int srcFd = open(src, O_RDONLY);
+	if (srcFd < 0)
+		return 1;
+
+	struct stat st;
+	if (fstat(srcFd, &st))
+	{
+		close(srcFd);
+		return 1;
+	}
+
+	int dstFd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (dstFd < 0)
+	{
+		close(srcFd);
+		return 1;
+	}
+
+	int failed = 1;
+#ifdef FICLONE
+	failed = ioctl(dstFd, FICLONE, srcFd) != 0;
+#endif
+	if (failed)
+	{
+		close(dstFd);
+		unlink(dst);
+
+		if (!link(src, dst))
+		{
+			close(srcFd);
+			return 0;
+		}
+
+		if ((dstFd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+		{
+			close(srcFd);
+			return 1;
+		}
+
+		char buf[65536];
+		ssize_t n;
+		failed = 0;
+		while (!failed && (n = read(srcFd, buf, sizeof(buf))) != 0)
+		{
+			if (n < 0)
+				failed = errno != EINTR;
+			else
+			{
+				for (ssize_t written = 0, m; !failed && written < n; written += m > 0 ? m : 0)
+				{
+					m = write(dstFd, buf + written, (size_t)(n - written));
+					failed = m < 0 && errno != EINTR;
+				}
+			}
+		}
+	}
+
+	// Keep permissions such as the executable bit.
+	if (fchmod(dstFd, st.st_mode & 07777))
+		failed = 1;
+	if (close(dstFd))
+		failed = 1;
+	close(srcFd);
+
+	if (failed)
+		unlink(dst);
+	return failed;
+#endif
+}
+
+//
+// Clone a file over another path atomically.
+//
+static int _slakeReplaceFile(const char *src, const char *dst)
+{
+	char tmp[SLAKE_CACHE_PATH_MAX];
+	int n = snprintf(tmp, sizeof(tmp), "%s.slake-tmp", dst);
+	if (n < 0 || n >= (int)sizeof(tmp))
+		return 1;
+
+	remove(tmp);
+	if (_slakeCloneFile(src, tmp))
+		return 1;
+
+#ifdef _WIN32
+	remove(dst);
+#endif
+	// Renaming a hard link over another link of the same file does nothing,
+	// so the temporary file is removed in any case.
+	int failed = rename(tmp, dst) != 0;
+	remove(tmp);
+	return failed;
+}
+
+//
+// Record the use of an object by touching "<object>.used". The object itself
+// may be hard linked to output files, whose modification times must be kept.
+//
+static void _slakeTouchObject(uint64_t hash)
+{
+	char path[SLAKE_CACHE_PATH_MAX];
+	if (_slakeCachePath(path, "objects", hash, ".used"))
+		return;
+
+	FILE *fp = fopen(path, "ab");
+	if (!fp)
+		return;
+	fclose(fp);
+	utime(path, NULL);
+}
+
+/**
+ * @brief Enable the action cache. Outputs of build rules are restored from
+ * the cache if their commands, prerequisites and environment variables match
+ * a cached build.
+ *
+ * @param dir Directory of the cache, created if it does not exist. NULL to
+ * disable the cache.
+ * @param maxSize Maximum size in byte of cached outputs. Least recently used
+ * outputs are evicted when the size is exceeded. 0 for no limit.
+ */
+void slakeSetActionCache(const char *dir, unsigned long long maxSize)
+{
+	free(cacheDir);
+	cacheDir = NULL;
+	cacheMaxSize = maxSize;
+
+	if (!dir)
+		return;
+
+	size_t length = strlen(dir);
+	while (length > 1 && (dir[length - 1] == '/' || dir[length - 1] == '\\'))
+		length--;
+
+	if (!(cacheDir = malloc(length + 1)))
+		slakePanic("Out of memory");
+	memcpy(cacheDir, dir, length);
+	cacheDir[length] = '\0';
+
+	char path[SLAKE_CACHE_PATH_MAX];
+	int n = snprintf(path, sizeof(path), "%s/objects", cacheDir);
+	int failed = n < 0 || n >= (int)sizeof(path) || _slakeMakeDirs(path);
+	if (!failed)
+	{
+		n = snprintf(path, sizeof(path), "%s/actions", cacheDir);
+		failed = n < 0 || n >= (int)sizeof(path) || _slakeMakeDirs(path);
+	}
+
+	if (failed)
+	{
+		fprintf(stderr, "Warning: Error creating action cache, disabled:%s\n", cacheDir);
+		free(cacheDir);
+		cacheDir = NULL;
+	}
+}
+
+/**
+ * @brief Check if the action cache is enabled.
+ *
+ * @return Non-zero if enabled.
+ */
+int slakeIsActionCacheEnabled()
+{
+	return cacheDir != NULL;
+}
+
+// Variables which commonly change outputs of commands. Others, such as the
+// ones set by CI services for each run, would make every key different, so
+// they are only included if rules declare them.
+static const char *const toolchainVariables[] = {
+	"PATH", "CC", "CXX", "CPP", "LD", "AR", "AS", "RANLIB", "NM", "STRIP", "OBJCOPY",
+	"CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS", "LDLIBS", "ASFLAGS", "ARFLAGS",
+	"CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "LIBRARY_PATH", "PKG_CONFIG_PATH",
+	"INCLUDE", "LIB", "LIBPATH"
+};
+
+/**
+ * @brief Hash the name and the value of an environment variable.
+ *
+ * @param name Name of the variable.
+ * @param seed Hash to combine with.
+ * @return Combined hash.
+ */
+uint64_t slakeHashEnvironmentVariable(const char *name, uint64_t seed)
+{
+	const char *value = getenv(name);
+
+	// Hashed as "<name>=<value>", or only the name if unset, which differs
+	// from an empty value.
+	seed = utilHash64(name, strlen(name), seed);
+	if (!value)
+		return utilHash64("", 1, seed);
+
+	seed = utilHash64("=", 1, seed);
+	return utilHash64(value, strlen(value) + 1, seed);
+}
+
+/**
+ * @brief Get a hash of PATH and the variables of toolchains, which is
+ * included in the keys of actions since commands may depend on them.
+ *
+ * @return Hash of the environment.
+ */
+uint64_t slakeGetEnvironmentHash()
+{
+	static uint64_t hash;
+	static int isHashed = 0;
+
+	if (isHashed)
+		return hash;
+
+	hash = 0;
+	for (size_t i = 0; i < sizeof(toolchainVariables) / sizeof(toolchainVariables[0]); i++)
+		hash = slakeHashEnvironmentVariable(toolchainVariables[i], hash);
+
+	isHashed = 1;
+	return hash;
+}
+
+/**
+ * @brief Restore the output of an action from the cache.
+ *
+ * @param key Key of the action.
+ * @param output Path of the output file.
+ * @param hash Where to store the content hash of the output.
+ * @return Non-zero if the output is restored.
+ */
+int slakeRestoreAction(uint64_t key, const char *output, uint64_t *hash)
+{
+	char actionPath[SLAKE_CACHE_PATH_MAX], objectPath[SLAKE_CACHE_PATH_MAX];
+	if (!cacheDir || _slakeCachePath(actionPath, "actions", key, ""))
+		return 0;
+
+	FILE *fp = fopen(actionPath, "rb");
+	if (!fp)
+		return 0;
+
+	unsigned long long objectHash, size;
+	int n = fscanf(fp, "%llx %llu", &objectHash, &size);
+	fclose(fp);
+
+	// Drop entries whose objects were evicted or changed.
+	struct stat st;
+	if (n != 2 || _slakeCachePath(objectPath, "objects", objectHash, "") || stat(objectPath, &st) || (unsigned long long)st.st_size != size)
+	{
+		remove(actionPath);
+		return 0;
+	}
+
+	if (_slakeReplaceFile(objectPath, output))
+		return 0;
+
+	_slakeTouchObject(objectHash);
+
+	*hash = objectHash;
+	return 1;
+}
+
+/**
+ * @brief Store the output of an action into the cache.
+ *
+ * @param key Key of the action.
+ * @param output Path of the output file.
+ * @param hash Where to store the content hash of the output.
+ * @return Non-zero if the output is stored.
+ */
+int slakeStoreAction(uint64_t key, const char *output, uint64_t *hash)
+{
+	if (!cacheDir)
+		return 0;
+
+	SlakeSource *source = slakeLoadSource(output);
+	if (!source)
+		return 0;
+
+	uint64_t objectHash = utilHash64(source->data, source->size, 0);
+	unsigned long long size = source->size;
+	slakeUnloadSource(source);
+
+	char actionPath[SLAKE_CACHE_PATH_MAX], objectPath[SLAKE_CACHE_PATH_MAX], tmp[SLAKE_CACHE_PATH_MAX];
+	if (_slakeCachePath(actionPath, "actions", key, "") || _slakeCachePath(objectPath, "objects", objectHash, "") ||
+		_slakeCachePath(tmp, "actions", key, ".tmp"))
+		return 0;
+
+	// Objects with the same contents are shared by actions.
+	struct stat st;
+	if ((stat(objectPath, &st) || (unsigned long long)st.st_size != size) && _slakeReplaceFile(output, objectPath))
+		return 0;
+	_slakeTouchObject(objectHash);
+
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp)
+		return 0;
+
+	int failed = fprintf(fp, "%016llx %llu\n", (unsigned long long)objectHash, size) < 0;
+	if (fclose(fp) || failed)
+	{
+		remove(tmp);
+		return 0;
+	}
+
+#ifdef _WIN32
+	remove(actionPath);
+#endif
+	if (rename(tmp, actionPath))
+	{
+		remove(tmp);
+		return 0;
+	}
+
+	isCacheChanged = 1;
+	*hash = objectHash;
+	return 1;
+}
+
+/**
+ * @brief Unlink an output file if it is hard linked to another file, which
+ * may be a cached object, so that a command writing to it in place does not
+ * change the cache.
+ *
+ * @param output Path of the output file.
+ */
+void slakeDetachActionOutput(const char *output)
+{
+#ifndef _WIN32
+	struct stat st;
+	if (!lstat(output, &st) && S_ISREG(st.st_mode) && st.st_nlink > 1)
+		unlink(output);
+#endif
+}
+
+//
+// Call a function with each file name in a directory of the cache. Names
+// containing dots, such as temporary files, are skipped.
+//
+static void _slakeForEachCacheFile(const char *kind, void (*proc)(const char *name, void *ctx), void *ctx)
+{
+	char path[SLAKE_CACHE_PATH_MAX];
+
+#ifdef _WIN32
+	int n = snprintf(path, sizeof(path), "%s/%s/*", cacheDir, kind);
+	if (n < 0 || n >= (int)sizeof(path))
+		return;
+
+	WIN32_FIND_DATAA data;
+	HANDLE hFind = FindFirstFileA(path, &data);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (!strchr(data.cFileName, '.'))
+			proc(data.cFileName, ctx);
+	} while (FindNextFileA(hFind, &data));
+	FindClose(hFind);
+#else
+	int n = snprintf(path, sizeof(path), "%s/%s", cacheDir, kind);
+	if (n < 0 || n >= (int)sizeof(path))
+		return;
+
+	DIR *dir = opendir(path);
+	if (!dir)
+		return;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)))
+	{
+		if (!strchr(entry->d_name, '.'))
+			proc(entry->d_name, ctx);
+	}
+	closedir(dir);
+#endif
+}
+
+static void _slakeCollectObject(const char *name, void *ctx)
+{
+	UtilVector *objects = ctx;
+	char path[SLAKE_CACHE_PATH_MAX];
+	SlakeCacheObject object;
+	struct stat st;
+
+	object.hash = strtoull(name, NULL, 16);
+	if (_slakeCachePath(path, "objects", object.hash, "") || stat(path, &st))
+		return;
+	object.size = (unsigned long long)st.st_size;
+
+	// Objects whose uses were never recorded are aged by their own times.
+	struct stat used;
+	if (!_slakeCachePath(path, "objects", object.hash, ".used") && !stat(path, &used))
+		st = used;
+
+#if defined(_WIN32)
+	object.mtime = (long long)st.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+	object.mtime = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	object.mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	if (!utilVectorPush(objects, &object))
+		slakePanic("Out of memory");
+}
+
+static void _slakeRemoveDanglingAction(const char *name, void *ctx)
+{
+	char actionPath[SLAKE_CACHE_PATH_MAX], objectPath[SLAKE_CACHE_PATH_MAX];
+	if (_slakeCachePath(actionPath, "actions", strtoull(name, NULL, 16), ""))
+		return;
+
+	FILE *fp = fopen(actionPath, "rb");
+	if (!fp)
+		return;
+
+	unsigned long long objectHash;
+	int n = fscanf(fp, "%llx", &objectHash);
+	fclose(fp);
+
+	struct stat st;
+	if (n != 1 || _slakeCachePath(objectPath, "objects", objectHash, "") || stat(objectPath, &st))
+		remove(actionPath);
+}
+
+static int _slakeCompareObjects(const void *a, const void *b)
+{
+	const SlakeCacheObject *x = a, *y = b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/**
+ * @brief Evict least recently used outputs if the cache is too large, and
+ * disable the cache.
+ */
+void slakeCloseActionCache()
+{
+	if (cacheDir && cacheMaxSize && isCacheChanged)
+	{
+		UtilVector objects;
+		utilVectorInit(&objects, sizeof(SlakeCacheObject), NULL);
+		_slakeForEachCacheFile("objects", _slakeCollectObject, &objects);
+
+		unsigned long long totalSize = 0;
+		for (size_t i = 0; i < objects.size; i++)
+			totalSize += utilVectorAt(&objects, SlakeCacheObject, i).size;
+
+		if (totalSize > cacheMaxSize)
+		{
+			qsort(objects.data, objects.size, sizeof(SlakeCacheObject), _slakeCompareObjects);
+
+			char path[SLAKE_CACHE_PATH_MAX];
+			for (size_t i = 0; i < objects.size && totalSize > cacheMaxSize; i++)
+			{
+				SlakeCacheObject *object = &utilVectorAt(&objects, SlakeCacheObject, i);
+				if (!_slakeCachePath(path, "objects", object->hash, "") && !remove(path))
+				{
+					totalSize -= object->size;
+					if (!_slakeCachePath(path, "objects", object->hash, ".used"))
+						remove(path);
+				}
+			}
+
+			_slakeForEachCacheFile("actions", _slakeRemoveDanglingAction, NULL);
+		}
+
+		utilVectorFree(&objects);
+	}
+
+	isCacheChanged = 0;
+	slakeSetActionCache(NULL, 0);
+}
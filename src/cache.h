@@ -0,0 +1,25 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Local content-addressed cache of action outputs. Outputs are stored in
+// "<dir>/objects/<content hash>", and "<dir>/actions/<action key>" refers
+// to the output of an action. Uses of objects are recorded by the
+// modification times of "<dir>/objects/<content hash>.used".
+//
+
+void slakeSetActionCache(const char *dir, unsigned long long maxSize);
+int slakeIsActionCacheEnabled();
+uint64_t slakeGetEnvironmentHash();
+uint64_t slakeHashEnvironmentVariable(const char *name, uint64_t seed);
+
+int slakeRestoreAction(uint64_t key, const char *output, uint64_t *hash);
+int slakeStoreAction(uint64_t key, const char *output, uint64_t *hash);
+void slakeDetachActionOutput(const char *output);
+
+void slakeCloseActionCache();
+
+#endif
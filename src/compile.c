@@ -0,0 +1,790 @@
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Switches with fewer cases are compiled into comparison chains.
+//
+#define SLAKE_SWITCH_MIN_CASES 4
+
+//
+// Pending jumps of a loop. Jumps to be patched are chained through their
+// targets, a target of 0 ends the chain and others are indexes plus 1.
+//
+typedef struct _SlakeLoopLabels
+{
+	struct _SlakeLoopLabels *parent;
+	size_t breakChain, continueChain;
+} SlakeLoopLabels;
+
+typedef struct _SlakeCompiler
+{
+	SlakeBytecode *bc;
+	size_t insnCapacity;
+	size_t constCapacity;
+	size_t symbolCapacity;
+	uint16_t top; // The first free register.
+	SlakeLoopLabels *loop;
+} SlakeCompiler;
+
+static void _slakeCompileInto(SlakeCompiler *c, SlakeExpr *expr, uint16_t dest);
+static void _slakeCompileBody(SlakeCompiler *c, SlakeExecBody body);
+
+static size_t _slakeEmit(SlakeCompiler *c, SlakeOpcode op, uint16_t a, uint16_t b, uint16_t cc)
+{
+	SlakeBytecode *bc = c->bc;
+
+	if (bc->insnCount == c->insnCapacity)
+	{
+		c->insnCapacity = c->insnCapacity ? c->insnCapacity * 2 : 64;
+		bc->insns = realloc(bc->insns, c->insnCapacity * sizeof(SlakeInsn));
+		if (!bc->insns)
+			slakePanic("Out of memory");
+	}
+
+	SlakeInsn *insn = &bc->insns[bc->insnCount];
+	insn->op = op;
+	insn->a = a;
+	insn->b = b;
+	insn->c = cc;
+
+	return bc->insnCount++;
+}
+
+//
+// Emit an instruction with a 32-bit operand stored in b and c.
+//
+static size_t _slakeEmitWide(SlakeCompiler *c, SlakeOpcode op, uint16_t a, size_t x)
+{
+	return _slakeEmit(c, op, a, (uint16_t)(x & 0xffff), (uint16_t)(x >> 16));
+}
+
+static size_t _slakeEmitJump(SlakeCompiler *c, SlakeOpcode op, uint16_t a, size_t target)
+{
+	return _slakeEmitWide(c, op, a, target);
+}
+
+static void _slakeSetJumpTarget(SlakeCompiler *c, size_t index, size_t target)
+{
+	c->bc->insns[index].b = (uint16_t)(target & 0xffff);
+	c->bc->insns[index].c = (uint16_t)(target >> 16);
+}
+
+//
+// Point all jumps in a chain to the target.
+//
+static void _slakePatchChain(SlakeCompiler *c, size_t chain, size_t target)
+{
+	while (chain)
+	{
+		size_t index = chain - 1;
+		chain = slakeInsnWide(c->bc->insns[index]);
+		_slakeSetJumpTarget(c, index, target);
+	}
+}
+
+static int _slakeConstEquals(const SlakeValue *x, const SlakeValue *y)
+{
+	if (x->type != y->type)
+		return 0;
+
+	switch (x->type)
+	{
+	case VALUE_TYPE_STR:
+		return !strcmp(slakeGetString(x), slakeGetString(y));
+	case VALUE_TYPE_INT:
+	case VALUE_TYPE_UINT:
+		return x->data.u32 == y->data.u32;
+	case VALUE_TYPE_LONG:
+	case VALUE_TYPE_ULONG:
+		return x->data.u64 == y->data.u64;
+	default:
+		return 1;
+	}
+}
+
+//
+// Append a copy of the value into the constant pool.
+//
+static uint16_t _slakePushConst(SlakeCompiler *c, const SlakeValue *value)
+{
+	SlakeBytecode *bc = c->bc;
+
+	if (bc->constCount > SLAKE_RK_MAX)
+		slakePanic("Too many constants in a function");
+
+	if (bc->constCount == c->constCapacity)
+	{
+		c->constCapacity = c->constCapacity ? c->constCapacity * 2 : 16;
+		bc->consts = realloc(bc->consts, c->constCapacity * sizeof(SlakeValue));
+		if (!bc->consts)
+			slakePanic("Out of memory");
+	}
+
+	SlakeValue *k = &bc->consts[bc->constCount];
+	k->type = VALUE_TYPE_NULL;
+	slakeAssignValue(k, value);
+
+	return bc->constCount++;
+}
+
+//
+// Add a value into the constant pool and return its index. Equal constants
+// are only stored once.
+//
+static uint16_t _slakeAddConst(SlakeCompiler *c, const SlakeValue *value)
+{
+	for (uint16_t i = 0; i < c->bc->constCount; i++)
+		if (_slakeConstEquals(&c->bc->consts[i], value))
+			return i;
+
+	return _slakePushConst(c, value);
+}
+
+//
+// Append a symbol into the symbol table.
+//
+static uint16_t _slakePushSymbol(SlakeCompiler *c, SlakeSymbol symbol)
+{
+	SlakeBytecode *bc = c->bc;
+
+	if (bc->symbolCount == UINT16_MAX)
+		slakePanic("Too many symbols in a function");
+
+	if (bc->symbolCount == c->symbolCapacity)
+	{
+		c->symbolCapacity = c->symbolCapacity ? c->symbolCapacity * 2 : 16;
+		bc->symbols = realloc(bc->symbols, c->symbolCapacity * sizeof(SlakeSymbol));
+		if (!bc->symbols)
+			slakePanic("Out of memory");
+	}
+
+	bc->symbols[bc->symbolCount] = symbol;
+	return bc->symbolCount++;
+}
+
+//
+// Add a symbol into the symbol table and return its index.
+//
+static uint16_t _slakeAddSymbol(SlakeCompiler *c, SlakeSymbol symbol)
+{
+	for (uint16_t i = 0; i < c->bc->symbolCount; i++)
+		if (c->bc->symbols[i] == symbol)
+			return i;
+
+	return _slakePushSymbol(c, symbol);
+}
+
+static uint16_t _slakeAllocReg(SlakeCompiler *c, uint16_t count)
+{
+	uint16_t reg = c->top;
+
+	if ((size_t)c->top + count > SLAKE_RK_MAX)
+		slakePanic("Too many registers in a function");
+
+	c->top += count;
+	if (c->top > c->bc->regCount)
+		c->bc->regCount = c->top;
+
+	return reg;
+}
+
+//
+// Compile an expression as an RK operand. Immediate values are referred as
+// constants directly, other expressions are evaluated into a new register,
+// which will be released when the register top is restored.
+//
+static uint16_t _slakeCompileOperand(SlakeCompiler *c, SlakeExpr *expr)
+{
+	if (expr->type == EXPR_VALUE)
+		return SLAKE_RK_CONST | _slakeAddConst(c, expr->attribs.value);
+
+	// Local variables are in registers already.
+	if (expr->type == EXPR_VARREF && !expr->attribs.varRef.depth)
+		return (uint16_t)expr->attribs.varRef.slot;
+
+	uint16_t reg = _slakeAllocReg(c, 1);
+	_slakeCompileInto(c, expr, reg);
+	return reg;
+}
+
+//
+// Load value of a variable into a register.
+//
+static void _slakeCompileLoad(SlakeCompiler *c, SlakeExpr *varRef, uint16_t dest)
+{
+	switch (varRef->attribs.varRef.depth)
+	{
+	case 0:
+		if (dest != varRef->attribs.varRef.slot)
+			_slakeEmit(c, OP_MOVE, dest, (uint16_t)varRef->attribs.varRef.slot, 0);
+		break;
+	case 1:
+		_slakeEmitWide(c, OP_GETGLOBAL, dest, varRef->attribs.varRef.slot);
+		break;
+	default:
+		slakePanic("Invalid variable reference");
+	}
+}
+
+//
+// Store an RK operand into the variable referred by an assignment target.
+//
+static void _slakeCompileStore(SlakeCompiler *c, SlakeExpr *target, uint16_t value)
+{
+	if (target->type != EXPR_VARREF)
+		slakePanic("Invalid assignment target");
+
+	switch (target->attribs.varRef.depth)
+	{
+	case 0:
+		_slakeEmit(c, OP_SETLOCAL, (uint16_t)target->attribs.varRef.slot, value, 0);
+		break;
+	case 1:
+		_slakeEmitWide(c, OP_SETGLOBAL, value, target->attribs.varRef.slot);
+		break;
+	default:
+		slakePanic("Invalid variable reference");
+	}
+}
+
+//
+// Compile an expression whose result is not needed.
+//
+static void _slakeCompileDiscard(SlakeCompiler *c, SlakeExpr *expr)
+{
+	uint16_t top = c->top;
+
+	switch (expr->type)
+	{
+	case EXPR_VALUE:
+	case EXPR_VARREF:
+		break;
+	case EXPR_BINARY:
+		if (expr->attribs.binaryOp.type == BINARY_EXPR_MOV)
+		{
+			_slakeCompileStore(c, expr->attribs.binaryOp.l, _slakeCompileOperand(c, expr->attribs.binaryOp.r));
+			break;
+		}
+		// Other operations are discarded like any other expression.
+		// fall through
+	default:
+		_slakeCompileInto(c, expr, _slakeAllocReg(c, 1));
+	}
+
+	c->top = top;
+}
+
+static void _slakeCompileCall(SlakeCompiler *c, SlakeOpcode op, uint16_t name, SlakeExpr **params, unsigned short paramCount, uint16_t dest)
+{
+	uint16_t top = c->top;
+	uint16_t base = _slakeAllocReg(c, 1 + paramCount);
+
+	for (unsigned short i = 0; i < paramCount; i++)
+		_slakeCompileInto(c, params[i], base + 1 + i);
+
+	_slakeEmit(c, op, base, name, paramCount);
+	if (dest != base)
+		_slakeEmit(c, OP_MOVE, dest, base, 0);
+
+	c->top = top;
+}
+
+static int _slakeIsAddition(SlakeExpr *expr)
+{
+	return expr->type == EXPR_BINARY && expr->attribs.binaryOp.type == BINARY_EXPR_ADD;
+}
+
+//
+// Compile operands of an addition chain into the registers following base in
+// order of evaluation. Returns the operand of the leftmost one.
+//
+static uint16_t _slakeCompileConcatOperands(SlakeCompiler *c, SlakeExpr *expr, uint16_t base, uint16_t index)
+{
+	if (!index)
+		return _slakeCompileOperand(c, expr);
+
+	uint16_t first = _slakeCompileConcatOperands(c, expr->attribs.binaryOp.l, base, index - 1);
+	_slakeCompileInto(c, expr->attribs.binaryOp.r, base + index);
+	return first;
+}
+
+//
+// Compile a chain of additions, such as "cp " + src + " " + dest, into one
+// instruction, so strings are concatenated with a single allocation.
+//
+static void _slakeCompileConcat(SlakeCompiler *c, SlakeExpr *expr, uint16_t dest)
+{
+	uint16_t top = c->top;
+	size_t count = 2;
+
+	for (SlakeExpr *l = expr->attribs.binaryOp.l; _slakeIsAddition(l); l = l->attribs.binaryOp.l)
+		count++;
+	if (count > SLAKE_RK_MAX)
+		slakePanic("Too many registers in a function");
+
+	// The sum is computed in place if the destination is the last register.
+	uint16_t base = dest + 1 == c->top ? dest : _slakeAllocReg(c, 1);
+	_slakeAllocReg(c, (uint16_t)(count - 1));
+	uint16_t first = _slakeCompileConcatOperands(c, expr, base, (uint16_t)(count - 1));
+
+	_slakeEmit(c, OP_CONCAT, base, first, (uint16_t)count);
+	if (dest != base)
+		_slakeEmit(c, OP_MOVE, dest, base, 0);
+
+	c->top = top;
+}
+
+static void _slakeCompileBinary(SlakeCompiler *c, SlakeExpr *expr, uint16_t dest)
+{
+	static const SlakeOpcode binaryOpcodes[] = {
+		[BINARY_EXPR_ADD] = OP_ADD,
+		[BINARY_EXPR_SUB] = OP_SUB,
+		[BINARY_EXPR_MUL] = OP_MUL,
+		[BINARY_EXPR_DIV] = OP_DIV,
+		[BINARY_EXPR_MOD] = OP_MOD,
+		[BINARY_EXPR_AND] = OP_AND,
+		[BINARY_EXPR_OR] = OP_OR,
+		[BINARY_EXPR_XOR] = OP_XOR,
+		[BINARY_EXPR_EQ] = OP_EQ,
+		[BINARY_EXPR_NEQ] = OP_NEQ,
+		[BINARY_EXPR_LT] = OP_LT,
+		[BINARY_EXPR_GT] = OP_GT,
+		[BINARY_EXPR_LTEQ] = OP_LTEQ,
+		[BINARY_EXPR_GTEQ] = OP_GTEQ
+	};
+	SlakeBinaryExprType type = expr->attribs.binaryOp.type;
+	uint16_t top = c->top;
+
+	switch (type)
+	{
+	case BINARY_EXPR_MOV:
+		_slakeCompileInto(c, expr->attribs.binaryOp.r, dest);
+		_slakeCompileStore(c, expr->attribs.binaryOp.l, dest);
+		break;
+	case BINARY_EXPR_LAND:
+	case BINARY_EXPR_LOR:
+	{
+		// Evaluate the right operand only if the left one does not decide.
+		_slakeEmit(c, OP_BOOL, dest, _slakeCompileOperand(c, expr->attribs.binaryOp.l), 0);
+		c->top = top;
+		size_t jump = _slakeEmitJump(c, type == BINARY_EXPR_LAND ? OP_JMPF : OP_JMPT, dest, 0);
+		_slakeEmit(c, OP_BOOL, dest, _slakeCompileOperand(c, expr->attribs.binaryOp.r), 0);
+		_slakeSetJumpTarget(c, jump, c->bc->insnCount);
+		break;
+	}
+	default:
+	{
+		if ((size_t)type >= sizeof(binaryOpcodes) / sizeof(binaryOpcodes[0]) || !binaryOpcodes[type])
+			slakePanic("Invalid binary operation");
+
+		if (type == BINARY_EXPR_ADD && _slakeIsAddition(expr->attribs.binaryOp.l))
+		{
+			_slakeCompileConcat(c, expr, dest);
+			break;
+		}
+
+		uint16_t l = _slakeCompileOperand(c, expr->attribs.binaryOp.l);
+		uint16_t r = _slakeCompileOperand(c, expr->attribs.binaryOp.r);
+		_slakeEmit(c, binaryOpcodes[type], dest, l, r);
+	}
+	}
+
+	c->top = top;
+}
+
+//
+// Compile a switch into an OP_SWITCH table if it has enough cases, and all
+// of them are integer or string constants. Jumps to the cases and the
+// default body are stored into caseJumps.
+//
+static int _slakeCompileSwitchTable(SlakeCompiler *c, SlakeExpr *expr, uint16_t cond, size_t *caseJumps)
+{
+	SlakeSwitchCase **cases = expr->attribs.switchBlock.cases;
+	size_t caseCount = expr->attribs.switchBlock.caseCount;
+
+	if (caseCount < SLAKE_SWITCH_MIN_CASES || caseCount >= UINT16_MAX ||
+		c->bc->constCount + caseCount > SLAKE_RK_MAX + 1)
+		return 0;
+
+	SlakeValueType type = VALUE_TYPE_NULL;
+	int32_t min = INT32_MAX, max = INT32_MIN;
+	for (size_t i = 0; i < caseCount; i++)
+	{
+		if (cases[i]->condition->type != EXPR_VALUE)
+			return 0;
+
+		const SlakeValue *value = cases[i]->condition->attribs.value;
+		if (!i)
+			type = value->type;
+		if (value->type != type || (type != VALUE_TYPE_INT && type != VALUE_TYPE_STR))
+			return 0;
+
+		if (type == VALUE_TYPE_INT)
+		{
+			if (value->data.i32 < min)
+				min = value->data.i32;
+			if (value->data.i32 > max)
+				max = value->data.i32;
+		}
+	}
+
+	// Integers use a dense table if at least half of its slots are taken.
+	uint16_t kind = SLAKE_SWITCH_HASHED;
+	size_t slotCount = 1;
+	if (type == VALUE_TYPE_INT && (int64_t)max - min < (int64_t)caseCount * 2)
+	{
+		kind = SLAKE_SWITCH_DENSE;
+		slotCount = (size_t)((int64_t)max - min + 1);
+	}
+	else
+		while (slotCount < caseCount * 2)
+			slotCount <<= 1;
+
+	uint16_t first = c->bc->constCount;
+	for (size_t i = 0; i < caseCount; i++)
+		_slakePushConst(c, cases[i]->condition->attribs.value);
+
+	_slakeEmit(c, OP_SWITCH, cond, first, (uint16_t)caseCount);
+	for (size_t i = 0; i <= caseCount; i++)
+		caseJumps[i] = _slakeEmitJump(c, OP_JMP, 0, 0);
+	_slakeEmitWide(c, OP_NOP, kind, slotCount);
+	_slakeEmitWide(c, OP_NOP, 0, (uint32_t)min);
+
+	size_t slots = c->bc->insnCount;
+	for (size_t i = 0; i < slotCount; i++)
+		_slakeEmit(c, OP_NOP, 0, 0, 0);
+
+	// The first one of duplicated cases is taken, like the comparison chain.
+	for (size_t i = 0; i < caseCount; i++)
+	{
+		const SlakeValue *value = &c->bc->consts[first + i];
+		SlakeInsn *slot;
+
+		if (kind == SLAKE_SWITCH_DENSE)
+			slot = &c->bc->insns[slots + (size_t)((int64_t)value->data.i32 - min)];
+		else
+		{
+			size_t h = slakeHashSwitchKey(value) & (slotCount - 1);
+			while (c->bc->insns[slots + h].a && !_slakeConstEquals(&c->bc->consts[first + c->bc->insns[slots + h].a - 1], value))
+				h = (h + 1) & (slotCount - 1);
+			slot = &c->bc->insns[slots + h];
+		}
+
+		if (!slot->a)
+			slot->a = (uint16_t)(i + 1);
+	}
+
+	return 1;
+}
+
+static void _slakeCompileSwitch(SlakeCompiler *c, SlakeExpr *expr)
+{
+	uint16_t top = c->top;
+	size_t caseCount = expr->attribs.switchBlock.caseCount;
+
+	size_t *caseJumps = malloc((caseCount + 1) * sizeof(size_t));
+	if (!caseJumps)
+		slakePanic("Out of memory");
+
+	uint16_t cond = _slakeCompileOperand(c, expr->attribs.switchBlock.condition);
+	if (!_slakeCompileSwitchTable(c, expr, cond, caseJumps))
+	{
+		// Compare with each case and jump to the first matched one.
+		uint16_t matched = _slakeAllocReg(c, 1);
+		for (size_t i = 0; i < caseCount; i++)
+		{
+			uint16_t caseTop = c->top;
+			uint16_t value = _slakeCompileOperand(c, expr->attribs.switchBlock.cases[i]->condition);
+			_slakeEmit(c, OP_EQ, matched, cond, value);
+			caseJumps[i] = _slakeEmitJump(c, OP_JMPT, matched, 0);
+			c->top = caseTop;
+		}
+		caseJumps[caseCount] = _slakeEmitJump(c, OP_JMP, 0, 0);
+	}
+	c->top = top;
+
+	// Case bodies, the default body comes last.
+	size_t endChain = 0;
+	for (size_t i = 0; i <= caseCount; i++)
+	{
+		_slakeSetJumpTarget(c, caseJumps[i], c->bc->insnCount);
+		if (i < caseCount)
+		{
+			_slakeCompileBody(c, expr->attribs.switchBlock.cases[i]->body);
+			endChain = _slakeEmitJump(c, OP_JMP, 0, endChain) + 1;
+		}
+		else
+			_slakeCompileBody(c, expr->attribs.switchBlock.defaultBody);
+	}
+	_slakePatchChain(c, endChain, c->bc->insnCount);
+
+	free(caseJumps);
+}
+
+//
+// Compile a loop. The condition is checked before each cycle if there is,
+// and loopEnd is executed at the end of each cycle if there is.
+//
+static void _slakeCompileLoop(SlakeCompiler *c, SlakeExpr *condition, SlakeExpr *loopEnd, SlakeExecBody body)
+{
+	SlakeLoopLabels labels = { c->loop, 0, 0 };
+	size_t start = c->bc->insnCount, exitJump = 0;
+	uint16_t top = c->top;
+
+	if (condition)
+	{
+		uint16_t cond = _slakeCompileOperand(c, condition);
+		exitJump = _slakeEmitJump(c, OP_JMPF, cond, 0) + 1;
+		c->top = top;
+	}
+
+	c->loop = &labels;
+	_slakeCompileBody(c, body);
+	c->loop = labels.parent;
+
+	_slakePatchChain(c, labels.continueChain, c->bc->insnCount);
+	if (loopEnd)
+		_slakeCompileDiscard(c, loopEnd);
+	_slakeEmitJump(c, OP_JMP, 0, start);
+
+	if (exitJump)
+		_slakeSetJumpTarget(c, exitJump - 1, c->bc->insnCount);
+	_slakePatchChain(c, labels.breakChain, c->bc->insnCount);
+}
+
+//
+// Compile a loop block which runs specified times.
+//
+static void _slakeCompileTimes(SlakeCompiler *c, int times, SlakeExecBody body)
+{
+	if (times < 0)
+	{
+		_slakeCompileLoop(c, NULL, NULL, body);
+		return;
+	}
+
+	// The counter is kept in a hidden register during the loop.
+	SlakeValue zero = { .type = VALUE_TYPE_INT }, one = { .type = VALUE_TYPE_INT }, limit = { .type = VALUE_TYPE_INT };
+	zero.data.i32 = 0;
+	one.data.i32 = 1;
+	limit.data.i32 = times;
+
+	uint16_t top = c->top;
+	uint16_t counter = _slakeAllocReg(c, 1), cond = _slakeAllocReg(c, 1);
+	_slakeEmit(c, OP_LOADK, counter, _slakeAddConst(c, &zero), 0);
+
+	SlakeLoopLabels labels = { c->loop, 0, 0 };
+	size_t start = c->bc->insnCount;
+	_slakeEmit(c, OP_LT, cond, counter, SLAKE_RK_CONST | _slakeAddConst(c, &limit));
+	size_t exitJump = _slakeEmitJump(c, OP_JMPF, cond, 0);
+
+	c->loop = &labels;
+	_slakeCompileBody(c, body);
+	c->loop = labels.parent;
+
+	_slakePatchChain(c, labels.continueChain, c->bc->insnCount);
+	_slakeEmit(c, OP_ADD, counter, counter, SLAKE_RK_CONST | _slakeAddConst(c, &one));
+	_slakeEmitJump(c, OP_JMP, 0, start);
+
+	_slakeSetJumpTarget(c, exitJump, c->bc->insnCount);
+	_slakePatchChain(c, labels.breakChain, c->bc->insnCount);
+
+	c->top = top;
+}
+
+//
+// Compile a statement.
+//
+static void _slakeCompileStmt(SlakeCompiler *c, SlakeExpr *expr)
+{
+	uint16_t top = c->top;
+
+	switch (expr->type)
+	{
+	case EXPR_RETURN:
+		_slakeEmit(c, OP_RET,
+			expr->attribs.returnValue ? _slakeCompileOperand(c, expr->attribs.returnValue) : SLAKE_NO_OPERAND,
+			0, 0);
+		break;
+	case EXPR_IF:
+	{
+		uint16_t cond = _slakeCompileOperand(c, expr->attribs.ifBlock.condition);
+		c->top = top;
+		size_t falseJump = _slakeEmitJump(c, OP_JMPF, cond, 0);
+
+		_slakeCompileBody(c, expr->attribs.ifBlock.trueBlock);
+		if (expr->attribs.ifBlock.falseBlock)
+		{
+			size_t endJump = _slakeEmitJump(c, OP_JMP, 0, 0);
+			_slakeSetJumpTarget(c, falseJump, c->bc->insnCount);
+			_slakeCompileBody(c, expr->attribs.ifBlock.falseBlock);
+			_slakeSetJumpTarget(c, endJump, c->bc->insnCount);
+		}
+		else
+			_slakeSetJumpTarget(c, falseJump, c->bc->insnCount);
+		break;
+	}
+	case EXPR_SWITCH:
+		_slakeCompileSwitch(c, expr);
+		break;
+	case EXPR_BREAK:
+		if (!c->loop)
+			slakePanic("Break outside of loops");
+		c->loop->breakChain = _slakeEmitJump(c, OP_JMP, 0, c->loop->breakChain) + 1;
+		break;
+	case EXPR_CONTINUE:
+		if (!c->loop)
+			slakePanic("Continue outside of loops");
+		c->loop->continueChain = _slakeEmitJump(c, OP_JMP, 0, c->loop->continueChain) + 1;
+		break;
+	case EXPR_LOOP:
+		_slakeCompileTimes(c, expr->attribs.loopBlock.times, expr->attribs.loopBlock.body);
+		break;
+	case EXPR_FOR:
+		_slakeCompileLoop(c, expr->attribs.forBlock.condition, expr->attribs.forBlock.loopEnd, expr->attribs.forBlock.body);
+		break;
+	case EXPR_WHILE:
+		_slakeCompileLoop(c, expr->attribs.whileBlock.condition, NULL, expr->attribs.whileBlock.body);
+		break;
+	case EXPR_VARDEF:
+		_slakeEmit(c, OP_DEFLOCAL,
+			(uint16_t)expr->attribs.varDef.slot,
+			expr->attribs.varDef.initValue ? _slakeCompileOperand(c, expr->attribs.varDef.initValue) : SLAKE_NO_OPERAND,
+			expr->attribs.varDef.type);
+		break;
+	default:
+		_slakeCompileDiscard(c, expr);
+	}
+
+	c->top = top;
+}
+
+static void _slakeCompileBody(SlakeCompiler *c, SlakeExecBody body)
+{
+	if (!body)
+		return;
+
+	for (size_t i = 0; i < body->size; i++)
+		_slakeCompileStmt(c, utilVectorAt(body, SlakeExpr *, i));
+}
+
+//
+// Compile an expression and store its result into a register.
+//
+static void _slakeCompileInto(SlakeCompiler *c, SlakeExpr *expr, uint16_t dest)
+{
+	uint16_t top = c->top;
+
+	switch (expr->type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+		_slakeCompileCall(c, expr->type == EXPR_CALL ? OP_CALL : OP_ACALL, _slakeAddSymbol(c, expr->attribs.call.symbol),
+			expr->attribs.call.params, expr->attribs.call.paramCount, dest);
+		break;
+	case EXPR_AWAIT:
+		_slakeEmit(c, OP_AWAIT, dest, _slakeCompileOperand(c, expr->attribs.await), 0);
+		break;
+	case EXPR_SUPER_CALL:
+		_slakeCompileCall(c, OP_SCALL, _slakeAddSymbol(c, expr->attribs.call.symbol),
+			expr->attribs.call.params, expr->attribs.call.paramCount, dest);
+		break;
+	case EXPR_EXTERNAL_CALL:
+	{
+		// The function name is always stored right after the module name.
+		uint16_t index = _slakePushSymbol(c, expr->attribs.externalCall.moduleName);
+		_slakePushSymbol(c, expr->attribs.externalCall.funcName);
+
+		_slakeCompileCall(c, expr->attribs.externalCall.async ? OP_XACALL : OP_XCALL, index,
+			expr->attribs.externalCall.params, expr->attribs.externalCall.paramCount, dest);
+		break;
+	}
+	case EXPR_UNARY:
+	{
+		uint16_t x = _slakeCompileOperand(c, expr->attribs.unaryOp.r);
+		_slakeEmit(c, expr->attribs.unaryOp.type == UNARY_EXPR_NOT ? OP_NOT : OP_NEG, dest, x, 0);
+		break;
+	}
+	case EXPR_BINARY:
+		_slakeCompileBinary(c, expr, dest);
+		break;
+	case EXPR_VALUE:
+		_slakeEmit(c, OP_LOADK, dest, _slakeAddConst(c, expr->attribs.value), 0);
+		break;
+	case EXPR_VARREF:
+		_slakeCompileLoad(c, expr, dest);
+		break;
+	case EXPR_RETURN:
+	case EXPR_IF:
+	case EXPR_SWITCH:
+	case EXPR_BREAK:
+	case EXPR_CONTINUE:
+	case EXPR_LOOP:
+	case EXPR_FOR:
+	case EXPR_WHILE:
+	case EXPR_VARDEF:
+		// Statements do not have values.
+		_slakeCompileStmt(c, expr);
+		_slakeEmit(c, OP_LOADK, dest, _slakeAddConst(c, &(SlakeValue){ .type = VALUE_TYPE_NULL }), 0);
+		break;
+	default:
+		slakePanic("Invalid expression type");
+	}
+
+	c->top = top;
+}
+
+/**
+ * @brief Compile body of a function into bytecode.
+ *
+ * @param func Function to compile.
+ * @return Compiled bytecode.
+ */
+SlakeBytecode *slakeCompileFunction(SlakeFunction *func)
+{
+	assert(func != NULL);
+	assert(func->isResolved);
+
+	// Local variables take the first registers.
+	if (func->localCount > SLAKE_RK_MAX)
+		slakePanic("Too many local variables in a function");
+
+	SlakeBytecode *bc = malloc(sizeof(SlakeBytecode));
+	if (!bc)
+		slakePanic("Out of memory");
+	bc->insns = NULL;
+	bc->insnCount = 0;
+	bc->consts = NULL;
+	bc->constCount = 0;
+	bc->symbols = NULL;
+	bc->symbolCount = 0;
+	bc->regCount = (uint16_t)func->localCount;
+	bc->isMapped = 0;
+
+	SlakeCompiler c = { bc, 0, 0, 0, (uint16_t)func->localCount, NULL };
+	_slakeCompileBody(&c, func->exprs);
+	_slakeEmit(&c, OP_RET, SLAKE_NO_OPERAND, 0, 0);
+
+	return bc;
+}
+
+/**
+ * @brief Destroy compiled bytecode.
+ *
+ * @param bc Bytecode to destroy.
+ */
+void slakeDestroyBytecode(SlakeBytecode *bc)
+{
+	if (!bc)
+		return;
+
+	for (uint16_t i = 0; i < bc->constCount; i++)
+		slakeClearValue(&bc->consts[i]);
+	free(bc->consts);
+	free(bc->symbols);
+	if (!bc->isMapped)
+		free(bc->insns);
+	free(bc);
+}
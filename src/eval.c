@@ -0,0 +1,862 @@
+#include <slakedef.h>
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eval.h"
+#include "future.h"
+#include "module.h"
+#include "superfn.h"
+#include "vm.h"
+
+typedef enum _SlakeExecFlow
+{
+	FLOW_NORMAL = 0, // Execute the next expression
+	FLOW_BREAK,		 // Leave the innermost loop
+	FLOW_CONTINUE,	 // Start the next cycle of the innermost loop
+	FLOW_RETURN		 // Leave the function
+} SlakeExecFlow;
+
+typedef struct _SlakeExecContext
+{
+	SlakeScope *scope;
+	SlakeExecFlow flow;
+	SlakeValue returnValue;
+} SlakeExecContext;
+
+//
+// Expression handler. The result will be stored into out, which is null on
+// entry, or discarded if out is NULL.
+//
+typedef void (*SlakeExprHandler)(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out);
+
+#define SLAKE_MAX_STACK_ARGS 8
+
+static void _slakeEval(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out);
+
+//
+// Output a formatted panic message and abort.
+//
+static SLAKE_NORETURN void _slakePanicf(const char *fmt, const char *s)
+{
+	char msg[256];
+	snprintf(msg, sizeof(msg), fmt, s);
+	slakePanic(msg);
+}
+
+//
+// Move a value into the result slot, or release it if the result is not
+// needed.
+//
+static void _slakeSetResult(SlakeValue *out, SlakeValue *value)
+{
+	if (out)
+		*out = *value;
+	else
+		slakeClearValue(value);
+	value->type = VALUE_TYPE_NULL;
+}
+
+//
+// Find the variable referred by a variable reference. Resolved references
+// are bound to slots directly.
+//
+static SlakeVariable *_slakeFindVariable(SlakeExecContext *ctx, SlakeExpr *varRef)
+{
+	SlakeVariable *var = NULL;
+
+	if (varRef->attribs.varRef.slot != SLAKE_SLOT_UNRESOLVED)
+	{
+		SlakeScope *scope = ctx->scope;
+		for (unsigned int i = 0; i < varRef->attribs.varRef.depth && scope; i++)
+			scope = scope->parent;
+
+		if (scope && varRef->attribs.varRef.slot < scope->slots.size)
+			var = utilVectorAt(&scope->slots, SlakeVariable *, varRef->attribs.varRef.slot);
+	}
+	else
+		var = slakeLookupVariable(ctx->scope, varRef->attribs.varRef.symbol);
+
+	if (!var)
+		_slakePanicf("Undefined variable: %s", slakeGetSymbolName(varRef->attribs.varRef.symbol));
+	return var;
+}
+
+//
+// Evaluate an operand. Immediate values and variables are borrowed without
+// copying, other expressions are evaluated into tmp, which must be cleared by
+// the caller afterwards.
+//
+static const SlakeValue *_slakeEvalOperand(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *tmp)
+{
+	switch (expr->type)
+	{
+	case EXPR_VALUE:
+		return expr->attribs.value;
+	case EXPR_VARREF:
+		return &_slakeFindVariable(ctx, expr)->value;
+	default:
+		_slakeEval(ctx, expr, tmp);
+		return tmp;
+	}
+}
+
+//
+// Execute expressions in an execution body until the control flow changes.
+//
+static void _slakeExecBody(SlakeExecContext *ctx, SlakeExecBody body)
+{
+	if (!body)
+		return;
+
+	for (size_t i = 0; i < body->size && ctx->flow == FLOW_NORMAL; i++)
+		_slakeEval(ctx, utilVectorAt(body, SlakeExpr *, i), NULL);
+}
+
+//
+// Check the control flow after a loop cycle, returns non-zero if the loop
+// should be left.
+//
+static int _slakeLeaveLoop(SlakeExecContext *ctx)
+{
+	switch (ctx->flow)
+	{
+	case FLOW_BREAK:
+		ctx->flow = FLOW_NORMAL;
+		return 1;
+	case FLOW_CONTINUE:
+		ctx->flow = FLOW_NORMAL;
+		return 0;
+	case FLOW_RETURN:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+//
+// Evaluate a condition expression.
+//
+static int _slakeEvalCondition(SlakeExecContext *ctx, SlakeExpr *expr)
+{
+	SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+	int result = slakeIsValueTrue(_slakeEvalOperand(ctx, expr, &tmp));
+	slakeClearValue(&tmp);
+	return result;
+}
+
+//
+// Evaluate parameters of a call expression and invoke the callback with
+// them. Parameters are stored on the stack if there are not too many.
+//
+static void _slakeEvalParams(
+	SlakeExecContext *ctx,
+	SlakeExpr **params,
+	unsigned short paramCount,
+	void (*callback)(void *data, SlakeValue *args, unsigned short argCount, SlakeValue *out),
+	void *data,
+	SlakeValue *out)
+{
+	SlakeValue stackArgs[SLAKE_MAX_STACK_ARGS];
+	SlakeValue *args = stackArgs;
+
+	if (paramCount > SLAKE_MAX_STACK_ARGS)
+	{
+		args = malloc(paramCount * sizeof(SlakeValue));
+		if (!args)
+			slakePanic("Out of memory");
+	}
+
+	for (unsigned short i = 0; i < paramCount; i++)
+	{
+		args[i].type = VALUE_TYPE_NULL;
+		_slakeEval(ctx, params[i], &args[i]);
+	}
+
+	callback(data, args, paramCount, out);
+
+	for (unsigned short i = 0; i < paramCount; i++)
+		slakeClearValue(&args[i]);
+	if (args != stackArgs)
+		free(args);
+}
+
+static void _slakeInvokeFunction(void *data, SlakeValue *args, unsigned short argCount, SlakeValue *out)
+{
+	slakeVMCall(data, args, argCount, out);
+}
+
+static void _slakeInvokeFunctionAsync(void *data, SlakeValue *args, unsigned short argCount, SlakeValue *out)
+{
+	SlakeFuture *future = slakeCreateFuture(data, args, argCount);
+	if (out)
+	{
+		out->type = VALUE_TYPE_FUTURE;
+		out->data.future = future;
+	}
+	else
+		slakeReleaseFuture(future);
+}
+
+static void _slakeInvokeSuperFunction(void *data, SlakeValue *args, unsigned short argCount, SlakeValue *out)
+{
+	SlakeValue ret = { .type = VALUE_TYPE_NULL };
+	((SlakeSuperFunctionProc)data)(args, argCount, &ret);
+	_slakeSetResult(out, &ret);
+}
+
+static void _slakeEvalCall(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeFunction *func = slakeLookupFunction(ctx->scope, expr->attribs.call.symbol);
+	if (!func)
+		_slakePanicf("Undefined function: %s", slakeGetSymbolName(expr->attribs.call.symbol));
+
+	_slakeEvalParams(
+		ctx,
+		expr->attribs.call.params,
+		expr->attribs.call.paramCount,
+		expr->type == EXPR_CALL_ASYNC ? _slakeInvokeFunctionAsync : _slakeInvokeFunction,
+		func,
+		out);
+}
+
+static void _slakeEvalAwait(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+	slakeAwaitValue(_slakeEvalOperand(ctx, expr->attribs.await, &tmp), out);
+	slakeClearValue(&tmp);
+}
+
+static void _slakeEvalSuperCall(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeSuperFunctionProc proc = slakeGetSuperFunction(slakeGetSymbolName(expr->attribs.call.symbol));
+	if (!proc)
+		_slakePanicf("Undefined super function: @%s", slakeGetSymbolName(expr->attribs.call.symbol));
+
+	_slakeEvalParams(
+		ctx,
+		expr->attribs.call.params,
+		expr->attribs.call.paramCount,
+		_slakeInvokeSuperFunction,
+		(void *)proc,
+		out);
+}
+
+static void _slakeEvalExternalCall(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeFunction *func = slakeGetExternalFunction(ctx->scope, expr->attribs.externalCall.moduleName, expr->attribs.externalCall.funcName);
+
+	_slakeEvalParams(
+		ctx,
+		expr->attribs.externalCall.params,
+		expr->attribs.externalCall.paramCount,
+		expr->attribs.externalCall.async ? _slakeInvokeFunctionAsync : _slakeInvokeFunction,
+		func,
+		out);
+}
+
+static void _slakeEvalReturn(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	slakeClearValue(&ctx->returnValue);
+	if (expr->attribs.returnValue)
+		_slakeEval(ctx, expr->attribs.returnValue, &ctx->returnValue);
+	ctx->flow = FLOW_RETURN;
+}
+
+static void _slakeEvalIf(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	if (_slakeEvalCondition(ctx, expr->attribs.ifBlock.condition))
+		_slakeExecBody(ctx, expr->attribs.ifBlock.trueBlock);
+	else
+		_slakeExecBody(ctx, expr->attribs.ifBlock.falseBlock);
+}
+
+static int _slakeValueEquals(const SlakeValue *x, const SlakeValue *y);
+
+static void _slakeEvalSwitch(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeValue condTmp = { .type = VALUE_TYPE_NULL };
+	const SlakeValue *cond = _slakeEvalOperand(ctx, expr->attribs.switchBlock.condition, &condTmp);
+
+	SlakeExecBody body = expr->attribs.switchBlock.defaultBody;
+	for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+	{
+		SlakeSwitchCase *swCase = expr->attribs.switchBlock.cases[i];
+
+		SlakeValue caseTmp = { .type = VALUE_TYPE_NULL };
+		int matched = _slakeValueEquals(cond, _slakeEvalOperand(ctx, swCase->condition, &caseTmp));
+		slakeClearValue(&caseTmp);
+
+		if (matched)
+		{
+			body = swCase->body;
+			break;
+		}
+	}
+	slakeClearValue(&condTmp);
+
+	_slakeExecBody(ctx, body);
+}
+
+static void _slakeEvalBreak(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	ctx->flow = FLOW_BREAK;
+}
+
+static void _slakeEvalContinue(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	ctx->flow = FLOW_CONTINUE;
+}
+
+static void _slakeEvalLoop(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	int times = expr->attribs.loopBlock.times;
+	for (int i = 0; times < 0 || i < times; i++)
+	{
+		_slakeExecBody(ctx, expr->attribs.loopBlock.body);
+		if (_slakeLeaveLoop(ctx))
+			break;
+	}
+}
+
+static void _slakeEvalFor(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	while (_slakeEvalCondition(ctx, expr->attribs.forBlock.condition))
+	{
+		_slakeExecBody(ctx, expr->attribs.forBlock.body);
+		if (_slakeLeaveLoop(ctx))
+			break;
+		_slakeEval(ctx, expr->attribs.forBlock.loopEnd, NULL);
+	}
+}
+
+static void _slakeEvalWhile(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	while (_slakeEvalCondition(ctx, expr->attribs.whileBlock.condition))
+	{
+		_slakeExecBody(ctx, expr->attribs.whileBlock.body);
+		if (_slakeLeaveLoop(ctx))
+			break;
+	}
+}
+
+/**
+ * @brief Perform an unary operation on a value.
+ *
+ * @param op Operation type.
+ * @param x Operand.
+ * @param result Value to store the result, must be null.
+ */
+void slakeEvalUnaryOp(SlakeUnaryExprType op, const SlakeValue *x, SlakeValue *result)
+{
+	switch (op)
+	{
+	case UNARY_EXPR_NOT:
+		slakeSetInt(result, !slakeIsValueTrue(x));
+		break;
+	case UNARY_EXPR_NEG:
+		switch (x->type)
+		{
+		// Negation wraps around like other arithmetic.
+		case VALUE_TYPE_INT:
+			slakeSetInt(result, (int)(0u - (unsigned int)x->data.i32));
+			break;
+		case VALUE_TYPE_LONG:
+			slakeSetLong(result, (long long)(0ull - (unsigned long long)x->data.i64));
+			break;
+		case VALUE_TYPE_UINT:
+			slakeSetUInt(result, -x->data.u32);
+			break;
+		case VALUE_TYPE_ULONG:
+			slakeSetULong(result, -x->data.u64);
+			break;
+		default:
+			slakePanic("Invalid operand type");
+		}
+		break;
+	default:
+		slakePanic("Invalid unary operation");
+	}
+}
+
+static void _slakeEvalUnary(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+	const SlakeValue *x = _slakeEvalOperand(ctx, expr->attribs.unaryOp.r, &tmp);
+	SlakeValue result = { .type = VALUE_TYPE_NULL };
+
+	slakeEvalUnaryOp(expr->attribs.unaryOp.type, x, &result);
+
+	slakeClearValue(&tmp);
+	_slakeSetResult(out, &result);
+}
+
+//
+// Format a value as a string, buf is used to store numbers.
+//
+static const char *_slakeFormatValue(const SlakeValue *value, char buf[32])
+{
+	switch (value->type)
+	{
+	case VALUE_TYPE_STR:
+		return slakeGetString(value);
+	case VALUE_TYPE_INT:
+		sprintf(buf, "%d", value->data.i32);
+		break;
+	case VALUE_TYPE_LONG:
+		sprintf(buf, "%lld", value->data.i64);
+		break;
+	case VALUE_TYPE_UINT:
+		sprintf(buf, "%u", value->data.u32);
+		break;
+	case VALUE_TYPE_ULONG:
+		sprintf(buf, "%llu", value->data.u64);
+		break;
+	default:
+		slakePanic("Invalid operand type");
+	}
+	return buf;
+}
+
+//
+// Get rank of a numeric type for promotion. Returns -1 for non-numeric types.
+//
+static int _slakeNumericRank(SlakeValueType type)
+{
+	switch (type)
+	{
+	case VALUE_TYPE_INT:
+		return 0;
+	case VALUE_TYPE_UINT:
+		return 1;
+	case VALUE_TYPE_LONG:
+		return 2;
+	case VALUE_TYPE_ULONG:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+//
+// Arithmetic wraps around like two's complement, computed in the unsigned
+// type to avoid overflows, and the minimum divided by -1 gives the minimum,
+// which would trap otherwise. min is 0 for unsigned types.
+//
+#define SLAKE_NUMERIC_OP(field, type, utype, min, setter)                            \
+	switch (op)                                                                      \
+	{                                                                                \
+	case BINARY_EXPR_ADD:                                                            \
+		setter(result, (type)((utype)x.data.field + (utype)y.data.field));           \
+		break;                                                                       \
+	case BINARY_EXPR_SUB:                                                            \
+		setter(result, (type)((utype)x.data.field - (utype)y.data.field));           \
+		break;                                                                       \
+	case BINARY_EXPR_MUL:                                                            \
+		setter(result, (type)((utype)x.data.field * (utype)y.data.field));           \
+		break;                                                                       \
+	case BINARY_EXPR_DIV:                                                            \
+		if (!y.data.field)                                                           \
+			slakePanic("Division by zero");                                          \
+		if (x.data.field == (min) && y.data.field == (type)-1)                       \
+			setter(result, (min));                                                   \
+		else                                                                         \
+			setter(result, x.data.field / y.data.field);                             \
+		break;                                                                       \
+	case BINARY_EXPR_MOD:                                                            \
+		if (!y.data.field)                                                           \
+			slakePanic("Division by zero");                                          \
+		if (x.data.field == (min) && y.data.field == (type)-1)                       \
+			setter(result, 0);                                                       \
+		else                                                                         \
+			setter(result, x.data.field % y.data.field);                             \
+		break;                                                                       \
+	case BINARY_EXPR_AND:                                                            \
+		setter(result, x.data.field & y.data.field);                                 \
+		break;                                                                       \
+	case BINARY_EXPR_OR:                                                             \
+		setter(result, x.data.field | y.data.field);                                 \
+		break;                                                                       \
+	case BINARY_EXPR_XOR:                                                            \
+		setter(result, x.data.field ^ y.data.field);                                 \
+		break;                                                                       \
+	case BINARY_EXPR_EQ:                                                             \
+		slakeSetInt(result, x.data.field == y.data.field);                           \
+		break;                                                                       \
+	case BINARY_EXPR_NEQ:                                                            \
+		slakeSetInt(result, x.data.field != y.data.field);                           \
+		break;                                                                       \
+	case BINARY_EXPR_LT:                                                             \
+		slakeSetInt(result, x.data.field < y.data.field);                            \
+		break;                                                                       \
+	case BINARY_EXPR_GT:                                                             \
+		slakeSetInt(result, x.data.field > y.data.field);                            \
+		break;                                                                       \
+	case BINARY_EXPR_LTEQ:                                                           \
+		slakeSetInt(result, x.data.field <= y.data.field);                           \
+		break;                                                                       \
+	case BINARY_EXPR_GTEQ:                                                           \
+		slakeSetInt(result, x.data.field >= y.data.field);                           \
+		break;                                                                       \
+	default:                                                                         \
+		slakePanic("Invalid binary operation");                                      \
+	}
+
+/**
+ * @brief Perform a binary operation on two values, except assignments and
+ * logical operations.
+ *
+ * @param op Operation type.
+ * @param l The left operand.
+ * @param r The right operand.
+ * @param result Value to store the result, must be null.
+ */
+void slakeEvalBinaryOp(SlakeBinaryExprType op, const SlakeValue *l, const SlakeValue *r, SlakeValue *result)
+{
+	if (l->type == VALUE_TYPE_FUTURE || r->type == VALUE_TYPE_FUTURE)
+		slakePanic("Future must be awaited before use");
+
+	if (l->type == VALUE_TYPE_STR || r->type == VALUE_TYPE_STR)
+	{
+		if (op == BINARY_EXPR_ADD)
+		{
+			char lBuf[32], rBuf[32];
+			const char *ls = _slakeFormatValue(l, lBuf), *rs = _slakeFormatValue(r, rBuf);
+			size_t lLen = l->type == VALUE_TYPE_STR ? slakeGetStringLength(l) : strlen(ls);
+			size_t rLen = r->type == VALUE_TYPE_STR ? slakeGetStringLength(r) : strlen(rs);
+
+			// Short results are stored in the value without allocating.
+			char *str = slakeAllocString(result, lLen + rLen);
+			memcpy(str, ls, lLen);
+			memcpy(str + lLen, rs, rLen);
+			return;
+		}
+
+		if (l->type != r->type)
+		{
+			if (op == BINARY_EXPR_EQ || op == BINARY_EXPR_NEQ)
+			{
+				slakeSetInt(result, op == BINARY_EXPR_NEQ);
+				return;
+			}
+			slakePanic("Invalid operand type");
+		}
+
+		int cmp = strcmp(slakeGetString(l), slakeGetString(r));
+		switch (op)
+		{
+		case BINARY_EXPR_EQ:
+			slakeSetInt(result, cmp == 0);
+			break;
+		case BINARY_EXPR_NEQ:
+			slakeSetInt(result, cmp != 0);
+			break;
+		case BINARY_EXPR_LT:
+			slakeSetInt(result, cmp < 0);
+			break;
+		case BINARY_EXPR_GT:
+			slakeSetInt(result, cmp > 0);
+			break;
+		case BINARY_EXPR_LTEQ:
+			slakeSetInt(result, cmp <= 0);
+			break;
+		case BINARY_EXPR_GTEQ:
+			slakeSetInt(result, cmp >= 0);
+			break;
+		default:
+			slakePanic("Invalid operand type");
+		}
+		return;
+	}
+
+	if (l->type == VALUE_TYPE_NULL || r->type == VALUE_TYPE_NULL)
+	{
+		if (op != BINARY_EXPR_EQ && op != BINARY_EXPR_NEQ)
+			slakePanic("Invalid operand type");
+		slakeSetInt(result, (l->type == r->type) == (op == BINARY_EXPR_EQ));
+		return;
+	}
+
+	// Promote both operands to the larger type.
+	SlakeValue x = *l, y = *r;
+	SlakeValueType type = _slakeNumericRank(l->type) > _slakeNumericRank(r->type) ? l->type : r->type;
+	slakeConvertValue(&x, type);
+	slakeConvertValue(&y, type);
+
+	switch (type)
+	{
+	case VALUE_TYPE_INT:
+		SLAKE_NUMERIC_OP(i32, int, unsigned int, INT_MIN, slakeSetInt);
+		break;
+	case VALUE_TYPE_LONG:
+		SLAKE_NUMERIC_OP(i64, long long, unsigned long long, LLONG_MIN, slakeSetLong);
+		break;
+	case VALUE_TYPE_UINT:
+		SLAKE_NUMERIC_OP(u32, unsigned int, unsigned int, 0, slakeSetUInt);
+		break;
+	case VALUE_TYPE_ULONG:
+		SLAKE_NUMERIC_OP(u64, unsigned long long, unsigned long long, 0, slakeSetULong);
+		break;
+	default:
+		slakePanic("Invalid operand type");
+	}
+}
+
+/**
+ * @brief Add operands to a value from left to right, as a chain of '+'
+ * operations. Once the sum becomes a string, the rest of the operands are
+ * appended at once, into the string itself if nothing else refers to it.
+ *
+ * @param sum Value holding the first operand, receives the sum.
+ * @param operands The rest of the operands.
+ * @param count Count of the rest of the operands.
+ */
+void slakeEvalConcat(SlakeValue *sum, const SlakeValue *operands, size_t count)
+{
+	size_t i = 0;
+
+	// Numbers are added as usual until a string appears.
+	for (; i < count && sum->type != VALUE_TYPE_STR && operands[i].type != VALUE_TYPE_STR; i++)
+	{
+		SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+		slakeEvalBinaryOp(BINARY_EXPR_ADD, sum, &operands[i], &tmp);
+		slakeClearValue(sum);
+		*sum = tmp;
+	}
+	if (i == count)
+		return;
+
+	char buf[32];
+	if (sum->type == VALUE_TYPE_FUTURE)
+		slakePanic("Future must be awaited before use");
+	if (sum->type != VALUE_TYPE_STR)
+		slakeSetString(sum, _slakeFormatValue(sum, buf));
+
+	size_t length = slakeGetStringLength(sum), total = length;
+	for (size_t j = i; j < count; j++)
+	{
+		if (operands[j].type == VALUE_TYPE_FUTURE)
+			slakePanic("Future must be awaited before use");
+		total += operands[j].type == VALUE_TYPE_STR ? slakeGetStringLength(&operands[j]) : strlen(_slakeFormatValue(&operands[j], buf));
+	}
+
+	char *str = slakeExtendString(sum, total);
+	for (; i < count; i++)
+	{
+		const char *s = _slakeFormatValue(&operands[i], buf);
+		size_t n = operands[i].type == VALUE_TYPE_STR ? slakeGetStringLength(&operands[i]) : strlen(s);
+		memcpy(str + length, s, n);
+		length += n;
+	}
+}
+
+static int _slakeValueEquals(const SlakeValue *x, const SlakeValue *y)
+{
+	SlakeValue result = { .type = VALUE_TYPE_NULL };
+	slakeEvalBinaryOp(BINARY_EXPR_EQ, x, y, &result);
+	return result.data.i32;
+}
+
+/**
+ * @brief Store a value into a variable. Variables keep their types once they
+ * have been defined, so the value will be converted. Variables holding
+ * futures take the types of new values.
+ *
+ * @param dest Value of the target variable.
+ * @param value Value to store.
+ * @param move Non-zero to move the value into the variable instead of
+ * copying, the value will be null afterwards.
+ */
+void slakeEvalStore(SlakeValue *dest, SlakeValue *value, int move)
+{
+	SlakeValueType type = dest->type;
+
+	if (move)
+	{
+		slakeClearValue(dest);
+		*dest = *value;
+		value->type = VALUE_TYPE_NULL;
+	}
+	else
+		slakeAssignValue(dest, value);
+
+	if (type != VALUE_TYPE_NULL && type != VALUE_TYPE_FUTURE)
+		slakeConvertValue(dest, type);
+}
+
+static void _slakeEvalAssign(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeExpr *l = expr->attribs.binaryOp.l;
+	if (l->type != EXPR_VARREF)
+		slakePanic("Invalid assignment target");
+
+	SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+	const SlakeValue *value = _slakeEvalOperand(ctx, expr->attribs.binaryOp.r, &tmp);
+
+	SlakeVariable *var = _slakeFindVariable(ctx, l);
+	slakeEvalStore(&var->value, (SlakeValue *)value, value == &tmp);
+
+	if (out)
+		slakeAssignValue(out, &var->value);
+}
+
+//
+// Evaluate a chain of additions into sum, so strings are appended in place
+// instead of being copied at every step.
+//
+static void _slakeEvalSum(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *sum)
+{
+	if (expr->type != EXPR_BINARY || expr->attribs.binaryOp.type != BINARY_EXPR_ADD)
+	{
+		_slakeEval(ctx, expr, sum);
+		return;
+	}
+
+	_slakeEvalSum(ctx, expr->attribs.binaryOp.l, sum);
+
+	SlakeValue tmp = { .type = VALUE_TYPE_NULL };
+	slakeEvalConcat(sum, _slakeEvalOperand(ctx, expr->attribs.binaryOp.r, &tmp), 1);
+	slakeClearValue(&tmp);
+}
+
+static void _slakeEvalBinary(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeBinaryExprType op = expr->attribs.binaryOp.type;
+	SlakeValue result = { .type = VALUE_TYPE_NULL };
+
+	switch (op)
+	{
+	case BINARY_EXPR_MOV:
+		_slakeEvalAssign(ctx, expr, out);
+		return;
+	case BINARY_EXPR_ADD:
+		_slakeEvalSum(ctx, expr, &result);
+		break;
+	case BINARY_EXPR_LAND:
+		slakeSetInt(&result,
+			_slakeEvalCondition(ctx, expr->attribs.binaryOp.l) &&
+				_slakeEvalCondition(ctx, expr->attribs.binaryOp.r));
+		break;
+	case BINARY_EXPR_LOR:
+		slakeSetInt(&result,
+			_slakeEvalCondition(ctx, expr->attribs.binaryOp.l) ||
+				_slakeEvalCondition(ctx, expr->attribs.binaryOp.r));
+		break;
+	default:
+	{
+		SlakeValue lTmp = { .type = VALUE_TYPE_NULL }, rTmp = { .type = VALUE_TYPE_NULL };
+		const SlakeValue *l = _slakeEvalOperand(ctx, expr->attribs.binaryOp.l, &lTmp);
+		const SlakeValue *r = _slakeEvalOperand(ctx, expr->attribs.binaryOp.r, &rTmp);
+
+		slakeEvalBinaryOp(op, l, r, &result);
+
+		slakeClearValue(&lTmp);
+		slakeClearValue(&rTmp);
+	}
+	}
+
+	_slakeSetResult(out, &result);
+}
+
+static void _slakeEvalValue(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	if (out)
+		slakeAssignValue(out, expr->attribs.value);
+}
+
+static void _slakeEvalVarRef(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeVariable *var = _slakeFindVariable(ctx, expr);
+	if (out)
+		slakeAssignValue(out, &var->value);
+}
+
+static void _slakeEvalVarDef(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	SlakeValue value = { .type = VALUE_TYPE_NULL };
+	if (expr->attribs.varDef.initValue)
+		_slakeEval(ctx, expr->attribs.varDef.initValue, &value);
+	slakeConvertValue(&value, expr->attribs.varDef.type);
+
+	slakeSetVariable(ctx->scope, expr->attribs.varDef.symbol, &value);
+	slakeClearValue(&value);
+}
+
+static const SlakeExprHandler exprHandlers[] = {
+	[EXPR_CALL] = _slakeEvalCall,
+	[EXPR_CALL_ASYNC] = _slakeEvalCall,
+	[EXPR_AWAIT] = _slakeEvalAwait,
+	[EXPR_SUPER_CALL] = _slakeEvalSuperCall,
+	[EXPR_EXTERNAL_CALL] = _slakeEvalExternalCall,
+	[EXPR_RETURN] = _slakeEvalReturn,
+
+	[EXPR_IF] = _slakeEvalIf,
+	[EXPR_SWITCH] = _slakeEvalSwitch,
+	[EXPR_BREAK] = _slakeEvalBreak,
+	[EXPR_CONTINUE] = _slakeEvalContinue,
+	[EXPR_LOOP] = _slakeEvalLoop,
+	[EXPR_FOR] = _slakeEvalFor,
+	[EXPR_WHILE] = _slakeEvalWhile,
+
+	[EXPR_UNARY] = _slakeEvalUnary,
+	[EXPR_BINARY] = _slakeEvalBinary,
+
+	[EXPR_VALUE] = _slakeEvalValue,
+	[EXPR_VARREF] = _slakeEvalVarRef,
+	[EXPR_VARDEF] = _slakeEvalVarDef
+};
+
+static void _slakeEval(SlakeExecContext *ctx, SlakeExpr *expr, SlakeValue *out)
+{
+	assert(expr != NULL);
+
+	if ((size_t)expr->type >= sizeof(exprHandlers) / sizeof(exprHandlers[0]) || !exprHandlers[expr->type])
+		slakePanic("Invalid expression type");
+
+	exprHandlers[expr->type](ctx, expr, out);
+}
+
+/**
+ * @brief Execute an expression in a scope.
+ *
+ * @param scope Scope to execute in.
+ * @param expr Expression to execute.
+ * @return Return value of the expression.
+ */
+SlakeValue slakeExprExec(SlakeScope *scope, SlakeExpr *expr)
+{
+	assert(scope != NULL);
+	assert(expr != NULL);
+
+	SlakeExecContext ctx;
+	ctx.scope = scope;
+	ctx.flow = FLOW_NORMAL;
+	ctx.returnValue.type = VALUE_TYPE_NULL;
+
+	SlakeValue value;
+	value.type = VALUE_TYPE_NULL;
+	_slakeEval(&ctx, expr, &value);
+	slakeClearValue(&ctx.returnValue);
+
+	return value;
+}
+
+/**
+ * @brief Call a function.
+ *
+ * @param func Function to call.
+ * @param args Arguments, will be converted to types of the parameters.
+ * @param argCount Count of arguments.
+ * @return Return value of the function, must be cleared by slakeClearValue.
+ */
+SlakeValue slakeCallFunction(SlakeFunction *func, SlakeValue *args, unsigned short argCount)
+{
+	assert(func != NULL);
+
+	SlakeValue value;
+	value.type = VALUE_TYPE_NULL;
+	slakeVMCall(func, args, argCount, &value);
+
+	return value;
+}
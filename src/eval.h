@@ -0,0 +1,11 @@
+#ifndef __EVAL_H__
+#define __EVAL_H__
+
+#include <slakedef.h>
+
+void slakeEvalUnaryOp(SlakeUnaryExprType op, const SlakeValue *x, SlakeValue *result);
+void slakeEvalBinaryOp(SlakeBinaryExprType op, const SlakeValue *l, const SlakeValue *r, SlakeValue *result);
+void slakeEvalConcat(SlakeValue *sum, const SlakeValue *operands, size_t count);
+void slakeEvalStore(SlakeValue *dest, SlakeValue *value, int move);
+
+#endif
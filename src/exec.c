@@ -1,34 +1,941 @@
+#ifdef __linux__
+#define _GNU_SOURCE // For pipe2.
+#endif
+
 #include "exec.h"
+#include "task.h"
+#include <slakedef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <Windows.h>
+#else
+#include <errno.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #endif
 
-int slakeExec(const char *cmdline)
+// On Linux, running jobs are supervised by one event loop, which watches
+// process descriptors and output pipes of all children.
+#ifdef __linux__
+#define SLAKE_EXEC_EVENT_LOOP 1
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef _WIN32
+typedef HANDLE SlakeProcess;
+#else
+typedef pid_t SlakeProcess;
+#endif
+
+#ifdef SLAKE_EXEC_EVENT_LOOP
+typedef struct _SlakeOutput
+{
+	int fd;		// Read end of the pipe, -1 if closed or not captured.
+	char *data; // Captured output, written out at once when the job finishes.
+	size_t length, capacity;
+} SlakeOutput;
+#endif
+
+typedef struct _SlakeJob
+{
+	SlakeProcess process;
+#ifdef SLAKE_EXEC_EVENT_LOOP
+	int pidFd;			   // Readable when the process exits, -1 if process descriptors are not supported.
+	SlakeOutput outputs[2]; // Captured stdout and stderr.
+#endif
+	int exitCode;
+	int done;
+	SlakeJobCallback onDone; // Called when the job finishes, NULL if the job is waited for.
+	void *arg;
+	char *cmdline;			 // Copy of the command line while queued.
+	struct _SlakeJob *next;	 // Next queued job.
+} SlakeJob;
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+static size_t maxJobs = 0;
+static SlakeJob **runningJobs = NULL;
+static size_t runningJobCount = 0, runningJobCapacity = 0;
+
+// Jobs can be submitted and waited on multiple threads. Only one thread
+// blocks collecting exit codes at a time, the others wait for it.
+static SlakeMutex jobMutex = SLAKE_MUTEX_INIT; // Protects the job list and the jobs.
+static SlakeCond jobCond = SLAKE_COND_INIT;	   // Signaled when the reaping thread wakes up.
+static int isReaping = 0;
+static size_t finishedJobCount = 0;
+
+// Jobs with callbacks are started from a queue once others finish, and a
+// watching thread collects their exit codes since nobody waits for them.
+static SlakeJob *queuedJobs = NULL, *lastQueuedJob = NULL;
+static size_t callbackJobCount = 0;			  // Count of unfinished jobs with callbacks.
+static SlakeCond watchCond = SLAKE_COND_INIT; // Signaled when a job with a callback is queued.
+static int isWatcherStarted = 0;
+
+#ifdef SLAKE_EXEC_EVENT_LOOP
+static int epollFd = -1;
+static int childSignalPipe[2] = { -1, -1 }; // Written on SIGCHLD if process descriptors are not supported.
+#endif
+
+/**
+ * @brief Get count of available processors.
+ *
+ * @return Count of processors, at least 1.
+ */
+size_t slakeGetCpuCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+/**
+ * @brief Set maximum count of jobs running at the same time.
+ *
+ * @param n Maximum job count. 0 for the count of processors.
+ */
+void slakeSetMaxJobs(size_t n)
+{
+	maxJobs = n ? n : slakeGetCpuCount();
+}
+
+/**
+ * @brief Get maximum count of jobs running at the same time.
+ *
+ * @return Maximum job count.
+ */
+size_t slakeGetMaxJobs()
+{
+	if (!maxJobs)
+		maxJobs = slakeGetCpuCount();
+	return maxJobs;
+}
+
+#ifndef _WIN32
+//
+// Check if a command line has to be interpreted by the shell.
+//
+static int _slakeNeedsShell(const char *cmdline)
+{
+	if (strpbrk(cmdline, "|&;<>()$`\\\"'*?[]{}!\n"))
+		return 1;
+
+	// Assignments in the first word, and tilde expansions or comments at the
+	// beginning of a word are also handled by the shell.
+	int firstWord = 1;
+	for (const char *i = cmdline; *i; i++)
+	{
+		if (*i == ' ' || *i == '\t')
+		{
+			if (i > cmdline && i[-1] != ' ' && i[-1] != '\t')
+				firstWord = 0;
+			continue;
+		}
+		if (firstWord && *i == '=')
+			return 1;
+		if ((*i == '~' || *i == '#') && (i == cmdline || i[-1] == ' ' || i[-1] == '\t'))
+			return 1;
+	}
+
+	return 0;
+}
+
+//
+// Split a command line into arguments in place. The returned array must be
+// released with free().
+//
+static char **_slakeSplitCmdline(char *buf)
+{
+	size_t argc = 0;
+	for (char *i = buf; *i; i++)
+		if ((*i != ' ' && *i != '\t') && (i == buf || i[-1] == ' ' || i[-1] == '\t'))
+			argc++;
+
+	char **argv = malloc((argc + 1) * sizeof(char *));
+	if (!argv)
+		slakePanic("Out of memory");
+
+	argc = 0;
+	for (char *i = buf; *i;)
+	{
+		while (*i == ' ' || *i == '\t')
+			*(i++) = '\0';
+		if (!*i)
+			break;
+
+		argv[argc++] = i;
+		while (*i && *i != ' ' && *i != '\t')
+			i++;
+	}
+	argv[argc] = NULL;
+
+	return argv;
+}
+#endif
+
+//
+// Start a process which executes the command line. On POSIX systems, simple
+// command lines are started directly without going through the shell. If
+// outFd and errFd are not -1, stdout and stderr of the process are
+// redirected to them.
+//
+static int _slakeSpawn(const char *cmdline, int outFd, int errFd, SlakeProcess *process)
 {
 #ifdef _WIN32
 	STARTUPINFOA si;
 	PROCESS_INFORMATION pi;
-	if (!CreateProcessA(
-			NULL,
-			(char *)cmdline,
-			NULL,
-			NULL,
-			TRUE,
-			NULL,
-			NULL,
-			NULL,
-			&si,
-			&pi))
+
+	memset(&si, 0, sizeof(si));
+	si.cb = sizeof(si);
+
+	// CreateProcessA may modify the command line buffer.
+	char *buf = strdup(cmdline);
+	if (!buf)
+		slakePanic("Out of memory");
+
+	(void)outFd;
+	(void)errFd;
+
+	BOOL succeeded = CreateProcessA(NULL, buf, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+	free(buf);
+	if (!succeeded)
 		return -1;
-	WaitForSingleObject(pi.hThread, INFINITE);
-	WaitForSingleObject(pi.hProcess, INFINITE);
+
 	CloseHandle(pi.hThread);
-	CloseHandle(pi.hProcess);
+	*process = pi.hProcess;
+	return 0;
+#else
+	char *buf = NULL;
+	char **argv = NULL;
+	posix_spawn_file_actions_t actions, *pActions = NULL;
+	pid_t pid;
+	int err;
+
+	if (outFd != -1)
+	{
+		if (posix_spawn_file_actions_init(&actions))
+			slakePanic("Out of memory");
+		if (posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO) ||
+			posix_spawn_file_actions_adddup2(&actions, errFd, STDERR_FILENO))
+			slakePanic("Out of memory");
+		pActions = &actions;
+	}
+
+	if (!_slakeNeedsShell(cmdline))
+	{
+		if (!(buf = strdup(cmdline)))
+			slakePanic("Out of memory");
+		argv = _slakeSplitCmdline(buf);
+	}
+
+	// Retry with the shell if the command cannot be started directly. Shell
+	// builtins are not found in PATH, files without a known executable
+	// format are run as scripts, and other failures end with the exit
+	// codes 126 or 127 like system().
+	if (!argv || !argv[0] || (err = posix_spawnp(&pid, argv[0], pActions, NULL, argv, environ)))
+	{
+		char *shArgv[] = { "sh", "-c", (char *)cmdline, NULL };
+		err = posix_spawn(&pid, "/bin/sh", pActions, NULL, shArgv, environ);
+	}
+
+	if (pActions)
+		posix_spawn_file_actions_destroy(pActions);
+	free(argv);
+	free(buf);
+	if (err)
+		return -1;
+
+	*process = pid;
+	return 0;
+#endif
+}
+
+//
+// Call the callback of a job which has finished.
+//
+static void _slakeNotifyJob(SlakeJob *job)
+{
+	if (!job->onDone)
+		return;
 
-	DWORD exitcode;
-	GetExitCodeProcess(pi.hProcess, &exitcode);
+	callbackJobCount--;
+	job->onDone(job, job->arg);
+}
+
+//
+// Mark a running job as done and remove it from the running job list.
+//
+static void _slakeFinishJob(size_t index, int exitCode)
+{
+	SlakeJob *job = runningJobs[index];
+	job->exitCode = exitCode;
+	job->done = 1;
+
+	runningJobs[index] = runningJobs[--runningJobCount];
+	finishedJobCount++;
+	_slakeNotifyJob(job);
+}
+
+#ifndef _WIN32
+//
+// Convert a wait status to an exit code. Processes killed by a signal get
+// 128 plus the signal number, as in the shell.
+//
+static int _slakeGetExitCode(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return -1;
+}
+
+//
+// Collect the exit code of a job if its process has exited. Returns non-zero
+// if it has.
+//
+static int _slakePollJob(SlakeJob *job)
+{
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(job->process, &status, WNOHANG)) < 0 && errno == EINTR)
+		;
+	if (!pid)
+		return 0;
 
-	return *((int *)&exitcode);
+	job->exitCode = pid < 0 ? -1 : _slakeGetExitCode(status);
+	return 1;
+}
 #endif
+
+#ifdef SLAKE_EXEC_EVENT_LOOP
+static void _slakeOnChildSignal(int sig)
+{
+	(void)sig;
+
+	int savedErrno = errno;
+	char c = 0;
+	ssize_t n = write(childSignalPipe[1], &c, 1);
+	(void)n;
+	errno = savedErrno;
+}
+
+static void _slakeWatchFd(int fd)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event))
+		slakePanic("Error watching child processes");
+}
+
+static void _slakeUnwatchFd(int fd)
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+}
+
+//
+// Open a descriptor which becomes readable when the process exits.
+//
+static int _slakeOpenPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+//
+// Fall back to SIGCHLD on kernels without process descriptors. The handler
+// wakes the event loop through a pipe, and running jobs are polled then.
+//
+static void _slakeUseChildSignal()
+{
+	if (childSignalPipe[0] != -1)
+		return;
+
+	if (pipe2(childSignalPipe, O_CLOEXEC | O_NONBLOCK))
+		slakePanic("Error watching child processes");
+	_slakeWatchFd(childSignalPipe[0]);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _slakeOnChildSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	if (sigaction(SIGCHLD, &sa, NULL))
+		slakePanic("Error watching child processes");
+
+	// The process may have exited before the handler was installed.
+	_slakeOnChildSignal(SIGCHLD);
+}
+
+//
+// Read available output of a job without blocking. Returns zero at the end
+// of the output.
+//
+static int _slakeReadOutput(SlakeOutput *output)
+{
+	for (;;)
+	{
+		if (output->capacity - output->length < 4096)
+		{
+			size_t capacity = output->capacity ? output->capacity * 2 : 8192;
+			char *data = realloc(output->data, capacity);
+			if (!data)
+				slakePanic("Out of memory");
+			output->data = data;
+			output->capacity = capacity;
+		}
+
+		ssize_t n = read(output->fd, output->data + output->length, output->capacity - output->length);
+		if (n > 0)
+			output->length += (size_t)n;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+			return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+}
+
+//
+// Finish a job whose process has exited, and write out its output.
+//
+static void _slakeCompleteJob(size_t index)
+{
+	SlakeJob *job = runningJobs[index];
+
+	if (job->pidFd != -1)
+	{
+		_slakeUnwatchFd(job->pidFd);
+		job->pidFd = -1;
+	}
+
+	// Background processes started by the command may keep the pipes open,
+	// so only the output written so far is taken. Each stream is written out
+	// to the one it came from.
+	FILE *streams[2] = { stdout, stderr };
+	for (int i = 0; i < 2; i++)
+	{
+		SlakeOutput *output = &job->outputs[i];
+		if (output->fd != -1)
+		{
+			_slakeReadOutput(output);
+			_slakeUnwatchFd(output->fd);
+			output->fd = -1;
+		}
+
+		if (output->length)
+		{
+			fwrite(output->data, 1, output->length, streams[i]);
+			fflush(streams[i]);
+		}
+		free(output->data);
+		output->data = NULL;
+	}
+
+	_slakeFinishJob(index, job->exitCode);
+}
+
+//
+// Handle a readable descriptor reported by the event loop.
+//
+static void _slakeHandleEvent(int fd)
+{
+	if (fd == childSignalPipe[0])
+	{
+		char buf[64];
+		while (read(fd, buf, sizeof(buf)) > 0)
+			;
+
+		for (size_t i = runningJobCount; i > 0; i--)
+		{
+			if (runningJobs[i - 1]->pidFd == -1 && _slakePollJob(runningJobs[i - 1]))
+				_slakeCompleteJob(i - 1);
+		}
+		return;
+	}
+
+	// Descriptors closed by earlier events of the same batch match no job.
+	for (size_t i = 0; i < runningJobCount; i++)
+	{
+		SlakeJob *job = runningJobs[i];
+		for (int j = 0; j < 2; j++)
+		{
+			SlakeOutput *output = &job->outputs[j];
+			if (fd == output->fd)
+			{
+				if (!_slakeReadOutput(output))
+				{
+					_slakeUnwatchFd(fd);
+					output->fd = -1;
+				}
+				return;
+			}
+		}
+		if (fd == job->pidFd)
+		{
+			if (_slakePollJob(job))
+				_slakeCompleteJob(i);
+			return;
+		}
+	}
+}
+
+//
+// Start the process of a job and register it to the event loop. Output is
+// captured only if other jobs are running, so a command running alone keeps
+// the terminal. The job lock must be held.
+//
+static int _slakeStartJob(SlakeJob *job, const char *cmdline)
+{
+	int pipeFds[2][2] = { { -1, -1 }, { -1, -1 } };
+
+	if (epollFd == -1 && (epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		slakePanic("Error watching child processes");
+
+	job->pidFd = -1;
+	for (int i = 0; i < 2; i++)
+	{
+		job->outputs[i].fd = -1;
+		job->outputs[i].data = NULL;
+		job->outputs[i].length = job->outputs[i].capacity = 0;
+
+		if (runningJobCount)
+		{
+			if (pipe2(pipeFds[i], O_CLOEXEC))
+				slakePanic("Error creating pipe");
+			fcntl(pipeFds[i][0], F_SETFL, fcntl(pipeFds[i][0], F_GETFL) | O_NONBLOCK);
+		}
+	}
+
+	// Flush pending output of the script before the command writes its own.
+	fflush(stdout);
+	fflush(stderr);
+	int err = _slakeSpawn(cmdline, pipeFds[0][1], pipeFds[1][1], &job->process);
+	for (int i = 0; i < 2; i++)
+	{
+		if (pipeFds[i][1] != -1)
+			close(pipeFds[i][1]);
+		if (err && pipeFds[i][0] != -1)
+			close(pipeFds[i][0]);
+	}
+	if (err)
+		return -1;
+
+	if ((job->pidFd = _slakeOpenPidFd(job->process)) != -1)
+	{
+		fcntl(job->pidFd, F_SETFD, FD_CLOEXEC);
+		_slakeWatchFd(job->pidFd);
+	}
+	else
+		_slakeUseChildSignal();
+
+	for (int i = 0; i < 2; i++)
+	{
+		if ((job->outputs[i].fd = pipeFds[i][0]) != -1)
+			_slakeWatchFd(job->outputs[i].fd);
+	}
+	return 0;
+}
+#endif
+
+static SlakeJob *_slakeNewJob()
+{
+	SlakeJob *job = malloc(sizeof(SlakeJob));
+	if (!job)
+		slakePanic("Out of memory");
+
+	job->exitCode = -1;
+	job->done = 0;
+	job->onDone = NULL;
+	job->arg = NULL;
+	job->cmdline = NULL;
+	job->next = NULL;
+	return job;
+}
+
+//
+// Start the process of a job and add it to the running job list. Returns
+// non-zero if failed, then the job is marked as done. The job lock must be
+// held.
+//
+static int _slakeLaunchJob(SlakeJob *job, const char *cmdline)
+{
+#ifdef SLAKE_EXEC_EVENT_LOOP
+	if (_slakeStartJob(job, cmdline))
+#else
+	if (_slakeSpawn(cmdline, -1, -1, &job->process))
+#endif
+	{
+		job->done = 1;
+		return 1;
+	}
+
+	if (runningJobCount == runningJobCapacity)
+	{
+		size_t capacity = runningJobCapacity ? runningJobCapacity * 2 : slakeGetMaxJobs();
+		SlakeJob **jobs = realloc(runningJobs, capacity * sizeof(SlakeJob *));
+		if (!jobs)
+			slakePanic("Out of memory");
+		runningJobs = jobs;
+		runningJobCapacity = capacity;
+	}
+	runningJobs[runningJobCount++] = job;
+	return 0;
+}
+
+//
+// Start queued jobs while fewer jobs than the limit are running. The job
+// lock must be held.
+//
+static void _slakeStartQueuedJobs()
+{
+	while (queuedJobs && runningJobCount < slakeGetMaxJobs())
+	{
+		SlakeJob *job = queuedJobs;
+		if (!(queuedJobs = job->next))
+			lastQueuedJob = NULL;
+
+		int failed = _slakeLaunchJob(job, job->cmdline);
+		free(job->cmdline);
+		job->cmdline = NULL;
+		if (failed)
+			_slakeNotifyJob(job);
+	}
+}
+
+//
+// Collect exit codes of finished jobs. If block is non-zero, wait until at
+// least one job has finished, or until another thread collecting them wakes
+// up. The job lock must be held.
+//
+static void _slakeCollectJobs(int block)
+{
+	if (isReaping)
+	{
+		if (block)
+			slakeWaitCond(&jobCond, &jobMutex);
+		return;
+	}
+
+#ifdef _WIN32
+	while (runningJobCount)
+	{
+		// WaitForMultipleObjects accepts a limited count of handles at once,
+		// so the running jobs are polled in chunks.
+		for (size_t i = 0; i < runningJobCount; i += MAXIMUM_WAIT_OBJECTS)
+		{
+			HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+			DWORD n = (DWORD)(runningJobCount - i);
+			if (n > MAXIMUM_WAIT_OBJECTS)
+				n = MAXIMUM_WAIT_OBJECTS;
+
+			for (DWORD j = 0; j < n; j++)
+				handles[j] = runningJobs[i + j]->process;
+
+			DWORD timeout = (block && runningJobCount <= MAXIMUM_WAIT_OBJECTS) ? INFINITE : 0;
+			DWORD result;
+			if (timeout == INFINITE)
+			{
+				// Jobs are only finished by the reaping thread, so indexes
+				// stay valid while unlocked.
+				isReaping = 1;
+				slakeUnlockMutex(&jobMutex);
+				result = WaitForMultipleObjects(n, handles, FALSE, timeout);
+				slakeLockMutex(&jobMutex);
+				isReaping = 0;
+				slakeBroadcastCond(&jobCond);
+			}
+			else
+				result = WaitForMultipleObjects(n, handles, FALSE, timeout);
+			if (result >= WAIT_OBJECT_0 + n)
+				continue;
+
+			size_t index = i + (result - WAIT_OBJECT_0);
+			DWORD exitCode;
+			if (!GetExitCodeProcess(runningJobs[index]->process, &exitCode))
+				exitCode = (DWORD)-1;
+			CloseHandle(runningJobs[index]->process);
+			_slakeFinishJob(index, (int)exitCode);
+			return;
+		}
+
+		if (!block)
+			break;
+		slakeUnlockMutex(&jobMutex);
+		Sleep(1);
+		slakeLockMutex(&jobMutex);
+	}
+#elif defined(SLAKE_EXEC_EVENT_LOOP)
+	size_t finished = finishedJobCount;
+	while (runningJobCount)
+	{
+		struct epoll_event events[64];
+		int n;
+		if (block)
+		{
+			// Jobs are only finished by the reaping thread, so descriptors
+			// stay valid while unlocked.
+			isReaping = 1;
+			slakeUnlockMutex(&jobMutex);
+			n = epoll_wait(epollFd, events, 64, -1);
+			slakeLockMutex(&jobMutex);
+			isReaping = 0;
+			slakeBroadcastCond(&jobCond);
+		}
+		else
+			n = epoll_wait(epollFd, events, 64, 0);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			slakePanic("Error waiting for child processes");
+		}
+
+		for (int i = 0; i < n; i++)
+			_slakeHandleEvent(events[i].data.fd);
+
+		if (!block || finishedJobCount != finished)
+			break;
+	}
+#else
+	// Only processes of the jobs are waited for, so that children started by
+	// other code keep their exit statuses. Without a way to wait for any of
+	// several processes, they are polled.
+	while (runningJobCount)
+	{
+		for (size_t i = runningJobCount; i > 0; i--)
+		{
+			if (_slakePollJob(runningJobs[i - 1]))
+			{
+				_slakeFinishJob(i - 1, runningJobs[i - 1]->exitCode);
+				block = 0;
+			}
+		}
+
+		if (!block)
+			break;
+
+		// Jobs are only finished by the reaping thread, so indexes stay valid
+		// while unlocked.
+		isReaping = 1;
+		slakeUnlockMutex(&jobMutex);
+		usleep(1000);
+		slakeLockMutex(&jobMutex);
+		isReaping = 0;
+		slakeBroadcastCond(&jobCond);
+	}
+#endif
+}
+
+//
+// Collect exit codes of finished jobs as _slakeCollectJobs() does, and start
+// queued jobs in place of them. The job lock must be held.
+//
+static void _slakeReapJobs(int block)
+{
+	_slakeCollectJobs(block);
+	_slakeStartQueuedJobs();
+}
+
+//
+// Collect exit codes of jobs with callbacks, which nobody else may wait for.
+//
+static int _slakeWatchJobsProc(void *arg)
+{
+	(void)arg;
+
+	slakeLockMutex(&jobMutex);
+	for (;;)
+	{
+		while (!callbackJobCount)
+			slakeWaitCond(&watchCond, &jobMutex);
+		_slakeReapJobs(1);
+	}
+	return 0;
+}
+
+/**
+ * @brief Start a command as a job. If the count of running jobs has reached
+ * the limit, wait until one of them finishes.
+ *
+ * @param cmdline Command line to execute.
+ * @return Created job object, must be released by slakeWaitJob.
+ */
+SlakeJob *slakeSubmitJob(const char *cmdline)
+{
+	assert(cmdline != NULL);
+
+	slakeLockMutex(&jobMutex);
+	while (runningJobCount >= slakeGetMaxJobs())
+		_slakeReapJobs(1);
+
+	SlakeJob *job = _slakeNewJob();
+	_slakeLaunchJob(job, cmdline);
+	slakeUnlockMutex(&jobMutex);
+
+	return job;
+}
+
+/**
+ * @brief Start a command as a job without blocking. If the count of running
+ * jobs has reached the limit, the job is queued until others finish. The
+ * callback is called with the job lock held when the job finishes, so it
+ * must not call other functions of jobs.
+ *
+ * @param cmdline Command line to execute.
+ * @param onDone Callback receiving the finished job, which must be released
+ * by slakeWaitJob later.
+ * @param arg Argument passed to the callback.
+ */
+void slakeQueueJob(const char *cmdline, SlakeJobCallback onDone, void *arg)
+{
+	assert(cmdline != NULL);
+	assert(onDone != NULL);
+
+	slakeLockMutex(&jobMutex);
+	if (!isWatcherStarted)
+	{
+		isWatcherStarted = 1;
+		if (slakeStartThread(_slakeWatchJobsProc, NULL))
+			slakePanic("Error creating thread");
+	}
+
+	SlakeJob *job = _slakeNewJob();
+	job->onDone = onDone;
+	job->arg = arg;
+	if (!callbackJobCount++)
+		slakeSignalCond(&watchCond);
+
+	if (runningJobCount < slakeGetMaxJobs())
+	{
+		if (_slakeLaunchJob(job, cmdline))
+			_slakeNotifyJob(job);
+	}
+	else
+	{
+		if (!(job->cmdline = strdup(cmdline)))
+			slakePanic("Out of memory");
+		if (lastQueuedJob)
+			lastQueuedJob->next = job;
+		else
+			queuedJobs = job;
+		lastQueuedJob = job;
+	}
+	slakeUnlockMutex(&jobMutex);
+}
+
+/**
+ * @brief Check if a job has finished without blocking.
+ *
+ * @param job Target job.
+ * @return Non-zero if the job has finished.
+ */
+int slakeIsJobDone(SlakeJob *job)
+{
+	assert(job != NULL);
+
+	slakeLockMutex(&jobMutex);
+	if (!job->done)
+		_slakeReapJobs(0);
+	int done = job->done;
+	slakeUnlockMutex(&jobMutex);
+
+	return done;
+}
+
+/**
+ * @brief Wait for a job to finish and release it.
+ *
+ * @param job Job to wait.
+ * @return Exit code of the job. -1 if the command failed to start.
+ */
+int slakeWaitJob(SlakeJob *job)
+{
+	assert(job != NULL);
+
+	slakeLockMutex(&jobMutex);
+	while (!job->done)
+		_slakeReapJobs(1);
+	slakeUnlockMutex(&jobMutex);
+
+	int exitCode = job->exitCode;
+	free(job);
+	return exitCode;
+}
+
+/**
+ * @brief Wait until at least one running job has finished. Returns
+ * immediately if no job is running.
+ */
+void slakeWaitAnyJob()
+{
+	slakeLockMutex(&jobMutex);
+	_slakeReapJobs(1);
+	slakeUnlockMutex(&jobMutex);
+}
+
+/**
+ * @brief Wait for all running jobs to finish. The job objects still need to
+ * be released by slakeWaitJob.
+ */
+void slakeWaitAllJobs()
+{
+	slakeLockMutex(&jobMutex);
+	while (runningJobCount || queuedJobs)
+		_slakeReapJobs(1);
+	slakeUnlockMutex(&jobMutex);
+}
+
+typedef struct _SlakeExecWaiter
+{
+	SlakeFiber *fiber;
+	SlakeJob *job;
+} SlakeExecWaiter;
+
+static void _slakeResumeWaiter(SlakeJob *job, void *arg)
+{
+	SlakeExecWaiter *waiter = arg;
+	waiter->job = job;
+	slakeScheduleFiber(waiter->fiber);
+}
+
+/**
+ * @brief Execute a command line and wait for it to finish. A fiber waiting
+ * for the command is suspended, so that it does not hold its thread.
+ *
+ * @param cmdline Command line to execute.
+ * @return Exit code of the command. -1 if the command failed to start.
+ */
+int slakeExec(const char *cmdline)
+{
+	SlakeExecWaiter waiter = { slakeGetCurrentFiber(), NULL };
+	if (!waiter.fiber)
+		return slakeWaitJob(slakeSubmitJob(cmdline));
+
+	// The job resumes the fiber on the pool when it finishes.
+	slakeQueueJob(cmdline, _slakeResumeWaiter, &waiter);
+	slakeSuspendFiber();
+	return slakeWaitJob(waiter.job);
 }
@@ -1,6 +1,23 @@
 #ifndef __EXEC_H__
 #define __EXEC_H__
 
+#include <stddef.h>
+
+typedef struct _SlakeJob SlakeJob;
+
+typedef void (*SlakeJobCallback)(SlakeJob *job, void *arg);
+
+size_t slakeGetCpuCount();
+void slakeSetMaxJobs(size_t n);
+size_t slakeGetMaxJobs();
+
+SlakeJob *slakeSubmitJob(const char *cmdline);
+void slakeQueueJob(const char *cmdline, SlakeJobCallback onDone, void *arg);
+int slakeIsJobDone(SlakeJob *job);
+int slakeWaitJob(SlakeJob *job);
+void slakeWaitAnyJob();
+void slakeWaitAllJobs();
+
 int slakeExec(const char *cmdline);
 
 #endif
@@ -0,0 +1,411 @@
+#include <slakedef.h>
+#include <assert.h>
+#include "eval.h"
+
+typedef struct _SlakeFolder
+{
+	SlakeSymbol hostSymbol; // __SLAKE_HOST__, SLAKE_SYMBOL_NONE if the module defines or assigns it.
+} SlakeFolder;
+
+static SlakeExpr *_slakeFoldExpr(SlakeFolder *f, SlakeExpr *expr);
+static int _slakeBodyDefines(SlakeExecBody body, SlakeSymbol symbol);
+
+//
+// Check if an expression defines or assigns a variable.
+//
+static int _slakeExprDefines(SlakeExpr *expr, SlakeSymbol symbol)
+{
+	if (!expr)
+		return 0;
+
+	switch (expr->type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+	case EXPR_SUPER_CALL:
+		for (unsigned short i = 0; i < expr->attribs.call.paramCount; i++)
+			if (_slakeExprDefines(expr->attribs.call.params[i], symbol))
+				return 1;
+		return 0;
+	case EXPR_EXTERNAL_CALL:
+		for (unsigned short i = 0; i < expr->attribs.externalCall.paramCount; i++)
+			if (_slakeExprDefines(expr->attribs.externalCall.params[i], symbol))
+				return 1;
+		return 0;
+	case EXPR_AWAIT:
+		return _slakeExprDefines(expr->attribs.await, symbol);
+	case EXPR_RETURN:
+		return _slakeExprDefines(expr->attribs.returnValue, symbol);
+	case EXPR_IF:
+		return _slakeExprDefines(expr->attribs.ifBlock.condition, symbol) ||
+			   _slakeBodyDefines(expr->attribs.ifBlock.trueBlock, symbol) ||
+			   _slakeBodyDefines(expr->attribs.ifBlock.falseBlock, symbol);
+	case EXPR_SWITCH:
+		if (_slakeExprDefines(expr->attribs.switchBlock.condition, symbol) ||
+			_slakeBodyDefines(expr->attribs.switchBlock.defaultBody, symbol))
+			return 1;
+		for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+			if (_slakeExprDefines(expr->attribs.switchBlock.cases[i]->condition, symbol) ||
+				_slakeBodyDefines(expr->attribs.switchBlock.cases[i]->body, symbol))
+				return 1;
+		return 0;
+	case EXPR_LOOP:
+		return _slakeBodyDefines(expr->attribs.loopBlock.body, symbol);
+	case EXPR_FOR:
+		return _slakeExprDefines(expr->attribs.forBlock.condition, symbol) ||
+			   _slakeExprDefines(expr->attribs.forBlock.loopEnd, symbol) ||
+			   _slakeBodyDefines(expr->attribs.forBlock.body, symbol);
+	case EXPR_WHILE:
+		return _slakeExprDefines(expr->attribs.whileBlock.condition, symbol) ||
+			   _slakeBodyDefines(expr->attribs.whileBlock.body, symbol);
+	case EXPR_UNARY:
+		return _slakeExprDefines(expr->attribs.unaryOp.r, symbol);
+	case EXPR_BINARY:
+		if (expr->attribs.binaryOp.type == BINARY_EXPR_MOV && expr->attribs.binaryOp.l->type == EXPR_VARREF &&
+			expr->attribs.binaryOp.l->attribs.varRef.symbol == symbol)
+			return 1;
+		return _slakeExprDefines(expr->attribs.binaryOp.l, symbol) || _slakeExprDefines(expr->attribs.binaryOp.r, symbol);
+	case EXPR_VARDEF:
+		return expr->attribs.varDef.symbol == symbol || _slakeExprDefines(expr->attribs.varDef.initValue, symbol);
+	default:
+		return 0;
+	}
+}
+
+static int _slakeBodyDefines(SlakeExecBody body, SlakeSymbol symbol)
+{
+	if (!body)
+		return 0;
+
+	for (size_t i = 0; i < body->size; i++)
+		if (_slakeExprDefines(utilVectorAt(body, SlakeExpr *, i), symbol))
+			return 1;
+	return 0;
+}
+
+//
+// Check if any statement of a module defines or assigns a variable, so it
+// does not refer to the built-in one.
+//
+static int _slakeStatementsDefine(UtilVector *statements, SlakeSymbol symbol)
+{
+	for (size_t i = 0; i < statements->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(statements, SlakeStmt, i);
+		switch (stmt->type)
+		{
+		case STMT_IMPORT:
+			if (stmt->attribs.import.name == symbol)
+				return 1;
+			break;
+		case STMT_GLOBALS:
+			if (_slakeBodyDefines(stmt->attribs.globals, symbol))
+				return 1;
+			break;
+		case STMT_FUNCTION:
+			for (unsigned short j = 0; j < stmt->attribs.function.paramCount; j++)
+				if (stmt->attribs.function.params[j].name == symbol)
+					return 1;
+			if (_slakeBodyDefines(stmt->attribs.function.body, symbol))
+				return 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+static int _slakeIsConst(SlakeExpr *expr)
+{
+	return expr && expr->type == EXPR_VALUE;
+}
+
+//
+// Check if a binary operation on two constants can be evaluated ahead. The
+// ones which fail are left to fail when they are executed.
+//
+static int _slakeIsFoldable(SlakeBinaryExprType op, const SlakeValue *l, const SlakeValue *r)
+{
+	if (l->type == VALUE_TYPE_NULL || r->type == VALUE_TYPE_NULL)
+		return op == BINARY_EXPR_EQ || op == BINARY_EXPR_NEQ;
+
+	if (l->type == VALUE_TYPE_STR || r->type == VALUE_TYPE_STR)
+	{
+		if (op == BINARY_EXPR_ADD || op == BINARY_EXPR_EQ || op == BINARY_EXPR_NEQ)
+			return 1;
+		return l->type == r->type && op >= BINARY_EXPR_EQ && op <= BINARY_EXPR_GTEQ;
+	}
+
+	if (op == BINARY_EXPR_DIV || op == BINARY_EXPR_MOD)
+		return slakeIsValueTrue(r);
+
+	return op != BINARY_EXPR_MOV;
+}
+
+//
+// Replace an expression with a constant. Results of folding are owned by the
+// arena like other immediate values.
+//
+static SlakeExpr *_slakeMakeConst(SlakeValue *value)
+{
+	SlakeExpr *expr = slakeExprImmediateValue(value);
+	slakeClearValue(value);
+	return expr;
+}
+
+static SlakeExpr *_slakeFoldBinary(SlakeFolder *f, SlakeExpr *expr)
+{
+	SlakeBinaryExprType op = expr->attribs.binaryOp.type;
+	SlakeExpr *l = expr->attribs.binaryOp.l, *r = expr->attribs.binaryOp.r;
+
+	// Assignment targets are not folded.
+	if (op != BINARY_EXPR_MOV)
+		expr->attribs.binaryOp.l = l = _slakeFoldExpr(f, l);
+	expr->attribs.binaryOp.r = r = _slakeFoldExpr(f, r);
+
+	if (!_slakeIsConst(l))
+		return expr;
+
+	SlakeValue result = { .type = VALUE_TYPE_NULL };
+	switch (op)
+	{
+	case BINARY_EXPR_MOV:
+		return expr;
+	case BINARY_EXPR_LAND:
+	case BINARY_EXPR_LOR:
+	{
+		// The left operand may decide by itself.
+		int lValue = slakeIsValueTrue(l->attribs.value);
+		if (lValue == (op == BINARY_EXPR_LOR))
+			slakeSetInt(&result, lValue);
+		else if (_slakeIsConst(r))
+			slakeSetInt(&result, slakeIsValueTrue(r->attribs.value));
+		else
+			return expr;
+		break;
+	}
+	default:
+		if (!_slakeIsConst(r) || !_slakeIsFoldable(op, l->attribs.value, r->attribs.value))
+			return expr;
+		slakeEvalBinaryOp(op, l->attribs.value, r->attribs.value, &result);
+	}
+
+	return _slakeMakeConst(&result);
+}
+
+static SlakeExpr *_slakeFoldUnary(SlakeFolder *f, SlakeExpr *expr)
+{
+	SlakeExpr *x = expr->attribs.unaryOp.r = _slakeFoldExpr(f, expr->attribs.unaryOp.r);
+	if (!_slakeIsConst(x))
+		return expr;
+
+	SlakeValue result = { .type = VALUE_TYPE_NULL };
+	switch (expr->attribs.unaryOp.type)
+	{
+	case UNARY_EXPR_NOT:
+		slakeSetInt(&result, !slakeIsValueTrue(x->attribs.value));
+		break;
+	case UNARY_EXPR_NEG:
+		if (x->attribs.value->type == VALUE_TYPE_STR || x->attribs.value->type == VALUE_TYPE_NULL)
+			return expr;
+		slakeEvalUnaryOp(UNARY_EXPR_NEG, x->attribs.value, &result);
+		break;
+	default:
+		return expr;
+	}
+
+	return _slakeMakeConst(&result);
+}
+
+static void _slakeFoldParams(SlakeFolder *f, SlakeExpr **params, unsigned short paramCount)
+{
+	for (unsigned short i = 0; i < paramCount; i++)
+		params[i] = _slakeFoldExpr(f, params[i]);
+}
+
+static SlakeExecBody _slakeFoldBody(SlakeFolder *f, SlakeExecBody body);
+
+//
+// Fold an expression, returns the expression to replace it.
+//
+static SlakeExpr *_slakeFoldExpr(SlakeFolder *f, SlakeExpr *expr)
+{
+	if (!expr)
+		return NULL;
+
+	switch (expr->type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+	case EXPR_SUPER_CALL:
+		_slakeFoldParams(f, expr->attribs.call.params, expr->attribs.call.paramCount);
+		break;
+	case EXPR_EXTERNAL_CALL:
+		_slakeFoldParams(f, expr->attribs.externalCall.params, expr->attribs.externalCall.paramCount);
+		break;
+	case EXPR_AWAIT:
+		expr->attribs.await = _slakeFoldExpr(f, expr->attribs.await);
+		break;
+	case EXPR_RETURN:
+		expr->attribs.returnValue = _slakeFoldExpr(f, expr->attribs.returnValue);
+		break;
+	case EXPR_IF:
+		expr->attribs.ifBlock.condition = _slakeFoldExpr(f, expr->attribs.ifBlock.condition);
+		expr->attribs.ifBlock.trueBlock = _slakeFoldBody(f, expr->attribs.ifBlock.trueBlock);
+		expr->attribs.ifBlock.falseBlock = _slakeFoldBody(f, expr->attribs.ifBlock.falseBlock);
+		break;
+	case EXPR_SWITCH:
+		expr->attribs.switchBlock.condition = _slakeFoldExpr(f, expr->attribs.switchBlock.condition);
+		for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+		{
+			SlakeSwitchCase *swCase = expr->attribs.switchBlock.cases[i];
+			swCase->condition = _slakeFoldExpr(f, swCase->condition);
+			swCase->body = _slakeFoldBody(f, swCase->body);
+		}
+		expr->attribs.switchBlock.defaultBody = _slakeFoldBody(f, expr->attribs.switchBlock.defaultBody);
+		break;
+	case EXPR_LOOP:
+		expr->attribs.loopBlock.body = _slakeFoldBody(f, expr->attribs.loopBlock.body);
+		break;
+	case EXPR_FOR:
+		expr->attribs.forBlock.condition = _slakeFoldExpr(f, expr->attribs.forBlock.condition);
+		expr->attribs.forBlock.loopEnd = _slakeFoldExpr(f, expr->attribs.forBlock.loopEnd);
+		expr->attribs.forBlock.body = _slakeFoldBody(f, expr->attribs.forBlock.body);
+		break;
+	case EXPR_WHILE:
+		expr->attribs.whileBlock.condition = _slakeFoldExpr(f, expr->attribs.whileBlock.condition);
+		expr->attribs.whileBlock.body = _slakeFoldBody(f, expr->attribs.whileBlock.body);
+		break;
+	case EXPR_UNARY:
+		return _slakeFoldUnary(f, expr);
+	case EXPR_BINARY:
+		return _slakeFoldBinary(f, expr);
+	case EXPR_VARREF:
+		if (f->hostSymbol != SLAKE_SYMBOL_NONE && expr->attribs.varRef.symbol == f->hostSymbol)
+		{
+			SlakeValue host = slakeMakeArenaString(SLAKE_HOST);
+			return slakeExprImmediateValue(&host);
+		}
+		break;
+	case EXPR_VARDEF:
+		expr->attribs.varDef.initValue = _slakeFoldExpr(f, expr->attribs.varDef.initValue);
+		break;
+	default:
+		break;
+	}
+
+	return expr;
+}
+
+//
+// Get the body taken by a conditional block whose condition is constant.
+// Returns non-zero if the block can be replaced by the body, which may be
+// NULL for nothing.
+//
+static int _slakeGetTakenBody(SlakeExpr *expr, SlakeExecBody *body)
+{
+	switch (expr->type)
+	{
+	case EXPR_IF:
+		if (!_slakeIsConst(expr->attribs.ifBlock.condition))
+			return 0;
+		*body = slakeIsValueTrue(expr->attribs.ifBlock.condition->attribs.value) ? expr->attribs.ifBlock.trueBlock : expr->attribs.ifBlock.falseBlock;
+		return 1;
+	case EXPR_SWITCH:
+	{
+		if (!_slakeIsConst(expr->attribs.switchBlock.condition))
+			return 0;
+
+		// Cases are matched in order, so all of them before the taken one
+		// must be constant.
+		const SlakeValue *cond = expr->attribs.switchBlock.condition->attribs.value;
+		for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+		{
+			SlakeSwitchCase *swCase = expr->attribs.switchBlock.cases[i];
+			if (!_slakeIsConst(swCase->condition))
+				return 0;
+
+			SlakeValue matched = { .type = VALUE_TYPE_NULL };
+			slakeEvalBinaryOp(BINARY_EXPR_EQ, cond, swCase->condition->attribs.value, &matched);
+			if (matched.data.i32)
+			{
+				*body = swCase->body;
+				return 1;
+			}
+		}
+		*body = expr->attribs.switchBlock.defaultBody;
+		return 1;
+	}
+	default:
+		return 0;
+	}
+}
+
+//
+// Fold expressions in a body. Blocks do not have their own scopes, so the
+// taken bodies of constant conditions are merged into the body, and the
+// others are dropped. Returns the body to replace it.
+//
+static SlakeExecBody _slakeFoldBody(SlakeFolder *f, SlakeExecBody body)
+{
+	if (!body)
+		return NULL;
+
+	// The body is only rebuilt once a block is merged.
+	SlakeExecBody folded = NULL;
+	for (size_t i = 0; i < body->size; i++)
+	{
+		SlakeExpr *expr = _slakeFoldExpr(f, utilVectorAt(body, SlakeExpr *, i));
+
+		SlakeExecBody taken;
+		if (_slakeGetTakenBody(expr, &taken))
+		{
+			if (!folded)
+			{
+				folded = slakeCreateExecBody();
+				if (i && !utilVectorAppend(folded, body->data, i))
+					slakePanic("Out of memory");
+			}
+			slakeExecBodyMerge(folded, taken);
+		}
+		else if (folded)
+			slakeExprAttach(folded, expr);
+		else
+			utilVectorAt(body, SlakeExpr *, i) = expr;
+	}
+
+	return folded ? folded : body;
+}
+
+/**
+ * @brief Fold constant expressions in the statements of a module, and drop
+ * branches of conditional blocks whose conditions are constant. Built-in
+ * variables are treated as constants unless the module defines or assigns
+ * them. New expressions are allocated in the current arena.
+ *
+ * @param statements Statements of the module.
+ */
+void slakeFoldStatements(UtilVector *statements)
+{
+	assert(statements != NULL);
+
+	SlakeFolder f;
+	f.hostSymbol = slakeIntern("__SLAKE_HOST__");
+	if (_slakeStatementsDefine(statements, f.hostSymbol))
+		f.hostSymbol = SLAKE_SYMBOL_NONE;
+
+	for (size_t i = 0; i < statements->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(statements, SlakeStmt, i);
+		switch (stmt->type)
+		{
+		case STMT_GLOBALS:
+			stmt->attribs.globals = _slakeFoldBody(&f, stmt->attribs.globals);
+			break;
+		case STMT_FUNCTION:
+			stmt->attribs.function.body = _slakeFoldBody(&f, stmt->attribs.function.body);
+			break;
+		default:
+			break;
+		}
+	}
+}
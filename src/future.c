@@ -0,0 +1,218 @@
+#include "future.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static SlakeMutex interpreterMutex = SLAKE_MUTEX_INIT;
+static SlakeCond futureCond = SLAKE_COND_INIT; // Signaled when a future is done, with the interpreter lock.
+static size_t pendingFutureCount = 0;
+
+typedef struct _SlakeFutureWaiter
+{
+	SlakeFiber *fiber;
+	struct _SlakeFutureWaiter *next;
+} SlakeFutureWaiter;
+
+/**
+ * @brief Acquire the interpreter lock, which must be held while running
+ * scripts or touching their values.
+ */
+void slakeLockInterpreter()
+{
+	slakeLockMutex(&interpreterMutex);
+}
+
+/**
+ * @brief Release the interpreter lock, so that other threads can run
+ * scripts while the current thread blocks.
+ */
+void slakeUnlockInterpreter()
+{
+	slakeUnlockMutex(&interpreterMutex);
+}
+
+//
+// Run the call of a future.
+//
+static int _slakeRunFuture(void *arg)
+{
+	SlakeFuture *future = arg;
+
+	slakeLockInterpreter();
+
+	slakeVMCall(future->func, future->args, future->argCount, &future->result);
+
+	for (unsigned short i = 0; i < future->argCount; i++)
+		slakeClearValue(&future->args[i]);
+	free(future->args);
+	future->args = NULL;
+	future->argCount = 0;
+
+	future->isDone = 1;
+	pendingFutureCount--;
+	slakeBroadcastCond(&futureCond);
+	for (SlakeFutureWaiter *waiter = future->waiters, *next; waiter; waiter = next)
+	{
+		next = waiter->next;
+		slakeScheduleFiber(waiter->fiber);
+	}
+	future->waiters = NULL;
+
+	// The reference held by the running call.
+	slakeReleaseFuture(future);
+
+	slakeUnlockInterpreter();
+	return 0;
+}
+
+//
+// Run the call of a future on the thread pool. On workers, the call runs on
+// a fiber, which is suspended instead of blocking the worker while waiting
+// for commands. Awaiting threads running the call by themselves would block
+// anyway.
+//
+static int _slakeFutureProc(void *arg)
+{
+	SlakeFiber *fiber;
+	if (slakeIsWorkerThread() && (fiber = slakeCreateFiber(_slakeRunFuture, arg)))
+		slakeResumeFiber(fiber);
+	else
+		_slakeRunFuture(arg);
+	return 0;
+}
+
+/**
+ * @brief Start calling a function asynchronously. The interpreter lock must
+ * be held.
+ *
+ * @param func Function to call.
+ * @param args Arguments, this function will make a copy.
+ * @param argCount Count of arguments.
+ * @return Created future, referred once by the caller.
+ */
+SlakeFuture *slakeCreateFuture(SlakeFunction *func, const SlakeValue *args, unsigned short argCount)
+{
+	assert(func != NULL);
+
+	SlakeFuture *future = malloc(sizeof(SlakeFuture));
+	if (!future)
+		slakePanic("Out of memory");
+
+	future->args = NULL;
+	if (argCount && !(future->args = malloc(argCount * sizeof(SlakeValue))))
+		slakePanic("Out of memory");
+	for (unsigned short i = 0; i < argCount; i++)
+	{
+		future->args[i].type = VALUE_TYPE_NULL;
+		slakeAssignValue(&future->args[i], &args[i]);
+	}
+
+	future->func = func;
+	future->argCount = argCount;
+	future->result.type = VALUE_TYPE_NULL;
+	future->waiters = NULL;
+	future->isDone = 0;
+	future->refCount = 2; // The caller and the running call.
+
+	pendingFutureCount++;
+	if (!(future->task = slakeCreateTask(_slakeFutureProc, future)))
+		slakePanic("Out of memory");
+
+	return future;
+}
+
+/**
+ * @brief Add a reference to a future. The interpreter lock must be held.
+ *
+ * @param future Target future.
+ */
+void slakeRetainFuture(SlakeFuture *future)
+{
+	future->refCount++;
+}
+
+/**
+ * @brief Drop a reference to a future, and free it with the last one. The
+ * interpreter lock must be held.
+ *
+ * @param future Target future.
+ */
+void slakeReleaseFuture(SlakeFuture *future)
+{
+	if (--future->refCount)
+		return;
+
+	// The call has finished, but its task may not have been released.
+	if (future->task)
+		slakeDetachTask(future->task);
+
+	slakeClearValue(&future->result);
+	free(future);
+}
+
+/**
+ * @brief Wait for a future and get its result. Futures returned by the call
+ * are awaited as well. The interpreter lock must be held, it is released
+ * while waiting.
+ *
+ * @param future Target future.
+ * @param out Value to store the result. NULL to discard it.
+ */
+void slakeAwaitFuture(SlakeFuture *future, SlakeValue *out)
+{
+	slakeRetainFuture(future);
+
+	if (!future->isDone)
+	{
+		// The first awaiting thread takes the task, and runs it by itself if
+		// no worker has started it. Others wait for it to finish.
+		SlakeTask *task = future->task;
+		future->task = NULL;
+
+		slakeUnlockInterpreter();
+		if (task)
+			slakeAwait(task);
+		slakeLockInterpreter();
+
+		// Fibers are suspended instead of blocking their workers, which may
+		// be needed to finish the call.
+		SlakeFutureWaiter waiter;
+		while (!future->isDone && (waiter.fiber = slakeGetCurrentFiber()))
+		{
+			waiter.next = future->waiters;
+			future->waiters = &waiter;
+			slakeUnlockInterpreter();
+			slakeSuspendFiber();
+			slakeLockInterpreter();
+		}
+		while (!future->isDone)
+			slakeWaitCond(&futureCond, &interpreterMutex);
+	}
+
+	slakeAwaitValue(&future->result, out);
+	slakeReleaseFuture(future);
+}
+
+/**
+ * @brief Get the result of a value, which is awaited if it is a future.
+ *
+ * @param value Value to await.
+ * @param out Value to store the result. NULL to discard it.
+ */
+void slakeAwaitValue(const SlakeValue *value, SlakeValue *out)
+{
+	if (value->type == VALUE_TYPE_FUTURE)
+		slakeAwaitFuture(value->data.future, out);
+	else if (out)
+		slakeAssignValue(out, value);
+}
+
+/**
+ * @brief Wait for all futures to finish, including ones which are not
+ * referred anymore. The interpreter lock must be held.
+ */
+void slakeWaitAllFutures()
+{
+	while (pendingFutureCount)
+		slakeWaitCond(&futureCond, &interpreterMutex);
+}
@@ -0,0 +1,38 @@
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include <slakedef.h>
+#include "task.h"
+
+//
+// Result of an asynchronous call. Futures are shared by values, and they are
+// released with the last value referring to them.
+//
+typedef struct _SlakeFuture
+{
+	SlakeFunction *func;
+	SlakeValue *args;
+	unsigned short argCount;
+	SlakeValue result;
+	SlakeTask *task; // Task running the call, NULL once it is taken by an awaiting thread.
+	struct _SlakeFutureWaiter *waiters; // Fibers suspended until the call is done.
+	int isDone;
+	int refCount;
+} SlakeFuture;
+
+//
+// Scripts run on multiple threads, but only the thread holding the
+// interpreter lock executes them. The lock is released while waiting for
+// futures and commands, so asynchronous calls overlap where they block.
+//
+void slakeLockInterpreter();
+void slakeUnlockInterpreter();
+
+SlakeFuture *slakeCreateFuture(SlakeFunction *func, const SlakeValue *args, unsigned short argCount);
+void slakeRetainFuture(SlakeFuture *future);
+void slakeReleaseFuture(SlakeFuture *future);
+void slakeAwaitFuture(SlakeFuture *future, SlakeValue *out);
+void slakeAwaitValue(const SlakeValue *value, SlakeValue *out);
+void slakeWaitAllFutures();
+
+#endif
@@ -0,0 +1,621 @@
+#include "glob.h"
+#include "task.h"
+#include <slakedef.h>
+#include <util/hashmap.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// On Linux, directories are read by getdents64 with a large buffer.
+#ifdef __linux__
+#define SLAKE_GLOB_GETDENTS 1
+#include <sys/syscall.h>
+#endif
+
+#define SLAKE_GLOB_BUFFER_SIZE 65536
+
+typedef struct _SlakeDirEntry
+{
+	size_t name; // Offset of the name in the name buffer.
+	unsigned char isDir;
+	unsigned char isLink;
+} SlakeDirEntry;
+
+//
+// Listing of a directory, which is cached until the directory is modified.
+// Listings are shared by walking threads and released with the last user.
+//
+typedef struct _SlakeDirListing
+{
+	struct _SlakeDirListing *next; // Next listing with the same key.
+	char *path;
+	long long mtime; // Modification time of the directory in nanoseconds.
+	UtilVector entries; // Entries (SlakeDirEntry).
+	UtilVector names;	// Null-terminated names of the entries.
+	size_t refCount;
+} SlakeDirListing;
+
+typedef struct _SlakeGlob
+{
+	char **components;
+	size_t componentCount;
+	SlakeMutex lock; // Protects the matched paths.
+	UtilVector *paths;
+} SlakeGlob;
+
+//
+// Directory to walk, with the index of the pattern component to match its
+// entries.
+//
+typedef struct _SlakeGlobVisit
+{
+	SlakeGlob *glob;
+	char *dir;
+	size_t index;
+	SlakeTask *task;
+} SlakeGlobVisit;
+
+static SlakeMutex listingLock = SLAKE_MUTEX_INIT;
+static UtilHashMap *listings = NULL; // Listings keyed by hashes of their paths.
+
+static char *_slakeCopyString(const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *copy = malloc(size);
+	if (!copy)
+		slakePanic("Out of memory");
+	return memcpy(copy, s, size);
+}
+
+static char *_slakeJoinPath(const char *dir, const char *name)
+{
+	size_t dirLength = strlen(dir), nameLength = strlen(name);
+	int sep = dirLength && dir[dirLength - 1] != '/';
+
+	char *path = malloc(dirLength + sep + nameLength + 1);
+	if (!path)
+		slakePanic("Out of memory");
+
+	memcpy(path, dir, dirLength);
+	path[dirLength] = '/';
+	memcpy(path + dirLength + sep, name, nameLength + 1);
+	return path;
+}
+
+static size_t _slakeGetListingKey(const char *path)
+{
+	// Keys of the hash map must not be 0.
+	return utilHashString(path) | 1;
+}
+
+static void _slakeReleaseListing(SlakeDirListing *listing)
+{
+	slakeLockMutex(&listingLock);
+	size_t refCount = --listing->refCount;
+	slakeUnlockMutex(&listingLock);
+
+	if (refCount)
+		return;
+
+	utilVectorFree(&listing->entries);
+	utilVectorFree(&listing->names);
+	free(listing->path);
+	free(listing);
+}
+
+//
+// Refer to the cached listing of a directory if it has not been modified.
+// Returns NULL if there is none.
+//
+static SlakeDirListing *_slakeFindListing(const char *path, long long mtime)
+{
+	SlakeDirListing *found = NULL;
+
+	slakeLockMutex(&listingLock);
+	SlakeDirListing *listing = listings ? utilHashMapGet(listings, _slakeGetListingKey(path)) : NULL;
+	for (; listing; listing = listing->next)
+	{
+		if (strcmp(listing->path, path))
+			continue;
+		if (listing->mtime == mtime)
+		{
+			listing->refCount++;
+			found = listing;
+		}
+		break;
+	}
+	slakeUnlockMutex(&listingLock);
+
+	return found;
+}
+
+//
+// Cache a listing, replacing the previous one of the directory.
+//
+static void _slakeCacheListing(SlakeDirListing *listing)
+{
+	SlakeDirListing *replaced = NULL;
+
+	slakeLockMutex(&listingLock);
+	if (!listings && !(listings = utilHashMapNew()))
+		slakePanic("Out of memory");
+
+	UtilHashMapSlot *slot = utilHashMapInsert(listings, _slakeGetListingKey(listing->path));
+	if (!slot)
+		slakePanic("Out of memory");
+
+	SlakeDirListing **link = (SlakeDirListing **)&slot->value;
+	while (*link && strcmp((*link)->path, listing->path))
+		link = &(*link)->next;
+	if ((replaced = *link))
+		listing->next = replaced->next;
+	*link = listing;
+	listing->refCount++;
+	slakeUnlockMutex(&listingLock);
+
+	if (replaced)
+		_slakeReleaseListing(replaced);
+}
+
+static void _slakeAddDirEntry(SlakeDirListing *listing, const char *name, int isDir, int isLink)
+{
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+		return;
+
+	SlakeDirEntry entry = { listing->names.size, (unsigned char)isDir, (unsigned char)isLink };
+	if (!utilVectorAppend(&listing->names, name, strlen(name) + 1) || !utilVectorPush(&listing->entries, &entry))
+		slakePanic("Out of memory");
+}
+
+#ifndef _WIN32
+//
+// Add an entry whose type is not known from the directory, or which is a
+// symbolic link that may refer to a directory.
+//
+static void _slakeAddDirEntryAt(SlakeDirListing *listing, int fd, const char *name, int isLink)
+{
+	struct stat st;
+	int failed = 0;
+
+	if (!isLink)
+	{
+		failed = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW);
+		isLink = !failed && S_ISLNK(st.st_mode);
+	}
+	if (isLink)
+		failed = fstatat(fd, name, &st, 0);
+
+	_slakeAddDirEntry(listing, name, !failed && S_ISDIR(st.st_mode), isLink);
+}
+#endif
+
+#ifdef SLAKE_GLOB_GETDENTS
+typedef struct _SlakeLinuxDirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} SlakeLinuxDirent64;
+#endif
+
+//
+// Read entries of a directory into a listing. Returns non-zero if failed.
+//
+#ifdef _WIN32
+static int _slakeReadDir(SlakeDirListing *listing)
+{
+	char *pattern = _slakeJoinPath(listing->path[0] ? listing->path : ".", "*");
+
+	WIN32_FIND_DATAA data;
+	HANDLE hFind = FindFirstFileA(pattern, &data);
+	free(pattern);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 1;
+	do
+	{
+		_slakeAddDirEntry(listing, data.cFileName, !!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY),
+			!!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT));
+	} while (FindNextFileA(hFind, &data));
+	FindClose(hFind);
+
+	return 0;
+}
+#elif defined(SLAKE_GLOB_GETDENTS)
+static int _slakeReadDir(SlakeDirListing *listing, int fd)
+{
+	char *buf = malloc(SLAKE_GLOB_BUFFER_SIZE);
+	if (!buf)
+		slakePanic("Out of memory");
+
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf, SLAKE_GLOB_BUFFER_SIZE)) > 0)
+	{
+		for (long offset = 0; offset < n;)
+		{
+			SlakeLinuxDirent64 *entry = (SlakeLinuxDirent64 *)(buf + offset);
+			offset += entry->d_reclen;
+
+			if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+				_slakeAddDirEntryAt(listing, fd, entry->d_name, entry->d_type == DT_LNK);
+			else
+				_slakeAddDirEntry(listing, entry->d_name, entry->d_type == DT_DIR, 0);
+		}
+	}
+	free(buf);
+
+	return n < 0;
+}
+#else
+static int _slakeReadDir(SlakeDirListing *listing, int fd)
+{
+	// The directory takes its own descriptor, which is closed with it.
+	int dirFd = dup(fd);
+	DIR *dir = dirFd < 0 ? NULL : fdopendir(dirFd);
+	if (!dir)
+	{
+		if (dirFd >= 0)
+			close(dirFd);
+		return 1;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)))
+	{
+		if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+			_slakeAddDirEntryAt(listing, fd, entry->d_name, entry->d_type == DT_LNK);
+		else
+			_slakeAddDirEntry(listing, entry->d_name, entry->d_type == DT_DIR, 0);
+	}
+	closedir(dir);
+
+	return 0;
+}
+#endif
+
+//
+// Get the listing of a directory, from the cache if it has not been
+// modified since it was read. Returns NULL if the directory cannot be read.
+//
+static SlakeDirListing *_slakeGetListing(const char *path)
+{
+	long long mtime;
+
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (!GetFileAttributesExA(path[0] ? path : ".", GetFileExInfoStandard, &attrs) ||
+		!(attrs.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return NULL;
+	mtime = (long long)(((unsigned long long)attrs.ftLastWriteTime.dwHighDateTime << 32) | attrs.ftLastWriteTime.dwLowDateTime) * 100;
+#else
+	struct stat st;
+	int fd = open(path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st))
+	{
+		close(fd);
+		return NULL;
+	}
+#if defined(__APPLE__)
+	mtime = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+	SlakeDirListing *listing = _slakeFindListing(path, mtime);
+	if (!listing)
+	{
+		if (!(listing = malloc(sizeof(SlakeDirListing))))
+			slakePanic("Out of memory");
+		listing->next = NULL;
+		listing->path = _slakeCopyString(path);
+		listing->mtime = mtime;
+		utilVectorInit(&listing->entries, sizeof(SlakeDirEntry), NULL);
+		utilVectorInit(&listing->names, 1, NULL);
+		listing->refCount = 1;
+
+#ifdef _WIN32
+		int failed = _slakeReadDir(listing);
+#else
+		int failed = _slakeReadDir(listing, fd);
+#endif
+		if (failed)
+		{
+			_slakeReleaseListing(listing);
+			listing = NULL;
+		}
+		else
+			_slakeCacheListing(listing);
+	}
+
+#ifndef _WIN32
+	close(fd);
+#endif
+	return listing;
+}
+
+//
+// Match a character with the pattern element at the beginning, and return
+// where the next element starts. Returns NULL if not matched.
+//
+static const char *_slakeMatchChar(const char *pattern, char c)
+{
+	switch (*pattern)
+	{
+	case '\0':
+		return NULL;
+	case '?':
+		return pattern + 1;
+	case '[':
+	{
+		const char *p = pattern + 1;
+		int negate = 0, matched = 0;
+
+		if (*p == '!' || *p == '^')
+		{
+			negate = 1;
+			p++;
+		}
+
+		// A ']' right after the opening bracket is a member.
+		do
+		{
+			// Unterminated brackets are matched literally.
+			if (!*p)
+				return c == '[' ? pattern + 1 : NULL;
+
+			if (p[1] == '-' && p[2] && p[2] != ']')
+			{
+				if ((unsigned char)c >= (unsigned char)p[0] && (unsigned char)c <= (unsigned char)p[2])
+					matched = 1;
+				p += 3;
+			}
+			else if (*p++ == c)
+				matched = 1;
+		} while (*p != ']');
+
+		return matched != negate ? p + 1 : NULL;
+	}
+	case '\\':
+		if (pattern[1])
+			pattern++;
+		// Fall through.
+	default:
+		return *pattern == c ? pattern + 1 : NULL;
+	}
+}
+
+//
+// Match a name with a component of the pattern. A '*' is retried from the
+// next character of the name on mismatch.
+//
+static int _slakeMatchName(const char *pattern, const char *name)
+{
+	const char *starPattern = NULL, *starName = NULL;
+
+	if (*name == '.' && *pattern != '.')
+		return 0;
+
+	while (*name)
+	{
+		if (*pattern == '*')
+		{
+			starPattern = ++pattern;
+			starName = name;
+			continue;
+		}
+
+		const char *next = _slakeMatchChar(pattern, *name);
+		if (next)
+		{
+			pattern = next;
+			name++;
+		}
+		else if (starPattern)
+		{
+			pattern = starPattern;
+			name = ++starName;
+		}
+		else
+			return 0;
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return !*pattern;
+}
+
+static void _slakeAddMatch(SlakeGlob *glob, char *path)
+{
+	slakeLockMutex(&glob->lock);
+	void *pushed = utilVectorPush(glob->paths, &path);
+	slakeUnlockMutex(&glob->lock);
+
+	if (!pushed)
+		slakePanic("Out of memory");
+}
+
+static void _slakeAddVisit(UtilVector *visits, SlakeGlob *glob, char *dir, size_t index)
+{
+	SlakeGlobVisit visit = { glob, dir, index, NULL };
+	if (!utilVectorPush(visits, &visit))
+		slakePanic("Out of memory");
+}
+
+//
+// Match entries of a directory with a component of the pattern. Matched
+// directories which need to be walked further are pushed into visits.
+//
+static void _slakeGlobDir(SlakeGlob *glob, const char *dir, size_t index, UtilVector *visits)
+{
+	const char *component = glob->components[index];
+	int isLast = index + 1 == glob->componentCount;
+
+	// Literal names are checked without listing the directory.
+	if (strcmp(component, "**") && !strpbrk(component, "*?[\\"))
+	{
+		char *path = _slakeJoinPath(dir, component);
+		struct stat st;
+
+		if (!stat(path, &st) && (isLast || (st.st_mode & S_IFMT) == S_IFDIR))
+		{
+			if (isLast)
+				_slakeAddMatch(glob, path);
+			else
+				_slakeAddVisit(visits, glob, path, index + 1);
+		}
+		else
+			free(path);
+		return;
+	}
+
+	SlakeDirListing *listing = _slakeGetListing(dir);
+	if (!listing)
+		return;
+
+	SlakeDirEntry *entries = listing->entries.data;
+	const char *names = listing->names.data;
+
+	if (!strcmp(component, "**"))
+	{
+		// Match no directory, and walk into subdirectories with the same
+		// component. Links are not followed to avoid cycles.
+		_slakeGlobDir(glob, dir, index + 1, visits);
+
+		for (size_t i = 0; i < listing->entries.size; i++)
+		{
+			const char *name = names + entries[i].name;
+			if (entries[i].isDir && !entries[i].isLink && name[0] != '.')
+				_slakeAddVisit(visits, glob, _slakeJoinPath(dir, name), index);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < listing->entries.size; i++)
+		{
+			const char *name = names + entries[i].name;
+			if (!_slakeMatchName(component, name))
+				continue;
+
+			if (isLast)
+				_slakeAddMatch(glob, _slakeJoinPath(dir, name));
+			else if (entries[i].isDir)
+				_slakeAddVisit(visits, glob, _slakeJoinPath(dir, name), index + 1);
+		}
+	}
+
+	_slakeReleaseListing(listing);
+}
+
+static int _slakeGlobProc(void *arg);
+
+//
+// Walk directories on the thread pool and wait for them.
+//
+static void _slakeRunVisits(UtilVector *visits)
+{
+	SlakeGlobVisit *visit = visits->data;
+
+	for (size_t i = 0; i < visits->size; i++)
+		visit[i].task = slakeCreateTask(_slakeGlobProc, &visit[i]);
+
+	for (size_t i = 0; i < visits->size; i++)
+	{
+		if (visit[i].task)
+			slakeAwait(visit[i].task);
+		else
+			_slakeGlobProc(&visit[i]);
+		free(visit[i].dir);
+	}
+}
+
+static int _slakeGlobProc(void *arg)
+{
+	SlakeGlobVisit *visit = arg;
+	UtilVector visits;
+
+	utilVectorInit(&visits, sizeof(SlakeGlobVisit), NULL);
+	_slakeGlobDir(visit->glob, visit->dir, visit->index, &visits);
+	_slakeRunVisits(&visits);
+	utilVectorFree(&visits);
+
+	return 0;
+}
+
+static int _slakeComparePaths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Find paths matching a glob pattern. Directories are walked in
+ * parallel on the thread pool, and their listings are cached for later
+ * calls until they are modified.
+ *
+ * @param pattern Glob pattern.
+ * @param paths Vector to push matched paths (char*) into, which are sorted
+ * and must be freed by the caller.
+ */
+void slakeGlob(const char *pattern, UtilVector *paths)
+{
+	char *buf = _slakeCopyString(pattern);
+	UtilVector components;
+	utilVectorInit(&components, sizeof(char *), NULL);
+
+	// Split by hand, since strtok is not safe on concurrent calls. Empty
+	// components are skipped.
+	for (char *s = buf; *s;)
+	{
+		char *end = s + strcspn(s, "/");
+		int isLast = !*end;
+		*end = '\0';
+		if (*s && !utilVectorPush(&components, &s))
+			slakePanic("Out of memory");
+		s = isLast ? end : end + 1;
+	}
+
+	// A trailing "**" matches everything under the directories.
+	static const char *const anyName = "*";
+	if (components.size && !strcmp(utilVectorAt(&components, char *, components.size - 1), "**") &&
+		!utilVectorPush(&components, &anyName))
+		slakePanic("Out of memory");
+
+	if (components.size)
+	{
+		SlakeGlob glob = { components.data, components.size, SLAKE_MUTEX_INIT, paths };
+		SlakeGlobVisit root = { &glob, (char *)(pattern[0] == '/' ? "/" : ""), 0, NULL };
+		size_t first = paths->size;
+
+		_slakeGlobProc(&root);
+
+		// Patterns with multiple "**" may match a path more than once.
+		char **matches = (char **)paths->data + first;
+		size_t count = paths->size - first, n = 0;
+		if (count)
+			qsort(matches, count, sizeof(char *), _slakeComparePaths);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (n && !strcmp(matches[n - 1], matches[i]))
+				free(matches[i]);
+			else
+				matches[n++] = matches[i];
+		}
+		paths->size = first + n;
+	}
+
+	utilVectorFree(&components);
+	free(buf);
+}
@@ -0,0 +1,13 @@
+#ifndef __GLOB_H__
+#define __GLOB_H__
+
+#include <util/vector.h>
+
+//
+// Patterns are paths separated by '/', components may contain '*', '?' and
+// bracket expressions, and a "**" component matches any levels of
+// directories. Names starting with '.' are only matched explicitly.
+//
+void slakeGlob(const char *pattern, UtilVector *paths);
+
+#endif
@@ -0,0 +1,1082 @@
+#include "image.h"
+#include "module.h"
+#include "source.h"
+#include "vm.h"
+#include <slakedef.h>
+#include <util/hash.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+//
+// A script image is a header followed by the top-level statements of the
+// script. Syntax trees are stored in prefix order with a 16-bit type before
+// each expression, EXPR_INVALID stands for null expressions. Strings are
+// stored with their lengths and terminating null characters, so they are
+// used in place after the image is mapped. The names of global slots come
+// first, since bytecode refers to globals by slots. Functions which had been
+// compiled also carry their bytecode, whose instructions are aligned to 8
+// bytes and used in place as well.
+//
+typedef struct _SlakeImageHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t opCount; // OP_MAX, so images are dropped if instructions change.
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint64_t bodyHash; // Hash of the data after the header.
+	uint32_t stmtCount;
+	uint32_t globalCount; // Count of global slots after executing the statements, which the bytecode was resolved with.
+} SlakeImageHeader;
+
+#define SLAKE_IMAGE_MAGIC "SLKI"
+#define SLAKE_IMAGE_NULL_LENGTH 0xffffffff
+
+typedef struct _SlakeImageWriter
+{
+	UtilVector data; // Data after the header, which is hashed before being written.
+} SlakeImageWriter;
+
+typedef struct _SlakeImageReader
+{
+	char *base, *p, *end;
+	int failed;
+} SlakeImageReader;
+
+//
+// Bytecode read from an image, attached to its function after the statements are executed.
+//
+typedef struct _SlakeImageBytecode
+{
+	size_t stmtIndex;
+	unsigned int localCount;
+	SlakeBytecode *bc;
+} SlakeImageBytecode;
+
+//
+// Get path of the image of a script, named by the hash of the script path.
+//
+static int _slakeGetImagePath(char *buf, size_t size, const char *path)
+{
+	int n = snprintf(buf, size, "%s/%016llx", SLAKE_IMAGE_DIR, (unsigned long long)utilHash64(path, strlen(path), 0));
+	return n < 0 || (size_t)n >= size;
+}
+
+//
+// Writer functions.
+//
+static void _slakeWrite(SlakeImageWriter *w, const void *data, size_t size)
+{
+	if (size && !utilVectorAppend(&w->data, data, size))
+		slakePanic("Out of memory");
+}
+
+static void _slakeWriteU8(SlakeImageWriter *w, uint8_t x) { _slakeWrite(w, &x, sizeof(x)); }
+static void _slakeWriteU16(SlakeImageWriter *w, uint16_t x) { _slakeWrite(w, &x, sizeof(x)); }
+static void _slakeWriteU32(SlakeImageWriter *w, uint32_t x) { _slakeWrite(w, &x, sizeof(x)); }
+static void _slakeWriteU64(SlakeImageWriter *w, uint64_t x) { _slakeWrite(w, &x, sizeof(x)); }
+
+static void _slakeWriteAlign(SlakeImageWriter *w, size_t alignment)
+{
+	static const char zeros[16] = { 0 };
+	size_t offset = sizeof(SlakeImageHeader) + w->data.size;
+	_slakeWrite(w, zeros, (alignment - offset % alignment) % alignment);
+}
+
+static void _slakeWriteString(SlakeImageWriter *w, const char *s)
+{
+	if (!s)
+	{
+		_slakeWriteU32(w, SLAKE_IMAGE_NULL_LENGTH);
+		return;
+	}
+
+	size_t length = strlen(s);
+	_slakeWriteU32(w, (uint32_t)length);
+	_slakeWrite(w, s, length + 1);
+}
+
+static void _slakeWriteSymbol(SlakeImageWriter *w, SlakeSymbol symbol)
+{
+	_slakeWriteString(w, symbol == SLAKE_SYMBOL_NONE ? NULL : slakeGetSymbolName(symbol));
+}
+
+static void _slakeWriteValue(SlakeImageWriter *w, const SlakeValue *value)
+{
+	_slakeWriteU16(w, (uint16_t)value->type);
+	switch (value->type)
+	{
+	case VALUE_TYPE_STR:
+		_slakeWriteString(w, slakeGetString(value));
+		break;
+	case VALUE_TYPE_INT:
+	case VALUE_TYPE_UINT:
+		_slakeWriteU32(w, value->data.u32);
+		break;
+	case VALUE_TYPE_LONG:
+	case VALUE_TYPE_ULONG:
+		_slakeWriteU64(w, value->data.u64);
+		break;
+	default:
+		break;
+	}
+}
+
+static void _slakeWriteExpr(SlakeImageWriter *w, SlakeExpr *expr);
+
+static void _slakeWriteBody(SlakeImageWriter *w, SlakeExecBody body)
+{
+	if (!body)
+	{
+		_slakeWriteU32(w, SLAKE_IMAGE_NULL_LENGTH);
+		return;
+	}
+
+	_slakeWriteU32(w, (uint32_t)body->size);
+	for (size_t i = 0; i < body->size; i++)
+		_slakeWriteExpr(w, utilVectorAt(body, SlakeExpr *, i));
+}
+
+static void _slakeWriteExprs(SlakeImageWriter *w, SlakeExpr **exprs, unsigned short count)
+{
+	_slakeWriteU16(w, count);
+	for (unsigned short i = 0; i < count; i++)
+		_slakeWriteExpr(w, exprs[i]);
+}
+
+static void _slakeWriteExpr(SlakeImageWriter *w, SlakeExpr *expr)
+{
+	if (!expr)
+	{
+		_slakeWriteU16(w, EXPR_INVALID);
+		return;
+	}
+
+	_slakeWriteU16(w, (uint16_t)expr->type);
+	switch (expr->type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+	case EXPR_SUPER_CALL:
+		_slakeWriteSymbol(w, expr->attribs.call.symbol);
+		_slakeWriteExprs(w, expr->attribs.call.params, expr->attribs.call.paramCount);
+		break;
+	case EXPR_AWAIT:
+		_slakeWriteExpr(w, expr->attribs.await);
+		break;
+	case EXPR_EXTERNAL_CALL:
+		_slakeWriteSymbol(w, expr->attribs.externalCall.moduleName);
+		_slakeWriteSymbol(w, expr->attribs.externalCall.funcName);
+		_slakeWriteU8(w, expr->attribs.externalCall.async != 0);
+		_slakeWriteExprs(w, expr->attribs.externalCall.params, expr->attribs.externalCall.paramCount);
+		break;
+	case EXPR_RETURN:
+		_slakeWriteExpr(w, expr->attribs.returnValue);
+		break;
+	case EXPR_IF:
+		_slakeWriteExpr(w, expr->attribs.ifBlock.condition);
+		_slakeWriteBody(w, expr->attribs.ifBlock.trueBlock);
+		_slakeWriteBody(w, expr->attribs.ifBlock.falseBlock);
+		break;
+	case EXPR_SWITCH:
+		_slakeWriteExpr(w, expr->attribs.switchBlock.condition);
+		_slakeWriteU32(w, (uint32_t)expr->attribs.switchBlock.caseCount);
+		for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+		{
+			_slakeWriteExpr(w, expr->attribs.switchBlock.cases[i]->condition);
+			_slakeWriteBody(w, expr->attribs.switchBlock.cases[i]->body);
+		}
+		_slakeWriteBody(w, expr->attribs.switchBlock.defaultBody);
+		break;
+	case EXPR_BREAK:
+	case EXPR_CONTINUE:
+		break;
+	case EXPR_LOOP:
+		_slakeWriteU32(w, (uint32_t)expr->attribs.loopBlock.times);
+		_slakeWriteBody(w, expr->attribs.loopBlock.body);
+		break;
+	case EXPR_FOR:
+		_slakeWriteExpr(w, expr->attribs.forBlock.condition);
+		_slakeWriteExpr(w, expr->attribs.forBlock.loopEnd);
+		_slakeWriteBody(w, expr->attribs.forBlock.body);
+		break;
+	case EXPR_WHILE:
+		_slakeWriteExpr(w, expr->attribs.whileBlock.condition);
+		_slakeWriteBody(w, expr->attribs.whileBlock.body);
+		break;
+	case EXPR_UNARY:
+		_slakeWriteU16(w, (uint16_t)expr->attribs.unaryOp.type);
+		_slakeWriteExpr(w, expr->attribs.unaryOp.r);
+		break;
+	case EXPR_BINARY:
+		_slakeWriteU16(w, (uint16_t)expr->attribs.binaryOp.type);
+		_slakeWriteExpr(w, expr->attribs.binaryOp.l);
+		_slakeWriteExpr(w, expr->attribs.binaryOp.r);
+		break;
+	case EXPR_VALUE:
+		_slakeWriteValue(w, expr->attribs.value);
+		break;
+	case EXPR_VARREF:
+		_slakeWriteSymbol(w, expr->attribs.varRef.symbol);
+		break;
+	case EXPR_VARDEF:
+		_slakeWriteSymbol(w, expr->attribs.varDef.symbol);
+		_slakeWriteU16(w, (uint16_t)expr->attribs.varDef.type);
+		_slakeWriteExpr(w, expr->attribs.varDef.initValue);
+		break;
+	default:
+		slakePanic("Invalid expression type");
+	}
+}
+
+static void _slakeWriteBytecode(SlakeImageWriter *w, SlakeFunction *func)
+{
+	SlakeBytecode *bc = func->bytecode;
+
+	_slakeWriteU32(w, func->localCount);
+	_slakeWriteU16(w, bc->regCount);
+	_slakeWriteU16(w, bc->constCount);
+	for (uint16_t i = 0; i < bc->constCount; i++)
+		_slakeWriteValue(w, &bc->consts[i]);
+	_slakeWriteU16(w, bc->symbolCount);
+	for (uint16_t i = 0; i < bc->symbolCount; i++)
+		_slakeWriteSymbol(w, bc->symbols[i]);
+
+	_slakeWriteU32(w, (uint32_t)bc->insnCount);
+	_slakeWriteAlign(w, 8);
+	_slakeWrite(w, bc->insns, bc->insnCount * sizeof(SlakeInsn));
+}
+
+//
+// Reader functions. Reading past the end sets the failure flag, and
+// returns zeros to let callers finish.
+//
+static void *_slakeRead(SlakeImageReader *r, size_t size)
+{
+	if (r->failed || (size_t)(r->end - r->p) < size)
+	{
+		r->failed = 1;
+		return NULL;
+	}
+
+	void *p = r->p;
+	r->p += size;
+	return p;
+}
+
+#define _SLAKE_DEFINE_READ(name, type)           \
+	static type name(SlakeImageReader *r)        \
+	{                                            \
+		type x = 0;                              \
+		const void *p = _slakeRead(r, sizeof(x)); \
+		if (p)                                   \
+			memcpy(&x, p, sizeof(x));            \
+		return x;                                \
+	}
+
+_SLAKE_DEFINE_READ(_slakeReadU8, uint8_t)
+_SLAKE_DEFINE_READ(_slakeReadU16, uint16_t)
+_SLAKE_DEFINE_READ(_slakeReadU32, uint32_t)
+_SLAKE_DEFINE_READ(_slakeReadU64, uint64_t)
+
+static void _slakeReadAlign(SlakeImageReader *r, size_t alignment)
+{
+	_slakeRead(r, (alignment - (size_t)(r->p - r->base) % alignment) % alignment);
+}
+
+//
+// Read a string in place. Returns NULL for null strings or if failed.
+//
+static char *_slakeReadString(SlakeImageReader *r)
+{
+	uint32_t length = _slakeReadU32(r);
+	if (length == SLAKE_IMAGE_NULL_LENGTH)
+		return NULL;
+
+	char *s = _slakeRead(r, (size_t)length + 1);
+	if (s && s[length])
+		r->failed = 1;
+	return r->failed ? NULL : s;
+}
+
+static SlakeSymbol _slakeReadSymbol(SlakeImageReader *r)
+{
+	const char *name = _slakeReadString(r);
+	return name ? slakeIntern(name) : SLAKE_SYMBOL_NONE;
+}
+
+//
+// Read a value. Strings refer to the image unless copy is set.
+//
+static void _slakeReadValue(SlakeImageReader *r, SlakeValue *value, int copy)
+{
+	uint16_t type = _slakeReadU16(r);
+
+	value->type = VALUE_TYPE_NULL;
+	switch (type)
+	{
+	case VALUE_TYPE_STR:
+	{
+		const char *s = _slakeReadString(r);
+		if (!s)
+			r->failed = 1;
+		else if (copy)
+			slakeSetString(value, s);
+		else
+			*value = slakeMakeArenaString(s);
+		break;
+	}
+	case VALUE_TYPE_INT:
+	case VALUE_TYPE_UINT:
+		value->data.u32 = _slakeReadU32(r);
+		value->type = (SlakeValueType)type;
+		break;
+	case VALUE_TYPE_LONG:
+	case VALUE_TYPE_ULONG:
+		value->data.u64 = _slakeReadU64(r);
+		value->type = (SlakeValueType)type;
+		break;
+	case VALUE_TYPE_NULL:
+		break;
+	default:
+		r->failed = 1;
+	}
+}
+
+static SlakeExpr *_slakeReadExpr(SlakeImageReader *r);
+
+static SlakeExecBody _slakeReadBody(SlakeImageReader *r)
+{
+	uint32_t count = _slakeReadU32(r);
+	if (count == SLAKE_IMAGE_NULL_LENGTH || r->failed)
+		return NULL;
+
+	SlakeExecBody body = slakeCreateExecBody();
+	for (uint32_t i = 0; i < count && !r->failed; i++)
+	{
+		SlakeExpr *expr = _slakeReadExpr(r);
+		if (expr)
+			slakeExprAttach(body, expr);
+		else
+			r->failed = 1;
+	}
+	return body;
+}
+
+//
+// Read expressions into a temporary array, which must be freed by the caller.
+//
+static SlakeExpr **_slakeReadExprs(SlakeImageReader *r, unsigned short *count)
+{
+	*count = _slakeReadU16(r);
+	SlakeExpr **exprs = malloc(sizeof(SlakeExpr *) * (*count ? *count : 1));
+	if (!exprs)
+		slakePanic("Out of memory");
+
+	for (unsigned short i = 0; i < *count; i++)
+		exprs[i] = _slakeReadExpr(r);
+	return exprs;
+}
+
+static SlakeExpr *_slakeReadExpr(SlakeImageReader *r)
+{
+	uint16_t type = _slakeReadU16(r);
+	if (r->failed || type == EXPR_INVALID)
+		return NULL;
+
+	SlakeExpr *expr = NULL, *x, *y;
+	SlakeExpr **params;
+	SlakeExecBody body;
+	SlakeSymbol symbol, funcName;
+	unsigned short paramCount;
+
+	switch (type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+	case EXPR_SUPER_CALL:
+		symbol = _slakeReadSymbol(r);
+		params = _slakeReadExprs(r, &paramCount);
+		if (type == EXPR_CALL)
+			expr = slakeExprCall(symbol, params, paramCount);
+		else if (type == EXPR_CALL_ASYNC)
+			expr = slakeExprCallAsync(symbol, params, paramCount);
+		else
+			expr = slakeExprSuperCall(symbol, params, paramCount);
+		free(params);
+		break;
+	case EXPR_AWAIT:
+		expr = slakeExprAwait(_slakeReadExpr(r));
+		break;
+	case EXPR_EXTERNAL_CALL:
+	{
+		symbol = _slakeReadSymbol(r);
+		funcName = _slakeReadSymbol(r);
+		int async = _slakeReadU8(r);
+		params = _slakeReadExprs(r, &paramCount);
+		if (async)
+			expr = slakeExprExternalCallAsync(symbol, funcName, params, paramCount);
+		else
+			expr = slakeExprExternalCall(symbol, funcName, params, paramCount);
+		free(params);
+		break;
+	}
+	case EXPR_RETURN:
+		expr = slakeExprReturn(_slakeReadExpr(r));
+		break;
+	case EXPR_IF:
+		x = _slakeReadExpr(r);
+		body = _slakeReadBody(r);
+		expr = slakeExprIfBlock(x, body, _slakeReadBody(r));
+		break;
+	case EXPR_SWITCH:
+	{
+		x = _slakeReadExpr(r);
+		uint32_t caseCount = _slakeReadU32(r);
+
+		// Each case takes at least 6 bytes, which limits the count.
+		if (r->failed || caseCount > (size_t)(r->end - r->p) / 6)
+		{
+			r->failed = 1;
+			break;
+		}
+
+		SlakeSwitchCase **cases = malloc(sizeof(SlakeSwitchCase *) * (caseCount ? caseCount : 1));
+		if (!cases)
+			slakePanic("Out of memory");
+		for (uint32_t i = 0; i < caseCount; i++)
+		{
+			y = _slakeReadExpr(r);
+			cases[i] = slakeCreateSwitchCase(y, _slakeReadBody(r));
+		}
+
+		expr = slakeExprSwitch(x, cases, caseCount, _slakeReadBody(r));
+		free(cases);
+		break;
+	}
+	case EXPR_BREAK:
+		expr = slakeExprBreak();
+		break;
+	case EXPR_CONTINUE:
+		expr = slakeExprContinue();
+		break;
+	case EXPR_LOOP:
+	{
+		int times = (int)_slakeReadU32(r);
+		expr = slakeExprLoopBlock(times, _slakeReadBody(r));
+		break;
+	}
+	case EXPR_FOR:
+		x = _slakeReadExpr(r);
+		y = _slakeReadExpr(r);
+		expr = slakeExprForBlock(x, y, _slakeReadBody(r));
+		break;
+	case EXPR_WHILE:
+		x = _slakeReadExpr(r);
+		expr = slakeExprWhileBlock(x, _slakeReadBody(r));
+		break;
+	case EXPR_UNARY:
+	{
+		uint16_t op = _slakeReadU16(r);
+		if (op > UNARY_EXPR_NEG)
+			r->failed = 1;
+		expr = slakeExprUnary((SlakeUnaryExprType)op, _slakeReadExpr(r));
+		break;
+	}
+	case EXPR_BINARY:
+	{
+		uint16_t op = _slakeReadU16(r);
+		if (op > BINARY_EXPR_GTEQ)
+			r->failed = 1;
+		x = _slakeReadExpr(r);
+		expr = slakeExprBinary((SlakeBinaryExprType)op, x, _slakeReadExpr(r));
+		break;
+	}
+	case EXPR_VALUE:
+	{
+		// The value refers to the image directly instead of being copied.
+		SlakeValue *value = utilArenaAlloc(slakeGetCurrentArena(), sizeof(SlakeValue));
+		if (!value)
+			slakePanic("Out of memory");
+		_slakeReadValue(r, value, 0);
+
+		expr = slakeCreateExpr();
+		expr->type = EXPR_VALUE;
+		expr->attribs.value = value;
+		break;
+	}
+	case EXPR_VARREF:
+		expr = slakeExprVarRef(_slakeReadSymbol(r));
+		break;
+	case EXPR_VARDEF:
+	{
+		symbol = _slakeReadSymbol(r);
+		uint16_t valueType = _slakeReadU16(r);
+		if (valueType > VALUE_TYPE_NULL)
+			r->failed = 1;
+		expr = slakeExprVarDef(symbol, (SlakeValueType)valueType, _slakeReadExpr(r));
+		break;
+	}
+	default:
+		r->failed = 1;
+	}
+
+	return r->failed ? NULL : expr;
+}
+
+//
+// Check the jumps and the table following OP_SWITCH at the index.
+//
+static int _slakeCheckSwitch(const SlakeBytecode *bc, size_t index)
+{
+	const SlakeInsn *insn = &bc->insns[index];
+	size_t caseCount = insn->c, table = index + caseCount + 2;
+	if (!caseCount || (size_t)insn->b + caseCount > bc->constCount || table + 2 > bc->insnCount)
+		return 0;
+
+	for (size_t i = index + 1; i < table; i++)
+		if (bc->insns[i].op != OP_JMP)
+			return 0;
+
+	// Cases have the same type, which the VM compares by the first one.
+	const SlakeValue *cases = &bc->consts[insn->b];
+	if (cases->type != VALUE_TYPE_INT && cases->type != VALUE_TYPE_STR)
+		return 0;
+	for (size_t i = 1; i < caseCount; i++)
+		if (cases[i].type != cases->type)
+			return 0;
+
+	uint16_t kind = bc->insns[table].a;
+	uint32_t slotCount = slakeInsnWide(bc->insns[table]);
+	if (slotCount > bc->insnCount - table - 2)
+		return 0;
+
+	size_t emptyCount = 0;
+	for (size_t i = table; i < table + 2 + slotCount; i++)
+	{
+		if (bc->insns[i].op != OP_NOP || (i >= table + 2 && bc->insns[i].a > caseCount))
+			return 0;
+		emptyCount += i >= table + 2 && !bc->insns[i].a;
+	}
+
+	// Probing hashed tables stops at an empty slot.
+	if (kind == SLAKE_SWITCH_DENSE)
+		return cases->type == VALUE_TYPE_INT;
+	return kind == SLAKE_SWITCH_HASHED && slotCount && !(slotCount & (slotCount - 1)) && emptyCount;
+}
+
+//
+// Check that all operands of the instructions are within the bytecode, since
+// the VM does not check them. Returns non-zero if valid.
+//
+static int _slakeCheckBytecode(const SlakeBytecode *bc, unsigned int localCount, size_t globalCount)
+{
+#define REG(x) ((uint32_t)(x) < bc->regCount)
+#define RK(x) ((x) & SLAKE_RK_CONST ? ((x) & SLAKE_RK_MAX) < bc->constCount : REG(x))
+#define TARGET(insn) (slakeInsnWide(insn) < bc->insnCount)
+
+	if (localCount > bc->regCount || !bc->insnCount || bc->insns[bc->insnCount - 1].op != OP_RET)
+		return 0;
+
+	int valid = 1;
+	for (size_t i = 0; valid && i < bc->insnCount; i++)
+	{
+		const SlakeInsn *insn = &bc->insns[i];
+		uint32_t a = insn->a, b = insn->b, c = insn->c;
+
+		switch (insn->op)
+		{
+		case OP_NOP:
+			break;
+		case OP_LOADK:
+			valid = REG(a) && b < bc->constCount;
+			break;
+		case OP_MOVE:
+			valid = REG(a) && REG(b);
+			break;
+		case OP_SETLOCAL:
+		case OP_NOT:
+		case OP_NEG:
+		case OP_BOOL:
+		case OP_AWAIT:
+			valid = REG(a) && RK(b);
+			break;
+		case OP_DEFLOCAL:
+			valid = REG(a) && (b == SLAKE_NO_OPERAND || RK(b)) && c <= VALUE_TYPE_NULL;
+			break;
+		case OP_GETGLOBAL:
+			valid = REG(a) && slakeInsnWide(*insn) < globalCount;
+			break;
+		case OP_SETGLOBAL:
+			valid = RK(a) && slakeInsnWide(*insn) < globalCount;
+			break;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_MOD:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_EQ:
+		case OP_NEQ:
+		case OP_LT:
+		case OP_GT:
+		case OP_LTEQ:
+		case OP_GTEQ:
+			valid = REG(a) && RK(b) && RK(c);
+			break;
+		case OP_CONCAT:
+			valid = RK(b) && c && a + c <= bc->regCount;
+			break;
+		case OP_JMP:
+			valid = TARGET(*insn);
+			break;
+		case OP_JMPF:
+		case OP_JMPT:
+			valid = RK(a) && TARGET(*insn);
+			break;
+		case OP_SWITCH:
+			valid = RK(a) && _slakeCheckSwitch(bc, i);
+			break;
+		case OP_CALL:
+		case OP_SCALL:
+		case OP_ACALL:
+			valid = b < bc->symbolCount && a + c < bc->regCount;
+			break;
+		case OP_XCALL:
+		case OP_XACALL:
+			valid = b + 1 < bc->symbolCount && a + c < bc->regCount;
+			break;
+		case OP_RET:
+			valid = a == SLAKE_NO_OPERAND || RK(a);
+			break;
+		default:
+			valid = 0;
+		}
+	}
+
+#undef TARGET
+#undef RK
+#undef REG
+	return valid;
+}
+
+static SlakeBytecode *_slakeReadBytecode(SlakeImageReader *r, size_t globalCount, unsigned int *localCount)
+{
+	SlakeBytecode *bc = malloc(sizeof(SlakeBytecode));
+	if (!bc)
+		slakePanic("Out of memory");
+
+	*localCount = _slakeReadU32(r);
+	bc->regCount = _slakeReadU16(r);
+	bc->isMapped = 1;
+	bc->insns = NULL;
+	bc->insnCount = 0;
+	bc->symbols = NULL;
+	bc->symbolCount = 0;
+
+	bc->constCount = _slakeReadU16(r);
+	if (!(bc->consts = malloc(sizeof(SlakeValue) * (bc->constCount ? bc->constCount : 1))))
+		slakePanic("Out of memory");
+	for (uint16_t i = 0; i < bc->constCount; i++)
+		_slakeReadValue(r, &bc->consts[i], 1);
+
+	uint16_t symbolCount = _slakeReadU16(r);
+	if (!(bc->symbols = malloc(sizeof(SlakeSymbol) * (symbolCount ? symbolCount : 1))))
+		slakePanic("Out of memory");
+	for (; bc->symbolCount < symbolCount; bc->symbolCount++)
+		bc->symbols[bc->symbolCount] = _slakeReadSymbol(r);
+
+	bc->insnCount = _slakeReadU32(r);
+	_slakeReadAlign(r, 8);
+	bc->insns = _slakeRead(r, bc->insnCount * sizeof(SlakeInsn));
+
+	// Check the instructions once, the VM does not check them.
+	if (!r->failed && !_slakeCheckBytecode(bc, *localCount, globalCount))
+		r->failed = 1;
+
+	return bc;
+}
+
+//
+// Decode statements of an image without executing them.
+//
+static int _slakeReadStatements(SlakeImageReader *r, uint32_t stmtCount, size_t globalCount, UtilVector *stmts, UtilVector *bytecodes)
+{
+	for (uint32_t i = 0; i < stmtCount && !r->failed; i++)
+	{
+		SlakeStmt stmt;
+		stmt.type = (SlakeStmtType)_slakeReadU16(r);
+
+		switch (stmt.type)
+		{
+		case STMT_IMPORT:
+			stmt.attribs.import.name = _slakeReadSymbol(r);
+			if (!(stmt.attribs.import.path = _slakeReadString(r)))
+				r->failed = 1;
+			break;
+		case STMT_GLOBALS:
+			if (!(stmt.attribs.globals = _slakeReadBody(r)))
+				r->failed = 1;
+			break;
+		case STMT_FUNCTION:
+		{
+			stmt.attribs.function.name = _slakeReadSymbol(r);
+			stmt.attribs.function.isPublic = _slakeReadU8(r);
+
+			unsigned short paramCount = _slakeReadU16(r);
+			SlakeParamDef *params = utilArenaAlloc(slakeGetCurrentArena(), sizeof(SlakeParamDef) * (paramCount ? paramCount : 1));
+			if (!params)
+				slakePanic("Out of memory");
+			for (unsigned short j = 0; j < paramCount; j++)
+			{
+				params[j].name = _slakeReadSymbol(r);
+				params[j].type = (SlakeValueType)_slakeReadU16(r);
+				if (params[j].type > VALUE_TYPE_NULL)
+					r->failed = 1;
+			}
+			stmt.attribs.function.params = params;
+			stmt.attribs.function.paramCount = paramCount;
+			stmt.attribs.function.body = _slakeReadBody(r);
+
+			if (_slakeReadU8(r) && !r->failed)
+			{
+				SlakeImageBytecode bytecode;
+				bytecode.stmtIndex = stmts->size;
+				bytecode.bc = _slakeReadBytecode(r, globalCount, &bytecode.localCount);
+				if (!utilVectorPush(bytecodes, &bytecode))
+					slakePanic("Out of memory");
+
+				// Parameters take the first registers.
+				if (bytecode.localCount < paramCount)
+					r->failed = 1;
+			}
+			if (stmt.attribs.function.name == SLAKE_SYMBOL_NONE)
+				r->failed = 1;
+			break;
+		}
+		default:
+			r->failed = 1;
+		}
+
+		if (!r->failed && !utilVectorPush(stmts, &stmt))
+			slakePanic("Out of memory");
+	}
+
+	return r->failed || r->p != r->end;
+}
+
+/**
+ * @brief Initialize the image of a module as not loaded.
+ *
+ * @param image Target image.
+ */
+void slakeInitImage(SlakeImage *image)
+{
+	image->data = NULL;
+	utilVectorInit(&image->bytecodes, sizeof(SlakeImageBytecode), NULL);
+	utilVectorInit(&image->globals, sizeof(SlakeSymbol), NULL);
+	image->isSaved = 0;
+	image->savedBytecodeCount = 0;
+}
+
+/**
+ * @brief Load the image of a module and record its statements instead of
+ * parsing the script. The image is only used if it was saved from the same
+ * source. Syntax trees are allocated from the current arena.
+ *
+ * @param module Target module, whose source hash, size and statement vector
+ * must be set.
+ * @return Non-zero if the image is loaded.
+ */
+int slakeLoadImage(SlakeModule *module)
+{
+	SlakeImage *image = &module->image;
+
+	char imagePath[256];
+	if (image->data || _slakeGetImagePath(imagePath, sizeof(imagePath), module->path) ||
+		!(image->data = slakeLoadSource(imagePath)))
+		return 0;
+
+	SlakeImageReader r = { image->data->data, image->data->data, image->data->data + image->data->size, 0 };
+	const SlakeImageHeader *header = _slakeRead(&r, sizeof(SlakeImageHeader));
+
+	UtilVector stmts;
+	utilVectorInit(&stmts, sizeof(SlakeStmt), NULL);
+
+	int failed = !header || memcmp(header->magic, SLAKE_IMAGE_MAGIC, 4) || header->version != SLAKE_IMAGE_VERSION ||
+				 header->opCount != OP_MAX || header->sourceHash != module->sourceHash ||
+				 header->sourceSize != module->sourceSize ||
+				 header->bodyHash != utilHash64(r.p, (size_t)(r.end - r.p), 0);
+
+	for (uint32_t i = 0; !failed && !r.failed && i < header->globalCount; i++)
+	{
+		SlakeSymbol name = _slakeReadSymbol(&r);
+		if (!utilVectorPush(&image->globals, &name))
+			slakePanic("Out of memory");
+	}
+	failed = failed || _slakeReadStatements(&r, header->stmtCount, image->globals.size, &stmts, &image->bytecodes);
+
+	if (!failed)
+	{
+		for (size_t i = 0; i < stmts.size; i++)
+		{
+			if (!utilVectorPush(module->statements, &utilVectorAt(&stmts, SlakeStmt, i)))
+				slakePanic("Out of memory");
+		}
+	}
+	utilVectorFree(&stmts);
+
+	if (failed)
+	{
+		slakeUnloadImage(module);
+		return 0;
+	}
+
+	image->isSaved = 1;
+	return 1;
+}
+
+//
+// Get the name of a global slot, SLAKE_SYMBOL_NONE if the slot is empty.
+//
+static SlakeSymbol _slakeGetGlobalName(SlakeScope *root, size_t slot)
+{
+	SlakeVariable *var = utilVectorAt(&root->slots, SlakeVariable *, slot);
+	return var ? var->name : SLAKE_SYMBOL_NONE;
+}
+
+//
+// Check if global slots hold the same variables as when the image was saved.
+// Globals may be defined in another order or set, for example under
+// conditions on the environment.
+//
+static int _slakeHasSameGlobals(SlakeScope *root, SlakeImage *image)
+{
+	if (root->slots.size != image->globals.size)
+		return 0;
+
+	for (size_t i = 0; i < image->globals.size; i++)
+	{
+		if (_slakeGetGlobalName(root, i) != utilVectorAt(&image->globals, SlakeSymbol, i))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Attach bytecode in the image of a module to its functions, after
+ * the statements of the module are executed.
+ *
+ * @param module Target module.
+ */
+void slakeAttachImageBytecode(SlakeModule *module)
+{
+	SlakeImage *image = &module->image;
+	SlakeScope *root = module->scope;
+
+	// Bytecode refers to global slots, which must be laid out the same.
+	int hasSameGlobals = _slakeHasSameGlobals(root, image);
+	size_t attached = 0;
+	for (size_t i = 0; i < image->bytecodes.size; i++)
+	{
+		SlakeImageBytecode *bytecode = &utilVectorAt(&image->bytecodes, SlakeImageBytecode, i);
+		SlakeStmt *stmt = &utilVectorAt(module->statements, SlakeStmt, bytecode->stmtIndex);
+		SlakeFunction *func = slakeGetFunction(root, stmt->attribs.function.name);
+
+		if (func && !func->bytecode && hasSameGlobals && func->exprs == stmt->attribs.function.body)
+		{
+			func->localCount = bytecode->localCount;
+			func->isResolved = 1;
+			func->bytecode = bytecode->bc;
+			slakePrefetchModules(root, func->bytecode);
+			attached++;
+		}
+		else
+			slakeDestroyBytecode(bytecode->bc);
+	}
+	utilVectorClear(&image->bytecodes);
+	utilVectorFree(&image->globals);
+
+	image->savedBytecodeCount = attached;
+}
+
+//
+// Get the statement which defines the final version of each function.
+//
+static UtilHashMap *_slakeGetFinalFunctions(UtilVector *stmts)
+{
+	UtilHashMap *finals = utilHashMapNew();
+	if (!finals)
+		slakePanic("Out of memory");
+
+	for (size_t i = 0; i < stmts->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(stmts, SlakeStmt, i);
+		if (stmt->type != STMT_FUNCTION)
+			continue;
+
+		UtilHashMapSlot *slot = utilHashMapInsert(finals, stmt->attribs.function.name);
+		if (!slot)
+			slakePanic("Out of memory");
+		slot->value = stmt;
+	}
+
+	return finals;
+}
+
+/**
+ * @brief Save the image of a loaded module, if it has not been saved or more
+ * functions have been compiled since. Failures are ignored since the image
+ * is only a cache.
+ *
+ * @param module Target module.
+ */
+void slakeSaveImage(SlakeModule *module)
+{
+	SlakeImage *image = &module->image;
+	UtilVector *stmts = module->statements;
+	UtilHashMap *finals = _slakeGetFinalFunctions(stmts);
+	SlakeScope *root = module->scope;
+
+	// Only functions which have not been redefined carry bytecode.
+	size_t bytecodeCount = 0;
+	for (size_t i = 0; i < stmts->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(stmts, SlakeStmt, i);
+		if (stmt->type != STMT_FUNCTION || utilHashMapGet(finals, stmt->attribs.function.name) != stmt)
+			continue;
+
+		SlakeFunction *func = slakeGetFunction(root, stmt->attribs.function.name);
+		if (func && func->bytecode)
+			bytecodeCount++;
+	}
+
+	char imagePath[256], tmpPath[260];
+	if ((image->isSaved && bytecodeCount <= image->savedBytecodeCount) || module->globalCount > UINT32_MAX ||
+		_slakeGetImagePath(imagePath, sizeof(imagePath), module->path))
+	{
+		utilHashMapDelete(finals);
+		return;
+	}
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", imagePath);
+
+#ifdef _WIN32
+	_mkdir(SLAKE_IMAGE_DIR);
+#else
+	mkdir(SLAKE_IMAGE_DIR, 0777);
+#endif
+
+	SlakeImageWriter w;
+	utilVectorInit(&w.data, 1, NULL);
+
+	for (size_t i = 0; i < module->globalCount; i++)
+		_slakeWriteSymbol(&w, _slakeGetGlobalName(root, i));
+
+	for (size_t i = 0; i < stmts->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(stmts, SlakeStmt, i);
+		_slakeWriteU16(&w, (uint16_t)stmt->type);
+
+		switch (stmt->type)
+		{
+		case STMT_IMPORT:
+			_slakeWriteSymbol(&w, stmt->attribs.import.name);
+			_slakeWriteString(&w, stmt->attribs.import.path);
+			break;
+		case STMT_GLOBALS:
+			_slakeWriteBody(&w, stmt->attribs.globals);
+			break;
+		case STMT_FUNCTION:
+		{
+			_slakeWriteSymbol(&w, stmt->attribs.function.name);
+			_slakeWriteU8(&w, stmt->attribs.function.isPublic != 0);
+			_slakeWriteU16(&w, stmt->attribs.function.paramCount);
+			for (unsigned short j = 0; j < stmt->attribs.function.paramCount; j++)
+			{
+				_slakeWriteSymbol(&w, stmt->attribs.function.params[j].name);
+				_slakeWriteU16(&w, (uint16_t)stmt->attribs.function.params[j].type);
+			}
+			_slakeWriteBody(&w, stmt->attribs.function.body);
+
+			SlakeFunction *func = slakeGetFunction(root, stmt->attribs.function.name);
+			int hasBytecode = utilHashMapGet(finals, stmt->attribs.function.name) == stmt && func && func->bytecode;
+			_slakeWriteU8(&w, (uint8_t)hasBytecode);
+			if (hasBytecode)
+				_slakeWriteBytecode(&w, func);
+			break;
+		}
+		}
+	}
+
+	utilHashMapDelete(finals);
+
+	SlakeImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SLAKE_IMAGE_MAGIC, 4);
+	header.version = SLAKE_IMAGE_VERSION;
+	header.opCount = OP_MAX;
+	header.sourceHash = module->sourceHash;
+	header.sourceSize = module->sourceSize;
+	header.bodyHash = utilHash64(w.data.data, w.data.size, 0);
+	header.stmtCount = (uint32_t)stmts->size;
+	header.globalCount = (uint32_t)module->globalCount;
+
+	FILE *fp = fopen(tmpPath, "wb");
+	if (!fp)
+	{
+		utilVectorFree(&w.data);
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(w.data.data, 1, w.data.size, fp);
+	utilVectorFree(&w.data);
+
+	int failed = ferror(fp);
+	if (fclose(fp) || failed)
+	{
+		remove(tmpPath);
+		return;
+	}
+
+#ifdef _WIN32
+	remove(imagePath);
+#endif
+	if (rename(tmpPath, imagePath))
+		remove(tmpPath);
+	else
+	{
+		image->isSaved = 1;
+		image->savedBytecodeCount = bytecodeCount;
+	}
+}
+
+/**
+ * @brief Unload the image of a module. Functions loaded from the image must
+ * have been destroyed.
+ *
+ * @param module Target module.
+ */
+void slakeUnloadImage(SlakeModule *module)
+{
+	SlakeImage *image = &module->image;
+
+	for (size_t i = 0; i < image->bytecodes.size; i++)
+		slakeDestroyBytecode(utilVectorAt(&image->bytecodes, SlakeImageBytecode, i).bc);
+	utilVectorFree(&image->bytecodes);
+	utilVectorFree(&image->globals);
+
+	if (image->data)
+		slakeUnloadSource(image->data);
+	slakeInitImage(image);
+}
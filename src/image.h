@@ -0,0 +1,36 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <slakedef.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "source.h"
+
+// Directory of script images, in the working directory.
+#define SLAKE_IMAGE_DIR ".slake_scripts"
+
+//
+// Version of script images, must be increased when the format, the syntax
+// tree or the bytecode changes.
+//
+#define SLAKE_IMAGE_VERSION 4
+
+//
+// Image of a module.
+//
+typedef struct _SlakeImage
+{
+	SlakeSource *data;		   // Mapped image, referred by loaded syntax trees and bytecode.
+	UtilVector bytecodes;	   // Bytecode read from the image, attached after the statements are executed.
+	UtilVector globals;		   // Names of global slots which the bytecode was resolved with (SlakeSymbol).
+	int isSaved;			   // Non-zero if the image on disk has the current statements.
+	size_t savedBytecodeCount; // Count of compiled functions in the image on disk.
+} SlakeImage;
+
+void slakeInitImage(SlakeImage *image);
+int slakeLoadImage(SlakeModule *module);
+void slakeAttachImageBytecode(SlakeModule *module);
+void slakeSaveImage(SlakeModule *module);
+void slakeUnloadImage(SlakeModule *module);
+
+#endif
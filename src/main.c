@@ -1,18 +1,22 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include <slake.tab.h>
 #include <slakedef.h>
+#include "build.h"
+#include "cache.h"
+#include "exec.h"
+#include "future.h"
+#include "module.h"
 
-extern FILE *slakein;
-extern int slakelineno;
-
-void slakeerror(const char *s, ...)
+void slakeerror(SLAKELTYPE *lloc, SlakeParser *parser, const char *s, ...)
 {
 	va_list vargs;
 	va_start(vargs, s);
 
-	fprintf(stderr, "Error at line %d: ", slakelineno);
-	fprintf(stderr, s, vargs);
+	fprintf(stderr, "Error at %s:%d: ", parser->path, lloc->first_line);
+	vfprintf(stderr, s, vargs);
 	fputs("\n", stderr);
 
 	va_end(vargs);
@@ -27,27 +31,101 @@ int main(int argc, char **argv)
 	_CrtSetReportMode(_CRT_ERROR, _CRTDBG_MODE_DEBUG);
 #endif
 
-	if (argc < 2)
+	const char *src_filename = NULL, *target = "all";
+	int targetSpecified = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strncmp(argv[i], "-j", 2))
+		{
+			// Accept both "-j N" and "-jN".
+			const char *s = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+			if (!s)
+			{
+				puts("Error: Missing job count.");
+				return -1;
+			}
+
+			char *end;
+			long n = strtol(s, &end, 10);
+			if (*end || n <= 0)
+			{
+				printf("Error: Invalid job count:%s\n", s);
+				return -1;
+			}
+			slakeSetMaxJobs((size_t)n);
+		}
+		else if (!src_filename)
+			src_filename = argv[i];
+		else if (!targetSpecified)
+		{
+			target = argv[i];
+			targetSpecified = 1;
+		}
+		else
+		{
+			printf("Error: Unexpected argument:%s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	if (!src_filename)
 	{
 		puts("Error: Too few arguments.");
 		return -1;
 	}
 
-	const char *src_filename = argv[1];
+	slakeInit();
+	slakeLockInterpreter();
+
+	// Imported modules are loaded when they are used.
+	int failed = !slakeLoadMainModule(src_filename);
 
-	if ((slakein = fopen(src_filename, "rb")) == NULL)
+	int exitCode = 0;
+	if (failed)
+		exitCode = 1;
+	else
 	{
-		printf("Error: Error opening file:%s\n", src_filename);
-		return 1;
+		slakeResolveScope(slakeGetRootScope());
+
+		SlakeFunction *func = slakeGetFunction(slakeGetRootScope(), slakeIntern(target));
+		if (!func)
+		{
+			printf("Error: Target not found:%s\n", target);
+			exitCode = 1;
+		}
+		else
+		{
+			SlakeValue result = slakeCallFunction(func, NULL, 0);
+			if (result.type == VALUE_TYPE_FUTURE)
+			{
+				SlakeValue value;
+				value.type = VALUE_TYPE_NULL;
+				slakeAwaitValue(&result, &value);
+				slakeClearValue(&result);
+				result = value;
+			}
+			if (result.type != VALUE_TYPE_STR && result.type != VALUE_TYPE_NULL)
+				exitCode = slakeConvertValue(&result, VALUE_TYPE_INT)->data.i32;
+			slakeClearValue(&result);
+		}
 	}
 
-	slakeparse();
+	// Asynchronous calls which were never awaited still finish.
+	slakeWaitAllFutures();
+
+	// Functions compiled while running are saved into the images as well.
+	slakeSaveModuleImages();
 
-	fclose(slakein);
+	slakeWaitAllJobs();
+	slakeSaveBuildState();
+	slakeCloseActionCache();
+	slakeDestroyBuildGraph();
+	slakeDestroyModules();
 
 #ifdef _WIN32
 	_CrtDumpMemoryLeaks();
 #endif
 
-	return 0;
+	return exitCode;
 }
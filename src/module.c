@@ -0,0 +1,475 @@
+#include "module.h"
+#include "exec.h"
+#include <slake.tab.h>
+#include <util/hash.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static UtilHashMap *modules = NULL;	   // Modules (SlakeModule*), keyed by symbols of their paths.
+static UtilVector prefetchingModules; // Modules (SlakeModule*) whose sources are being loaded ahead.
+
+static SLAKE_NORETURN void _slakePanicf(const char *fmt, const char *s, const char *t)
+{
+	char msg[512];
+	snprintf(msg, sizeof(msg), fmt, s, t);
+	slakePanic(msg);
+}
+
+//
+// Get the module of a path, or create one which has not been loaded.
+//
+static SlakeModule *_slakeGetModule(const char *path)
+{
+	if (!modules)
+	{
+		if (!(modules = utilHashMapNew()))
+			slakePanic("Out of memory");
+		utilVectorInit(&prefetchingModules, sizeof(SlakeModule *), NULL);
+	}
+
+	UtilHashMapSlot *slot = utilHashMapInsert(modules, slakeIntern(path));
+	if (!slot)
+		slakePanic("Out of memory");
+	if (slot->value)
+		return slot->value;
+
+	SlakeModule *module = malloc(sizeof(SlakeModule));
+	if (!module || !(module->path = malloc(strlen(path) + 1)))
+		slakePanic("Out of memory");
+	strcpy(module->path, path);
+
+	module->scope = NULL;
+	module->arena = NULL;
+	module->statements = NULL;
+	module->globalCount = 0;
+	module->source = NULL;
+	module->sourceHash = 0;
+	module->sourceSize = 0;
+	module->task = NULL;
+	slakeInitImage(&module->image);
+	module->state = MODULE_UNLOADED;
+
+	slot->value = module;
+	return module;
+}
+
+static int _slakeIsSeparator(char c)
+{
+#ifdef _WIN32
+	return c == '/' || c == '\\';
+#else
+	return c == '/';
+#endif
+}
+
+//
+// Remove "." and ".." components of a path in place, so that a module is
+// only loaded once when it is imported by different relative paths.
+//
+static void _slakeNormalizePath(char *path)
+{
+	char *out = path, *p = path;
+	size_t keptCount = 0; // Count of components which ".." can remove.
+
+	// Components are written before where they are read from.
+	if (_slakeIsSeparator(*p))
+		*out++ = *p++;
+	char *start = out;
+
+	while (*p)
+	{
+		char *end = p;
+		while (*end && !_slakeIsSeparator(*end))
+			end++;
+		size_t length = (size_t)(end - p);
+		int isParent = length == 2 && p[0] == '.' && p[1] == '.';
+
+		if (!length || (length == 1 && p[0] == '.'))
+			;
+		else if (isParent && keptCount)
+		{
+			// Remove the last component and its separator.
+			while (out > start && !_slakeIsSeparator(out[-1]))
+				out--;
+			if (out > start)
+				out--;
+			keptCount--;
+		}
+		else
+		{
+			if (out > start)
+				*out++ = '/';
+			memmove(out, p, length);
+			out += length;
+			if (!isParent)
+				keptCount++;
+		}
+
+		p = *end ? end + 1 : end;
+	}
+
+	*out = '\0';
+}
+
+//
+// Resolve the path of an imported module. Relative paths are relative to
+// the directory of the importing script.
+//
+static char *_slakeResolvePath(const char *path, const char *importer)
+{
+	const char *dirEnd = NULL;
+	for (const char *p = importer; *p; p++)
+	{
+		if (_slakeIsSeparator(*p))
+			dirEnd = p + 1;
+	}
+
+#ifdef _WIN32
+	int isAbsolute = path[0] == '/' || path[0] == '\\' || (path[0] && path[1] == ':');
+#else
+	int isAbsolute = path[0] == '/';
+#endif
+	size_t dirLength = isAbsolute || !dirEnd ? 0 : (size_t)(dirEnd - importer);
+
+	char *resolved = malloc(dirLength + strlen(path) + 1);
+	if (!resolved)
+		slakePanic("Out of memory");
+	memcpy(resolved, importer, dirLength);
+	strcpy(resolved + dirLength, path);
+
+	_slakeNormalizePath(resolved);
+	return resolved;
+}
+
+//
+// Load the source of a module, and parse it or replay its image. This runs
+// on prefetching tasks, so it must not touch anything but the source, the
+// arena, the statements and the image of the module.
+//
+static int _slakeParseModuleProc(void *arg)
+{
+	SlakeModule *module = arg;
+
+	if (!module->source)
+	{
+		if (!(module->source = slakeLoadSource(module->path)))
+		{
+			printf("Error: Error opening file:%s\n", module->path);
+			return -1;
+		}
+		module->sourceHash = utilHash64(module->source->data, module->source->size, 0);
+		module->sourceSize = module->source->size;
+	}
+
+	// The syntax tree is kept until the module is destroyed.
+	if (!(module->arena = utilArenaNew(0)))
+		slakePanic("Out of memory");
+	UtilArena *savedArena = slakeGetCurrentArena();
+	slakeEnterArena(module->arena);
+	module->statements = slakeCreateStatements();
+
+	// Replay the cached image of the script instead of parsing if possible.
+	int failed = 0;
+	if (!slakeLoadImage(module))
+	{
+		SlakeParser parser;
+		parser.path = module->path;
+		parser.arena = module->arena;
+		parser.statements = module->statements;
+
+		if (!slakeBeginScan(&parser, module->source->data, module->source->size))
+			slakePanic("Error scanning source");
+
+		failed = slakeparse(&parser) || parser.hasError;
+
+		slakeEndScan(&parser);
+
+		// Images keep the folded trees.
+		if (!failed)
+			slakeFoldStatements(module->statements);
+	}
+
+	slakeEnterArena(savedArena);
+	slakeUnloadSource(module->source);
+	module->source = NULL;
+
+	return failed ? -1 : 0;
+}
+
+//
+// Wait for the prefetching task of a module.
+//
+// Returns the result of the task.
+//
+static int _slakeAwaitPrefetch(SlakeModule *module)
+{
+	// The interpreter lock is held, so the current thread has to block. The
+	// task is parsing, so it does not wait for long.
+	int result = slakeAwaitBlocking(module->task);
+	module->task = NULL;
+
+	for (size_t i = 0; i < prefetchingModules.size; i++)
+	{
+		if (utilVectorAt(&prefetchingModules, SlakeModule *, i) == module)
+		{
+			utilVectorAt(&prefetchingModules, SlakeModule *, i) =
+				utilVectorAt(&prefetchingModules, SlakeModule *, prefetchingModules.size - 1);
+			prefetchingModules.size--;
+			break;
+		}
+	}
+
+	return result;
+}
+
+//
+// Release prefetching tasks which have finished.
+//
+static void _slakeReapPrefetches()
+{
+	for (size_t i = prefetchingModules.size; i > 0; i--)
+	{
+		SlakeModule *module = utilVectorAt(&prefetchingModules, SlakeModule *, i - 1);
+		if (!slakeIsTaskAlive(module->task))
+			_slakeAwaitPrefetch(module);
+	}
+}
+
+//
+// Execute top-level statements of a module in its root scope.
+//
+static void _slakeExecStatements(SlakeModule *module)
+{
+	for (size_t i = 0; i < module->statements->size; i++)
+	{
+		SlakeStmt *stmt = &utilVectorAt(module->statements, SlakeStmt, i);
+		switch (stmt->type)
+		{
+		case STMT_IMPORT:
+			slakeImportModule(module->scope, stmt->attribs.import.name, stmt->attribs.import.path, module->path);
+			break;
+		case STMT_GLOBALS:
+			slakeDefineGlobals(module->scope, stmt->attribs.globals);
+			break;
+		case STMT_FUNCTION:
+			slakeDefineFunction(module->scope, stmt->attribs.function.name, stmt->attribs.function.params,
+								stmt->attribs.function.paramCount, stmt->attribs.function.body, stmt->attribs.function.isPublic);
+			break;
+		}
+	}
+}
+
+//
+// Parse a module, or replay its image, and execute its statements.
+//
+static int _slakeLoadModule(SlakeModule *module)
+{
+	assert(module->state == MODULE_UNLOADED);
+
+	int failed = module->task ? _slakeAwaitPrefetch(module) : _slakeParseModuleProc(module);
+	if (failed)
+	{
+		module->state = MODULE_FAILED;
+		return -1;
+	}
+
+	if (!module->scope)
+	{
+		if (!(module->scope = slakeCreateScope(NULL)))
+			slakePanic("Out of memory");
+		slakeInitScope(module->scope);
+	}
+
+	// Functions of the module can be called while the statements are executed.
+	module->state = MODULE_LOADING;
+	_slakeExecStatements(module);
+	module->globalCount = module->scope->slots.size;
+	slakeAttachImageBytecode(module);
+	module->state = MODULE_LOADED;
+
+	slakeSaveImage(module);
+	return 0;
+}
+
+/**
+ * @brief Load the main script into the root scope.
+ *
+ * @param path Path of the script.
+ * @return Module of the script. NULL if failed.
+ */
+SlakeModule *slakeLoadMainModule(const char *path)
+{
+	char *resolved = _slakeResolvePath(path, "");
+	SlakeModule *module = _slakeGetModule(resolved);
+	free(resolved);
+
+	module->scope = slakeGetRootScope();
+
+	return _slakeLoadModule(module) ? NULL : module;
+}
+
+/**
+ * @brief Import a module into a scope. The module will not be loaded until
+ * one of its functions is called.
+ *
+ * @param scope Root scope of the importing module.
+ * @param name Name of the module in the scope.
+ * @param path Path of the module.
+ * @param importer Path of the importing script, which relative paths are
+ * relative to.
+ * @return Imported module.
+ */
+SlakeModule *slakeImportModule(SlakeScope *scope, SlakeSymbol name, const char *path, const char *importer)
+{
+	char *resolved = _slakeResolvePath(path, importer);
+	SlakeModule *module = _slakeGetModule(resolved);
+	free(resolved);
+
+	UtilHashMapSlot *slot = utilHashMapInsert(scope->modules, name);
+	if (!slot)
+		slakePanic("Out of memory");
+	slot->value = module;
+
+	// The path is defined as a global variable as well.
+	SlakeValue value = slakeMakeString(path);
+	slakeSetVariable(scope, name, &value);
+	slakeClearValue(&value);
+
+	return module;
+}
+
+/**
+ * @brief Lookup an imported module in a scope and its parents.
+ *
+ * @param scope Scope to lookup in.
+ * @param name Name of the module.
+ * @return The module. NULL if not found.
+ */
+SlakeModule *slakeLookupModule(SlakeScope *scope, SlakeSymbol name)
+{
+	for (SlakeScope *i = scope; i; i = i->parent)
+	{
+		SlakeModule *module = utilHashMapGet(i->modules, name);
+		if (module)
+			return module;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Get a public function of an imported module, the module will be
+ * loaded if it has not been loaded.
+ *
+ * @param scope Scope which the module is imported in.
+ * @param moduleName Name of the module.
+ * @param funcName Name of the function.
+ * @return The function.
+ */
+SlakeFunction *slakeGetExternalFunction(SlakeScope *scope, SlakeSymbol moduleName, SlakeSymbol funcName)
+{
+	SlakeModule *module = slakeLookupModule(scope, moduleName);
+	if (!module)
+		_slakePanicf("Undefined module: %s", slakeGetSymbolName(moduleName), NULL);
+
+	// Functions of a module which is being loaded can be called as well.
+	if (module->state == MODULE_UNLOADED)
+		_slakeLoadModule(module);
+	if (module->state == MODULE_FAILED)
+		_slakePanicf("Error loading module: %s", module->path, NULL);
+
+	SlakeFunction *func = slakeGetFunction(module->scope, funcName);
+	if (!func)
+		_slakePanicf("Undefined function: %s.%s", slakeGetSymbolName(moduleName), slakeGetSymbolName(funcName));
+	if (!func->isPublic)
+		_slakePanicf("Function is not public: %s.%s", slakeGetSymbolName(moduleName), slakeGetSymbolName(funcName));
+
+	return func;
+}
+
+/**
+ * @brief Start loading and parsing modules called by a function ahead on
+ * parallel tasks, so they are ready when the function calls them. Statements
+ * of the modules are still executed on their first calls.
+ *
+ * @param scope Scope which the function is defined in.
+ * @param bc Bytecode of the function.
+ */
+void slakePrefetchModules(SlakeScope *scope, const SlakeBytecode *bc)
+{
+	for (size_t i = 0; i < bc->insnCount; i++)
+	{
+		const SlakeInsn *insn = &bc->insns[i];
+		if ((insn->op != OP_XCALL && insn->op != OP_XACALL) || insn->b >= bc->symbolCount)
+			continue;
+
+		SlakeModule *module = slakeLookupModule(scope, bc->symbols[insn->b]);
+		if (!module || module->state != MODULE_UNLOADED || module->task || module->arena)
+			continue;
+
+		if (prefetchingModules.size >= slakeGetCpuCount())
+		{
+			_slakeReapPrefetches();
+			if (prefetchingModules.size >= slakeGetCpuCount())
+				return;
+		}
+
+		if (!(module->task = slakeCreateTask(_slakeParseModuleProc, module)))
+			return;
+		if (!utilVectorPush(&prefetchingModules, &module))
+			slakePanic("Out of memory");
+	}
+}
+
+/**
+ * @brief Save images of loaded modules, which include functions compiled
+ * since they were loaded.
+ */
+void slakeSaveModuleImages()
+{
+	if (!modules)
+		return;
+
+	for (size_t i = 0; i < modules->capacity; i++)
+	{
+		SlakeModule *module = modules->slots[i].value;
+		if (modules->slots[i].key && module->state == MODULE_LOADED)
+			slakeSaveImage(module);
+	}
+}
+
+/**
+ * @brief Destroy all modules, including their root scopes and syntax trees.
+ */
+void slakeDestroyModules()
+{
+	if (!modules)
+		return;
+
+	for (size_t i = 0; i < modules->capacity; i++)
+	{
+		SlakeModule *module = modules->slots[i].value;
+		if (!modules->slots[i].key)
+			continue;
+
+		if (module->task)
+			_slakeAwaitPrefetch(module);
+		if (module->source)
+			slakeUnloadSource(module->source);
+
+		// Functions may refer to the image, so they are destroyed first.
+		if (module->scope)
+			slakeDestroyScope(module->scope);
+		if (module->arena)
+			utilArenaDelete(module->arena);
+		slakeUnloadImage(module);
+
+		free(module->path);
+		free(module);
+	}
+
+	utilHashMapDelete(modules);
+	utilVectorFree(&prefetchingModules);
+	modules = NULL;
+}
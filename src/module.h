@@ -0,0 +1,48 @@
+#ifndef __MODULE_H__
+#define __MODULE_H__
+
+#include <slakedef.h>
+#include "image.h"
+#include "source.h"
+#include "task.h"
+#include "vm.h"
+
+typedef enum _SlakeModuleState
+{
+	MODULE_UNLOADED = 0, // Not parsed yet
+	MODULE_LOADING,		 // Statements are being executed
+	MODULE_LOADED,		 // Ready
+	MODULE_FAILED		 // Failed to open or parse
+} SlakeModuleState;
+
+//
+// Script loaded into its own root scope. Imported modules are only parsed
+// when one of their functions is called for the first time.
+//
+typedef struct _SlakeModule
+{
+	char *path;				// Path of the script.
+	SlakeScope *scope;		// Root scope, NULL if not loaded.
+	UtilArena *arena;		// Syntax trees of the module.
+	UtilVector *statements; // Top-level statements (SlakeStmt), in the arena.
+	size_t globalCount;		// Count of global slots after executing the statements.
+
+	SlakeSource *source; // Source text, only kept until the module is parsed.
+	uint64_t sourceHash;
+	size_t sourceSize;
+	SlakeTask *task; // Task parsing the module ahead, NULL if none.
+
+	SlakeImage image;
+	SlakeModuleState state;
+} SlakeModule;
+
+SlakeModule *slakeLoadMainModule(const char *path);
+SlakeModule *slakeImportModule(SlakeScope *scope, SlakeSymbol name, const char *path, const char *importer);
+SlakeModule *slakeLookupModule(SlakeScope *scope, SlakeSymbol name);
+SlakeFunction *slakeGetExternalFunction(SlakeScope *scope, SlakeSymbol moduleName, SlakeSymbol funcName);
+void slakePrefetchModules(SlakeScope *scope, const SlakeBytecode *bc);
+
+void slakeSaveModuleImages();
+void slakeDestroyModules();
+
+#endif
@@ -0,0 +1,205 @@
+#include <slakedef.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct _SlakeResolver
+{
+	SlakeScope *scope;		 // Scope to resolve non-local names in.
+	UtilHashMap *locals;	 // Local slots (plus 1) keyed by symbols, NULL if not in a function.
+	unsigned int localCount; // Count of local slots.
+} SlakeResolver;
+
+static void _slakeResolveExpr(SlakeResolver *r, SlakeExpr *expr);
+
+static void _slakeResolveBody(SlakeResolver *r, SlakeExecBody body)
+{
+	if (!body)
+		return;
+
+	for (size_t i = 0; i < body->size; i++)
+		_slakeResolveExpr(r, utilVectorAt(body, SlakeExpr *, i));
+}
+
+static void _slakeResolveParams(SlakeResolver *r, SlakeExpr **params, unsigned short paramCount)
+{
+	for (unsigned short i = 0; i < paramCount; i++)
+		_slakeResolveExpr(r, params[i]);
+}
+
+//
+// Allocate a local slot for a name, or return the existing one.
+//
+static unsigned int _slakeDefineLocal(SlakeResolver *r, SlakeSymbol name)
+{
+	UtilHashMapSlot *slot = utilHashMapInsert(r->locals, name);
+	if (!slot)
+		slakePanic("Out of memory");
+
+	if (!slot->value)
+		slot->value = (void *)(uintptr_t)(++r->localCount);
+
+	return (unsigned int)(uintptr_t)slot->value - 1;
+}
+
+static void _slakeResolveVarRef(SlakeResolver *r, SlakeExpr *expr)
+{
+	SlakeSymbol name = expr->attribs.varRef.symbol;
+	unsigned int depth = 0;
+
+	if (r->locals)
+	{
+		void *slot = utilHashMapGet(r->locals, name);
+		if (slot)
+		{
+			expr->attribs.varRef.depth = 0;
+			expr->attribs.varRef.slot = (unsigned int)(uintptr_t)slot - 1;
+			return;
+		}
+
+		// Function frames are children of the scope.
+		depth = 1;
+	}
+
+	for (SlakeScope *i = r->scope; i; i = i->parent, depth++)
+	{
+		SlakeVariable *var = slakeGetVariable(i, name);
+		if (var)
+		{
+			expr->attribs.varRef.depth = depth;
+			expr->attribs.varRef.slot = var->slot;
+			return;
+		}
+	}
+
+	char msg[256];
+	snprintf(msg, sizeof(msg), "Undefined variable: %s", slakeGetSymbolName(name));
+	slakePanic(msg);
+}
+
+static void _slakeResolveExpr(SlakeResolver *r, SlakeExpr *expr)
+{
+	if (!expr)
+		return;
+
+	switch (expr->type)
+	{
+	case EXPR_CALL:
+	case EXPR_CALL_ASYNC:
+	case EXPR_SUPER_CALL:
+		_slakeResolveParams(r, expr->attribs.call.params, expr->attribs.call.paramCount);
+		break;
+	case EXPR_AWAIT:
+		_slakeResolveExpr(r, expr->attribs.await);
+		break;
+	case EXPR_EXTERNAL_CALL:
+		_slakeResolveParams(r, expr->attribs.externalCall.params, expr->attribs.externalCall.paramCount);
+		break;
+	case EXPR_RETURN:
+		_slakeResolveExpr(r, expr->attribs.returnValue);
+		break;
+	case EXPR_IF:
+		_slakeResolveExpr(r, expr->attribs.ifBlock.condition);
+		_slakeResolveBody(r, expr->attribs.ifBlock.trueBlock);
+		_slakeResolveBody(r, expr->attribs.ifBlock.falseBlock);
+		break;
+	case EXPR_SWITCH:
+		_slakeResolveExpr(r, expr->attribs.switchBlock.condition);
+		for (size_t i = 0; i < expr->attribs.switchBlock.caseCount; i++)
+		{
+			_slakeResolveExpr(r, expr->attribs.switchBlock.cases[i]->condition);
+			_slakeResolveBody(r, expr->attribs.switchBlock.cases[i]->body);
+		}
+		_slakeResolveBody(r, expr->attribs.switchBlock.defaultBody);
+		break;
+	case EXPR_LOOP:
+		_slakeResolveBody(r, expr->attribs.loopBlock.body);
+		break;
+	case EXPR_FOR:
+		_slakeResolveExpr(r, expr->attribs.forBlock.condition);
+		_slakeResolveBody(r, expr->attribs.forBlock.body);
+		_slakeResolveExpr(r, expr->attribs.forBlock.loopEnd);
+		break;
+	case EXPR_WHILE:
+		_slakeResolveExpr(r, expr->attribs.whileBlock.condition);
+		_slakeResolveBody(r, expr->attribs.whileBlock.body);
+		break;
+	case EXPR_UNARY:
+		_slakeResolveExpr(r, expr->attribs.unaryOp.r);
+		break;
+	case EXPR_BINARY:
+		// The right operand is evaluated first by assignments.
+		_slakeResolveExpr(r, expr->attribs.binaryOp.r);
+		_slakeResolveExpr(r, expr->attribs.binaryOp.l);
+		break;
+	case EXPR_VARREF:
+		_slakeResolveVarRef(r, expr);
+		break;
+	case EXPR_VARDEF:
+		// The initial value cannot refer to the variable itself.
+		_slakeResolveExpr(r, expr->attribs.varDef.initValue);
+		if (r->locals)
+			expr->attribs.varDef.slot = _slakeDefineLocal(r, expr->attribs.varDef.symbol);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Resolve variable references in an expression which will be
+ * executed in a scope directly.
+ *
+ * @param scope Scope to execute the expression in.
+ * @param expr Expression to resolve.
+ */
+void slakeResolveExpr(SlakeScope *scope, SlakeExpr *expr)
+{
+	assert(scope != NULL);
+
+	SlakeResolver r = { scope, NULL, 0 };
+	_slakeResolveExpr(&r, expr);
+}
+
+/**
+ * @brief Resolve variable references in a function and lay out its local
+ * variables. Parameters take the first slots.
+ *
+ * @param scope Scope which the function will be executed in.
+ * @param func Function to resolve.
+ */
+void slakeResolveFunction(SlakeScope *scope, SlakeFunction *func)
+{
+	assert(scope != NULL);
+	assert(func != NULL);
+
+	SlakeResolver r = { scope, utilHashMapNew(), 0 };
+	if (!r.locals)
+		slakePanic("Out of memory");
+
+	for (unsigned short i = 0; i < func->paramCount; i++)
+		_slakeDefineLocal(&r, func->params[i].name);
+	_slakeResolveBody(&r, func->exprs);
+
+	utilHashMapDelete(r.locals);
+
+	func->localCount = r.localCount;
+	func->isResolved = 1;
+}
+
+/**
+ * @brief Resolve all functions in a scope.
+ *
+ * @param scope Target scope.
+ */
+void slakeResolveScope(SlakeScope *scope)
+{
+	assert(scope != NULL);
+
+	for (size_t i = 0; i < scope->functions->capacity; i++)
+	{
+		SlakeFunction *func = scope->functions->slots[i].value;
+		if (scope->functions->slots[i].key && !func->isResolved)
+			slakeResolveFunction(scope, func);
+	}
+}
@@ -4,89 +4,110 @@
 #include <string.h>
 #include <slakedef.h>
 #include <assert.h>
+%}
 
-static SlakeExecBody currentExecBody = NULL;
-static SlakeSwitchCase** currentSwitchCases = NULL;
-static size_t currentSwitchCaseCount = 0;
-
+%code {
 //
-// Push an expression into current execution body.
+// Create a temporary vector for parsing.
 //
-static void pushExpr(SlakeExpr* expr)
+static UtilVector* newVector(size_t dataSize)
 {
-	assert(expr!=NULL);
-
-	if(!currentExecBody)
-		currentExecBody = slakeCreateExecBody();
+	UtilVector* vec = utilVectorNew(dataSize);
+	if(!vec)
+		slakePanic("Out of memory");
 
-	slakeExprAttach(currentExecBody, expr);
+	return vec;
 }
 
 //
-// Get current execution body and reset for new execution body.
+// Push an element to a temporary vector and return the vector.
 //
-static SlakeExecBody postCurrentExecBody()
+static UtilVector* pushVector(UtilVector* vec, const void* elem)
 {
-	SlakeExecBody execBody = currentExecBody;
-	currentExecBody = NULL;
-	return execBody;
+	if(!utilVectorPush(vec, elem))
+		slakePanic("Out of memory");
+
+	return vec;
 }
 
 //
-// Push a switch case.
+// Build a compound assignment, which applies the operation to the target
+// and stores the result into it. The target must be a variable reference,
+// NULL is returned and an error is reported otherwise.
 //
-static void pushSwitchCase(SlakeSwitchCase* swCase)
+static SlakeExpr* compoundAssign(SlakeBinaryExprType op, SlakeExpr* target, SlakeExpr* value, SLAKELTYPE* lloc, SlakeParser* parser)
 {
-	if(!currentSwitchCases)
-		currentSwitchCases = malloc(sizeof(SlakeSwitchCase));
-	else
-		currentSwitchCases = realloc(currentSwitchCases, sizeof(SlakeSwitchCase*) * (currentSwitchCaseCount + 1));
-
-	if(!currentSwitchCases)
-		slakePanic("Out of memory");
+	if(target->type != EXPR_VARREF)
+	{
+		slakeerror(lloc, parser, "Invalid target of compound assignment");
+		return NULL;
+	}
 
-	currentSwitchCases[currentSwitchCaseCount] = swCase;
-	currentSwitchCaseCount++;
+	return slakeExprBinary(BINARY_EXPR_MOV, target, slakeExprBinary(op, slakeExprVarRef(target->attribs.varRef.symbol), value));
 }
 
 //
-// Get current switch cases and reset for new switch cases.
+// Wrap an expression into a new execution body.
 //
-static SlakeSwitchCase** postCurrentSwitchCases()
+static SlakeExecBody wrapExpr(SlakeExpr* expr)
 {
-	SlakeSwitchCase** swCases = currentSwitchCases;
-	currentSwitchCases = NULL;
-	return swCases;
+	return slakeExprAttach(slakeCreateExecBody(), expr);
+}
 }
-%}
 
 %define api.prefix {slake}
+%define api.pure full
 %define parse.error verbose
 %locations
+%parse-param {SlakeParser* parser}
+%lex-param {SlakeParser* parser}
 
 %code requires {
 #include <slakedef.h>
 
-extern FILE* slakein;
-extern int slakelineno;
+//
+// Context of a parsing. Each script is parsed with its own context, so that
+// multiple scripts can be parsed concurrently.
+//
+typedef struct _SlakeParser
+{
+	void* scanner; // State of the scanner.
+	const char* path; // Path of the script, for error messages.
+	UtilArena* arena; // Arena which syntax trees are allocated from.
+	UtilVector* statements; // Top-level statements (SlakeStmt), allocated from the arena.
 
-int slakelex();
-int slakeparse();
-void slakeerror(const char* msg, ...);
+	char* stringBuf; // Buffer of the string literal being scanned.
+	size_t stringLength, stringCapacity;
+	int hasError; // Set if the scanner has reported an error, which fails the parsing.
+	unsigned int loopDepth; // Count of loops enclosing the body being parsed.
+} SlakeParser;
+}
+
+%code provides {
+int slakeBeginScan(SlakeParser* parser, char* base, size_t size);
+void slakeEndScan(SlakeParser* parser);
+int slakelex(SLAKESTYPE* lval, SLAKELTYPE* lloc, SlakeParser* parser);
+int slakeparse(SlakeParser* parser);
+void slakeerror(SLAKELTYPE* lloc, SlakeParser* parser, const char* msg, ...);
 }
 
 %union
 {
-	char* str;
+	char* str; // Borrowed from the scanner, valid until the parsing is finished.
+	SlakeSymbol symbol;
 	int i32;
 	unsigned int u32;
 	long long i64;
 	unsigned long long u64;
-	SlakeValue* value;
+	SlakeValue value; // Immediate value, the string is owned by the arena.
 	SlakeValueType type;
 	SlakeExpr* expr;
 	SlakeExecBody execBody;
 	SlakeSwitchCase* swCase;
+	SlakeParamDef paramDef;
+	UtilVector* exprList; // Vector of SlakeExpr*.
+	UtilVector* paramDefs; // Vector of SlakeParamDef.
+	UtilVector* swCases; // Vector of SlakeSwitchCase*.
 }
 
 // Tokens
@@ -107,7 +128,7 @@ void slakeerror(const char* msg, ...);
 %token T_XOR_ASSIGN "^="
 
 // Miscellaneous
-%token <str> SYMBOL
+%token <symbol> SYMBOL
 
 // Keywords
 %token KW_VAR "var"
@@ -146,13 +167,14 @@ void slakeerror(const char* msg, ...);
 %type <type> typeName
 
 %type <execBody> execBody
+%type <execBody> loopBody
 %type <execBody> exprs
+%type <execBody> expr
+%type <execBody> singleExpr
+%type <execBody> valuedExprs
 %type <expr> leftExpr
 %type <expr> rightExpr
-%type <expr> valuedExprs
 %type <expr> valuedExpr
-%type <expr> expr
-%type <expr> singleExpr
 %type <expr> blockExpr
 
 %type <expr> funcCall
@@ -160,18 +182,35 @@ void slakeerror(const char* msg, ...);
 %type <expr> superFuncCall
 %type <expr> externalFuncCall
 %type <expr> asyncExternalFuncCall
+%type <exprList> params
+%type <exprList> paramList
+
+%type <paramDefs> paramDefs
+%type <paramDefs> paramDefList
+%type <paramDef> paramDef
 
 %type <expr> return
 %type <expr> await
 
 %type <expr> varRef
+%type <execBody> varDeclExpr
+%type <execBody> varDecls
+%type <expr> varDecl
 
 %type <expr> basicOp
 
 %type <expr> switchBlock
+%type <swCases> switchCases
 %type <swCase> switchCase
 %type <execBody> switchDefault
 
+%type <expr> ifBlock
+%type <execBody> elseBlock
+%type <expr> whileBlock
+%type <expr> loopBlock
+%type <execBody> forBlock
+%type <execBody> forInit
+
 %left '=' "+=" "-=" "*=" "/=" "%=" "|=" "&=" "^="
 %left "||"
 %left "&&"
@@ -183,7 +222,7 @@ void slakeerror(const char* msg, ...);
 %left '+' '-'
 %left '*' '/' '%'
 
-%precedence '!' T_NEG
+%precedence '!' T_NEG "await"
 
 %%
 
@@ -193,7 +232,7 @@ statements statement|
 
 statement:
 import ';'|
-varDeclExpr ';'|
+varDeclExpr ';' { slakeAddGlobals(parser->statements, $1); }|
 funcDef|
 pubFuncDef;
 
@@ -203,9 +242,7 @@ pubFuncDef;
 import:
 "import" SYMBOL '=' STR
 {
-	SlakeValue* value = slakeMakeString($2);
-	slakeSetVariable(slakeGetRootScope(), $2, value);
-	slakeDestroyValue(value);
+	slakeAddImport(parser->statements, $2, $4);
 };
 
 //
@@ -214,6 +251,8 @@ import:
 funcDef:
 "function" SYMBOL '(' paramDefs ')' '{' execBody '}'
 {
+	slakeAddFunction(parser->statements, $2, $4->data, (unsigned short)$4->size, $7, 0);
+	utilVectorDelete($4);
 };
 
 //
@@ -222,41 +261,75 @@ funcDef:
 pubFuncDef:
 "public" "function" SYMBOL '(' paramDefs ')' '{' execBody '}'
 {
+	slakeAddFunction(parser->statements, $3, $5->data, (unsigned short)$5->size, $8, 1);
+	utilVectorDelete($5);
 };
 
 //
 // Parameter definitions.
 //
 paramDefs:
-paramDefs ',' paramDef | paramDef | %empty;
+paramDefList { $$ = $1; }|
+%empty { $$ = newVector(sizeof(SlakeParamDef)); };
+
+paramDefList:
+paramDefList ',' paramDef
+{
+	$$ = pushVector($1, &$3);
+}|
+paramDef
+{
+	$$ = pushVector(newVector(sizeof(SlakeParamDef)), &$1);
+};
+
 paramDef:
 SYMBOL ':' typeName
 {
+	$$.name = $1;
+	$$.type = $3;
 };
 
 //
 // Execution body.
 //
-execBody: exprs { $$ = postCurrentExecBody(); } | %empty;
+execBody: exprs { $$ = $1; } | %empty { $$ = NULL; };
 
 //
 // Expressions.
 //
 exprs:
-exprs expr { pushExpr($2); } |
-expr { pushExpr($1); };
+exprs expr { $$ = slakeExecBodyMerge($1, $2); } |
+expr { $$ = $1; };
 
 expr:
 singleExpr ';' { $$ = $1; } |
-blockExpr { $$ = $1; };
+blockExpr { $$ = wrapExpr($1); } |
+forBlock { $$ = $1; };
 
 //
 // Single expressions (need a semicolon to terminate).
 //
 singleExpr:
-varDeclExpr { $$ = NULL; } |
-return { $$ = $1; } |
-await { $$ = $1; } |
+varDeclExpr { $$ = $1; } |
+return { $$ = wrapExpr($1); } |
+"break"
+{
+	if(!parser->loopDepth)
+	{
+		slakeerror(&@1, parser, "Break outside of loops");
+		YYERROR;
+	}
+	$$ = wrapExpr(slakeExprBreak());
+} |
+"continue"
+{
+	if(!parser->loopDepth)
+	{
+		slakeerror(&@1, parser, "Continue outside of loops");
+		YYERROR;
+	}
+	$$ = wrapExpr(slakeExprContinue());
+} |
 valuedExprs { $$ = $1; };
 
 //
@@ -265,11 +338,11 @@ valuedExprs { $$ = $1; };
 valuedExprs:
 valuedExprs ',' valuedExpr
 {
-	pushExpr($3);
+	$$ = slakeExprAttach($1, $3);
 }|
 valuedExpr
 {
-	pushExpr($1);
+	$$ = wrapExpr($1);
 };
 
 valuedExpr:
@@ -281,19 +354,23 @@ leftExpr:
 varRef { $$ = $1; };
 
 rightExpr:
-immediateValue { $$ = slakeExprImmediateValue($1); slakeDestroyValue($1); }|
+immediateValue { $$ = slakeExprImmediateValue(&$1); }|
 funcCall { $$ = $1; }|
 asyncFuncCall { $$ = $1; }|
 superFuncCall { $$ = $1; }|
 externalFuncCall { $$ = $1; }|
 asyncExternalFuncCall { $$ = $1; }|
+await { $$ = $1; }|
 basicOp { $$ = $1; };
 
 //
 // Block expressions.
 //
 blockExpr:
-switchBlock { $$ = $1; };
+switchBlock { $$ = $1; }|
+ifBlock { $$ = $1; }|
+whileBlock { $$ = $1; }|
+loopBlock { $$ = $1; };
 
 //
 // Variable reference.
@@ -301,8 +378,7 @@ switchBlock { $$ = $1; };
 varRef:
 SYMBOL
 {
-	SlakeExpr* expr = slakeExprVarRef($1);
-	$$ = expr;
+	$$ = slakeExprVarRef($1);
 }
 
 //
@@ -310,14 +386,14 @@ SYMBOL
 //
 basicOp:
 leftExpr '=' valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, $3); }|
-leftExpr "+=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_ADD, $1, $3)); }|
-leftExpr "-=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_SUB, $1, $3)); }|
-leftExpr "*=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_MUL, $1, $3)); }|
-leftExpr "/=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_DIV, $1, $3)); }|
-leftExpr "%=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_MOD, $1, $3)); }|
-leftExpr "|=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_OR, $1, $3)); }|
-leftExpr "&=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_AND, $1, $3)); }|
-leftExpr "^=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MOV, $1, slakeExprBinary(BINARY_EXPR_XOR, $1, $3)); }|
+leftExpr "+=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_ADD, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "-=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_SUB, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "*=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_MUL, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "/=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_DIV, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "%=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_MOD, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "|=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_OR, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "&=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_AND, $1, $3, &@1, parser))) YYERROR; }|
+leftExpr "^=" valuedExpr { if(!($$ = compoundAssign(BINARY_EXPR_XOR, $1, $3, &@1, parser))) YYERROR; }|
 valuedExpr '+' valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_ADD, $1, $3); }|
 valuedExpr '-' valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_SUB, $1, $3); }|
 valuedExpr '*' valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_MUL, $1, $3); }|
@@ -343,6 +419,8 @@ valuedExpr "!=" valuedExpr { $$ = slakeExprBinary(BINARY_EXPR_NEQ, $1, $3); }|
 funcCall:
 SYMBOL '(' params ')'
 {
+	$$ = slakeExprCall($1, $3->data, (unsigned short)$3->size);
+	utilVectorDelete($3);
 };
 
 //
@@ -351,6 +429,8 @@ SYMBOL '(' params ')'
 asyncFuncCall:
 SYMBOL '(' params ')' "async"
 {
+	$$ = slakeExprCallAsync($1, $3->data, (unsigned short)$3->size);
+	utilVectorDelete($3);
 };
 
 //
@@ -359,6 +439,8 @@ SYMBOL '(' params ')' "async"
 superFuncCall:
 '@' SYMBOL '(' params ')'
 {
+	$$ = slakeExprSuperCall($2, $4->data, (unsigned short)$4->size);
+	utilVectorDelete($4);
 };
 
 //
@@ -367,6 +449,8 @@ superFuncCall:
 externalFuncCall:
 SYMBOL SYMBOL '(' params ')'
 {
+	$$ = slakeExprExternalCall($1, $2, $4->data, (unsigned short)$4->size);
+	utilVectorDelete($4);
 };
 
 //
@@ -375,6 +459,8 @@ SYMBOL SYMBOL '(' params ')'
 asyncExternalFuncCall:
 SYMBOL SYMBOL '(' params ')' "async"
 {
+	$$ = slakeExprExternalCallAsync($1, $2, $4->data, (unsigned short)$4->size);
+	utilVectorDelete($4);
 };
 
 //
@@ -383,9 +469,11 @@ SYMBOL SYMBOL '(' params ')' "async"
 return:
 "return" valuedExpr
 {
+	$$ = slakeExprReturn($2);
 }|
 "return"
 {
+	$$ = slakeExprReturn(NULL);
 };
 
 //
@@ -401,28 +489,34 @@ await:
 // Parameters.
 //
 params:
-params ',' valuedExpr
-{
+paramList { $$ = $1; }|
+%empty { $$ = newVector(sizeof(SlakeExpr*)); };
 
+paramList:
+paramList ',' valuedExpr
+{
+	$$ = pushVector($1, &$3);
 }|
 valuedExpr
 {
-}|
-%empty;
+	$$ = pushVector(newVector(sizeof(SlakeExpr*)), &$1);
+};
 
 //
 // Variable declaration.
 //
-varDeclExpr: "var" varDecls;
-varDecls: varDecls ',' varDecl | varDecl;
+varDeclExpr: "var" varDecls { $$ = $2; };
+varDecls:
+varDecls ',' varDecl { $$ = slakeExprAttach($1, $3); }|
+varDecl { $$ = wrapExpr($1); };
 varDecl:
 SYMBOL ':' typeName '=' valuedExpr
 {
-
+	$$ = slakeExprVarDef($1, $3, $5);
 }|
 SYMBOL ':' typeName
 {
-
+	$$ = slakeExprVarDef($1, $3, NULL);
 };
 
 //
@@ -431,21 +525,22 @@ SYMBOL ':' typeName
 switchBlock:
 "switch" '(' valuedExpr ')' '{' switchCases switchDefault '}'
 {
-	$$ = slakeExprSwitch($3, postCurrentSwitchCases(), currentSwitchCaseCount, $7);
-	currentSwitchCaseCount = 0;
+	$$ = slakeExprSwitch($3, $6->data, $6->size, $7);
+	utilVectorDelete($6);
 }|
 "switch" '(' valuedExpr ')' '{' switchCases '}'
 {
-	$$ = slakeExprSwitch($3, postCurrentSwitchCases(), currentSwitchCaseCount, NULL);
+	$$ = slakeExprSwitch($3, $6->data, $6->size, NULL);
+	utilVectorDelete($6);
 };
 
 switchCases: switchCases switchCase
 {
-	pushSwitchCase($2);
+	$$ = pushVector($1, &$2);
 }|
 switchCase
 {
-	pushSwitchCase($1);
+	$$ = pushVector(newVector(sizeof(SlakeSwitchCase*)), &$1);
 };
 
 switchCase:
@@ -464,24 +559,65 @@ switchDefault:
 // If blocks.
 //
 ifBlock:
-if |
-ifBlock elif |
-ifBlock else;
+"if" '(' valuedExpr ')' '{' execBody '}' elseBlock
+{
+	$$ = slakeExprIfBlock($3, $6, $8);
+};
 
-if:
-"if" '(' valuedExpr ')' '{' execBody '}'
+elseBlock:
+"elif" '(' valuedExpr ')' '{' execBody '}' elseBlock
+{
+	$$ = wrapExpr(slakeExprIfBlock($3, $6, $8));
+}|
+"else" '{' execBody '}'
+{
+	$$ = $3;
+}|
+%empty
 {
+	$$ = NULL;
 };
-elif:
-"elif" '(' valuedExpr ')' '{' execBody '}'
+
+//
+// Loop blocks.
+//
+whileBlock:
+"while" '(' valuedExpr ')' loopBody
 {
+	$$ = slakeExprWhileBlock($3, $5);
 };
-else:
-"else" '{' execBody '}'
+
+loopBlock:
+"loop" '(' INT ')' loopBody
+{
+	$$ = slakeExprLoopBlock($3, $5);
+}|
+"loop" loopBody
 {
+	$$ = slakeExprLoopBlock(-1, $2);
+};
 
+forBlock:
+"for" '(' forInit ';' valuedExpr ';' valuedExpr ')' loopBody
+{
+	$$ = slakeExprAttach($3, slakeExprForBlock($5, $7, $9));
 };
 
+//
+// Body of a loop, where break and continue are allowed.
+//
+loopBody:
+'{' { parser->loopDepth++; } execBody '}'
+{
+	parser->loopDepth--;
+	$$ = $3;
+};
+
+forInit:
+varDeclExpr { $$ = $1; }|
+valuedExprs { $$ = $1; }|
+%empty { $$ = slakeCreateExecBody(); };
+
 //
 // Value types.
 //
@@ -496,10 +632,10 @@ typeName:
 // Values.
 //
 immediateValue:
-STR { $$ = slakeMakeString($1); }|
-INT { $$ = slakeMakeInt($1); }|
-UINT { $$ = slakeMakeUInt($1); }|
-LONG { $$ = slakeMakeLong($1); }|
-ULONG { $$ = slakeMakeULong($1); };
+STR { $$ = slakeMakeArenaString($1); }|
+INT { $$.type = VALUE_TYPE_INT; $$.data.i32 = $1; }|
+UINT { $$.type = VALUE_TYPE_UINT; $$.data.u32 = $1; }|
+LONG { $$.type = VALUE_TYPE_LONG; $$.data.i64 = $1; }|
+ULONG { $$.type = VALUE_TYPE_ULONG; $$.data.u64 = $1; };
 
 %%
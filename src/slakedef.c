@@ -1,21 +1,52 @@
 #include "slakedef.h"
 #include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "future.h"
+#include "vm.h"
 
 SlakeScope *rootScope = NULL;
+
 SlakeScope *currentScope = NULL;
 
+// The current arena is per thread, so that scripts can be parsed on multiple
+// threads. It is only set while parsing, which never suspends, so running
+// scripts get their scopes explicitly instead.
+#ifdef _MSC_VER
+static __declspec(thread) UtilArena *currentArena = NULL;
+#else
+static __thread UtilArena *currentArena = NULL;
+#endif
+
 /**
  * @brief Initialize Slake runtime.
  */
 void slakeInit()
 {
 	rootScope = slakeCreateScope(NULL);
+	if (!rootScope)
+		slakePanic("Out of memory");
 	currentScope = rootScope;
+
+	slakeInitScope(rootScope);
+
 	slakeDbgPrintf("Initialized Slake runtime");
 }
 
+/**
+ * @brief Define built-in variables in the root scope of a module.
+ *
+ * @param scope Target scope.
+ */
+void slakeInitScope(SlakeScope *scope)
+{
+	SlakeValue host = slakeMakeString(SLAKE_HOST);
+	slakeSetVariable(scope, slakeIntern("__SLAKE_HOST__"), &host);
+	slakeClearValue(&host);
+}
+
 /**
  * @brief Get root (global) scope object.
  *
@@ -26,6 +57,55 @@ SlakeScope *slakeGetRootScope()
 	return rootScope;
 }
 
+/**
+ * @brief Get the arena which syntax trees are allocated from on the current
+ * thread.
+ *
+ * @return Current arena object. NULL if not set.
+ */
+UtilArena *slakeGetCurrentArena()
+{
+	return currentArena;
+}
+
+/**
+ * @brief Set the arena which syntax trees are allocated from on the current
+ * thread. Expressions, their values, switch cases and execution bodies are
+ * owned by the arena and released with it.
+ *
+ * @param arena Arena object.
+ */
+void slakeEnterArena(UtilArena *arena)
+{
+	currentArena = arena;
+}
+
+//
+// Allocate memory for syntax trees from the current arena.
+//
+static void *_slakeArenaAlloc(size_t size)
+{
+	assert(currentArena != NULL);
+
+	void *p = utilArenaAlloc(currentArena, size);
+	if (!p)
+		slakePanic("Out of memory");
+
+	return p;
+}
+
+//
+// Copy an array of syntax tree objects into the current arena.
+//
+static void *_slakeArenaDup(const void *data, size_t size)
+{
+	void *p = _slakeArenaAlloc(size);
+	if (size)
+		memcpy(p, data, size);
+
+	return p;
+}
+
 /**
  * @brief Create a new scope object.
  *
@@ -38,13 +118,17 @@ SlakeScope *slakeCreateScope(SlakeScope *parent)
 	if (!scope)
 		return NULL;
 
-	parent->parent = parent;
-	parent->functions = utilListNew(sizeof(SlakeFunction));
-	if (parent->functions)
+	scope->parent = parent;
+	scope->functions = utilHashMapNew();
+	if (!scope->functions)
+		slakePanic("Out of memory");
+	scope->variables = utilHashMapNew();
+	if (!scope->variables)
 		slakePanic("Out of memory");
-	parent->variables = utilListNew(sizeof(SlakeVariable));
-	if (!parent->variables)
+	scope->modules = utilHashMapNew();
+	if (!scope->modules)
 		slakePanic("Out of memory");
+	utilVectorInit(&scope->slots, sizeof(SlakeVariable *), NULL);
 
 	return scope;
 }
@@ -105,16 +189,21 @@ void slakeEnterScope(SlakeScope *scope)
  * @param func Function object.
  * @return Created function object.
  */
-SlakeFunction *slakeSetFunction(SlakeScope *scope, const char *name, SlakeFunction *func)
+SlakeFunction *slakeSetFunction(SlakeScope *scope, SlakeSymbol name, SlakeFunction *func)
 {
-	assert(name != NULL);
+	assert(name != SLAKE_SYMBOL_NONE);
 
-	slakeUndefFunction(scope, name);
+	func->name = name;
+	func->scope = scope;
 
-	UtilListNode *node = utilListNodeNew(scope->functions, func);
-	if (!node)
+	UtilHashMapSlot *slot = utilHashMapInsert(scope->functions, name);
+	if (!slot)
 		slakePanic("Out of memory");
-	utilListAppend(scope->functions, node);
+
+	// Setting a function to its own name keeps it.
+	if (slot->value && slot->value != func)
+		slakeDestroyFunction(slot->value);
+	slot->value = func;
 
 	return func;
 }
@@ -127,38 +216,34 @@ SlakeFunction *slakeSetFunction(SlakeScope *scope, const char *name, SlakeFuncti
  * @param value Variable value.
  * @return Created variable object.
  */
-SlakeVariable *slakeSetVariable(SlakeScope *scope, const char *name, SlakeValue *value)
+SlakeVariable *slakeSetVariable(SlakeScope *scope, SlakeSymbol name, SlakeValue *value)
 {
-	assert(name != NULL);
+	assert(name != SLAKE_SYMBOL_NONE);
 
-	slakeUndefVariable(scope, name);
-	SlakeVariable *var = slakeCreateVariable();
-	if (!var)
+	UtilHashMapSlot *slot = utilHashMapInsert(scope->variables, name);
+	if (!slot)
 		slakePanic("Out of memory");
 
-	var->value = slakeCopyValue(value);
+	// Existing variables are reused.
+	SlakeVariable *var = slot->value;
+	if (!var)
+	{
+		var = slakeCreateVariable();
+		if (!var)
+			slakePanic("Out of memory");
 
-	UtilListNode *node = utilListNodeNew(scope->variables, var);
-	if (!node)
-		slakePanic("Out of memory");
+		var->name = name;
+		var->slot = (unsigned int)scope->slots.size;
+		if (!utilVectorPush(&scope->slots, &var))
+			slakePanic("Out of memory");
+		slot->value = var;
+	}
 
-	utilListAppend(scope->variables, node);
+	slakeAssignValue(&var->value, value);
 
 	return var;
 }
 
-static UtilListNode *_slakeGetFunction(SlakeScope *scope, const char *name)
-{
-	for (UtilListNode *i = scope->functions->begin; i != scope->functions->end; i = i->next)
-	{
-		SlakeFunction *fn = i->data;
-		if (!strcmp(fn->name, name))
-			return i;
-	}
-
-	return NULL;
-}
-
 /**
  * @brief Get a named function from a scope.
  *
@@ -166,41 +251,57 @@ static UtilListNode *_slakeGetFunction(SlakeScope *scope, const char *name)
  * @param name Function name.
  * @return Corresponding function name. NULL if not found.
  */
-SlakeFunction *slakeGetFunction(SlakeScope *scope, const char *name)
+SlakeFunction *slakeGetFunction(SlakeScope *scope, SlakeSymbol name)
 {
-	UtilListNode *node = _slakeGetFunction(scope, name);
-
-	if (node)
-		return node->data;
+	return utilHashMapGet(scope->functions, name);
+}
 
-	return NULL;
+/**
+ * @brief Get a named variable from a scope.
+ *
+ * @param scope Target scope.
+ * @param name Variable name.
+ * @return Corresponding variable object. NULL if not found.
+ */
+SlakeVariable *slakeGetVariable(SlakeScope *scope, SlakeSymbol name)
+{
+	return utilHashMapGet(scope->variables, name);
 }
 
-static UtilListNode *_slakeGetVariable(SlakeScope *scope, const char *name)
+/**
+ * @brief Find a named function in a scope and its parents.
+ *
+ * @param scope Scope to start with.
+ * @param name Function name.
+ * @return Corresponding function object. NULL if not found.
+ */
+SlakeFunction *slakeLookupFunction(SlakeScope *scope, SlakeSymbol name)
 {
-	for (UtilListNode *i = scope->variables->begin; i != scope->variables->end; i = i->next)
+	for (SlakeScope *i = scope; i; i = i->parent)
 	{
-		SlakeVariable *fn = i->data;
-		if (!strcmp(fn->name, name))
-			return i;
+		SlakeFunction *func = slakeGetFunction(i, name);
+		if (func)
+			return func;
 	}
 
 	return NULL;
 }
 
 /**
- * @brief Get a named variable from a scope.
+ * @brief Find a named variable in a scope and its parents.
  *
- * @param scope Target scope.
+ * @param scope Scope to start with.
  * @param name Variable name.
  * @return Corresponding variable object. NULL if not found.
  */
-SlakeVariable *slakeGetVariable(SlakeScope *scope, const char *name)
+SlakeVariable *slakeLookupVariable(SlakeScope *scope, SlakeSymbol name)
 {
-	UtilListNode *node = _slakeGetVariable(scope, name);
-
-	if (node)
-		return node->data;
+	for (SlakeScope *i = scope; i; i = i->parent)
+	{
+		SlakeVariable *var = slakeGetVariable(i, name);
+		if (var)
+			return var;
+	}
 
 	return NULL;
 }
@@ -211,14 +312,11 @@ SlakeVariable *slakeGetVariable(SlakeScope *scope, const char *name)
  * @param scope Target scope.
  * @param name Function name.
  */
-void slakeUndefFunction(SlakeScope *scope, const char *name)
+void slakeUndefFunction(SlakeScope *scope, SlakeSymbol name)
 {
-	UtilListNode *func = _slakeGetFunction(scope, name);
-	if (!func)
-		return;
-
-	slakeDestroyFunction(func->data);
-	utilListRemove(func);
+	SlakeFunction *func = utilHashMapRemove(scope->functions, name);
+	if (func)
+		slakeDestroyFunction(func);
 }
 
 /**
@@ -227,103 +325,222 @@ void slakeUndefFunction(SlakeScope *scope, const char *name)
  * @param scope Target scope.
  * @param name Variable name.
  */
-void slakeUndefVariable(SlakeScope *scope, const char *name)
+void slakeUndefVariable(SlakeScope *scope, SlakeSymbol name)
 {
-	SlakeVariable *var = slakeGetVariable(scope, name);
+	SlakeVariable *var = utilHashMapRemove(scope->variables, name);
 	if (!var)
 		return;
+
+	// Keep the slot empty so that other slots are not moved.
+	utilVectorAt(&scope->slots, SlakeVariable *, var->slot) = NULL;
+	slakeDestroyVariable(var);
+}
+
+/**
+ * @brief Set body of a function.
+ *
+ * @attention The execution body must live as long as the function, it is
+ * owned by the arena which it was allocated from.
+ *
+ * @param func Target function.
+ * @param body New execution body, NULL for empty.
+ * @return The target function.
+ */
+SlakeFunction *slakeSetFunctionBody(SlakeFunction *func, SlakeExecBody body)
+{
+	assert(func != NULL);
+
+	func->exprs = body;
+
+	slakeDestroyBytecode(func->bytecode);
+	func->bytecode = NULL;
+	func->isResolved = 0;
+
+	return func;
 }
 
-SlakeFunction *slakeSetFunctionBody(SlakeFunction *func, SlakeExpr *exprs)
+/**
+ * @brief Set parameter definitions of a function. The definitions will be
+ * copied.
+ *
+ * @param func Target function.
+ * @param params Parameter definitions.
+ * @param paramCount Count of parameters.
+ * @return The target function.
+ */
+SlakeFunction *slakeSetFunctionParams(SlakeFunction *func, SlakeParamDef *params, unsigned short paramCount)
 {
 	assert(func != NULL);
+
+	free(func->params);
+	func->params = NULL;
+	func->paramCount = paramCount;
+
+	if (paramCount)
+	{
+		func->params = malloc(paramCount * sizeof(SlakeParamDef));
+		if (!func->params)
+			slakePanic("Out of memory");
+		memcpy(func->params, params, paramCount * sizeof(SlakeParamDef));
+	}
+
+	slakeDestroyBytecode(func->bytecode);
+	func->bytecode = NULL;
+	func->isResolved = 0;
+
+	return func;
 }
 
 /**
- * @brief Create a value object with null.
+ * @brief Create a vector of top-level statements in the current arena.
  *
- * @return Created value object.
+ * @return Vector of statements (SlakeStmt).
  */
-SlakeValue *slakeCreateValue()
+UtilVector *slakeCreateStatements()
 {
-	SlakeValue *v = malloc(sizeof(SlakeValue));
-	if (!v)
+	UtilVector *statements = utilVectorNewInArena(currentArena, sizeof(SlakeStmt));
+	if (!statements)
 		slakePanic("Out of memory");
+	return statements;
+}
 
-	v->type = VALUE_TYPE_NULL;
-	return v;
+static void _slakeAddStatement(UtilVector *statements, const SlakeStmt *stmt)
+{
+	if (!utilVectorPush(statements, stmt))
+		slakePanic("Out of memory");
+}
+
+/**
+ * @brief Record an import statement.
+ *
+ * @param statements Vector of statements.
+ * @param name Name of the module.
+ * @param path Path of the module. This function will make a copy.
+ */
+void slakeAddImport(UtilVector *statements, SlakeSymbol name, const char *path)
+{
+	SlakeStmt stmt;
+	stmt.type = STMT_IMPORT;
+	stmt.attribs.import.name = name;
+	stmt.attribs.import.path = utilArenaStrdup(currentArena, path);
+	if (!stmt.attribs.import.path)
+		slakePanic("Out of memory");
+	_slakeAddStatement(statements, &stmt);
+}
+
+/**
+ * @brief Record global variable definitions.
+ *
+ * @param statements Vector of statements.
+ * @param execBody Definitions.
+ */
+void slakeAddGlobals(UtilVector *statements, SlakeExecBody execBody)
+{
+	SlakeStmt stmt;
+	stmt.type = STMT_GLOBALS;
+	stmt.attribs.globals = execBody;
+	_slakeAddStatement(statements, &stmt);
+}
+
+/**
+ * @brief Record a function definition.
+ *
+ * @param statements Vector of statements.
+ * @param name Name of the function.
+ * @param params Parameter definitions. This function will make a copy.
+ * @param paramCount Count of parameters.
+ * @param body Body of the function.
+ * @param isPublic Whether the function is public.
+ */
+void slakeAddFunction(UtilVector *statements, SlakeSymbol name, SlakeParamDef *params, unsigned short paramCount, SlakeExecBody body, int isPublic)
+{
+	SlakeStmt stmt;
+	stmt.type = STMT_FUNCTION;
+	stmt.attribs.function.name = name;
+	stmt.attribs.function.params = paramCount ? _slakeArenaDup(params, paramCount * sizeof(SlakeParamDef)) : NULL;
+	stmt.attribs.function.paramCount = paramCount;
+	stmt.attribs.function.isPublic = isPublic;
+	stmt.attribs.function.body = body;
+	_slakeAddStatement(statements, &stmt);
 }
 
 /**
- * @brief Copy a value object.
+ * @brief Execute global variable definitions in the root scope of a module.
+ * The scope is passed down explicitly, since initializers running commands
+ * may resume on another thread.
  *
- * @param value Source value object.
- * @return Copied value object.
+ * @param scope Root scope of the module.
+ * @param execBody Definitions to execute.
  */
-SlakeValue *slakeCopyValue(SlakeValue *value)
+void slakeDefineGlobals(SlakeScope *scope, SlakeExecBody execBody)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = value->type;
-	switch (v->type)
+	for (size_t i = 0; i < execBody->size; i++)
 	{
-	case VALUE_TYPE_INT:
-		v->data.i32 = value->data.i32;
-		break;
-	case VALUE_TYPE_LONG:
-		v->data.i64 = value->data.i64;
-		break;
-	case VALUE_TYPE_UINT:
-		v->data.u32 = value->data.u32;
-		break;
-	case VALUE_TYPE_ULONG:
-		v->data.u64 = value->data.u64;
-		break;
-	case VALUE_TYPE_STR:
-		v->data.str = strdup(value->data.str);
-		if (!v->data.str)
-			slakePanic("Out of memory");
-		break;
-	case VALUE_TYPE_NULL:
-		break;
-	default:
-		slakePanic("Invalid value type");
+		SlakeExpr *expr = utilVectorAt(execBody, SlakeExpr *, i);
+		slakeResolveExpr(scope, expr);
+		SlakeValue value = slakeExprExec(scope, expr);
+		slakeClearValue(&value);
 	}
+}
 
-	return v;
+/**
+ * @brief Define a function in the root scope of a module.
+ *
+ * @param scope Root scope of the module.
+ * @param name Name of the function.
+ * @param params Parameter definitions. This function will make a copy.
+ * @param paramCount Count of parameters.
+ * @param body Body of the function.
+ * @param isPublic Whether the function is public.
+ * @return Created function object.
+ */
+SlakeFunction *slakeDefineFunction(SlakeScope *scope, SlakeSymbol name, SlakeParamDef *params, unsigned short paramCount, SlakeExecBody body, int isPublic)
+{
+	SlakeFunction *func = slakeCreateFunction();
+	if (!func)
+		slakePanic("Out of memory");
+
+	slakeSetFunctionParams(func, params, paramCount);
+	slakeSetFunctionBody(func, body);
+	func->isPublic = isPublic;
+	return slakeSetFunction(scope, name, func);
 }
 
-SlakeValue *slakeMakeInt(int value)
+// Small strings are stored through data and smallTail.
+typedef char _SlakeValueSizeCheck[sizeof(SlakeValue) == 16 && offsetof(SlakeValue, smallTail) == sizeof(long long) ? 1 : -1];
+
+SlakeValue slakeMakeInt(int value)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = VALUE_TYPE_INT;
-	v->data.i32 = value;
+	SlakeValue v;
+	v.type = VALUE_TYPE_INT;
+	v.data.i32 = value;
 
 	return v;
 }
 
-SlakeValue *slakeMakeLong(long long value)
+SlakeValue slakeMakeLong(long long value)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = VALUE_TYPE_LONG;
-	v->data.i64 = value;
+	SlakeValue v;
+	v.type = VALUE_TYPE_LONG;
+	v.data.i64 = value;
 
 	return v;
 }
 
-SlakeValue *slakeMakeUInt(unsigned int value)
+SlakeValue slakeMakeUInt(unsigned int value)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = VALUE_TYPE_UINT;
-	v->data.u32 = value;
+	SlakeValue v;
+	v.type = VALUE_TYPE_UINT;
+	v.data.u32 = value;
 
 	return v;
 }
 
-SlakeValue *slakeMakeULong(unsigned long long value)
+SlakeValue slakeMakeULong(unsigned long long value)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = VALUE_TYPE_ULONG;
-	v->data.u64 = value;
+	SlakeValue v;
+	v.type = VALUE_TYPE_ULONG;
+	v.data.u64 = value;
 
 	return v;
 }
@@ -331,33 +548,408 @@ SlakeValue *slakeMakeULong(unsigned long long value)
 /**
  * @brief Make a string value.
  *
- * @param value Data.
- * @return A new value object with data.
+ * @param value Data, will be copied.
+ * @return The string value, must be cleared by slakeClearValue.
  */
-SlakeValue *slakeMakeString(const char *value)
+SlakeValue slakeMakeString(const char *value)
 {
-	SlakeValue *v = slakeCreateValue();
-	v->type = VALUE_TYPE_STR;
-	v->data.str = strdup(value);
-	if (!v->data.str)
-		slakePanic("Out of memory");
+	SlakeValue v;
+	v.type = VALUE_TYPE_NULL;
+	slakeSetString(&v, value);
+
+	return v;
+}
+
+/**
+ * @brief Make a string value owned by the current arena. The string is not
+ * counted, and values referring to it must not outlive the arena.
+ *
+ * @param value Data, will be copied.
+ * @return The string value.
+ */
+SlakeValue slakeMakeArenaString(const char *value)
+{
+	SlakeValue v;
+	size_t length = strlen(value);
+
+	v.type = VALUE_TYPE_STR;
+	if ((v.isSmall = length <= SLAKE_SMALL_STRING_MAX))
+	{
+		memcpy((char *)&v, value, length + 1);
+		return v;
+	}
+
+	SlakeString *str = _slakeArenaAlloc(sizeof(SlakeString) + length + 1);
+	str->refCount = 0;
+	str->length = str->capacity = length;
+	memcpy(str->data, value, length + 1);
+	v.data.str = str;
 
 	return v;
 }
 
+/**
+ * @brief Release data held by a value and set it to null. The value object
+ * itself will not be freed.
+ *
+ * @param value Target value.
+ */
+void slakeClearValue(SlakeValue *value)
+{
+	assert(value != NULL);
+
+	if (value->type == VALUE_TYPE_STR)
+	{
+		SlakeString *str = value->data.str;
+		if (!value->isSmall && str->refCount && !--str->refCount)
+			free(str);
+	}
+	else if (value->type == VALUE_TYPE_FUTURE)
+		slakeReleaseFuture(value->data.future);
+	value->type = VALUE_TYPE_NULL;
+}
+
+SlakeValue *slakeSetInt(SlakeValue *dest, int value)
+{
+	slakeClearValue(dest);
+	dest->type = VALUE_TYPE_INT;
+	dest->data.i32 = value;
+
+	return dest;
+}
+
+SlakeValue *slakeSetLong(SlakeValue *dest, long long value)
+{
+	slakeClearValue(dest);
+	dest->type = VALUE_TYPE_LONG;
+	dest->data.i64 = value;
+
+	return dest;
+}
+
+SlakeValue *slakeSetUInt(SlakeValue *dest, unsigned int value)
+{
+	slakeClearValue(dest);
+	dest->type = VALUE_TYPE_UINT;
+	dest->data.u32 = value;
+
+	return dest;
+}
+
+SlakeValue *slakeSetULong(SlakeValue *dest, unsigned long long value)
+{
+	slakeClearValue(dest);
+	dest->type = VALUE_TYPE_ULONG;
+	dest->data.u64 = value;
+
+	return dest;
+}
+
+/**
+ * @brief Set a value to a string. The string will be copied.
+ *
+ * @param dest Target value.
+ * @param value String data, may refer to the target value itself.
+ * @return The target value.
+ */
+SlakeValue *slakeSetString(SlakeValue *dest, const char *value)
+{
+	SlakeValue v;
+	size_t length = strlen(value);
+
+	v.type = VALUE_TYPE_NULL;
+	memcpy(slakeAllocString(&v, length), value, length);
+
+	slakeClearValue(dest);
+	*dest = v;
+	return dest;
+}
+
+/**
+ * @brief Set a value to a new string with uninitialized characters, which
+ * must be filled before the value is shared.
+ *
+ * @param dest Target value.
+ * @param length Length of the string.
+ * @return Buffer of the characters, terminated by a null character.
+ */
+char *slakeAllocString(SlakeValue *dest, size_t length)
+{
+	char *data;
+
+	slakeClearValue(dest);
+	dest->type = VALUE_TYPE_STR;
+	if ((dest->isSmall = length <= SLAKE_SMALL_STRING_MAX))
+		data = (char *)dest;
+	else
+	{
+		SlakeString *str = malloc(sizeof(SlakeString) + length + 1);
+		if (!str)
+			slakePanic("Out of memory");
+		str->refCount = 1;
+		str->length = str->capacity = length;
+		dest->data.str = str;
+		data = str->data;
+	}
+
+	data[length] = '\0';
+	return data;
+}
+
+/**
+ * @brief Extend a string value for appending to it. A string referred only
+ * by the value is extended in place, and its room grows geometrically, so
+ * appending repeatedly takes linear time. Shared strings are copied.
+ *
+ * @param value String value to extend.
+ * @param length New length, not less than the current one.
+ * @return Buffer of the characters, terminated by a null character.
+ * Characters after the old length must be filled before the value is shared.
+ */
+char *slakeExtendString(SlakeValue *value, size_t length)
+{
+	size_t oldLength = slakeGetStringLength(value);
+	assert(length >= oldLength);
+
+	if (value->isSmall && length <= SLAKE_SMALL_STRING_MAX)
+	{
+		((char *)value)[length] = '\0';
+		return (char *)value;
+	}
+
+	SlakeString *str = value->isSmall ? NULL : value->data.str;
+	if (str && str->refCount == 1)
+	{
+		if (length > str->capacity)
+		{
+			size_t capacity = str->capacity * 2 > length ? str->capacity * 2 : length;
+			if (!(str = realloc(str, sizeof(SlakeString) + capacity + 1)))
+				slakePanic("Out of memory");
+			str->capacity = capacity;
+			value->data.str = str;
+		}
+	}
+	else
+	{
+		if (!(str = malloc(sizeof(SlakeString) + length + 1)))
+			slakePanic("Out of memory");
+		str->refCount = 1;
+		str->capacity = length;
+		memcpy(str->data, slakeGetString(value), oldLength);
+
+		slakeClearValue(value);
+		value->type = VALUE_TYPE_STR;
+		value->isSmall = 0;
+		value->data.str = str;
+	}
+
+	str->length = length;
+	str->data[length] = '\0';
+	return str->data;
+}
+
+/**
+ * @brief Get characters of a string value.
+ *
+ * @param value String value.
+ * @return Null-terminated characters, valid while the value holds the string.
+ */
+const char *slakeGetString(const SlakeValue *value)
+{
+	assert(value->type == VALUE_TYPE_STR);
+	return value->isSmall ? (const char *)value : value->data.str->data;
+}
+
+/**
+ * @brief Get length of a string value.
+ *
+ * @param value String value.
+ * @return Count of characters.
+ */
+size_t slakeGetStringLength(const SlakeValue *value)
+{
+	assert(value->type == VALUE_TYPE_STR);
+	return value->isSmall ? strlen((const char *)value) : value->data.str->length;
+}
+
+/**
+ * @brief Copy a value into another existing value. Strings and futures are
+ * shared by counting references.
+ *
+ * @param dest Destination value.
+ * @param src Source value.
+ * @return The destination value.
+ */
+SlakeValue *slakeAssignValue(SlakeValue *dest, const SlakeValue *src)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+
+	if (dest == src)
+		return dest;
+
+	// The source may be released by clearing the destination.
+	if (src->type == VALUE_TYPE_STR)
+	{
+		if (!src->isSmall && src->data.str->refCount)
+			src->data.str->refCount++;
+	}
+	else if (src->type == VALUE_TYPE_FUTURE)
+		slakeRetainFuture(src->data.future);
+
+	slakeClearValue(dest);
+	*dest = *src;
+	return dest;
+}
+
+/**
+ * @brief Convert a value to another type in place. Conversions are only
+ * allowed between numeric types, or from null to any type. Futures are kept
+ * as they are, their results are converted when they are stored after being
+ * awaited.
+ *
+ * @param value Value to convert.
+ * @param type Target type.
+ * @return The converted value.
+ */
+SlakeValue *slakeConvertValue(SlakeValue *value, SlakeValueType type)
+{
+	assert(value != NULL);
+
+	if (value->type == type || value->type == VALUE_TYPE_FUTURE)
+		return value;
+
+	if (type == VALUE_TYPE_FUTURE)
+		slakePanic("Incompatible value type");
+
+	if (value->type == VALUE_TYPE_NULL)
+	{
+		switch (type)
+		{
+		case VALUE_TYPE_STR:
+			return slakeSetString(value, "");
+		case VALUE_TYPE_NULL:
+			return value;
+		default:
+			value->type = type;
+			value->data.u64 = 0;
+			return value;
+		}
+	}
+
+	if (value->type == VALUE_TYPE_STR || type == VALUE_TYPE_STR)
+		slakePanic("Incompatible value type");
+
+	unsigned long long u64;
+	long long i64;
+	int isSigned = 0;
+	switch (value->type)
+	{
+	case VALUE_TYPE_INT:
+		i64 = value->data.i32, isSigned = 1;
+		break;
+	case VALUE_TYPE_LONG:
+		i64 = value->data.i64, isSigned = 1;
+		break;
+	case VALUE_TYPE_UINT:
+		u64 = value->data.u32;
+		break;
+	case VALUE_TYPE_ULONG:
+		u64 = value->data.u64;
+		break;
+	default:
+		slakePanic("Invalid value type");
+	}
+	if (isSigned)
+		u64 = (unsigned long long)i64;
+
+	switch (type)
+	{
+	case VALUE_TYPE_INT:
+		value->data.i32 = (int)u64;
+		break;
+	case VALUE_TYPE_LONG:
+		value->data.i64 = (long long)u64;
+		break;
+	case VALUE_TYPE_UINT:
+		value->data.u32 = (unsigned int)u64;
+		break;
+	case VALUE_TYPE_ULONG:
+		value->data.u64 = u64;
+		break;
+	case VALUE_TYPE_NULL:
+		break;
+	default:
+		slakePanic("Invalid value type");
+	}
+	value->type = type;
+
+	return value;
+}
+
+/**
+ * @brief Check if a value is considered as true in conditions.
+ *
+ * @param value Value to check.
+ * @return Non-zero if the value is true.
+ */
+int slakeIsValueTrue(const SlakeValue *value)
+{
+	switch (value->type)
+	{
+	case VALUE_TYPE_INT:
+		return value->data.i32 != 0;
+	case VALUE_TYPE_LONG:
+		return value->data.i64 != 0;
+	case VALUE_TYPE_UINT:
+		return value->data.u32 != 0;
+	case VALUE_TYPE_ULONG:
+		return value->data.u64 != 0;
+	case VALUE_TYPE_STR:
+		return slakeGetString(value)[0] != '\0';
+	case VALUE_TYPE_NULL:
+		return 0;
+	case VALUE_TYPE_FUTURE:
+		slakePanic("Future must be awaited before use");
+	default:
+		slakePanic("Invalid value type");
+	}
+	return 0;
+}
+
 /**
  * @brief Generate a variable reference expression.
  *
  * @param symbol Variable name.
  * @return Generated expression.
  */
-SlakeExpr *slakeExprVarRef(const char *symbol)
+SlakeExpr *slakeExprVarRef(SlakeSymbol symbol)
 {
-	assert(strlen(symbol) <= SLAKE_SYMBOL_MAX);
-
 	SlakeExpr *expr = slakeCreateExpr();
 	expr->type = EXPR_VARREF;
-	strcpy(expr->attribs.varRef, symbol);
+	expr->attribs.varRef.symbol = symbol;
+	expr->attribs.varRef.depth = 0;
+	expr->attribs.varRef.slot = SLAKE_SLOT_UNRESOLVED;
+
+	return expr;
+}
+
+/**
+ * @brief Generate a variable definition expression.
+ *
+ * @param symbol Variable name.
+ * @param type Variable type.
+ * @param initValue Initial value expression. NULL for default value.
+ * @return Generated expression.
+ */
+SlakeExpr *slakeExprVarDef(SlakeSymbol symbol, SlakeValueType type, SlakeExpr *initValue)
+{
+	SlakeExpr *expr = slakeCreateExpr();
+	expr->type = EXPR_VARDEF;
+	expr->attribs.varDef.symbol = symbol;
+	expr->attribs.varDef.type = type;
+	expr->attribs.varDef.initValue = initValue;
+	expr->attribs.varDef.slot = SLAKE_SLOT_UNRESOLVED;
 
 	return expr;
 }
@@ -366,20 +958,18 @@ SlakeExpr *slakeExprVarRef(const char *symbol)
  * @brief Generate a call expression.
  *
  * @param symbol Function name.
+ * @param params Parameter expressions. This function will make a copy.
+ * @param paramCount Count of parameters.
  * @return Generated expression.
  */
-SlakeExpr *slakeExprCall(const char *symbol, SlakeValue *params, unsigned short paramCount)
+SlakeExpr *slakeExprCall(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount)
 {
-	assert(strlen(symbol) <= SLAKE_SYMBOL_MAX);
-
 	SlakeExpr *expr = slakeCreateExpr();
 	expr->type = EXPR_CALL;
-	strcpy(expr->attribs.call.symbol, symbol);
+	expr->attribs.call.symbol = symbol;
 
 	expr->attribs.call.paramCount = paramCount;
-	expr->attribs.call.params = calloc(paramCount, sizeof(SlakeValue));
-	for (unsigned short i = 0; i < paramCount; i++)
-		expr->attribs.call.params = slakeCopyValue(&(params[i]));
+	expr->attribs.call.params = _slakeArenaDup(params, paramCount * sizeof(SlakeExpr *));
 
 	return expr;
 }
@@ -388,20 +978,14 @@ SlakeExpr *slakeExprCall(const char *symbol, SlakeValue *params, unsigned short
  * @brief Generate an asynchronous call expression.
  *
  * @param symbol Function name.
+ * @param params Parameter expressions. This function will make a copy.
+ * @param paramCount Count of parameters.
  * @return Generated expression.
  */
-SlakeExpr *slakeExprCallAsync(const char *symbol, SlakeValue *params, unsigned short paramCount)
+SlakeExpr *slakeExprCallAsync(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount)
 {
-	assert(strlen(symbol) <= SLAKE_SYMBOL_MAX);
-
-	SlakeExpr *expr = slakeCreateExpr();
+	SlakeExpr *expr = slakeExprCall(symbol, params, paramCount);
 	expr->type = EXPR_CALL_ASYNC;
-	strcpy(expr->attribs.call.symbol, symbol);
-
-	expr->attribs.call.paramCount = paramCount;
-	expr->attribs.call.params = calloc(paramCount, sizeof(SlakeValue));
-	for (unsigned short i = 0; i < paramCount; i++)
-		expr->attribs.call.params = slakeCopyValue(&(params[i]));
 
 	return expr;
 }
@@ -409,7 +993,7 @@ SlakeExpr *slakeExprCallAsync(const char *symbol, SlakeValue *params, unsigned s
 /**
  * @brief Generate an await expression.
  *
- * @param symbol Function name.
+ * @param e Expression to await.
  * @return Generated expression.
  */
 SlakeExpr *slakeExprAwait(SlakeExpr *e)
@@ -421,24 +1005,33 @@ SlakeExpr *slakeExprAwait(SlakeExpr *e)
 	return expr;
 }
 
+/**
+ * @brief Generate a return expression.
+ *
+ * @param value Return value expression. NULL for none.
+ * @return Generated expression.
+ */
+SlakeExpr *slakeExprReturn(SlakeExpr *value)
+{
+	SlakeExpr *expr = slakeCreateExpr();
+	expr->type = EXPR_RETURN;
+	expr->attribs.returnValue = value;
+
+	return expr;
+}
+
 /**
  * @brief Generate a super call expression.
  *
  * @param symbol Function name.
+ * @param params Parameter expressions. This function will make a copy.
+ * @param paramCount Count of parameters.
  * @return Generated expression.
  */
-SlakeExpr *slakeExprSuperCall(const char *symbol, SlakeValue *params, unsigned short paramCount)
+SlakeExpr *slakeExprSuperCall(SlakeSymbol symbol, SlakeExpr **params, unsigned short paramCount)
 {
-	assert(strlen(symbol) <= SLAKE_SYMBOL_MAX);
-
-	SlakeExpr *expr = slakeCreateExpr();
+	SlakeExpr *expr = slakeExprCall(symbol, params, paramCount);
 	expr->type = EXPR_SUPER_CALL;
-	strcpy(expr->attribs.call.symbol, symbol);
-
-	expr->attribs.call.paramCount = paramCount;
-	expr->attribs.call.params = calloc(paramCount, sizeof(SlakeValue));
-	for (unsigned short i = 0; i < paramCount; i++)
-		expr->attribs.call.params = slakeCopyValue(&(params[i]));
 
 	return expr;
 }
@@ -448,22 +1041,37 @@ SlakeExpr *slakeExprSuperCall(const char *symbol, SlakeValue *params, unsigned s
  *
  * @param moduleName Imported module symbol name.
  * @param funcName Function name.
+ * @param params Parameter expressions. This function will make a copy.
+ * @param paramCount Count of parameters.
  * @return Generated expression.
  */
-SlakeExpr *slakeExprExternalCall(const char *moduleName, const char *funcName, SlakeValue *params, unsigned short paramCount)
+SlakeExpr *slakeExprExternalCall(SlakeSymbol moduleName, SlakeSymbol funcName, SlakeExpr **params, unsigned short paramCount)
 {
-	assert(strlen(moduleName) <= SLAKE_SYMBOL_MAX);
-	assert(strlen(funcName) <= SLAKE_SYMBOL_MAX);
-
 	SlakeExpr *expr = slakeCreateExpr();
 	expr->type = EXPR_EXTERNAL_CALL;
-	strcpy(expr->attribs.externalCall.moduleName, moduleName);
-	strcpy(expr->attribs.externalCall.funcName, funcName);
+	expr->attribs.externalCall.moduleName = moduleName;
+	expr->attribs.externalCall.funcName = funcName;
 
 	expr->attribs.externalCall.paramCount = paramCount;
-	expr->attribs.externalCall.params = calloc(paramCount, sizeof(SlakeValue));
-	for (unsigned short i = 0; i < paramCount; i++)
-		expr->attribs.externalCall.params = slakeCopyValue(&(params[i]));
+	expr->attribs.externalCall.params = _slakeArenaDup(params, paramCount * sizeof(SlakeExpr *));
+	expr->attribs.externalCall.async = 0;
+
+	return expr;
+}
+
+/**
+ * @brief Generate an asynchronous external call expression.
+ *
+ * @param moduleName Imported module symbol name.
+ * @param funcName Function name.
+ * @param params Parameter expressions. This function will make a copy.
+ * @param paramCount Count of parameters.
+ * @return Generated expression.
+ */
+SlakeExpr *slakeExprExternalCallAsync(SlakeSymbol moduleName, SlakeSymbol funcName, SlakeExpr **params, unsigned short paramCount)
+{
+	SlakeExpr *expr = slakeExprExternalCall(moduleName, funcName, params, paramCount);
+	expr->attribs.externalCall.async = 1;
 
 	return expr;
 }
@@ -501,10 +1109,7 @@ SlakeExpr* slakeExprSwitch(SlakeExpr* condition, SlakeSwitchCase** cases, size_t
 	SlakeExpr* expr=slakeCreateExpr();
 	expr->type=EXPR_SWITCH;
 
-	expr->attribs.switchBlock.cases=malloc(caseCount*sizeof(SlakeSwitchCase*));
-	if(!expr->attribs.switchBlock.cases)
-		slakePanic("Out of memory");
-	memcpy(expr->attribs.switchBlock.cases,cases,caseCount*sizeof(SlakeSwitchCase*));
+	expr->attribs.switchBlock.cases=_slakeArenaDup(cases,caseCount*sizeof(SlakeSwitchCase*));
 	expr->attribs.switchBlock.caseCount=caseCount;
 
 	expr->attribs.switchBlock.condition=condition;
@@ -516,14 +1121,14 @@ SlakeExpr* slakeExprSwitch(SlakeExpr* condition, SlakeSwitchCase** cases, size_t
 /**
  * @brief Generate a loop block expression.
  *
- * @param times Loop times.
+ * @param times Loop times, negative for infinite.
  * @param body Loop body expressions.
  * @return Generated expression.
  */
 SlakeExpr *slakeExprLoopBlock(int times, SlakeExecBody body)
 {
 	SlakeExpr *expr = slakeCreateExpr();
-	expr->type = EXPR_WHILE;
+	expr->type = EXPR_LOOP;
 	expr->attribs.loopBlock.times = times;
 	expr->attribs.loopBlock.body = body;
 	return expr;
@@ -634,19 +1239,26 @@ SlakeExpr *slakeExprImmediateValue(SlakeValue *value)
 {
 	SlakeExpr *expr = slakeCreateExpr();
 	expr->type = EXPR_VALUE;
-	expr->attribs.value = slakeCopyValue(value);
+
+	// The copy is owned by the arena and must not be cleared.
+	SlakeValue *v = _slakeArenaDup(value, sizeof(SlakeValue));
+	if (v->type == VALUE_TYPE_STR && !v->isSmall && v->data.str->refCount)
+		*v = slakeMakeArenaString(slakeGetString(value));
+	expr->attribs.value = v;
 
 	return expr;
 }
 
 /**
- * @brief Create an empty execution body.
+ * @brief Create an empty execution body in the current arena.
  *
  * @return Created execution body object.
  */
 SlakeExecBody slakeCreateExecBody()
 {
-	SlakeExecBody execBody=utilListNew(sizeof(SlakeExpr*));
+	assert(currentArena != NULL);
+
+	SlakeExecBody execBody=utilVectorNewInArena(currentArena,sizeof(SlakeExpr*));
 	if(!execBody)
 		slakePanic("Out of memory");
 
@@ -654,26 +1266,7 @@ SlakeExecBody slakeCreateExecBody()
 }
 
 /**
- * @brief Destroy an execution body and associated expressions.
- *
- * @param execBody Execution body to destroy.
- */
-void slakeDestroyExecBody(SlakeExecBody execBody)
-{
-	for(UtilListNode* i=execBody->begin;i!=execBody->end;i=i->next)
-	{
-		slakeDestroyExpr(i->data);
-		i->data=NULL;
-	}
-
-	utilListDelete(execBody);
-}
-
-/**
- * @brief Create a switch case.
- *
- * @attention The condition expression and the execution body will be associated
- * with the switch case.
+ * @brief Create a switch case in the current arena.
  *
  * @param condition Case condition.
  * @param execBody Execution body.
@@ -681,9 +1274,7 @@ void slakeDestroyExecBody(SlakeExecBody execBody)
  */
 SlakeSwitchCase* slakeCreateSwitchCase(SlakeExpr* condition, SlakeExecBody execBody)
 {
-	SlakeSwitchCase* swCase=malloc(sizeof(SlakeSwitchCase));
-	if(!swCase)
-		slakePanic("Out of memory");
+	SlakeSwitchCase* swCase=_slakeArenaAlloc(sizeof(SlakeSwitchCase));
 
 	swCase->condition=condition;
 	swCase->body=execBody;
@@ -691,17 +1282,6 @@ SlakeSwitchCase* slakeCreateSwitchCase(SlakeExpr* condition, SlakeExecBody execB
 	return swCase;
 }
 
-/**
- * @brief Destroy a case object and associated expressions.
- *
- * @param swCase Case object.
- */
-void slakeDestroySwitchCase(SlakeSwitchCase* swCase)
-{
-	slakeDestroyExpr(swCase->condition);
-	slakeDestroyExecBody(swCase->body);
-}
-
 /**
  * @brief Append an expression into an execution body.
  *
@@ -714,20 +1294,30 @@ SlakeExecBody slakeExprAttach(SlakeExecBody execBody, SlakeExpr *expr)
 	assert(execBody != NULL);
 	assert(expr != NULL);
 
-	utilListAppend(execBody, utilListNodeNew(execBody, expr));
+	if (!utilVectorPush(execBody, &expr))
+		slakePanic("Out of memory");
 
 	return execBody;
 }
 
 /**
- * @brief Execute an expression.
+ * @brief Move all expressions of an execution body to the end of another one.
  *
- * @param expr Expression to execute.
- * @return Return value of the expression.
+ * @param dest Destination execution body.
+ * @param src Source execution body.
+ * @return The destination execution body.
  */
-SlakeValue *slakeExprExec(SlakeExpr *expr)
+SlakeExecBody slakeExecBodyMerge(SlakeExecBody dest, SlakeExecBody src)
 {
-	assert(expr!=NULL);
+	assert(dest != NULL);
+
+	if (!src)
+		return dest;
+
+	if (!utilVectorAppend(dest, src->data, src->size))
+		slakePanic("Out of memory");
+
+	return dest;
 }
 
 /**
@@ -737,7 +1327,8 @@ SlakeValue *slakeExprExec(SlakeExpr *expr)
  */
 void slakePanic(const char *msg)
 {
-	printf("[PANIC]%s\n", msg);
+	fflush(stdout);
+	fprintf(stderr, "[PANIC]%s\n", msg);
 	abort();
 }
 
@@ -752,8 +1343,15 @@ SlakeFunction *slakeCreateFunction()
 	if (!func)
 		return NULL;
 
-	func->exprs = utilListNew(sizeof(SlakeExpr));
-	memset(func->name, 0, sizeof(func->name));
+	func->exprs = NULL;
+	func->params = NULL;
+	func->paramCount = 0;
+	func->isPublic = 0;
+	func->isResolved = 0;
+	func->localCount = 0;
+	func->bytecode = NULL;
+	func->scope = NULL;
+	func->name = SLAKE_SYMBOL_NONE;
 	return func;
 }
 
@@ -765,22 +1363,23 @@ SlakeFunction *slakeCreateFunction()
 SlakeVariable *slakeCreateVariable()
 {
 	SlakeVariable *var = malloc(sizeof(SlakeVariable));
-	memset(var->name, 0, sizeof(var->name));
-	var->value = slakeCreateValue();
+	if (!var)
+		return NULL;
+	var->name = SLAKE_SYMBOL_NONE;
+	var->slot = 0;
+	var->value.type = VALUE_TYPE_NULL;
 
 	return var;
 }
 
 /**
- * @brief Create an empty expression object.
+ * @brief Create an empty expression object in the current arena.
  *
  * @return Created expression object.
  */
 SlakeExpr *slakeCreateExpr()
 {
-	SlakeExpr *expr = malloc(sizeof(SlakeExpr));
-	if (!expr)
-		return NULL;
+	SlakeExpr *expr = _slakeArenaAlloc(sizeof(SlakeExpr));
 
 	expr->type = EXPR_INVALID;
 
@@ -798,36 +1397,31 @@ void slakeDestroyScope(SlakeScope *scope)
 	if (currentScope == scope)
 		currentScope = NULL;
 
-	for (UtilListNode *i = scope->functions->begin;
-		 i != scope->functions->end;
-		 i = i->next)
-		slakeDestroyFunction(i->data);
+	for (size_t i = 0; i < scope->functions->capacity; i++)
+		if (scope->functions->slots[i].key)
+			slakeDestroyFunction(scope->functions->slots[i].value);
+	utilHashMapDelete(scope->functions);
 
-	for (UtilListNode *i = scope->variables->begin;
-		 i != scope->variables->end;
-		 i = i->next)
-		slakeDestroyFunction(i->data);
+	for (size_t i = 0; i < scope->slots.size; i++)
+		if (utilVectorAt(&scope->slots, SlakeVariable *, i))
+			slakeDestroyVariable(utilVectorAt(&scope->slots, SlakeVariable *, i));
+	utilVectorFree(&scope->slots);
+	utilHashMapDelete(scope->variables);
+	utilHashMapDelete(scope->modules);
 
 	free(scope);
 }
 
 /**
- * @brief Destroy a function and its subexpressions.
+ * @brief Destroy a function. Its expressions are owned by their arena.
  *
  * @param func Function to destroy.
  */
 void slakeDestroyFunction(SlakeFunction *func)
 {
-	//
-	// Destroy the body.
-	//
-	for (UtilListNode *i = func->exprs->begin;
-		 i != func->exprs->end;
-		 i = i->next)
-	{
-		slakeDestroyExpr(i->data);
-		i->data = NULL;
-	}
+	slakeDestroyBytecode(func->bytecode);
+	free(func->params);
+	free(func);
 }
 
 /**
@@ -837,85 +1431,6 @@ void slakeDestroyFunction(SlakeFunction *func)
  */
 void slakeDestroyVariable(SlakeVariable *var)
 {
-	slakeDestroyValue(var->value);
-}
-
-/**
- * @brief Destroy and release an expression object and its subexpressions.
- *
- * @param expr Expression object to release.
- */
-void slakeDestroyExpr(SlakeExpr *expr)
-{
-	switch (expr->type)
-	{
-	case EXPR_CALL:
-	case EXPR_CALL_ASYNC:
-	case EXPR_AWAIT:
-		break;
-	case EXPR_IF:
-		slakeDestroyExpr(expr->attribs.ifBlock.condition);
-		slakeDestroyExecBody(expr->attribs.ifBlock.trueBlock);
-		slakeDestroyExecBody(expr->attribs.ifBlock.falseBlock);
-		break;
-	case EXPR_SWITCH:
-		for(size_t i=0;i<expr->attribs.switchBlock.caseCount;i++)
-			slakeDestroySwitchCase(expr->attribs.switchBlock.cases[i]);
-		slakeDestroyExpr(expr->attribs.switchBlock.condition);
-		slakeDestroyExecBody(expr->attribs.switchBlock.defaultBody);
-		break;
-	case EXPR_BREAK:
-	case EXPR_CONTINUE:
-		break;
-	case EXPR_LOOP:
-		slakeDestroyExecBody(expr->attribs.loopBlock.body);
-		break;
-	case EXPR_FOR:
-		slakeDestroyExecBody(expr->attribs.forBlock.body);
-		slakeDestroyExpr(expr->attribs.forBlock.condition);
-		slakeDestroyExpr(expr->attribs.forBlock.loopEnd);
-		break;
-	case EXPR_WHILE:
-		slakeDestroyExpr(expr->attribs.whileBlock.condition);
-		slakeDestroyExecBody(expr->attribs.whileBlock.body);
-		break;
-	case EXPR_UNARY:
-		slakeDestroyExpr(expr->attribs.unaryOp.r);
-		break;
-	case EXPR_BINARY:
-		slakeDestroyExpr(expr->attribs.binaryOp.l);
-		slakeDestroyExpr(expr->attribs.binaryOp.r);
-		break;
-	case EXPR_VALUE:
-		slakeDestroyValue(expr->attribs.value);
-		break;
-	default:
-		slakePanic("Invalid value type");
-	}
-	free(expr);
-}
-
-/**
- * @brief Destroy and free a value object.
- *
- * @param value Value object to release.
- */
-void slakeDestroyValue(SlakeValue *value)
-{
-	switch (value->type)
-	{
-	case VALUE_TYPE_INT:
-	case VALUE_TYPE_LONG:
-	case VALUE_TYPE_UINT:
-	case VALUE_TYPE_ULONG:
-	case VALUE_TYPE_NULL:
-		break;
-	case VALUE_TYPE_STR:
-		free(value->data.str);
-		break;
-	default:
-		slakePanic("Invalid value type");
-	}
-
-	free(value);
+	slakeClearValue(&var->value);
+	free(var);
 }
@@ -0,0 +1,155 @@
+#include "source.h"
+#include <slakedef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Count of null characters after the source text.
+#define SLAKE_SOURCE_PADDING 2
+
+#ifndef _WIN32
+static size_t _slakeGetMapSize(size_t size)
+{
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	return (size + SLAKE_SOURCE_PADDING + pageSize - 1) / pageSize * pageSize;
+}
+
+//
+// Map a regular file privately. The pages after the file are backed by an
+// anonymous mapping so that the padding is always readable and zeroed.
+//
+static char *_slakeMapFile(int fd, size_t size)
+{
+	size_t mapSize = _slakeGetMapSize(size);
+
+	char *data = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(data, mapSize);
+		return NULL;
+	}
+
+#ifdef MADV_SEQUENTIAL
+	madvise(data, mapSize, MADV_SEQUENTIAL);
+#endif
+
+	return data;
+}
+#endif
+
+//
+// Read a whole stream into a buffer, used if the file cannot be mapped.
+//
+static char *_slakeReadFile(FILE *fp, size_t *size)
+{
+	size_t capacity = 4096, n = 0;
+	char *data = malloc(capacity);
+	if (!data)
+		slakePanic("Out of memory");
+
+	for (;;)
+	{
+		n += fread(data + n, 1, capacity - n - SLAKE_SOURCE_PADDING, fp);
+		if (n < capacity - SLAKE_SOURCE_PADDING)
+			break;
+
+		data = realloc(data, capacity *= 2);
+		if (!data)
+			slakePanic("Out of memory");
+	}
+
+	if (ferror(fp))
+	{
+		free(data);
+		return NULL;
+	}
+
+	data[n] = data[n + 1] = '\0';
+	*size = n;
+	return data;
+}
+
+/**
+ * @brief Load a source file. Regular files are mapped into memory instead
+ * of being read if possible.
+ *
+ * @param path Path of the file.
+ * @return Loaded source. NULL if failed.
+ */
+SlakeSource *slakeLoadSource(const char *path)
+{
+	SlakeSource *source = malloc(sizeof(SlakeSource));
+	if (!source)
+		slakePanic("Out of memory");
+
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		free(source);
+		return NULL;
+	}
+
+	struct stat st;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		source->data = _slakeMapFile(fd, (size_t)st.st_size);
+		if (source->data)
+		{
+			close(fd);
+			source->size = (size_t)st.st_size;
+			source->isMapped = 1;
+			return source;
+		}
+	}
+
+	FILE *fp = fdopen(fd, "rb");
+	if (!fp)
+		close(fd);
+#else
+	FILE *fp = fopen(path, "rb");
+#endif
+	if (!fp)
+	{
+		free(source);
+		return NULL;
+	}
+
+	source->data = _slakeReadFile(fp, &source->size);
+	source->isMapped = 0;
+	fclose(fp);
+
+	if (!source->data)
+	{
+		free(source);
+		return NULL;
+	}
+
+	return source;
+}
+
+/**
+ * @brief Release a loaded source.
+ *
+ * @param source Source to release.
+ */
+void slakeUnloadSource(SlakeSource *source)
+{
+#ifndef _WIN32
+	if (source->isMapped)
+		munmap(source->data, _slakeGetMapSize(source->size));
+	else
+#endif
+		free(source->data);
+
+	free(source);
+}
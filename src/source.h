@@ -0,0 +1,20 @@
+#ifndef __SOURCE_H__
+#define __SOURCE_H__
+
+#include <stddef.h>
+
+//
+// Source file loaded into memory. The data is followed by two null
+// characters so that the scanner can use it as its buffer directly.
+//
+typedef struct _SlakeSource
+{
+	char *data;	  // Source text, writable.
+	size_t size;  // Size in byte of the source text.
+	int isMapped; // Non-zero if the data is mapped from the file.
+} SlakeSource;
+
+SlakeSource *slakeLoadSource(const char *path);
+void slakeUnloadSource(SlakeSource *source);
+
+#endif
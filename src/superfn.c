@@ -0,0 +1,281 @@
+#include "superfn.h"
+#include "exec.h"
+#include "build.h"
+#include "cache.h"
+#include "future.h"
+#include "glob.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// @shell(cmdline: string): int
+// Execute a command line and return its exit code. Other asynchronous calls
+// run while the command is running.
+//
+static void _slakeSuperShell(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount != 1 || args[0].type != VALUE_TYPE_STR)
+		slakePanic("@shell requires a string parameter");
+
+	fflush(stdout);
+
+	// The argument is owned by the caller, so it stays valid while unlocked.
+	slakeUnlockInterpreter();
+	int exitCode = slakeExec(slakeGetString(&args[0]));
+	slakeLockInterpreter();
+
+	slakeSetInt(ret, exitCode);
+}
+
+//
+// @panic(msg: string)
+// Output a panic message and abort.
+//
+static void _slakeSuperPanic(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount != 1 || args[0].type != VALUE_TYPE_STR)
+		slakePanic("@panic requires a string parameter");
+
+	slakePanic(slakeGetString(&args[0]));
+}
+
+//
+// @rule(target: string, command: string, deps...: string)
+// Define a rule which builds the target file with the command line.
+//
+static void _slakeSuperRule(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount < 2)
+		slakePanic("@rule requires a target and a command");
+	for (unsigned short i = 0; i < argCount; i++)
+		if (args[i].type != VALUE_TYPE_STR)
+			slakePanic("@rule requires string parameters");
+
+	const char **deps = NULL;
+	if (argCount > 2 && !(deps = malloc((argCount - 2) * sizeof(const char *))))
+		slakePanic("Out of memory");
+	for (unsigned short i = 2; i < argCount; i++)
+		deps[i - 2] = slakeGetString(&args[i]);
+
+	// A running build may hold the build graph, others keep running meanwhile.
+	slakeUnlockInterpreter();
+	slakeDefineRule(slakeGetString(&args[0]), slakeGetString(&args[1]), deps, argCount - 2);
+	slakeLockInterpreter();
+	free(deps);
+}
+
+//
+// @build(target: string): int
+// Build a target and its out-of-date prerequisites, return 0 if succeeded.
+// Other asynchronous calls run while building. Unlike @shell, a build in an
+// asynchronous call blocks its worker until it ends, see slakeBuild().
+//
+static void _slakeSuperBuild(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount != 1 || args[0].type != VALUE_TYPE_STR)
+		slakePanic("@build requires a string parameter");
+
+	// No script runs during a build, so the lock is not taken again until it ends.
+	slakeUnlockInterpreter();
+	int exitCode = slakeBuild(slakeGetString(&args[0]));
+	slakeLockInterpreter();
+
+	slakeSetInt(ret, exitCode);
+}
+
+//
+// @hashcheck(targets...: string)
+// Rebuild the targets only if contents of their prerequisites change.
+//
+static void _slakeSuperHashCheck(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	for (unsigned short i = 0; i < argCount; i++)
+		if (args[i].type != VALUE_TYPE_STR)
+			slakePanic("@hashcheck requires string parameters");
+
+	slakeUnlockInterpreter();
+	for (unsigned short i = 0; i < argCount; i++)
+		slakeUseContentHash(slakeGetString(&args[i]));
+	slakeLockInterpreter();
+}
+
+//
+// @actionenv(target: string, names...: string)
+// Include environment variables in the action cache key of the target. PATH
+// and the variables of toolchains such as CC and CFLAGS are always included.
+//
+static void _slakeSuperActionEnv(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount < 1)
+		slakePanic("@actionenv requires a target");
+	for (unsigned short i = 0; i < argCount; i++)
+		if (args[i].type != VALUE_TYPE_STR)
+			slakePanic("@actionenv requires string parameters");
+
+	const char **names = NULL;
+	if (argCount > 1 && !(names = malloc((argCount - 1) * sizeof(const char *))))
+		slakePanic("Out of memory");
+	for (unsigned short i = 1; i < argCount; i++)
+		names[i - 1] = slakeGetString(&args[i]);
+
+	slakeUnlockInterpreter();
+	slakeUseEnvironment(slakeGetString(&args[0]), names, argCount - 1);
+	slakeLockInterpreter();
+	free(names);
+}
+
+//
+// @actioncache(dir: string, maxMegabytes: int)
+// Restore outputs of build rules from a local cache in the directory if
+// their commands, prerequisites and environment match a cached build.
+// Least recently used outputs are evicted beyond the size, 0 for no limit.
+//
+static void _slakeSuperActionCache(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount != 2 || args[0].type != VALUE_TYPE_STR)
+		slakePanic("@actioncache requires a directory and a size");
+
+	long long maxMegabytes = slakeConvertValue(&args[1], VALUE_TYPE_LONG)->data.i64;
+	if (maxMegabytes < 0)
+		slakePanic("@actioncache requires a non-negative size");
+
+	// The action cache is used by builds running without the interpreter lock.
+	slakeUnlockInterpreter();
+	slakeLockBuildGraph();
+	slakeSetActionCache(slakeGetString(&args[0]), (unsigned long long)maxMegabytes << 20);
+	slakeUnlockBuildGraph();
+	slakeLockInterpreter();
+}
+
+//
+// Quote a path as a word of command lines, and return the length of the
+// quoted path. Only the length is computed if out is NULL. Paths of plain
+// characters are not quoted, so commands using them need no shell.
+//
+static size_t _slakeQuotePath(const char *path, char *out)
+{
+	size_t length = 0;
+
+	if (!path[strspn(path, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789/._-+,:@")])
+	{
+		length = strlen(path);
+		if (out)
+			memcpy(out, path, length);
+		return length;
+	}
+
+#ifdef _WIN32
+	// Arguments are split by the C runtime of the command. Backslashes are
+	// literal unless they precede a double quote, which cannot occur in a
+	// path, so only those before the closing quote are doubled.
+	if (strchr(path, '"'))
+		slakePanic("@glob cannot quote a path containing '\"'");
+
+	size_t pathLength = strlen(path), backslashCount = 0;
+	while (backslashCount < pathLength && path[pathLength - backslashCount - 1] == '\\')
+		backslashCount++;
+
+	length = pathLength + backslashCount + 2;
+	if (out)
+	{
+		*out++ = '"';
+		memcpy(out, path, pathLength);
+		memset(out + pathLength, '\\', backslashCount);
+		out[pathLength + backslashCount] = '"';
+	}
+#else
+	// Everything is literal within single quotes of the shell, except single
+	// quotes themselves, which are written as '\''.
+	length = 2;
+	if (out)
+		*out++ = '\'';
+	for (const char *i = path; *i; i++)
+	{
+		if (*i == '\'')
+		{
+			length += 4;
+			if (out)
+			{
+				memcpy(out, "'\\''", 4);
+				out += 4;
+			}
+		}
+		else
+		{
+			length++;
+			if (out)
+				*out++ = *i;
+		}
+	}
+	if (out)
+		*out = '\'';
+#endif
+
+	return length;
+}
+
+//
+// @glob(pattern: string): string
+// Find paths matching a glob pattern, and return them separated by spaces in
+// sorted order. Paths with spaces or special characters are quoted for the
+// command line. Other asynchronous calls run while directories are walked.
+//
+static void _slakeSuperGlob(SlakeValue *args, unsigned short argCount, SlakeValue *ret)
+{
+	if (argCount != 1 || args[0].type != VALUE_TYPE_STR)
+		slakePanic("@glob requires a string parameter");
+
+	UtilVector paths;
+	utilVectorInit(&paths, sizeof(char *), NULL);
+
+	slakeUnlockInterpreter();
+	slakeGlob(slakeGetString(&args[0]), &paths);
+	slakeLockInterpreter();
+
+	size_t length = 0;
+	for (size_t i = 0; i < paths.size; i++)
+		length += _slakeQuotePath(utilVectorAt(&paths, char *, i), NULL) + (i > 0);
+
+	char *str = slakeAllocString(ret, length);
+	for (size_t i = 0; i < paths.size; i++)
+	{
+		char *path = utilVectorAt(&paths, char *, i);
+
+		if (i)
+			*str++ = ' ';
+		str += _slakeQuotePath(path, str);
+		free(path);
+	}
+	utilVectorFree(&paths);
+}
+
+static const struct
+{
+	const char *name;
+	SlakeSuperFunctionProc proc;
+} superFunctions[] = {
+	{ "shell", _slakeSuperShell },
+	{ "panic", _slakeSuperPanic },
+	{ "rule", _slakeSuperRule },
+	{ "build", _slakeSuperBuild },
+	{ "hashcheck", _slakeSuperHashCheck },
+	{ "actioncache", _slakeSuperActionCache },
+	{ "actionenv", _slakeSuperActionEnv },
+	{ "glob", _slakeSuperGlob }
+};
+
+/**
+ * @brief Get a super function by name.
+ *
+ * @param name Super function name, without the '@' prefix.
+ * @return Corresponding super function. NULL if not found.
+ */
+SlakeSuperFunctionProc slakeGetSuperFunction(const char *name)
+{
+	for (size_t i = 0; i < sizeof(superFunctions) / sizeof(superFunctions[0]); i++)
+		if (!strcmp(superFunctions[i].name, name))
+			return superFunctions[i].proc;
+
+	return NULL;
+}
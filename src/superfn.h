@@ -0,0 +1,10 @@
+#ifndef __SUPERFN_H__
+#define __SUPERFN_H__
+
+#include <slakedef.h>
+
+typedef void (*SlakeSuperFunctionProc)(SlakeValue *args, unsigned short argCount, SlakeValue *ret);
+
+SlakeSuperFunctionProc slakeGetSuperFunction(const char *name);
+
+#endif
@@ -0,0 +1,113 @@
+#include <slakedef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "task.h"
+
+#define SLAKE_SYMBOL_TABLE_MIN_CAPACITY 256
+
+//
+// Names of interned symbols are stored in pages which are never moved, so
+// they can be read without locking while other threads are interning.
+//
+#define SLAKE_SYMBOL_PAGE_SIZE 4096
+#define SLAKE_SYMBOL_MAX_PAGES 4096
+
+//
+// Names of interned symbols, indexed by symbol IDs. ID 0 is reserved.
+//
+static char **symbolPages[SLAKE_SYMBOL_MAX_PAGES];
+static size_t symbolCount = 1;
+
+#define _slakeSymbolName(symbol) (symbolPages[(symbol) / SLAKE_SYMBOL_PAGE_SIZE][(symbol) % SLAKE_SYMBOL_PAGE_SIZE])
+
+// Protects interning.
+static SlakeMutex symbolMutex = SLAKE_MUTEX_INIT;
+
+//
+// Open addressing table of symbol IDs for interning, 0 for empty slots.
+//
+static SlakeSymbol *symbolTable = NULL;
+static size_t symbolTableCapacity = 0;
+
+static SlakeSymbol *_slakeProbeSymbol(const char *name, size_t hash)
+{
+	size_t mask = symbolTableCapacity - 1;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		SlakeSymbol *slot = &symbolTable[i];
+		if (!*slot || !strcmp(_slakeSymbolName(*slot), name))
+			return slot;
+	}
+}
+
+static void _slakeGrowSymbolTable()
+{
+	size_t capacity = symbolTableCapacity ? symbolTableCapacity * 2 : SLAKE_SYMBOL_TABLE_MIN_CAPACITY;
+	SlakeSymbol *table = calloc(capacity, sizeof(SlakeSymbol));
+	if (!table)
+		slakePanic("Out of memory");
+
+	free(symbolTable);
+	symbolTable = table;
+	symbolTableCapacity = capacity;
+
+	for (SlakeSymbol i = 1; i < symbolCount; i++)
+		*_slakeProbeSymbol(_slakeSymbolName(i), utilHashString(_slakeSymbolName(i))) = i;
+}
+
+/**
+ * @brief Intern a name. Equal names are always interned as the same symbol.
+ *
+ * @param name Name to intern.
+ * @return Symbol ID of the name.
+ */
+SlakeSymbol slakeIntern(const char *name)
+{
+	assert(name != NULL);
+
+	size_t hash = utilHashString(name);
+	slakeLockMutex(&symbolMutex);
+
+	// Keep the load factor under 1/2.
+	if (symbolCount * 2 > symbolTableCapacity)
+		_slakeGrowSymbolTable();
+
+	SlakeSymbol *slot = _slakeProbeSymbol(name, hash);
+	if (*slot)
+	{
+		SlakeSymbol symbol = *slot;
+		slakeUnlockMutex(&symbolMutex);
+		return symbol;
+	}
+
+	size_t page = symbolCount / SLAKE_SYMBOL_PAGE_SIZE;
+	if (page >= SLAKE_SYMBOL_MAX_PAGES)
+		slakePanic("Too many symbols");
+	if (!symbolPages[page] && !(symbolPages[page] = calloc(SLAKE_SYMBOL_PAGE_SIZE, sizeof(char *))))
+		slakePanic("Out of memory");
+
+	char *s = strdup(name);
+	if (!s)
+		slakePanic("Out of memory");
+
+	SlakeSymbol symbol = (SlakeSymbol)symbolCount++;
+	_slakeSymbolName(symbol) = s;
+	*slot = symbol;
+
+	slakeUnlockMutex(&symbolMutex);
+	return symbol;
+}
+
+/**
+ * @brief Get name of an interned symbol.
+ *
+ * @param symbol Symbol ID.
+ * @return Name of the symbol.
+ */
+const char *slakeGetSymbolName(SlakeSymbol symbol)
+{
+	assert(symbol != SLAKE_SYMBOL_NONE && symbol < (size_t)SLAKE_SYMBOL_PAGE_SIZE * SLAKE_SYMBOL_MAX_PAGES);
+	return _slakeSymbolName(symbol);
+}
@@ -1,59 +1,975 @@
 #include "task.h"
-#include <util/list.h>
+#include "exec.h"
+#include <slakedef.h>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include <Windows.h>
+#define SLAKE_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <sched.h>
+#define SLAKE_THREAD_LOCAL __thread
 #endif
 
-#ifdef _WIN32
+// Fibers are built on Win32 fibers, or on ucontext where it is provided.
+#if defined(_WIN32) || defined(__GLIBC__)
+#define SLAKE_FIBERS 1
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+#endif
+
+// Sanitizers have to be told about switches between stacks.
+#if defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define SLAKE_TSAN 1
+#endif
+#if __has_feature(address_sanitizer)
+#define SLAKE_ASAN 1
+#endif
+#endif
+#ifdef __SANITIZE_THREAD__
+#define SLAKE_TSAN 1
+#endif
+#ifdef __SANITIZE_ADDRESS__
+#define SLAKE_ASAN 1
+#endif
+#if defined(SLAKE_FIBERS) && defined(SLAKE_TSAN)
+#define SLAKE_FIBER_TSAN 1
+#include <sanitizer/tsan_interface.h>
+#endif
+#if defined(SLAKE_FIBERS) && defined(SLAKE_ASAN) && !defined(_WIN32)
+#define SLAKE_FIBER_ASAN 1
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+// Stacks of fibers are as large as default stacks of threads, but only the
+// pages which are used are committed.
+#define SLAKE_FIBER_STACK_SIZE (8 << 20)
+
+// Count of finished fibers kept for reuse.
+#define SLAKE_MAX_FREE_FIBERS 16
+
+typedef enum _SlakeTaskState
+{
+	TASK_PENDING = 0, // Queued, not claimed by any thread
+	TASK_RUNNING,	  // Being run by a worker or an awaiting thread
+	TASK_DONE		  // Finished or cancelled
+} SlakeTaskState;
+
+//
+// Task scheduled on the pool. A task is referred by its owner and by the
+// deque which it was pushed into, and it is released when both have dropped
+// it, since it can be claimed by slakeAwait before a worker pops it.
+//
 typedef struct _SlakeTask
 {
-	HANDLE hThread;
-}SlakeTask;
+	SlakeTaskProc proc;
+	void *arg;
+	int result;
+
+	SlakeMutex lock; // Protects the state, the waiters and the reference count.
+	SlakeCond done;	 // Signaled when the task is done.
+	SlakeTaskState state;
+	int refCount;
+	struct _SlakeTaskWaiter *waiters; // Fibers suspended until the task is done.
+} SlakeTask;
+
+typedef struct _SlakeTaskWaiter
+{
+	SlakeFiber *fiber;
+	struct _SlakeTaskWaiter *next;
+} SlakeTaskWaiter;
+
+//
+// Deque of tasks of a worker. The worker pushes and pops at the tail, and
+// idle workers steal from the head, so the oldest and usually the largest
+// tasks are stolen.
+//
+typedef struct _SlakeDeque
+{
+	SlakeMutex lock;
+	SlakeTask **tasks; // Ring buffer of tasks.
+	size_t head, size, capacity;
+} SlakeDeque;
+
+typedef struct _SlakeWorker
+{
+	SlakeDeque deque;
+	size_t index;
+} SlakeWorker;
+
+//
+// Stack on which a procedure runs, which can be suspended and resumed later
+// on any worker. The procedure runs in a loop, so finished fibers are reused
+// for other procedures.
+//
+typedef struct _SlakeFiber
+{
+	SlakeTaskProc proc;
+	void *arg;
+	int isDone;
+	int isSuspended;   // Non-zero if switched out and waiting to be scheduled.
+	int isWakePending; // Non-zero if scheduled before it was switched out.
+	struct _SlakeFiber *nextFree;
+#ifdef _WIN32
+	LPVOID handle, caller;
+#elif defined(SLAKE_FIBERS)
+	ucontext_t context, caller;
+	void *stack;
+#endif
+#ifdef SLAKE_FIBER_TSAN
+	void *tsanFiber, *tsanCaller;
+#endif
+#ifdef SLAKE_FIBER_ASAN
+	void *fakeStack;
+	const void *callerStack;
+	size_t callerStackSize;
+#endif
+} SlakeFiber;
+
+static SlakeMutex poolMutex = SLAKE_MUTEX_INIT; // Protects fields below, and is held by workers going idle.
+static SlakeCond poolCond = SLAKE_COND_INIT;	// Signaled when tasks are pushed while workers are idle.
+static SlakeWorker *workers = NULL;
+static size_t workerCount = 0;
+static size_t idleCount = 0;
+static size_t nextWorker = 0; // Worker which tasks from other threads are pushed to.
+static int isPoolStarted = 0;
+
+static SLAKE_THREAD_LOCAL SlakeWorker *currentWorker = NULL;
+static SLAKE_THREAD_LOCAL SlakeFiber *currentFiber = NULL;
+
+static SlakeMutex fiberMutex = SLAKE_MUTEX_INIT; // Protects the list of free fibers and states of suspension.
+static SlakeFiber *freeFibers = NULL;
+static size_t freeFiberCount = 0;
+
+static void _slakeInitMutex(SlakeMutex *mutex)
+{
+#ifdef _WIN32
+	InitializeSRWLock(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void _slakeDestroyMutex(SlakeMutex *mutex)
+{
+#ifndef _WIN32
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void _slakeInitCond(SlakeCond *cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(cond);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+static void _slakeDestroyCond(SlakeCond *cond)
+{
+#ifndef _WIN32
+	pthread_cond_destroy(cond);
+#endif
+}
+
+//
+// Drop a reference to a task, and free it if it is the last one.
+//
+static void _slakeReleaseTask(SlakeTask *task)
+{
+	slakeLockMutex(&task->lock);
+	int refCount = --task->refCount;
+	slakeUnlockMutex(&task->lock);
+
+	if (refCount)
+		return;
+
+	_slakeDestroyCond(&task->done);
+	_slakeDestroyMutex(&task->lock);
+	free(task);
+}
+
+//
+// Claim a pending task for the current thread.
+//
+// Returns non-zero if claimed, zero if the task has been claimed already.
+//
+static int _slakeClaimTask(SlakeTask *task)
+{
+	slakeLockMutex(&task->lock);
+	int claimed = task->state == TASK_PENDING;
+	if (claimed)
+		task->state = TASK_RUNNING;
+	slakeUnlockMutex(&task->lock);
+	return claimed;
+}
+
+//
+// Run a claimed task and wake up its waiters.
+//
+static void _slakeRunTask(SlakeTask *task)
+{
+	int result = task->proc(task->arg);
+
+	slakeLockMutex(&task->lock);
+	task->result = result;
+	task->state = TASK_DONE;
+	slakeBroadcastCond(&task->done);
+	SlakeTaskWaiter *waiters = task->waiters;
+	task->waiters = NULL;
+	slakeUnlockMutex(&task->lock);
+
+	for (SlakeTaskWaiter *waiter = waiters, *next; waiter; waiter = next)
+	{
+		next = waiter->next;
+		slakeScheduleFiber(waiter->fiber);
+	}
+}
+
+static void _slakePushTask(SlakeDeque *deque, SlakeTask *task)
+{
+	slakeLockMutex(&deque->lock);
+
+	if (deque->size == deque->capacity)
+	{
+		size_t capacity = deque->capacity ? deque->capacity * 2 : 16;
+		SlakeTask **tasks = malloc(sizeof(SlakeTask *) * capacity);
+		if (!tasks)
+			slakePanic("Out of memory");
+
+		for (size_t i = 0; i < deque->size; i++)
+			tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+		free(deque->tasks);
+
+		deque->tasks = tasks;
+		deque->head = 0;
+		deque->capacity = capacity;
+	}
+
+	deque->tasks[(deque->head + deque->size++) % deque->capacity] = task;
+
+	slakeUnlockMutex(&deque->lock);
+}
+
+//
+// Pop a task from the tail, or steal one from the head of a deque.
+//
+static SlakeTask *_slakePopTask(SlakeDeque *deque, int steal)
+{
+	SlakeTask *task = NULL;
+
+	slakeLockMutex(&deque->lock);
+	if (deque->size)
+	{
+		if (steal)
+		{
+			task = deque->tasks[deque->head];
+			deque->head = (deque->head + 1) % deque->capacity;
+		}
+		else
+			task = deque->tasks[(deque->head + deque->size - 1) % deque->capacity];
+		deque->size--;
+	}
+	slakeUnlockMutex(&deque->lock);
+
+	return task;
+}
+
+//
+// Take a task for a worker, from its own deque first and then from others.
+//
+static SlakeTask *_slakeTakeTask(SlakeWorker *worker)
+{
+	SlakeTask *task = _slakePopTask(&worker->deque, 0);
+
+	for (size_t i = 1; !task && i < workerCount; i++)
+		task = _slakePopTask(&workers[(worker->index + i) % workerCount].deque, 1);
+
+	return task;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _slakeWorkerProc(LPVOID param)
+#else
+static void *_slakeWorkerProc(void *param)
+#endif
+{
+	SlakeWorker *worker = param;
+	currentWorker = worker;
+
+#ifdef _WIN32
+	// Only fibers can switch to other fibers.
+	ConvertThreadToFiber(NULL);
+#endif
+
+	for (;;)
+	{
+		SlakeTask *task = _slakeTakeTask(worker);
+		if (!task)
+		{
+			// Look for tasks again while holding the pool lock, so no task
+			// pushed before the worker sleeps can be missed.
+			slakeLockMutex(&poolMutex);
+			while (!(task = _slakeTakeTask(worker)))
+			{
+				idleCount++;
+				slakeWaitCond(&poolCond, &poolMutex);
+				idleCount--;
+			}
+			slakeUnlockMutex(&poolMutex);
+		}
+
+		// Tasks which were claimed by awaiting threads are skipped.
+		if (_slakeClaimTask(task))
+			_slakeRunTask(task);
+		_slakeReleaseTask(task);
+	}
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+//
+// Start workers of the pool, one for each processor. Tasks waiting for
+// commands are suspended on fibers instead of blocking workers. The pool
+// lock must be held.
+//
+static void _slakeStartPool()
+{
+	isPoolStarted = 1;
+
+	size_t count = slakeGetCpuCount();
+	if (!(workers = malloc(sizeof(SlakeWorker) * count)))
+		slakePanic("Out of memory");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		_slakeInitMutex(&workers[i].deque.lock);
+		workers[i].deque.tasks = NULL;
+		workers[i].deque.head = workers[i].deque.size = workers[i].deque.capacity = 0;
+		workers[i].index = i;
+	}
+	workerCount = count;
+
+	// Workers are detached, they sleep until the process exits. Deques of
+	// workers which failed to start are still drained by stealing.
+	size_t startedCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+#ifdef _WIN32
+		HANDLE hThread = CreateThread(NULL, 0, _slakeWorkerProc, &workers[i], 0, NULL);
+		if (!hThread)
+			continue;
+		CloseHandle(hThread);
+#else
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, _slakeWorkerProc, &workers[i]))
+			continue;
+		pthread_detach(thread);
+#endif
+		startedCount++;
+	}
+
+	if (!startedCount)
+		workerCount = 0;
+}
+
+/**
+ * @brief Schedule a task on the thread pool. Tasks created by a worker are
+ * pushed to its own deque, idle workers steal them from others.
+ *
+ * @param proc Procedure of the task.
+ * @param arg Argument passed to the procedure.
+ * @return Created task, must be released by slakeAwait or slakeKillTask.
+ * NULL if failed.
+ */
+SlakeTask *slakeCreateTask(SlakeTaskProc proc, void *arg)
+{
+	SlakeTask *task = malloc(sizeof(SlakeTask));
+	if (!task)
+		return NULL;
+
+	task->proc = proc;
+	task->arg = arg;
+	task->result = 0;
+	_slakeInitMutex(&task->lock);
+	_slakeInitCond(&task->done);
+	task->state = TASK_PENDING;
+	task->refCount = 2;
+	task->waiters = NULL;
+
+	if (currentWorker)
+	{
+		_slakePushTask(&currentWorker->deque, task);
+
+		slakeLockMutex(&poolMutex);
+		if (idleCount)
+			slakeSignalCond(&poolCond);
+		slakeUnlockMutex(&poolMutex);
+		return task;
+	}
+
+	slakeLockMutex(&poolMutex);
+	if (!isPoolStarted)
+		_slakeStartPool();
+
+	if (workerCount)
+	{
+		_slakePushTask(&workers[nextWorker++ % workerCount].deque, task);
+		if (idleCount)
+			slakeSignalCond(&poolCond);
+	}
+	else
+		task->refCount = 1; // Without workers, the task is run when it is awaited.
+	slakeUnlockMutex(&poolMutex);
+
+	return task;
+}
+
+/**
+ * @brief Cancel a task and release it. A task which has started cannot be
+ * interrupted, it is waited for instead.
+ *
+ * @param task Target task.
+ */
+void slakeKillTask(SlakeTask *task)
+{
+	slakeLockMutex(&task->lock);
+	if (task->state == TASK_PENDING)
+	{
+		task->result = -1;
+		task->state = TASK_DONE;
+	}
+	while (task->state != TASK_DONE)
+		slakeWaitCond(&task->done, &task->lock);
+	slakeUnlockMutex(&task->lock);
+
+	_slakeReleaseTask(task);
+}
+
+/**
+ * @brief Release a task without waiting for it. The task still runs, and it
+ * is freed after it has finished.
+ *
+ * @param task Target task.
+ */
+void slakeDetachTask(SlakeTask *task)
+{
+	// Without workers, nobody else would run the task.
+	if (!workerCount && _slakeClaimTask(task))
+		_slakeRunTask(task);
+
+	_slakeReleaseTask(task);
+}
+
+/**
+ * @brief Check if a task is still pending or running.
+ *
+ * @param task Target task.
+ * @return Non-zero if the task is not done.
+ */
+int slakeIsTaskAlive(SlakeTask *task)
+{
+	slakeLockMutex(&task->lock);
+	int alive = task->state != TASK_DONE;
+	slakeUnlockMutex(&task->lock);
+	return alive;
+}
+
+//
+// Wait for a task to finish and release it. If canSuspend is non-zero, a
+// fiber waiting for a task running on another thread is suspended instead
+// of blocking its worker.
+//
+static int _slakeAwait(SlakeTask *task, int canSuspend)
+{
+	if (_slakeClaimTask(task))
+		_slakeRunTask(task);
+
+	SlakeTaskWaiter waiter;
+	waiter.fiber = canSuspend ? slakeGetCurrentFiber() : NULL;
+
+	slakeLockMutex(&task->lock);
+	while (task->state != TASK_DONE)
+	{
+		if (!waiter.fiber)
+		{
+			slakeWaitCond(&task->done, &task->lock);
+			continue;
+		}
+
+		waiter.next = task->waiters;
+		task->waiters = &waiter;
+		slakeUnlockMutex(&task->lock);
+		slakeSuspendFiber();
+		slakeLockMutex(&task->lock);
+	}
+	int result = task->result;
+	slakeUnlockMutex(&task->lock);
+
+	_slakeReleaseTask(task);
+	return result;
+}
+
+/**
+ * @brief Wait for a task to finish and release it. A task which has not
+ * been started by any worker is run on the current thread. On a fiber, the
+ * fiber is suspended while another thread runs the task, so the caller must
+ * not hold any lock, since the fiber may resume on another thread.
+ *
+ * @param task Target task.
+ * @return Return value of the task procedure.
+ */
+int slakeAwait(SlakeTask *task)
+{
+	return _slakeAwait(task, 1);
+}
+
+/**
+ * @brief Wait for a task to finish and release it, blocking the current
+ * thread even on a fiber. Used by callers which hold locks while waiting.
+ *
+ * @param task Target task.
+ * @return Return value of the task procedure.
+ */
+int slakeAwaitBlocking(SlakeTask *task)
+{
+	return _slakeAwait(task, 0);
+}
+
+/**
+ * @brief Check if the current thread is a worker of the pool.
+ *
+ * @return Non-zero if it is.
+ */
+int slakeIsWorkerThread()
+{
+	return currentWorker != NULL;
+}
+
+typedef struct _SlakeThreadStart
+{
+	SlakeTaskProc proc;
+	void *arg;
+} SlakeThreadStart;
 
-static LPVOID WINAPI slakeTaskWrap(LPVOID param)
+#ifdef _WIN32
+static DWORD WINAPI _slakeThreadProc(LPVOID param)
+#else
+static void *_slakeThreadProc(void *param)
+#endif
 {
-	SlakeTaskProc proc=param;
-	return proc();
+	SlakeThreadStart start = *(SlakeThreadStart *)param;
+	free(param);
+
+	start.proc(start.arg);
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
 }
+
+/**
+ * @brief Start a detached thread out of the pool, for procedures which
+ * block most of the time.
+ *
+ * @param proc Procedure of the thread.
+ * @param arg Argument passed to the procedure.
+ * @return Non-zero if failed.
+ */
+int slakeStartThread(SlakeTaskProc proc, void *arg)
+{
+	SlakeThreadStart *start = malloc(sizeof(SlakeThreadStart));
+	if (!start)
+		return 1;
+	start->proc = proc;
+	start->arg = arg;
+
+#ifdef _WIN32
+	HANDLE hThread = CreateThread(NULL, 0, _slakeThreadProc, start, 0, NULL);
+	if (hThread)
+	{
+		CloseHandle(hThread);
+		return 0;
+	}
+#else
+	pthread_t thread;
+	if (!pthread_create(&thread, NULL, _slakeThreadProc, start))
+	{
+		pthread_detach(thread);
+		return 0;
+	}
 #endif
 
-SlakeTask *slakeCreateTask(SlakeTaskProc proc)
+	free(start);
+	return 1;
+}
+
+#ifdef SLAKE_FIBERS
+//
+// Switch from the resuming thread into a fiber, and return when the fiber
+// switches back.
+//
+static void _slakeSwitchIn(SlakeFiber *fiber)
 {
-	#ifdef _WIN32
-	SlakeTask* t=malloc(sizeof(SlakeTask));
-	if(!t)
+#ifdef SLAKE_FIBER_TSAN
+	fiber->tsanCaller = __tsan_get_current_fiber();
+	__tsan_switch_to_fiber(fiber->tsanFiber, 0);
+#endif
+#ifdef SLAKE_FIBER_ASAN
+	void *fakeStack;
+	__sanitizer_start_switch_fiber(&fakeStack, fiber->stack, SLAKE_FIBER_STACK_SIZE);
+#endif
+
+#ifdef _WIN32
+	fiber->caller = GetCurrentFiber();
+	SwitchToFiber(fiber->handle);
+#else
+	swapcontext(&fiber->caller, &fiber->context);
+#endif
+
+#ifdef SLAKE_FIBER_ASAN
+	__sanitizer_finish_switch_fiber(fakeStack, NULL, NULL);
+#endif
+}
+
+//
+// Switch from a fiber back to the thread which resumed it, and return when
+// the fiber is resumed again, possibly by another thread.
+//
+static void _slakeSwitchOut(SlakeFiber *fiber)
+{
+#ifdef SLAKE_FIBER_TSAN
+	__tsan_switch_to_fiber(fiber->tsanCaller, 0);
+#endif
+#ifdef SLAKE_FIBER_ASAN
+	__sanitizer_start_switch_fiber(&fiber->fakeStack, fiber->callerStack, fiber->callerStackSize);
+#endif
+
+#ifdef _WIN32
+	SwitchToFiber(fiber->caller);
+#else
+	swapcontext(&fiber->context, &fiber->caller);
+#endif
+
+#ifdef SLAKE_FIBER_ASAN
+	__sanitizer_finish_switch_fiber(fiber->fakeStack, &fiber->callerStack, &fiber->callerStackSize);
+#endif
+}
+
+#ifdef _WIN32
+static VOID CALLBACK _slakeFiberEntry(LPVOID param)
+#else
+static void _slakeFiberEntry()
+#endif
+{
+#ifdef _WIN32
+	(void)param;
+#endif
+
+	// The fiber is taken from the resuming thread, since makecontext() only
+	// passes integers.
+	SlakeFiber *fiber = currentFiber;
+
+#ifdef SLAKE_FIBER_ASAN
+	__sanitizer_finish_switch_fiber(NULL, &fiber->callerStack, &fiber->callerStackSize);
+#endif
+
+	for (;;)
+	{
+		fiber->proc(fiber->arg);
+		fiber->isDone = 1;
+		_slakeSwitchOut(fiber);
+	}
+}
+
+static SlakeFiber *_slakeNewFiber()
+{
+	SlakeFiber *fiber = malloc(sizeof(SlakeFiber));
+	if (!fiber)
 		return NULL;
 
-	t->hThread=CreateThread(NULL,0,slakeTaskWrap,proc,0,NULL);
-	return t;
-	#endif
+#ifdef _WIN32
+	if (!(fiber->handle = CreateFiberEx(0, SLAKE_FIBER_STACK_SIZE, FIBER_FLAG_FLOAT_SWITCH, _slakeFiberEntry, NULL)))
+	{
+		free(fiber);
+		return NULL;
+	}
+#else
+	// The lowest page is protected, so overflows fault instead of corrupting
+	// other memory.
+	fiber->stack = mmap(NULL, SLAKE_FIBER_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (fiber->stack == MAP_FAILED)
+	{
+		free(fiber);
+		return NULL;
+	}
+	mprotect(fiber->stack, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE);
+
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = SLAKE_FIBER_STACK_SIZE;
+	fiber->context.uc_link = NULL;
+	makecontext(&fiber->context, _slakeFiberEntry, 0);
+#endif
+
+#ifdef SLAKE_FIBER_TSAN
+	fiber->tsanFiber = __tsan_create_fiber(0);
+#endif
+	return fiber;
+}
+
+//
+// Keep a finished fiber for reuse, or destroy it.
+//
+static void _slakeFreeFiber(SlakeFiber *fiber)
+{
+	slakeLockMutex(&fiberMutex);
+	if (freeFiberCount < SLAKE_MAX_FREE_FIBERS)
+	{
+		fiber->nextFree = freeFibers;
+		freeFibers = fiber;
+		freeFiberCount++;
+		fiber = NULL;
+	}
+	slakeUnlockMutex(&fiberMutex);
+
+	if (!fiber)
+		return;
+
+#ifdef SLAKE_FIBER_TSAN
+	__tsan_destroy_fiber(fiber->tsanFiber);
+#endif
+#ifdef _WIN32
+	DeleteFiber(fiber->handle);
+#else
+	munmap(fiber->stack, SLAKE_FIBER_STACK_SIZE);
+#endif
+	free(fiber);
+}
+#endif
+
+static int _slakeResumeFiberProc(void *arg)
+{
+	slakeResumeFiber(arg);
+	return 0;
+}
+
+//
+// Resume a fiber on the pool.
+//
+static void _slakeQueueFiber(SlakeFiber *fiber)
+{
+	SlakeTask *task = slakeCreateTask(_slakeResumeFiberProc, fiber);
+	if (!task)
+		slakePanic("Out of memory");
+	slakeDetachTask(task);
+}
+
+/**
+ * @brief Create a fiber, which runs a procedure on its own stack when it is
+ * resumed. Fibers can only be resumed by workers of the pool.
+ *
+ * @param proc Procedure to run.
+ * @param arg Argument passed to the procedure.
+ * @return Created fiber, released when the procedure finishes. NULL if
+ * failed or fibers are not supported.
+ */
+SlakeFiber *slakeCreateFiber(SlakeTaskProc proc, void *arg)
+{
+#ifdef SLAKE_FIBERS
+	slakeLockMutex(&fiberMutex);
+	SlakeFiber *fiber = freeFibers;
+	if (fiber)
+	{
+		freeFibers = fiber->nextFree;
+		freeFiberCount--;
+	}
+	slakeUnlockMutex(&fiberMutex);
+
+	if (!fiber && !(fiber = _slakeNewFiber()))
+		return NULL;
+
+	fiber->proc = proc;
+	fiber->arg = arg;
+	fiber->isDone = 0;
+	fiber->isSuspended = 0;
+	fiber->isWakePending = 0;
+	return fiber;
+#else
+	(void)proc;
+	(void)arg;
+	return NULL;
+#endif
+}
+
+/**
+ * @brief Run a fiber on the current thread until its procedure finishes or
+ * suspends it.
+ *
+ * @param fiber Target fiber.
+ */
+void slakeResumeFiber(SlakeFiber *fiber)
+{
+#ifdef SLAKE_FIBERS
+	SlakeFiber *resumer = currentFiber;
+	currentFiber = fiber;
+	_slakeSwitchIn(fiber);
+	currentFiber = resumer;
+
+	if (fiber->isDone)
+	{
+		_slakeFreeFiber(fiber);
+		return;
+	}
+
+	// The fiber may have been scheduled before it was switched out, then it
+	// is resumed now.
+	slakeLockMutex(&fiberMutex);
+	int isWoken = fiber->isWakePending;
+	fiber->isWakePending = 0;
+	fiber->isSuspended = !isWoken;
+	slakeUnlockMutex(&fiberMutex);
+
+	if (isWoken)
+		_slakeQueueFiber(fiber);
+#else
+	(void)fiber;
+#endif
 }
 
-void slakeKillTask(SlakeTask* task)
+/**
+ * @brief Suspend the current fiber and return to the thread which resumed
+ * it, until slakeScheduleFiber() is called for the fiber. It may have been
+ * called already since the fiber arranged it.
+ */
+void slakeSuspendFiber()
 {
-	#ifdef _WIN32
-	TerminateThread(task->hThread, 0xffffffff);
-	CloseHandle(task->hThread);
-	#endif
+#ifdef SLAKE_FIBERS
+	_slakeSwitchOut(currentFiber);
+#endif
 }
 
-int slakeIsTaskAlive(SlakeTask* task)
+/**
+ * @brief Resume a suspended fiber on a worker of the pool. If the fiber has
+ * not been suspended yet, it is resumed as soon as it is.
+ *
+ * @param fiber Target fiber.
+ */
+void slakeScheduleFiber(SlakeFiber *fiber)
 {
-	#ifdef _WIN32
-	#endif
+	slakeLockMutex(&fiberMutex);
+	int isSuspended = fiber->isSuspended;
+	fiber->isSuspended = 0;
+	if (!isSuspended)
+		fiber->isWakePending = 1;
+	slakeUnlockMutex(&fiberMutex);
+
+	if (isSuspended)
+		_slakeQueueFiber(fiber);
 }
 
-void slakeAwait(SlakeTask* task)
+/**
+ * @brief Get the fiber running on the current thread.
+ *
+ * @return Current fiber, NULL if the thread is not running any fiber.
+ */
+SlakeFiber *slakeGetCurrentFiber()
 {
-	#ifdef _WIN32
-	WaitForSingleObject(task->hThread,INFINITE);
-	#endif
+	return currentFiber;
 }
 
+/**
+ * @brief Give up the processor to other threads.
+ */
 void slakeYield()
 {
-	#ifdef _WIN32
+#ifdef _WIN32
 	SwitchToThread();
-	#endif
+#else
+	sched_yield();
+#endif
+}
+
+/**
+ * @brief Lock a mutex, which must be initialized with SLAKE_MUTEX_INIT.
+ *
+ * @param mutex Target mutex.
+ */
+void slakeLockMutex(SlakeMutex *mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+/**
+ * @brief Unlock a mutex locked by slakeLockMutex.
+ *
+ * @param mutex Target mutex.
+ */
+void slakeUnlockMutex(SlakeMutex *mutex)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+/**
+ * @brief Wait on a condition variable, which must be initialized with
+ * SLAKE_COND_INIT. The mutex is unlocked while waiting.
+ *
+ * @param cond Target condition variable.
+ * @param mutex Mutex locked by the current thread.
+ */
+void slakeWaitCond(SlakeCond *cond, SlakeMutex *mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+	pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/**
+ * @brief Wake up one thread waiting on a condition variable.
+ *
+ * @param cond Target condition variable.
+ */
+void slakeSignalCond(SlakeCond *cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(cond);
+#else
+	pthread_cond_signal(cond);
+#endif
+}
+
+/**
+ * @brief Wake up all threads waiting on a condition variable.
+ *
+ * @param cond Target condition variable.
+ */
+void slakeBroadcastCond(SlakeCond *cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(cond);
+#else
+	pthread_cond_broadcast(cond);
+#endif
 }
@@ -1,14 +1,45 @@
 #ifndef __TASK_H__
 #define __TASK_H__
 
+#ifdef _WIN32
+#include <Windows.h>
+typedef SRWLOCK SlakeMutex;
+typedef CONDITION_VARIABLE SlakeCond;
+#define SLAKE_MUTEX_INIT SRWLOCK_INIT
+#define SLAKE_COND_INIT CONDITION_VARIABLE_INIT
+#else
+#include <pthread.h>
+typedef pthread_mutex_t SlakeMutex;
+typedef pthread_cond_t SlakeCond;
+#define SLAKE_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define SLAKE_COND_INIT PTHREAD_COND_INITIALIZER
+#endif
+
 typedef struct _SlakeTask SlakeTask;
+typedef struct _SlakeFiber SlakeFiber;
 
-typedef int (*SlakeTaskProc)();
+typedef int (*SlakeTaskProc)(void *arg);
 
-SlakeTask *slakeCreateTask(SlakeTaskProc proc);
+SlakeTask *slakeCreateTask(SlakeTaskProc proc, void *arg);
 void slakeKillTask(SlakeTask* task);
+void slakeDetachTask(SlakeTask *task);
 int slakeIsTaskAlive(SlakeTask* task);
-void slakeAwait(SlakeTask* task);
+int slakeAwait(SlakeTask* task);
+int slakeAwaitBlocking(SlakeTask *task);
+int slakeIsWorkerThread();
+int slakeStartThread(SlakeTaskProc proc, void *arg);
 void slakeYield();
 
+SlakeFiber *slakeCreateFiber(SlakeTaskProc proc, void *arg);
+void slakeResumeFiber(SlakeFiber *fiber);
+void slakeSuspendFiber();
+void slakeScheduleFiber(SlakeFiber *fiber);
+SlakeFiber *slakeGetCurrentFiber();
+
+void slakeLockMutex(SlakeMutex *mutex);
+void slakeUnlockMutex(SlakeMutex *mutex);
+void slakeWaitCond(SlakeCond *cond, SlakeMutex *mutex);
+void slakeSignalCond(SlakeCond *cond);
+void slakeBroadcastCond(SlakeCond *cond);
+
 #endif
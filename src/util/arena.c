@@ -0,0 +1,160 @@
+#include <util/arena.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define UTIL_ARENA_DEFAULT_CHUNK_SIZE 65536
+#define UTIL_ARENA_ALIGN 16
+
+#define _utilArenaAlignUp(n) (((n) + UTIL_ARENA_ALIGN - 1) & ~(size_t)(UTIL_ARENA_ALIGN - 1))
+#define _utilArenaChunkData(chunk) ((char *)(chunk) + _utilArenaAlignUp(sizeof(UtilArenaChunk)))
+
+/**
+ * @brief Create a new arena.
+ *
+ * @param chunkSize Size in byte of each chunk, 0 for default.
+ * @return Created arena. NULL if failed.
+ */
+UtilArena *utilArenaNew(size_t chunkSize)
+{
+	UtilArena *arena = malloc(sizeof(UtilArena));
+	if (!arena)
+		return NULL;
+
+	// Chunks are allocated on the first allocation.
+	arena->chunks = NULL;
+	arena->lastChunk = NULL;
+	arena->freeChunks = NULL;
+	arena->chunkSize = chunkSize ? _utilArenaAlignUp(chunkSize) : UTIL_ARENA_DEFAULT_CHUNK_SIZE;
+
+	return arena;
+}
+
+static void _utilArenaFreeChunks(UtilArenaChunk *chunk)
+{
+	while (chunk)
+	{
+		UtilArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+/**
+ * @brief Free an arena and all memory allocated from it.
+ *
+ * @param arena Target arena.
+ */
+void utilArenaDelete(UtilArena *arena)
+{
+	assert(arena != NULL);
+
+	_utilArenaFreeChunks(arena->chunks);
+	_utilArenaFreeChunks(arena->freeChunks);
+	free(arena);
+}
+
+/**
+ * @brief Release all memory allocated from an arena at once. The chunks
+ * will be kept for later allocations.
+ *
+ * @param arena Target arena.
+ */
+void utilArenaReset(UtilArena *arena)
+{
+	assert(arena != NULL);
+
+	if (!arena->chunks)
+		return;
+
+	arena->lastChunk->next = arena->freeChunks;
+	arena->freeChunks = arena->chunks;
+	arena->chunks = NULL;
+	arena->lastChunk = NULL;
+}
+
+//
+// Make a chunk with at least specified size current, reusing a free chunk
+// if possible.
+//
+static UtilArenaChunk *_utilArenaNewChunk(UtilArena *arena, size_t size)
+{
+	UtilArenaChunk *chunk = arena->freeChunks;
+
+	if (chunk && chunk->size >= size)
+		arena->freeChunks = chunk->next;
+	else
+	{
+		if (size < arena->chunkSize)
+			size = arena->chunkSize;
+
+		chunk = malloc(_utilArenaAlignUp(sizeof(UtilArenaChunk)) + size);
+		if (!chunk)
+			return NULL;
+		chunk->size = size;
+	}
+	chunk->used = 0;
+
+	chunk->next = arena->chunks;
+	if (!arena->chunks)
+		arena->lastChunk = chunk;
+	arena->chunks = chunk;
+
+	return chunk;
+}
+
+/**
+ * @brief Allocate memory from an arena. The memory cannot be freed
+ * individually.
+ *
+ * @param arena Target arena.
+ * @param size Size in byte to allocate.
+ * @return Allocated memory. NULL if failed.
+ */
+void *utilArenaAlloc(UtilArena *arena, size_t size)
+{
+	assert(arena != NULL);
+
+	size = _utilArenaAlignUp(size ? size : 1);
+
+	UtilArenaChunk *chunk = arena->chunks;
+	if (!chunk || chunk->size - chunk->used < size)
+	{
+		if (!(chunk = _utilArenaNewChunk(arena, size)))
+			return NULL;
+	}
+
+	void *p = _utilArenaChunkData(chunk) + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+/**
+ * @brief Copy a memory block into an arena.
+ *
+ * @param arena Target arena.
+ * @param data Data to copy.
+ * @param size Size in byte of the data.
+ * @return Copied memory. NULL if failed.
+ */
+void *utilArenaDup(UtilArena *arena, const void *data, size_t size)
+{
+	void *p = utilArenaAlloc(arena, size);
+	if (p && size)
+		memcpy(p, data, size);
+
+	return p;
+}
+
+/**
+ * @brief Copy a string into an arena.
+ *
+ * @param arena Target arena.
+ * @param str String to copy.
+ * @return Copied string. NULL if failed.
+ */
+char *utilArenaStrdup(UtilArena *arena, const char *str)
+{
+	return utilArenaDup(arena, str, strlen(str) + 1);
+}
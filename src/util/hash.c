@@ -0,0 +1,107 @@
+#include <util/hash.h>
+#include <string.h>
+
+//
+// XXH64 constants.
+//
+#define UTIL_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define UTIL_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define UTIL_HASH_PRIME3 0x165667B19E3779F9ULL
+#define UTIL_HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define UTIL_HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+#define _utilRotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t _utilRead64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t _utilRead32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t _utilHashRound(uint64_t acc, uint64_t input)
+{
+	acc += input * UTIL_HASH_PRIME2;
+	acc = _utilRotl64(acc, 31);
+	return acc * UTIL_HASH_PRIME1;
+}
+
+static inline uint64_t _utilHashMerge(uint64_t acc, uint64_t v)
+{
+	acc ^= _utilHashRound(0, v);
+	return acc * UTIL_HASH_PRIME1 + UTIL_HASH_PRIME4;
+}
+
+/**
+ * @brief Hash a memory block with XXH64. Results are the same as the
+ * reference implementation on little-endian hosts.
+ *
+ * @param data Data to hash.
+ * @param size Size in byte of the data.
+ * @param seed Seed of the hash, can be used to chain hashes.
+ * @return Hash of the data.
+ */
+uint64_t utilHash64(const void *data, size_t size, uint64_t seed)
+{
+	const unsigned char *p = data, *end = p + size;
+	uint64_t h;
+
+	if (size >= 32)
+	{
+		uint64_t v1 = seed + UTIL_HASH_PRIME1 + UTIL_HASH_PRIME2;
+		uint64_t v2 = seed + UTIL_HASH_PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - UTIL_HASH_PRIME1;
+
+		// Four independent lanes for instruction-level parallelism.
+		for (const unsigned char *limit = end - 32; p <= limit; p += 32)
+		{
+			v1 = _utilHashRound(v1, _utilRead64(p));
+			v2 = _utilHashRound(v2, _utilRead64(p + 8));
+			v3 = _utilHashRound(v3, _utilRead64(p + 16));
+			v4 = _utilHashRound(v4, _utilRead64(p + 24));
+		}
+
+		h = _utilRotl64(v1, 1) + _utilRotl64(v2, 7) + _utilRotl64(v3, 12) + _utilRotl64(v4, 18);
+		h = _utilHashMerge(h, v1);
+		h = _utilHashMerge(h, v2);
+		h = _utilHashMerge(h, v3);
+		h = _utilHashMerge(h, v4);
+	}
+	else
+		h = seed + UTIL_HASH_PRIME5;
+
+	h += (uint64_t)size;
+
+	for (; end - p >= 8; p += 8)
+	{
+		h ^= _utilHashRound(0, _utilRead64(p));
+		h = _utilRotl64(h, 27) * UTIL_HASH_PRIME1 + UTIL_HASH_PRIME4;
+	}
+	if (end - p >= 4)
+	{
+		h ^= (uint64_t)_utilRead32(p) * UTIL_HASH_PRIME1;
+		h = _utilRotl64(h, 23) * UTIL_HASH_PRIME2 + UTIL_HASH_PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		h ^= *p * UTIL_HASH_PRIME5;
+		h = _utilRotl64(h, 11) * UTIL_HASH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= UTIL_HASH_PRIME2;
+	h ^= h >> 29;
+	h *= UTIL_HASH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
@@ -0,0 +1,197 @@
+#include <util/hashmap.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define UTIL_HASHMAP_MIN_CAPACITY 8
+
+/**
+ * @brief Hash a string with FNV-1a.
+ *
+ * @param str String to hash.
+ * @return Hash of the string.
+ */
+size_t utilHashString(const char *str)
+{
+	size_t hash = (size_t)14695981039346656037ULL;
+
+	while (*str)
+	{
+		hash ^= (unsigned char)*str++;
+		hash *= (size_t)1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Create a new hash map.
+ *
+ * @return Created hash map. NULL if failed.
+ */
+UtilHashMap *utilHashMapNew()
+{
+	UtilHashMap *map = malloc(sizeof(UtilHashMap));
+	if (!map)
+		return NULL;
+
+	// Slots are allocated on the first insertion.
+	map->slots = NULL;
+	map->capacity = 0;
+	map->size = 0;
+
+	return map;
+}
+
+/**
+ * @brief Free a hash map. The keys and values will not be freed.
+ *
+ * @param map Target hash map.
+ */
+void utilHashMapDelete(UtilHashMap *map)
+{
+	assert(map != NULL);
+
+	free(map->slots);
+	free(map);
+}
+
+//
+// Scatter integer keys so that strided keys do not cluster.
+//
+static size_t _utilHashKey(size_t key)
+{
+	unsigned long long hash = key * 0x9e3779b97f4a7c15ULL;
+	return (size_t)(hash ^ (hash >> 32));
+}
+
+//
+// Find the slot of a key, or the empty slot where it should be inserted.
+//
+static UtilHashMapSlot *_utilHashMapProbe(const UtilHashMap *map, size_t key)
+{
+	size_t mask = map->capacity - 1;
+
+	for (size_t i = _utilHashKey(key) & mask;; i = (i + 1) & mask)
+	{
+		UtilHashMapSlot *slot = &map->slots[i];
+		if (!slot->key || slot->key == key)
+			return slot;
+	}
+}
+
+static int _utilHashMapResize(UtilHashMap *map, size_t capacity)
+{
+	UtilHashMapSlot *slots = calloc(capacity, sizeof(UtilHashMapSlot));
+	if (!slots)
+		return 0;
+
+	UtilHashMapSlot *oldSlots = map->slots;
+	size_t oldCapacity = map->capacity;
+
+	map->slots = slots;
+	map->capacity = capacity;
+
+	for (size_t i = 0; i < oldCapacity; i++)
+		if (oldSlots[i].key)
+			*_utilHashMapProbe(map, oldSlots[i].key) = oldSlots[i];
+
+	free(oldSlots);
+	return 1;
+}
+
+/**
+ * @brief Find the slot of a key.
+ *
+ * @param map Target hash map.
+ * @param key Key to find.
+ * @return Corresponding slot. NULL if not found.
+ */
+UtilHashMapSlot *utilHashMapFind(const UtilHashMap *map, size_t key)
+{
+	assert(map != NULL);
+	assert(key != 0);
+
+	if (!map->size)
+		return NULL;
+
+	UtilHashMapSlot *slot = _utilHashMapProbe(map, key);
+	return slot->key ? slot : NULL;
+}
+
+/**
+ * @brief Get value of a key.
+ *
+ * @param map Target hash map.
+ * @param key Key to find.
+ * @return Corresponding value. NULL if not found.
+ */
+void *utilHashMapGet(const UtilHashMap *map, size_t key)
+{
+	UtilHashMapSlot *slot = utilHashMapFind(map, key);
+	return slot ? slot->value : NULL;
+}
+
+/**
+ * @brief Find the slot of a key, or insert a new slot with NULL value if
+ * not found.
+ *
+ * @param map Target hash map.
+ * @param key Key to insert.
+ * @return Corresponding slot. NULL if failed.
+ */
+UtilHashMapSlot *utilHashMapInsert(UtilHashMap *map, size_t key)
+{
+	assert(map != NULL);
+	assert(key != 0);
+
+	// Keep the load factor under 3/4.
+	if ((map->size + 1) * 4 > map->capacity * 3)
+	{
+		if (!_utilHashMapResize(map, map->capacity ? map->capacity * 2 : UTIL_HASHMAP_MIN_CAPACITY))
+			return NULL;
+	}
+
+	UtilHashMapSlot *slot = _utilHashMapProbe(map, key);
+	if (!slot->key)
+	{
+		slot->key = key;
+		slot->value = NULL;
+		map->size++;
+	}
+
+	return slot;
+}
+
+/**
+ * @brief Remove a key from a hash map.
+ *
+ * @param map Target hash map.
+ * @param key Key to remove.
+ * @return Value of the removed key. NULL if not found.
+ */
+void *utilHashMapRemove(UtilHashMap *map, size_t key)
+{
+	UtilHashMapSlot *slot = utilHashMapFind(map, key);
+	if (!slot)
+		return NULL;
+
+	void *value = slot->value;
+	size_t mask = map->capacity - 1;
+	size_t hole = (size_t)(slot - map->slots);
+
+	// Shift the following entries back instead of leaving a tombstone.
+	for (size_t i = (hole + 1) & mask; map->slots[i].key; i = (i + 1) & mask)
+	{
+		size_t home = _utilHashKey(map->slots[i].key) & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			map->slots[hole] = map->slots[i];
+			hole = i;
+		}
+	}
+
+	map->slots[hole].key = 0;
+	map->size--;
+
+	return value;
+}
@@ -0,0 +1,192 @@
+#include <util/vector.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define UTIL_VECTOR_MIN_CAPACITY 4
+
+/**
+ * @brief Initialize an empty vector in place.
+ *
+ * @param vec Target vector.
+ * @param dataSize Size in byte of each element.
+ * @param arena Arena to allocate the buffer from, NULL for heap.
+ */
+void utilVectorInit(UtilVector *vec, size_t dataSize, UtilArena *arena)
+{
+	assert(vec != NULL);
+
+	vec->data = NULL;
+	vec->dataSize = dataSize;
+	vec->size = 0;
+	vec->capacity = 0;
+	vec->arena = arena;
+}
+
+/**
+ * @brief Release the buffer of a vector initialized in place.
+ *
+ * @param vec Target vector.
+ */
+void utilVectorFree(UtilVector *vec)
+{
+	assert(vec != NULL);
+
+	if (!vec->arena)
+		free(vec->data);
+	vec->data = NULL;
+	vec->size = 0;
+	vec->capacity = 0;
+}
+
+/**
+ * @brief Create a new vector.
+ *
+ * @param dataSize Size in byte of each element.
+ * @return Created vector. NULL if failed.
+ */
+UtilVector *utilVectorNew(size_t dataSize)
+{
+	UtilVector *vec = malloc(sizeof(UtilVector));
+	if (!vec)
+		return NULL;
+
+	utilVectorInit(vec, dataSize, NULL);
+	return vec;
+}
+
+/**
+ * @brief Create a new vector in an arena. The vector and its buffer will be
+ * released with the arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param dataSize Size in byte of each element.
+ * @return Created vector. NULL if failed.
+ */
+UtilVector *utilVectorNewInArena(UtilArena *arena, size_t dataSize)
+{
+	assert(arena != NULL);
+
+	UtilVector *vec = utilArenaAlloc(arena, sizeof(UtilVector));
+	if (!vec)
+		return NULL;
+
+	utilVectorInit(vec, dataSize, arena);
+	return vec;
+}
+
+/**
+ * @brief Free a vector and its buffer.
+ *
+ * @param vec Target vector.
+ */
+void utilVectorDelete(UtilVector *vec)
+{
+	assert(vec != NULL);
+
+	// Vectors in arenas are released with their arenas.
+	if (vec->arena)
+		return;
+
+	free(vec->data);
+	free(vec);
+}
+
+/**
+ * @brief Make sure a vector can hold specified count of elements without
+ * reallocation.
+ *
+ * @param vec Target vector.
+ * @param capacity Count of elements.
+ * @return Non-zero if succeeded.
+ */
+int utilVectorReserve(UtilVector *vec, size_t capacity)
+{
+	assert(vec != NULL);
+
+	if (capacity <= vec->capacity)
+		return 1;
+
+	void *data;
+	if (vec->arena)
+	{
+		// The old buffer stays in the arena, growing geometrically keeps
+		// the waste under the size of the final buffer.
+		data = utilArenaAlloc(vec->arena, capacity * vec->dataSize);
+		if (data && vec->size)
+			memcpy(data, vec->data, vec->size * vec->dataSize);
+	}
+	else
+		data = realloc(vec->data, capacity * vec->dataSize);
+	if (!data)
+		return 0;
+
+	vec->data = data;
+	vec->capacity = capacity;
+
+	return 1;
+}
+
+static int _utilVectorGrow(UtilVector *vec, size_t count)
+{
+	size_t capacity = vec->capacity ? vec->capacity : UTIL_VECTOR_MIN_CAPACITY;
+	while (capacity < vec->size + count)
+		capacity *= 2;
+
+	return utilVectorReserve(vec, capacity);
+}
+
+/**
+ * @brief Push an element to the end of a vector. The data will be copied.
+ *
+ * @param vec Target vector.
+ * @param data Element data. NULL to leave it uninitialized.
+ * @return Pushed element. NULL if failed.
+ */
+void *utilVectorPush(UtilVector *vec, const void *data)
+{
+	assert(vec != NULL);
+
+	if (vec->size == vec->capacity && !_utilVectorGrow(vec, 1))
+		return NULL;
+
+	void *elem = (char *)vec->data + vec->size++ * vec->dataSize;
+	if (data)
+		memcpy(elem, data, vec->dataSize);
+
+	return elem;
+}
+
+/**
+ * @brief Append elements to the end of a vector. The data will be copied.
+ *
+ * @param vec Target vector.
+ * @param data Element array.
+ * @param count Count of elements.
+ * @return The first appended element. NULL if failed.
+ */
+void *utilVectorAppend(UtilVector *vec, const void *data, size_t count)
+{
+	assert(vec != NULL);
+
+	if (vec->size + count > vec->capacity && !_utilVectorGrow(vec, count))
+		return NULL;
+
+	void *elem = (char *)vec->data + vec->size * vec->dataSize;
+	if (count)
+		memcpy(elem, data, count * vec->dataSize);
+	vec->size += count;
+
+	return elem;
+}
+
+/**
+ * @brief Remove all elements from a vector. The buffer will be kept.
+ *
+ * @param vec Target vector.
+ */
+void utilVectorClear(UtilVector *vec)
+{
+	assert(vec != NULL);
+	vec->size = 0;
+}
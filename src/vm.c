@@ -0,0 +1,443 @@
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/hash.h>
+#include "eval.h"
+#include "future.h"
+#include "module.h"
+#include "superfn.h"
+
+#define SLAKE_MAX_STACK_REGS 32
+
+//
+// Computed goto is used for dispatching if the compiler supports it.
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define SLAKE_VM_COMPUTED_GOTO 1
+#endif
+
+static SLAKE_NORETURN void _slakePanicf(const char *fmt, const char *s)
+{
+	char msg[256];
+	snprintf(msg, sizeof(msg), fmt, s);
+	slakePanic(msg);
+}
+
+static SlakeVariable *_slakeGetGlobal(SlakeScope *root, uint32_t slot)
+{
+	if (slot >= root->slots.size || !utilVectorAt(&root->slots, SlakeVariable *, slot))
+		slakePanic("Undefined global variable");
+	return utilVectorAt(&root->slots, SlakeVariable *, slot);
+}
+
+//
+// Replace the value in a register.
+//
+static inline void _slakeSetRegister(SlakeValue *reg, SlakeValue *value)
+{
+	slakeClearValue(reg);
+	*reg = *value;
+}
+
+/**
+ * @brief Hash a key of OP_SWITCH tables.
+ *
+ * @param key Integer or string key.
+ * @return Hash of the key.
+ */
+uint32_t slakeHashSwitchKey(const SlakeValue *key)
+{
+	if (key->type == VALUE_TYPE_STR)
+	{
+		const char *str = slakeGetString(key);
+		return (uint32_t)utilHash64(str, strlen(str), 0);
+	}
+	return (uint32_t)utilHash64(&key->data.i32, sizeof(key->data.i32), 0);
+}
+
+/**
+ * @brief Call a function on the VM. The function will be compiled on its
+ * first call.
+ *
+ * @param func Function to call.
+ * @param args Arguments, will be converted to types of the parameters.
+ * @param argCount Count of arguments.
+ * @param out Value to store the return value, must be null.
+ */
+void slakeVMCall(SlakeFunction *func, const SlakeValue *args, unsigned short argCount, SlakeValue *out)
+{
+	static const SlakeBinaryExprType binaryOps[] = {
+		BINARY_EXPR_ADD, BINARY_EXPR_SUB, BINARY_EXPR_MUL, BINARY_EXPR_DIV,
+		BINARY_EXPR_MOD, BINARY_EXPR_AND, BINARY_EXPR_OR, BINARY_EXPR_XOR,
+		BINARY_EXPR_EQ, BINARY_EXPR_NEQ, BINARY_EXPR_LT, BINARY_EXPR_GT,
+		BINARY_EXPR_LTEQ, BINARY_EXPR_GTEQ
+	};
+
+	assert(func != NULL);
+	assert(out != NULL);
+
+	if (argCount != func->paramCount)
+		_slakePanicf("Mismatched parameter count for function: %s", slakeGetSymbolName(func->name));
+
+	// Globals and functions are in the root scope of the module of the function.
+	SlakeScope *root = func->scope;
+
+	if (!func->bytecode)
+	{
+		if (!func->isResolved)
+			slakeResolveFunction(root, func);
+		func->bytecode = slakeCompileFunction(func);
+		slakePrefetchModules(root, func->bytecode);
+	}
+	SlakeBytecode *bc = func->bytecode;
+
+	SlakeValue stackRegs[SLAKE_MAX_STACK_REGS];
+	SlakeValue *regs = stackRegs;
+	if (bc->regCount > SLAKE_MAX_STACK_REGS)
+	{
+		regs = malloc(bc->regCount * sizeof(SlakeValue));
+		if (!regs)
+			slakePanic("Out of memory");
+	}
+	for (uint16_t i = 0; i < bc->regCount; i++)
+		regs[i].type = VALUE_TYPE_NULL;
+
+	// Parameters take the first registers.
+	for (unsigned short i = 0; i < argCount; i++)
+	{
+		slakeAssignValue(&regs[i], &args[i]);
+		slakeConvertValue(&regs[i], func->params[i].type);
+	}
+
+	const SlakeValue *consts = bc->consts;
+	const SlakeSymbol *symbols = bc->symbols;
+	const SlakeInsn *insns = bc->insns, *pc = insns, *insn;
+	SlakeValue tmp;
+	const SlakeValue *operands; // The rest of the operands of additions with strings.
+	size_t operandCount;
+
+#define RK(x) ((x) & SLAKE_RK_CONST ? &consts[(x) & SLAKE_RK_MAX] : &regs[(x)])
+#define SYM(x) (symbols[(x)])
+
+#ifdef SLAKE_VM_COMPUTED_GOTO
+	static const void *const dispatchTable[OP_MAX] = {
+		[OP_NOP] = &&L_OP_NOP,
+		[OP_LOADK] = &&L_OP_LOADK,
+		[OP_MOVE] = &&L_OP_MOVE,
+		[OP_SETLOCAL] = &&L_OP_SETLOCAL,
+		[OP_DEFLOCAL] = &&L_OP_DEFLOCAL,
+		[OP_GETGLOBAL] = &&L_OP_GETGLOBAL,
+		[OP_SETGLOBAL] = &&L_OP_SETGLOBAL,
+		[OP_ADD] = &&L_OP_ADD,
+		[OP_SUB] = &&L_OP_SUB,
+		[OP_MUL] = &&L_OP_BINARY,
+		[OP_DIV] = &&L_OP_BINARY,
+		[OP_MOD] = &&L_OP_BINARY,
+		[OP_AND] = &&L_OP_BINARY,
+		[OP_OR] = &&L_OP_BINARY,
+		[OP_XOR] = &&L_OP_BINARY,
+		[OP_EQ] = &&L_OP_EQ,
+		[OP_NEQ] = &&L_OP_NEQ,
+		[OP_LT] = &&L_OP_LT,
+		[OP_GT] = &&L_OP_GT,
+		[OP_LTEQ] = &&L_OP_LTEQ,
+		[OP_GTEQ] = &&L_OP_GTEQ,
+		[OP_NOT] = &&L_OP_NOT,
+		[OP_NEG] = &&L_OP_NEG,
+		[OP_BOOL] = &&L_OP_BOOL,
+		[OP_CONCAT] = &&L_OP_CONCAT,
+		[OP_JMP] = &&L_OP_JMP,
+		[OP_JMPF] = &&L_OP_JMPF,
+		[OP_JMPT] = &&L_OP_JMPT,
+		[OP_SWITCH] = &&L_OP_SWITCH,
+		[OP_CALL] = &&L_OP_CALL,
+		[OP_SCALL] = &&L_OP_SCALL,
+		[OP_XCALL] = &&L_OP_XCALL,
+		[OP_ACALL] = &&L_OP_ACALL,
+		[OP_XACALL] = &&L_OP_XACALL,
+		[OP_AWAIT] = &&L_OP_AWAIT,
+		[OP_RET] = &&L_OP_RET
+	};
+#define DISPATCH()                       \
+	do                                   \
+	{                                    \
+		insn = pc++;                     \
+		goto *dispatchTable[insn->op];   \
+	} while (0)
+#define CASE(op) L_##op:
+#define NEXT() DISPATCH()
+#else
+#define CASE(op) case op:
+#define NEXT() continue
+#endif
+
+// Fast path for operations on two integers.
+#define INT_OP(op, expr)                                                          \
+	CASE(op)                                                                      \
+	{                                                                             \
+		const SlakeValue *l = RK(insn->b), *r = RK(insn->c);                      \
+		if (l->type == VALUE_TYPE_INT && r->type == VALUE_TYPE_INT)               \
+		{                                                                         \
+			int result = (expr);                                                  \
+			slakeSetInt(&regs[insn->a], result);                                  \
+			NEXT();                                                               \
+		}                                                                         \
+		goto binaryOp;                                                            \
+	}
+
+#ifdef SLAKE_VM_COMPUTED_GOTO
+	DISPATCH();
+#else
+	for (;;)
+	{
+		insn = pc++;
+		switch (insn->op)
+		{
+#endif
+			CASE(OP_NOP)
+			NEXT();
+			CASE(OP_LOADK)
+			slakeAssignValue(&regs[insn->a], &consts[insn->b]);
+			NEXT();
+			CASE(OP_MOVE)
+			slakeAssignValue(&regs[insn->a], &regs[insn->b]);
+			NEXT();
+			CASE(OP_SETLOCAL)
+			{
+				SlakeValue *dest = &regs[insn->a];
+				const SlakeValue *value = RK(insn->b);
+				if (dest->type == value->type && dest->type != VALUE_TYPE_STR && dest->type != VALUE_TYPE_FUTURE)
+					dest->data = value->data;
+				else
+					slakeEvalStore(dest, (SlakeValue *)value, 0);
+				NEXT();
+			}
+			CASE(OP_DEFLOCAL)
+			if (insn->b == SLAKE_NO_OPERAND)
+				slakeClearValue(&regs[insn->a]);
+			else
+				slakeAssignValue(&regs[insn->a], RK(insn->b));
+			slakeConvertValue(&regs[insn->a], (SlakeValueType)insn->c);
+			NEXT();
+			CASE(OP_GETGLOBAL)
+			slakeAssignValue(&regs[insn->a], &_slakeGetGlobal(root, slakeInsnWide(*insn))->value);
+			NEXT();
+			CASE(OP_SETGLOBAL)
+			slakeEvalStore(&_slakeGetGlobal(root, slakeInsnWide(*insn))->value, (SlakeValue *)RK(insn->a), 0);
+			NEXT();
+
+			CASE(OP_ADD)
+			{
+				const SlakeValue *l = RK(insn->b), *r = RK(insn->c);
+				if (l->type == VALUE_TYPE_INT && r->type == VALUE_TYPE_INT)
+				{
+					slakeSetInt(&regs[insn->a], (int)((unsigned int)l->data.i32 + (unsigned int)r->data.i32));
+					NEXT();
+				}
+				if ((l->type != VALUE_TYPE_STR && r->type != VALUE_TYPE_STR) || insn->c == insn->a || insn->c == insn->b)
+					goto binaryOp;
+				operands = r;
+				operandCount = 1;
+				goto concat;
+			}
+			INT_OP(OP_SUB, (int)((unsigned int)l->data.i32 - (unsigned int)r->data.i32))
+			INT_OP(OP_EQ, l->data.i32 == r->data.i32)
+			INT_OP(OP_NEQ, l->data.i32 != r->data.i32)
+			INT_OP(OP_LT, l->data.i32 < r->data.i32)
+			INT_OP(OP_GT, l->data.i32 > r->data.i32)
+			INT_OP(OP_LTEQ, l->data.i32 <= r->data.i32)
+			INT_OP(OP_GTEQ, l->data.i32 >= r->data.i32)
+
+#ifdef SLAKE_VM_COMPUTED_GOTO
+			L_OP_BINARY:
+#else
+			case OP_MUL:
+			case OP_DIV:
+			case OP_MOD:
+			case OP_AND:
+			case OP_OR:
+			case OP_XOR:
+#endif
+			binaryOp:
+			tmp.type = VALUE_TYPE_NULL;
+			slakeEvalBinaryOp(binaryOps[insn->op - OP_ADD], RK(insn->b), RK(insn->c), &tmp);
+			_slakeSetRegister(&regs[insn->a], &tmp);
+			NEXT();
+
+			CASE(OP_NOT)
+			slakeSetInt(&regs[insn->a], !slakeIsValueTrue(RK(insn->b)));
+			NEXT();
+			CASE(OP_NEG)
+			tmp.type = VALUE_TYPE_NULL;
+			slakeEvalUnaryOp(UNARY_EXPR_NEG, RK(insn->b), &tmp);
+			_slakeSetRegister(&regs[insn->a], &tmp);
+			NEXT();
+			CASE(OP_BOOL)
+			slakeSetInt(&regs[insn->a], slakeIsValueTrue(RK(insn->b)));
+			NEXT();
+			CASE(OP_CONCAT)
+			operands = &regs[insn->a + 1];
+			operandCount = insn->c - 1;
+			concat:
+			// A local string replaced by the sum, as in s = s + x, is appended
+			// to in place, so building strings in loops takes linear time.
+			if (!(insn->b & SLAKE_RK_CONST) && insn->a != insn->b && regs[insn->b].type == VALUE_TYPE_STR &&
+				pc->op == OP_SETLOCAL && pc->a == insn->b && pc->b == insn->a)
+			{
+				slakeClearValue(&regs[insn->a]);
+				slakeEvalConcat(&regs[insn->b], operands, operandCount);
+				slakeAssignValue(&regs[insn->a], &regs[insn->b]);
+			}
+			else
+			{
+				tmp.type = VALUE_TYPE_NULL;
+				slakeAssignValue(&tmp, RK(insn->b));
+				slakeEvalConcat(&tmp, operands, operandCount);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+			}
+			NEXT();
+
+			CASE(OP_JMP)
+			pc = insns + slakeInsnWide(*insn);
+			NEXT();
+			CASE(OP_JMPF)
+			if (!slakeIsValueTrue(RK(insn->a)))
+				pc = insns + slakeInsnWide(*insn);
+			NEXT();
+			CASE(OP_JMPT)
+			if (slakeIsValueTrue(RK(insn->a)))
+				pc = insns + slakeInsnWide(*insn);
+			NEXT();
+			CASE(OP_SWITCH)
+			{
+				const SlakeValue *value = RK(insn->a), *cases = &consts[insn->b];
+				const SlakeInsn *table = pc + insn->c + 1, *slots = table + 2;
+				uint32_t slotCount = slakeInsnWide(table[0]);
+				uint16_t matched = 0;
+
+				// Cases in a table have the same type.
+				if (value->type == cases->type && table->a == SLAKE_SWITCH_DENSE)
+				{
+					uint32_t index = (uint32_t)value->data.i32 - slakeInsnWide(table[1]);
+					if (index < slotCount)
+						matched = slots[index].a;
+				}
+				else if (value->type == cases->type)
+				{
+					uint32_t mask = slotCount - 1;
+					for (uint32_t h = slakeHashSwitchKey(value) & mask; (matched = slots[h].a); h = (h + 1) & mask)
+					{
+						const SlakeValue *k = &cases[matched - 1];
+						if (value->type == VALUE_TYPE_STR ? !strcmp(slakeGetString(value), slakeGetString(k))
+														  : value->data.i32 == k->data.i32)
+							break;
+					}
+				}
+				else
+				{
+					// Other types are compared like OP_EQ.
+					for (uint16_t i = 0; i < insn->c && !matched; i++)
+					{
+						tmp.type = VALUE_TYPE_NULL;
+						slakeEvalBinaryOp(BINARY_EXPR_EQ, value, &cases[i], &tmp);
+						if (tmp.data.i32)
+							matched = i + 1;
+					}
+				}
+
+				pc = insns + slakeInsnWide(pc[matched ? matched - 1 : insn->c]);
+				NEXT();
+			}
+
+			CASE(OP_CALL)
+			{
+				SlakeFunction *callee = slakeGetFunction(root, SYM(insn->b));
+				if (!callee)
+					_slakePanicf("Undefined function: %s", slakeGetSymbolName(SYM(insn->b)));
+
+				tmp.type = VALUE_TYPE_NULL;
+				slakeVMCall(callee, &regs[insn->a + 1], insn->c, &tmp);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+				NEXT();
+			}
+			CASE(OP_SCALL)
+			{
+				SlakeSuperFunctionProc proc = slakeGetSuperFunction(slakeGetSymbolName(SYM(insn->b)));
+				if (!proc)
+					_slakePanicf("Undefined super function: @%s", slakeGetSymbolName(SYM(insn->b)));
+
+				tmp.type = VALUE_TYPE_NULL;
+				proc(&regs[insn->a + 1], insn->c, &tmp);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+				NEXT();
+			}
+			CASE(OP_XCALL)
+			{
+				SlakeFunction *callee = slakeGetExternalFunction(root, SYM(insn->b), SYM(insn->b + 1));
+
+				tmp.type = VALUE_TYPE_NULL;
+				slakeVMCall(callee, &regs[insn->a + 1], insn->c, &tmp);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+				NEXT();
+			}
+			CASE(OP_ACALL)
+			{
+				SlakeFunction *callee = slakeGetFunction(root, SYM(insn->b));
+				if (!callee)
+					_slakePanicf("Undefined function: %s", slakeGetSymbolName(SYM(insn->b)));
+
+				tmp.type = VALUE_TYPE_FUTURE;
+				tmp.data.future = slakeCreateFuture(callee, &regs[insn->a + 1], insn->c);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+				NEXT();
+			}
+			CASE(OP_XACALL)
+			{
+				SlakeFunction *callee = slakeGetExternalFunction(root, SYM(insn->b), SYM(insn->b + 1));
+
+				tmp.type = VALUE_TYPE_FUTURE;
+				tmp.data.future = slakeCreateFuture(callee, &regs[insn->a + 1], insn->c);
+				_slakeSetRegister(&regs[insn->a], &tmp);
+				NEXT();
+			}
+			CASE(OP_AWAIT)
+			tmp.type = VALUE_TYPE_NULL;
+			slakeAwaitValue(RK(insn->b), &tmp);
+			_slakeSetRegister(&regs[insn->a], &tmp);
+			NEXT();
+
+			CASE(OP_RET)
+			if (insn->a == SLAKE_NO_OPERAND)
+				out->type = VALUE_TYPE_NULL;
+			else if (insn->a & SLAKE_RK_CONST)
+				slakeAssignValue(out, RK(insn->a));
+			else
+			{
+				*out = regs[insn->a];
+				regs[insn->a].type = VALUE_TYPE_NULL;
+			}
+			goto leave;
+#ifndef SLAKE_VM_COMPUTED_GOTO
+		default:
+			slakePanic("Invalid instruction");
+		}
+	}
+#endif
+
+#undef INT_OP
+#undef NEXT
+#undef CASE
+#ifdef SLAKE_VM_COMPUTED_GOTO
+#undef DISPATCH
+#endif
+#undef SYM
+#undef RK
+
+leave:
+	for (uint16_t i = 0; i < bc->regCount; i++)
+		slakeClearValue(&regs[i]);
+	if (regs != stackRegs)
+		free(regs);
+}
@@ -0,0 +1,101 @@
+#ifndef __VM_H__
+#define __VM_H__
+
+#include <slakedef.h>
+#include <stdint.h>
+
+//
+// Instructions are 4 16-bit fields: the opcode and operands a, b and c.
+// Operands marked as RK refer to a constant if SLAKE_RK_CONST is set, or to
+// a register otherwise. Jump targets and global slots are stored in b (low
+// half) and c (high half). Local variables take the first registers, other
+// names are referred by indexes in the symbol table of the function.
+//
+#define SLAKE_RK_CONST 0x8000
+#define SLAKE_RK_MAX 0x7fff
+#define SLAKE_NO_OPERAND 0xffff
+
+typedef enum _SlakeOpcode
+{
+	OP_NOP = 0,
+	OP_LOADK,  // R[a] = K[b]
+	OP_MOVE,   // R[a] = R[b]
+	OP_SETLOCAL,  // R[a] = RK[b], converted to the type of R[a]
+	OP_DEFLOCAL,  // R[a] = RK[b] converted to type c, default value if no operand
+	OP_GETGLOBAL, // R[a] = global variable in the slot
+	OP_SETGLOBAL, // Global variable in the slot = RK[a]
+
+	OP_ADD, // R[a] = RK[b] + RK[c]
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_EQ,
+	OP_NEQ,
+	OP_LT,
+	OP_GT,
+	OP_LTEQ,
+	OP_GTEQ,
+
+	OP_NOT,	 // R[a] = !RK[b]
+	OP_NEG,	 // R[a] = -RK[b]
+	OP_BOOL, // R[a] = RK[b] is true ? 1 : 0
+	OP_CONCAT, // R[a] = RK[b] + R[a + 1] + ... + R[a + c - 1]
+
+	OP_JMP,	 // Jump to target
+	OP_JMPF, // Jump to target if RK[a] is false
+	OP_JMPT, // Jump to target if RK[a] is true
+	OP_SWITCH, // Jump to the case matching RK[a], with c cases in K[b]..., see below
+
+	OP_CALL,  // R[a] = function named S[b] with c arguments in R[a + 1]...
+	OP_SCALL, // R[a] = super function named S[b] with c arguments in R[a + 1]...
+	OP_XCALL, // R[a] = function named S[b + 1] of module S[b] with c arguments in R[a + 1]...
+	OP_ACALL, // R[a] = future of an asynchronous OP_CALL
+	OP_XACALL, // R[a] = future of an asynchronous OP_XCALL
+	OP_AWAIT, // R[a] = RK[b], awaited if it is a future
+	OP_RET,	  // Return RK[a], or null if no operand
+
+	OP_MAX
+} SlakeOpcode;
+
+typedef struct _SlakeInsn
+{
+	uint16_t op, a, b, c;
+} SlakeInsn;
+
+#define slakeInsnWide(insn) ((uint32_t)(insn).b | ((uint32_t)(insn).c << 16))
+
+//
+// OP_SWITCH is followed by c + 1 OP_JMP to the cases and the default body,
+// then an OP_NOP with the table kind in a and the slot count in b and c, an
+// OP_NOP with the base of a dense table in b and c, and the slots, which are
+// OP_NOP with the matched case index plus 1 in a, or 0 if there is none.
+// Dense tables are indexed by integers minus the base. Hashed tables are
+// probed linearly from slakeHashSwitchKey() masked by the slot count.
+//
+#define SLAKE_SWITCH_DENSE 0
+#define SLAKE_SWITCH_HASHED 1
+
+typedef struct _SlakeBytecode
+{
+	SlakeInsn *insns;
+	size_t insnCount;
+	SlakeValue *consts;
+	uint16_t constCount;
+	SlakeSymbol *symbols;
+	uint16_t symbolCount;
+	uint16_t regCount;
+	int isMapped; // Non-zero if the instructions are mapped from a script image and not owned.
+} SlakeBytecode;
+
+SlakeBytecode *slakeCompileFunction(SlakeFunction *func);
+void slakeDestroyBytecode(SlakeBytecode *bc);
+
+uint32_t slakeHashSwitchKey(const SlakeValue *key);
+
+void slakeVMCall(SlakeFunction *func, const SlakeValue *args, unsigned short argCount, SlakeValue *out);
+
+#endif